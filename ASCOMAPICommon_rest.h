@@ -6,6 +6,7 @@ File to be included into relevant device REST setup
 #define _ASCOMAPI_Common_h_
 #include "JSONHelperFunctions.h"
 #include "Webrelay_common.h"
+#include "Webrelay_sessions.h"
 #include "DebugSerial.h"
 
 //PUT /{DeviceType}/{DeviceNumber}/Action Invokes the specified device-specific action.
@@ -32,6 +33,13 @@ void handleNameGet(void);
 //GET /{DeviceType}/{DeviceNumber}/SupportedActions Returns the list of action names supported by this driver.  
 void handleSupportedActionsGet(void);
 
+//Device specific actions, defined alongside the device's own handlers.
+//deviceAction() runs the named action, setting result and errMsg, and returns an ALPACA error number.
+int deviceAction( const String& action, const String& parameters, String& result, String& errMsg );
+void deviceSupportedActions( JsonArray& actions );
+//deviceCommand() runs the command text sent to the Command* calls, setting its string and boolean results.
+int deviceCommand( const String& command, String& result, bool& state, String& errMsg );
+
 void handleAction(void)
 {
     String message;
@@ -41,17 +49,19 @@ void handleAction(void)
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
     
-    if ( connectedClient != clientID) 
+    if ( findSession( deviceNumber, clientID ) == nullptr ) 
     {
-      jsonResponseBuilder( root, clientID, transID, "Action", notConnected , "Action not available for 'not connected' client." );
+      jsonResponseBuilder( root, clientID, transID, F("Action"), notConnected , F("Action not available for 'not connected' client.") );
       root["Value"]= "";
       root.printTo(message);
       server.send(400, "application/json", message);      
     }
     else
     {    
-      jsonResponseBuilder( root, clientID, transID, "Action", notImplemented , "Not implemented" );
-      root["Value"]= "";
+      String result, errMsg;
+      int err = deviceAction( server.arg("Action"), server.arg("Parameters"), result, errMsg );
+      jsonResponseBuilder( root, clientID, transID, F("Action"), err, errMsg );
+      root["Value"]= result;
       root.printTo(message);
       server.send(200, "application/json", message);
     }
@@ -66,16 +76,19 @@ void handleCommandBlind(void)
         
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    if ( connectedClient != clientID) 
+    if ( findSession( deviceNumber, clientID ) == nullptr ) 
     {
-      jsonResponseBuilder( root, clientID, transID, "Action", notConnected , "Action not available for 'not connected' client." );
+      jsonResponseBuilder( root, clientID, transID, F("Action"), notConnected , F("Action not available for 'not connected' client.") );
       root["Value"]= "";
       root.printTo(message);
       server.send(400, "application/json", message);      
     }
     else
     {
-      jsonResponseBuilder( root, clientID, transID, "Action", notImplemented , "Not implemented" );
+      String result, errMsg;
+      bool state;
+      int err = deviceCommand( server.arg("Command"), result, state, errMsg );
+      jsonResponseBuilder( root, clientID, transID, F("CommandBlind"), err, errMsg );
       root["Value"]= "";
       root.printTo(message);
       server.send(200, "application/json", message);
@@ -91,17 +104,20 @@ void handleCommandBool(void)
     
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    if ( connectedClient != clientID) 
+    if ( findSession( deviceNumber, clientID ) == nullptr ) 
     {
-      jsonResponseBuilder( root, clientID, transID, "Action", notConnected , "Action not available for 'not connected' client." );
+      jsonResponseBuilder( root, clientID, transID, F("Action"), notConnected , F("Action not available for 'not connected' client.") );
       root["Value"]= "";
       root.printTo(message);
       server.send(400, "application/json", message);      
     }
     else
     {
-      jsonResponseBuilder( root, clientID, transID, "CommandBool", notImplemented , "Not implemented" );
-      root["Value"]= false; 
+      String result, errMsg;
+      bool state;
+      int err = deviceCommand( server.arg("Command"), result, state, errMsg );
+      jsonResponseBuilder( root, clientID, transID, F("CommandBool"), err, errMsg );
+      root["Value"]= state; 
       root.printTo(message);   
       server.send(200, "application/json", message);
     }
@@ -111,22 +127,25 @@ void handleCommandBool(void)
 void handleCommandString(void)
 {
     String message;
-    DynamicJsonBuffer jsonBuffer(256);
+    DynamicJsonBuffer jsonBuffer(512);
     JsonObject& root = jsonBuffer.createObject();
     uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
     
-    if ( connectedClient != clientID) 
+    if ( findSession( deviceNumber, clientID ) == nullptr ) 
     {
-      jsonResponseBuilder( root, clientID, transID, "Action", notConnected , "Action not available for 'not connected' client." );
+      jsonResponseBuilder( root, clientID, transID, F("Action"), notConnected , F("Action not available for 'not connected' client.") );
       root["Value"]= "";
       root.printTo(message);
-      server.send(200, "application/json", message);      
+      server.send(400, "application/json", message);      
     }
     else
     {
-      jsonResponseBuilder( root, clientID, transID, "CommandString", notImplemented , "Not implemented" );
-      root["Value"]= false; 
+      String result, errMsg;
+      bool state;
+      int err = deviceCommand( server.arg("Command"), result, state, errMsg );
+      jsonResponseBuilder( root, clientID, transID, F("CommandString"), err, errMsg );
+      root["Value"]= result; 
       root.printTo(message);   
       server.send(200, "application/json", message);
     }
@@ -139,93 +158,75 @@ void handleConnected(void)
     int outputCode = 200;
     uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
+    ClientSession* session = findSession( deviceNumber, clientID );
     
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    String argToSearchFor = "Connected";
+    const __FlashStringHelper* argToSearchFor = F("Connected");
     if ( server.method() == HTTP_PUT )
     { 
-       DEBUGSL1( "Entered handleConnected::PUT" );
+      DEBUGSL1( "Entered handleConnected::PUT" );
 
-      //don't like the logic here - if its already connected for this client we should refuse a connect. 
+      //Each client has its own session - connecting again from the same client is benign.
       if( hasArgIC( argToSearchFor, server, false ) && 
-          server.arg(argToSearchFor) && 
           server.arg(argToSearchFor).equalsIgnoreCase("true" ) )
       { //setting to true 
-        if ( connected )//already true
+        if ( session != nullptr )//already true
         {
-          if( clientID == connectedClient )
-          {
           DEBUGSL1( "Entered handleConnected::PUT::True::already connected - benign error" );        
-            //Check error numbers
-            jsonResponseBuilder( root, clientID, transID, "Connected", Success , "" );        
-            root["Value"]= connected;    
-            root.printTo(message);
-            outputCode = 200;
+          jsonResponseBuilder( root, clientID, transID, F("Connected"), Success , "" );        
+          outputCode = 200;
+        }
+        else 
+        {  
+          session = openSession( deviceNumber, clientID );
+          if( session == nullptr )
+          {
+            DEBUGSL1( "Entered handleConnected::PUT::True::session table full - error" );
+            jsonResponseBuilder( root, clientID, transID, F("Connected"), invalidOperation, F("Too many connected clients") );        
+            outputCode = 400;
           }
           else
           {
-          DEBUGSL1( "Entered handleConnected::PUT::True::already connected but not by this client - error" );        
-            //Check error numbers
-            jsonResponseBuilder( root, clientID, transID, "Connected", notConnected , "Setting connected when already connected by different client" );        
-            root["Value"]= connected;    
-            root.printTo(message);
-            outputCode = 400;            
+            DEBUGSL1( "Entered handleConnected::PUT::True::setting connected - OK" );
+            session->lastTransID = transID;
+            jsonResponseBuilder( root, clientID, transID, F("Connected"), Success, F("Setting connected OK") );        
+            outputCode = 200;
           }
         }
-        else //OK
-        {  
-          DEBUGSL1( "Entered handleConnected::PUT::True::setting connected - OK" );
-          connected = true;
-          connectedClient = clientID;
-          jsonResponseBuilder( root, clientID, transID, "Connected", Success, "Setting connected OK" );        
-          root["Value"]= connected;    
-          root.printTo(message);
-          outputCode = 200;          
-        }
       }
       else //set to false
       {
-        if ( connected ) //
+        if ( session != nullptr ) //
         {
           DEBUGSL1( "Entered handleConnected::PUT::False::set unconnected - OK" );
-          connected = false; //OK   
-          connectedClient = -1;       
-          jsonResponseBuilder( root, clientID, transID, "Connected", Success , "Disconnected OK" );        
-          root["Value"]= connected;    
-          root.printTo(message);
-          outputCode = 200;
+          closeSession( session );
+          session = nullptr;
+          jsonResponseBuilder( root, clientID, transID, F("Connected"), Success , F("Disconnected OK") );        
         }
         else
         {
-          //Check error numbers
           DEBUGSL1( "Entered handleConnected::PUT::False::not already connected - ignoring" );
-          jsonResponseBuilder( root, clientID, transID, "Connected", Success , "" );        
-          root["Value"]= connected; 
-          root.printTo(message);   
-          outputCode = 200;
+          jsonResponseBuilder( root, clientID, transID, F("Connected"), Success , "" );        
         }
+        outputCode = 200;
       }
     }
     else if ( server.method() == HTTP_GET )
     {
-      //Check error numbers
-      jsonResponseBuilder( root, clientID, transID, "Connected", 0, "" );        
-      root["Value"]= connected;
-      root.printTo(message);
+      jsonResponseBuilder( root, clientID, transID, F("Connected"), Success, "" );        
       outputCode = 200;
     }
     else
     {
-      jsonResponseBuilder( root, clientID, transID, "Connected", invalidOperation , "Unexpected HTTP request verb" );        
-      root["Value"]= connected;      
-      root.printTo(message);
-      outputCode = 200;
+      jsonResponseBuilder( root, clientID, transID, F("Connected"), invalidOperation , F("Unexpected HTTP request verb") );        
+      outputCode = 400;
     }
 
-   server.send( outputCode, "application/json", message);
-   return;          
-
+    root["Value"]= ( session != nullptr );
+    root.printTo(message);
+    server.send( outputCode, "application/json", message);
+    return;          
 }
 
 void handleDescriptionGet(void)
@@ -236,8 +237,8 @@ void handleDescriptionGet(void)
 
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "Description", Success , "" );    
-    root["Value"]= Description;    
+    jsonResponseBuilder( root, clientID, transID, F("Description"), Success , "" );    
+    root["Value"]= FPSTR( Description );    
     root.printTo(message);
     server.send(200, "application/json", message);
     return ;
@@ -251,8 +252,8 @@ void handleDriverInfoGet(void)
 
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "DriverInfo", Success , "" );    
-    root["Value"]= DriverInfo;    
+    jsonResponseBuilder( root, clientID, transID, F("DriverInfo"), Success , "" );    
+    root["Value"]= FPSTR( DriverInfo );    
     root.printTo(message);
     server.send(200, "application/json", message);
     return ;
@@ -266,8 +267,8 @@ void handleDriverVersionGet(void)
 
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "DriverVersion", Success , "" );    
-    root["Value"]= DriverVersion;    
+    jsonResponseBuilder( root, clientID, transID, F("DriverVersion"), Success , "" );    
+    root["Value"]= FPSTR( DriverVersion );    
     root.printTo(message);
     server.send(200, "application/json", message);
     return ;
@@ -281,8 +282,8 @@ void handleInterfaceVersionGet(void)
 
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "InterfaceVersion", Success , "" );    
-    root["Value"]= InterfaceVersion;    
+    jsonResponseBuilder( root, clientID, transID, F("InterfaceVersion"), Success , "" );    
+    root["Value"]= FPSTR( InterfaceVersion );    
     root.printTo(message);
     server.send(200, "application/json", message);
     return ;
@@ -296,8 +297,8 @@ void handleNameGet(void)
 
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "Name", Success , "" );    
-    root["Value"] = DriverName;    
+    jsonResponseBuilder( root, clientID, transID, F("Name"), Success , "" );    
+    root["Value"] = FPSTR( DriverName );    
     root.printTo(message);
     server.send(200, "application/json", message);
     return ;
@@ -309,10 +310,11 @@ void handleSupportedActionsGet(void)
     uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
 
-    DynamicJsonBuffer jsonBuffer(256);
+    DynamicJsonBuffer jsonBuffer(1024);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "SupportedActions", Success , "" );    
-    root["Value"]= "";    //Empty array until otherwise 
+    jsonResponseBuilder( root, clientID, transID, F("SupportedActions"), Success , "" );    
+    JsonArray& actions = root.createNestedArray( "Value" );
+    deviceSupportedActions( actions );
     root.printTo(message);
     server.send(200, "application/json", message);
     return ;
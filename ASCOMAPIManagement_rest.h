@@ -0,0 +1,135 @@
+/*
+File to be included into relevant device REST setup
+Implements the ALPACA management API used by clients after discovery to find the devices served by this host.
+The responses only change when the device configuration changes, so the 'Value' part of each response is built once
+and cached. Each request then only has to wrap the cached value with the transaction ids.
+Call invalidateManagementCache() whenever the hostname, the IP address or the device configuration changes.
+*/
+//Assumes Use of ARDUINO ESP8266WebServer for entry handlers
+#if !defined _ASCOMAPI_Management_h_
+#define _ASCOMAPI_Management_h_
+#include "JSONHelperFunctions.h"
+#include "Webrelay_common.h"
+#include "DebugSerial.h"
+
+//GET /management/apiversions Supported Alpaca API versions
+void handleMgmtApiVersions(void);
+//GET /management/v1/description Summary information about this device as a whole
+void handleMgmtDescription(void);
+//GET /management/v1/configureddevices The list of devices that this host has configured
+void handleMgmtConfiguredDevices(void);
+void invalidateManagementCache(void);
+void buildManagementCache(void);
+String& managementResponseBuilder( String& message, const String& value );
+
+bool mgmtCacheValid = false;
+String mgmtApiVersions;
+String mgmtDescription;
+String mgmtConfiguredDevices;
+String discoveryResponse;
+
+void invalidateManagementCache(void)
+{
+  mgmtCacheValid = false;
+}
+
+void buildManagementCache(void)
+{
+  DynamicJsonBuffer jsonBuffer(256);
+  char uniqueID[40];
+
+  DEBUGSL1( "buildManagementCache: rebuilding management responses" );
+
+  mgmtApiVersions = F("[1]");
+
+  JsonObject& desc = jsonBuffer.createObject();
+  desc["ServerName"] = FPSTR( DriverName );
+  desc["Manufacturer"] = F("Skybadger");
+  desc["ManufacturerVersion"] = FPSTR( DriverVersion );
+  desc["Location"] = myHostname;
+  mgmtDescription = "";
+  desc.printTo( mgmtDescription );
+
+  //Alpaca expects a unique id per device that stays the same across reboots - derive it from the chip id.
+  JsonArray& devices = jsonBuffer.createArray();
+  for( int i = 0; i < numDevices; i++ )
+  {
+    JsonObject& entry = devices.createNestedObject();
+    String deviceName = myHostname;
+    if( numDevices > 1 )
+    {
+      deviceName.concat( '/' );
+      deviceName.concat( i );
+    }
+    snprintf_P( uniqueID, sizeof(uniqueID), PSTR( "%08X-0000-0000-0000-%012X" ), system_get_chip_id(), i );
+    entry["DeviceName"] = deviceName;
+    entry["DeviceType"] = FPSTR( DriverType );
+    entry["DeviceNumber"] = i;
+    entry["UniqueID"] = String( uniqueID );
+  }
+  mgmtConfiguredDevices = "";
+  devices.printTo( mgmtConfiguredDevices );
+
+  JsonObject& disc = jsonBuffer.createObject();
+  disc["IPAddress"] = WiFi.localIP().toString();
+  disc["Type"] = FPSTR( DriverType );
+  disc["AlpacaPort"] = 80;
+  disc["Name"] = myHostname;
+  disc["UniqueID"] = system_get_chip_id();
+  discoveryResponse = "";
+  disc.printTo( discoveryResponse );
+
+  mgmtCacheValid = true;
+}
+
+/*
+ * Wrap a cached value in the standard Alpaca response fields without going through a json buffer.
+ */
+String& managementResponseBuilder( String& message, const String& value )
+{
+    uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
+    uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
+
+    message.reserve( value.length() + 96 );
+    message = F("{\"Value\":");
+    message += value;
+    message += F(",\"ClientID\":");
+    message += clientID;
+    message += F(",\"ClientTransactionID\":");
+    message += transID;
+    message += F(",\"ServerTransactionID\":");
+    message += nextServerTransactionId();
+    message += F(",\"ErrorNumber\":0,\"ErrorMessage\":\"\"}");
+    return message;
+}
+
+void handleMgmtApiVersions(void)
+{
+    String message;
+    if( !mgmtCacheValid )
+      buildManagementCache();
+    managementResponseBuilder( message, mgmtApiVersions );
+    server.send(200, "application/json", message);
+    return;
+}
+
+void handleMgmtDescription(void)
+{
+    String message;
+    if( !mgmtCacheValid )
+      buildManagementCache();
+    managementResponseBuilder( message, mgmtDescription );
+    server.send(200, "application/json", message);
+    return;
+}
+
+void handleMgmtConfiguredDevices(void)
+{
+    String message;
+    if( !mgmtCacheValid )
+      buildManagementCache();
+    managementResponseBuilder( message, mgmtConfiguredDevices );
+    server.send(200, "application/json", message);
+    return;
+}
+#endif
@@ -29,6 +29,9 @@ telnet espASW01 32272 (UDP)
 #include "DebugSerial.h"
 #include "SkybadgerStrings.h"
 #include "Webrelay_common.h"
+#include "Webrelay_flash.h"
+#include "Webrelay_log.h"
+#include "Webrelay_switchtypes.h"
 #include "AlpacaErrorConsts.h"
 #include <esp8266_peri.h> //register map and access
 #include <ESP8266WiFi.h>
@@ -39,8 +42,13 @@ telnet espASW01 32272 (UDP)
 #include <Time.h>         //Look at https://github.com/PaulStoffregen/Time for a more useful internal timebase library
 #include <WiFiUdp.h>      //WiFi UDP discovery responder
 #include <ESP8266WebServer.h>
-#include <ESP8266HTTPUpdateServer.h>
 #include <ArduinoJson.h>  //https://arduinojson.org/v5/api/
+#include "Webrelay_httpserver.h"
+#include "Webrelay_trace.h"
+#include "Webrelay_metrics.h"
+#include "Webrelay_scheduler.h"
+#include "Webrelay_eventqueue.h"
+#include "Webrelay_backlog.h"
 
 extern "C" { 
 //Ntp dependencies - available from v2.4
@@ -66,12 +74,17 @@ char* thisID = nullptr;
 
 WiFiClient espClient;
 PubSubClient client(espClient);
-volatile bool callbackFlag = 0;
+#define MQTT_RECONNECT_PERIOD 5000 //msecs before the first attempt to reconnect to the broker, doubled for each failure
+#define MQTT_RECONNECT_MAX 60000
+uint32_t mqttRetryDue = 0;         //millis() when the next attempt to connect is allowed
+uint32_t mqttBackoff = MQTT_RECONNECT_PERIOD;
+bool mqttWasConnected = false;
+#define HEALTH_PERIOD 60000        //msecs between health messages
 
 // Create an instance of the server
 // specify the port to listen on as an argument
-ESP8266WebServer server(80);
-ESP8266HTTPUpdateServer updater;
+// HttpServer serves several clients at once without waiting on any of them - see Webrelay_httpserver.h
+HttpServer server(80);
 
 //UDP Port can be edited in setup page
 int udpPort = ALPACA_DISCOVERY_PORT;
@@ -79,18 +92,66 @@ WiFiUDP Udp;
 
 //Hardware device system functions - reset/restart etc
 EspClass device;
+//Restarts asked for by a request wait for its response to go out - see scheduleRestart()
+#define RESTART_DELAY 1000 //msecs
+uint32_t restartDue = 0;   //millis() to restart at, 0 for none
+void scheduleRestart( void );
 ETSTimer timer, timeoutTimer;
-volatile bool newDataFlag = false;
-volatile bool timeoutFlag = false;
-volatile bool timerSet = false;
+
+//Events posted by the timer and MQTT callbacks, and separately by pin interrupts, for the event task to handle
+#define EVENT_BATCH 8
+EventQueue<16> events;
+EventQueue<16> isrEvents;
 
 void onTimer(void);
 void onTimeoutTimer(void);
 
+//Staged boot - outputs are restored first, the services that need the network are started once WiFi connects.
+//millis() at which each stage was reached is reported by /metrics
+enum BootStage { BOOT_OUTPUTS, BOOT_WIFI, BOOT_SERVICES, BOOT_FIRST_REQUEST, BOOT_STAGES };
+const char bootStageOutputs[] PROGMEM = "outputs";
+const char bootStageWifi[] PROGMEM = "wifi";
+const char bootStageServices[] PROGMEM = "services";
+const char bootStageFirstRequest[] PROGMEM = "first_request";
+const char* const bootStageNames[] PROGMEM = { bootStageOutputs, bootStageWifi, bootStageServices, bootStageFirstRequest };
+uint32_t bootStageTime[BOOT_STAGES];
+bool servicesStarted = false;
+void bootStageReached( enum BootStage stage );
+void startServices(void);
+
+//Scheduler tasks
+void taskEvents(void);
+void dispatchEvent( Event& event );
+void taskHttp(void);
+void taskNetwork(void);
+void taskDiscovery(void);
+void taskFastUdp(void);
+void taskMqtt(void);
+void taskRamp(void);
+void taskEepromFlush(void);
+void taskHealth(void);
+void taskUpdater(void);
+void taskInputs(void);
+void taskI2c(void);
+void taskSensors(void);
+void taskLog(void);
+void publishInputChanges( uint8_t changed );
+bool publishSwitchState( int index, bool state, const char* timestamp, bool replayed );
+void replayBacklog( void );
+void publishWear( void );
+
 //Make these variables rather than constants to allow the custom setup to change them and store them to EEPROM
 int numSwitches = 0;
 SwitchEntry** switchEntry;
 
+//ALPACA device numbers served by this host - each is a slice of switchEntry. 
+//dev points at the device addressed by the current request, hostDevice spans the whole switch table.
+int numDevices = 1;
+AlpacaDevice alpacaDevice[MAX_ALPACA_DEVICES];
+AlpacaDevice hostDevice;
+AlpacaDevice* dev = &alpacaDevice[0];
+int deviceNumber = 0;
+
 //Dome shutter control via I2C Port Expander PCF8574
 #include "PCF8574.h"
 //- TYPE      ADDRESS-RANGE
@@ -105,226 +166,376 @@ uint32_t switchStatus = 0;
 #include "Skybadger_common_funcs.h"
 #include "JSONHelperFunctions.h"
 #include "ASCOMAPICommon_rest.h" //ASCOM common driver web handlers. 
+#include "ASCOMAPIManagement_rest.h" //ALPACA management API handlers.
 #include "Webrelay_eeprom.h"
 #include "ESP8266_relayhandler.h"
-
-void setup_wifi()
-{
-  int zz = 0;
-  WiFi.hostname( myHostname );
-  WiFi.mode(WIFI_STA); 
-  WiFi.begin(ssid1, password1);
-  Serial.print("Searching for WiFi..");
-  while (WiFi.status() != WL_CONNECTED) 
-  {
-    delay(500);
-      Serial.print(".");
-   if ( zz++ > 200 ) 
-    device.restart();
-  }
-
-  Serial.println("WiFi connected");
-  Serial.printf("Hostname: %s\n\r",      WiFi.hostname().c_str() );
-  Serial.printf("IP address: %s\n\r",    WiFi.localIP().toString().c_str() );
-  Serial.printf("DNS address 0: %s\n\r", WiFi.dnsIP(0).toString().c_str() );
-  Serial.printf("DNS address 1: %s\n\r", WiFi.dnsIP(1).toString().c_str() );
-
-  //Setup sleep parameters
-  wifi_set_sleep_type(LIGHT_SLEEP_T);
-
-  delay(5000);
-  Serial.println( "WiFi connected" );
-}
+#include "Webrelay_router.h"
 
 void setup()
 {
   Serial.begin( 115200, SERIAL_8N1, SERIAL_TX_ONLY);
-  Serial.println(F("ESP starting."));
-  
-  //Start NTP client
-  configTime(TZ_SEC, DST_SEC, timeServer1, timeServer2, timeServer3 );
+  LOGI( "ESP starting." );
   
   //Setup default data structures
-  Serial.println("Setup EEprom variables"); 
+  LOGI( "Setup EEprom variables" ); 
   setupFromEeprom();
-  Serial.println("Setup eeprom variables complete."); 
-  
-  // Connect to wifi 
-  setup_wifi();                   
+  layoutDevices();
+  LOGI( "Setup eeprom variables complete." ); 
   
-  //Open a connection to MQTT
-  client.setServer( mqtt_server, 1883 );
-  client.connect( thisID, pubsubUserID, pubsubUserPwd ); 
-  //Create a timer-based callback that causes this device to read the local i2C bus devices for data to publish.
-  client.setCallback( callback );
-  client.subscribe( inTopic );
-  publishHealth();
-    
+  //Outputs first - relays go back to their saved state before anything else is started
   //Pins mode and direction setup for i2c on ESP8266-01
   pinMode(0, OUTPUT);
   pinMode(2, OUTPUT);
-  //GPIO 3 (normally RX on -01) swap the pin to a GPIO. Use it for the DHT 
-  pinMode(3, OUTPUT);
+  //GPIO 3 (normally RX on -01) swap the pin to a GPIO. Used for the expander INT line - see inputSetup()
   
   //pinMode(12, INPUT_PULLUP); disable for DHT  - let DHT class address
   
-  //I2C setup SDA pin 0, SCL pin 2 on ESP-01
-  //I2C setup SDA pin 5, SCL pin 4 on ESP-12
-  Wire.begin(0, 2);
-  Wire.setClock(50000 );//100KHz target rate
-  
-  Serial.println("Setup relay controls");
-  switchPresent = false;
-  
-  //initial switch state setup - set pins high to read inputs, drive pins low for low outputs. 
-  switchDevice.begin( (const uint8_t) 0b11111111 );
-  switchPresent = ( switchDevice.lastError() != PCF8574_OK );
+  //I2C at 400KHz if the expander answers at that rate, otherwise 100KHz - see Webrelay_i2c.h
+  restoreOutputs();
+  switchPresent = i2cSetup();
+  switchStatus = expanderApplied;
+  bootStageReached( BOOT_OUTPUTS );
+  //Count the boot if the image is on trial after an update - see Webrelay_ota.h
+  otaBoot();
+  LOGI( "I2C clock %u", i2cClock );
   if ( !switchPresent )
   {
-    Serial.printf( "ASCOMSwitch : Unable to find PCF8574 switch device \n");
+    LOGE( "ASCOMSwitch : Unable to find PCF8574 switch device" );
     String msg = scanI2CBus();
-    Serial.println( msg );
-  }
-  else
-  {
-    switchDevice.write(0, 1);delay(1000);
-    switchDevice.write(0, 0);delay(1000);
-    switchDevice.write(0, 1);
+    LOGI( "%s", msg.c_str() );
   }
-    
-  for ( int i=0;i< numSwitches ; i++ )
-  {
-    switch (switchEntry[i]->type)
-    {
-      case SWITCH_RELAY_NC:
-      case SWITCH_RELAY_NO:
-        switchEntry[i]->value = ( switchDevice.read( i ) == 1 )? 1.0F: 0.0F ;
-        break;
-      case SWITCH_PWM:
-      case SWITCH_ANALG_DAC:
-        switchEntry[i]->value = switchEntry[i]->value; //TO do - read digital value back from pin
-        break;
-      default:
-        break;
-    }
-  }
-  switchStatus  = switchDevice.read8();
   DEBUGS1( "switchStatus: "); DEBUGSL1( switchStatus );
+  inputSetup();
 
-  //Setup webserver handler functions
-  server.on("/", handlerStatus );
-  server.onNotFound(handlerNotFound); 
-  
-  //Common ASCOM handlers
-  server.on("/api/v1/switch/0/action",              HTTP_PUT, handleAction );
-  server.on("/api/v1/switch/0/commandblind",        HTTP_PUT, handleCommandBlind );
-  server.on("/api/v1/switch/0/commandbool",         HTTP_PUT, handleCommandBool );
-  server.on("/api/v1/switch/0/commandstring",       HTTP_PUT, handleCommandString );
-  server.on("/api/v1/switch/0/connected",           handleConnected );
-  server.on("/api/v1/switch/0/description",         HTTP_GET, handleDescriptionGet );
-  server.on("/api/v1/switch/0/driverinfo",          HTTP_GET, handleDriverInfoGet );
-  server.on("/api/v1/switch/0/driverversion",       HTTP_GET, handleDriverVersionGet );
-  server.on("/api/v1/switch/0/interfaceversion",    HTTP_GET, handleInterfaceVersionGet );
-  server.on("/api/v1/switch/0/name",                HTTP_GET, handleNameGet );
-  server.on("/api/v1/switch/0/supportedactions",    HTTP_GET, handleSupportedActionsGet );
-
-  //Switch-specific functions
-  server.on("/api/v1/switch/0/maxswitch",           HTTP_GET, handlerMaxswitch );
-  server.on("/api/v1/switch/0/canwrite",            HTTP_GET, handlerCanWrite );
-  server.on("/api/v1/switch/0/getswitchdescription", HTTP_GET, handlerSwitchDescription );
-  server.on("/api/v1/switch/0/getswitch",           HTTP_GET, handlerSwitchState );
-  server.on("/api/v1/switch/0/setswitch",           HTTP_PUT, handlerSwitchState );
-  server.on("/api/v1/switch/0/getswitchname",       HTTP_GET, handlerSwitchName );
-  server.on("/api/v1/switch/0/setswitchname",       HTTP_PUT, handlerSwitchName );  
-  server.on("/api/v1/switch/0/getswitchtype",       HTTP_GET, handlerSwitchType );
-  server.on("/api/v1/switch/0/setswitchtype",       HTTP_PUT, handlerSwitchType );
-  server.on("/api/v1/switch/0/getswitchvalue",      HTTP_GET, handlerSwitchValue );
-  server.on("/api/v1/switch/0/setswitchvalue",      HTTP_PUT, handlerSwitchValue );
-  server.on("/api/v1/switch/0/minswitchvalue",      HTTP_GET, handlerMinSwitchValue );
-  server.on("/api/v1/switch/0/maxswitchvalue",      HTTP_GET, handlerMaxSwitchValue );
-  server.on("/api/v1/switch/0/switchstep",          HTTP_GET, handlerSwitchStep );
-
-//Additional non-ASCOM custom setup calls
-  server.on("/status",                              HTTP_GET, handlerStatus);
-  server.on("/api/v1/switch/0/status",              HTTP_ANY, handlerStatus );
-  server.on("/api/v1/switch/0/setup",               HTTP_ANY, handlerSetup );
-  server.on("/api/v1/switch/0/setup",               HTTP_ANY, handlerSetup );
-  server.on("/api/v1/switch/0/setupSwitches",       HTTP_ANY, handlerSetupSwitches );
-  updater.setup( &server );
-  server.begin();
+  //Start NTP client - runs once WiFi is up
+  configTime(TZ_SEC, DST_SEC, timeServer1, timeServer2, timeServer3 );
   
-  //Starts the discovery responder server
-  Udp.begin( udpPort);
+  // Connect to wifi - the network task follows the connection and starts the services that need it
+  wifiBegin();
   
   //Setup timers
   //setup interrupt-based 'soft' alarm handler for periodic acquisition of new bearing
   ets_timer_setfn( &timer, onTimer, NULL ); 
   ets_timer_setfn( &timeoutTimer, onTimeoutTimer, NULL ); 
+  wheelInit();
   
   //fire timer every 250 msec
   //Set the timer function first
   ets_timer_arm_new( &timer, 250, 1/*repeat*/, 1);
-  //ets_timer_arm_new( &timeoutTimer, 2500, 0/*one-shot*/, 1);
+  //Switch timer wheel tick, which also paces idle client session expiry
+  ets_timer_arm_new( &timeoutTimer, WHEEL_TICK, 1/*repeat*/, 1);
+
+  //Cooperative tasks run from loop() - priority 0 is highest. 
+  //            name,        function,        priority, period (ms), budget (us)
+  schedulerAdd( "events",    taskEvents,      0,        0,           5000 );
+  schedulerAdd( "http",      taskHttp,        0,        0,           20000 );
+  schedulerAdd( "fastudp",   taskFastUdp,     0,        0,           2000 );
+  schedulerAdd( "network",   taskNetwork,     1,        20,          5000 );
+  schedulerAdd( "discovery", taskDiscovery,   1,        50,          2000 );
+  schedulerAdd( "inputs",    taskInputs,      1,        10,          5000 );
+  schedulerAdd( "mqtt",      taskMqtt,        2,        10,          10000 );
+  schedulerAdd( "i2c",       taskI2c,         3,        100,         5000 );
+  schedulerAdd( "ramp",      taskRamp,        3,        RAMP_PERIOD, 2000 );
+  schedulerAdd( "sensors",   taskSensors,     3,        SENSOR_PERIOD, 2000 );
+  schedulerAdd( "eeprom",    taskEepromFlush, 4,        1000,        50000 );
+  schedulerAdd( "health",    taskHealth,      5,        HEALTH_PERIOD, 10000 );
+  schedulerAdd( "updater",   taskUpdater,     6,        100,         20000 );
+  schedulerAdd( "log",       taskLog,         6,        10,          2000 );
+  i2cTaskId = schedulerFind( "i2c" );
   
-  Serial.println( "Setup complete" );
+  heapAfterSetup = ESP.getFreeHeap();
+  LOGI( "Setup complete" );
+}
+
+//Start the services that need the network, once WiFi has connected
+void startServices( void )
+{
+  //MQTT - the mqtt task connects to the broker
+  client.setServer( mqtt_server, 1883 );
+  client.setCallback( callback );
+
+  //Setup webserver handler functions
+  server.on("/", handlerHostStatus );
+  server.onNotFound(handlerNotFound); 
+  
+  //Common ASCOM and switch-specific handlers for every device number /api/v1/switch/{device_number}/{method}
+  server.addHandler( &alpacaRouter );
+
+  //ALPACA management API
+  server.on("/management/apiversions",              HTTP_GET, handleMgmtApiVersions );
+  server.on("/management/v1/description",           HTTP_GET, handleMgmtDescription );
+  server.on("/management/v1/configureddevices",     HTTP_GET, handleMgmtConfiguredDevices );
+
+//Additional non-ASCOM custom setup calls
+  server.on("/status",                              HTTP_GET, handlerHostStatus);
+  server.on("/metrics",                             HTTP_GET, handlerMetrics);
+  server.on("/rules",                               HTTP_ANY, handlerRules);
+  server.on("/schedules",                           HTTP_ANY, handlerSchedules);
+  server.on("/sensors",                             HTTP_ANY, handlerSensors);
+  //Firmware updates stream in between other requests - see Webrelay_ota.h
+  server.onStream("/update",                        HTTP_POST, &ota );
+  server.begin();
+  
+  //Starts the discovery responder server
+  Udp.begin( udpPort);
+  //Fast binary switch control, if a port and key are set - see Webrelay_fastudp.h
+  fastSession = RANDOM_REG32 | 1;
+  if( fastEnabled() )
+    fastUdp.begin( fastPort );
+
+  servicesStarted = true;
+  bootStageReached( BOOT_SERVICES );
+}
+
+//Note the first time each boot stage is reached
+void bootStageReached( enum BootStage stage )
+{
+  if( bootStageTime[stage] == 0 )
+    bootStageTime[stage] = ( millis() > 0 ) ? millis() : 1;
 }
 
 //Timer handler for 'soft' 
 void onTimer( void * pArg )
 {
-  newDataFlag = true;
+  events.post( EVENT_TICK );
 }
 
-//Used to complete timeout actions. 
+//Used to complete timeout actions - drives the switch timer wheel and session expiry. 
 void onTimeoutTimer( void* pArg )
 {
-  //Read command list and apply. 
-  timeoutFlag = true;
+  static uint32_t ticks = 0;
+  
+  events.post( EVENT_TIMER_WHEEL );
+  if( ++ticks >= ( SESSION_EXPIRY_PERIOD / WHEEL_TICK ) )
+  {
+    ticks = 0;
+    events.post( EVENT_SESSION_EXPIRY );
+  }
 }
 
-//Main processing loop
+//Main processing loop - all the work is done by the scheduler tasks below. 
 void loop()
 {
-  String timestamp;
-  String output;
-  
-  DynamicJsonBuffer jsonBuffer(256);
-  JsonObject& root = jsonBuffer.createObject();
+  uint32_t loopStart = micros();
 
-  if( WiFi.status() != WL_CONNECTED )
-    device.restart(); 
-  
+  schedulerRun();
+
+  sampleHeap();
+  histRecord( &loopHist, micros() - loopStart );
+}
+
+//Handle events from the timer and MQTT callbacks and pin interrupts, a batch at a time
+void taskEvents( void )
+{
+  Event batch[EVENT_BATCH];
+  int i, count;
+
+  count = isrEvents.drain( batch, EVENT_BATCH );
+  for( i = 0; i < count; i++ )
+    dispatchEvent( batch[i] );
+
+  count = events.drain( batch, EVENT_BATCH );
+  for( i = 0; i < count; i++ )
+    dispatchEvent( batch[i] );
+}
+
+void dispatchEvent( Event& event )
+{
+  switch( event.type )
+  {
+    case EVENT_TICK:
+      time( &now );
+      scheduleRun( now, onSchedule );
+      break;
+    case EVENT_TIMER_WHEEL:
+      switchTimerTick();
+      break;
+    case EVENT_SESSION_EXPIRY:
+      expireSessions();
+      break;
+    case EVENT_MQTT:
+      //publish results
+      if( client.connected() )
+        publishHealth();
+      break;
+    case EVENT_GPIO:
+      inputSample();
+      break;
+    default:
+      break;
+  }
+}
+
+//Handle web requests
+void taskHttp( void )
+{
+  if( !servicesStarted )
+    return;
+  server.handleClient();
+  if( server.requests > 0 )
+    bootStageReached( BOOT_FIRST_REQUEST );
+}
+
+//Restart into a new image once it is accepted, and follow its trial - see Webrelay_ota.h.
+//Also makes restarts asked for by the setup page.
+void taskUpdater( void )
+{
+  otaPoll();
+  if( restartDue != 0 && (int32_t)( millis() - restartDue ) >= 0 )
+    otaRestart();
+}
+
+//Restart RESTART_DELAY from now, from the updater task, so the response to the request asking for it goes out first
+void scheduleRestart( void )
+{
+  restartDue = millis() + RESTART_DELAY;
+  if( restartDue == 0 )
+    restartDue = 1;
+}
+
+//Follow the WiFi connection and start the network services once it's up
+void taskNetwork( void )
+{
+  switch( wifiPoll() )
+  {
+    case WIFI_EVENT_CONNECTED:
+      bootStageReached( BOOT_WIFI );
+      LOGI( "WiFi connected%s",   ( wifiFast ) ? " to cached access point" : "" );
+      LOGI( "Hostname: %s",      WiFi.hostname().c_str() );
+      LOGI( "IP address: %s",    WiFi.localIP().toString().c_str() );
+      LOGI( "DNS address 0: %s", WiFi.dnsIP(0).toString().c_str() );
+      LOGI( "DNS address 1: %s", WiFi.dnsIP(1).toString().c_str() );
+
+      //Setup sleep parameters
+      wifi_set_sleep_type(LIGHT_SLEEP_T);
+      if( wifiRememberAP() )
+        markConfigDirty();
+      //The discovery response holds the address - it may have changed since the last connection
+      invalidateManagementCache();
+      if( !servicesStarted )
+        startServices();
+      //Don't wait out a broker backoff that was only failing for want of WiFi
+      mqttBackoff = MQTT_RECONNECT_PERIOD;
+      mqttRetryDue = millis();
+      break;
+    case WIFI_EVENT_LOST:
+      LOGW( "WiFi lost - reconnecting" );
+      break;
+    default:
+      if( wifiRestartDue() )
+      {
+        LOGW( "WiFi down for the restart window - restarting" );
+        if( configDirty || wearDirty || relayDirty )
+          saveToEeprom();
+        logFlush();
+        device.restart();
+      }
+      break;
+  }
+}
+
+//ALPACA discovery responder
+void taskDiscovery( void )
+{
+  if( !servicesStarted )
+    return;
   int udpBytesIn = Udp.parsePacket();
   if( udpBytesIn > 0  ) 
     handleDiscovery( udpBytesIn );
-    
-  if( newDataFlag == true ) 
-  {
-    root["time"] = getTimeAsString( timestamp );
-    //Serial.println( getTimeAsString( timestamp ) )
-  
-    newDataFlag = false;
-  }  
+}
 
+//Signed binary switch frames on the fast control port
+void taskFastUdp( void )
+{
+  if( !servicesStarted || !fastEnabled() )
+    return;
+  fastUdpPoll();
+}
+
+//Keep the broker connection, reconnecting with backoff while WiFi is up, and replay changes queued while it was away
+void taskMqtt( void )
+{
+  if( !servicesStarted )
+    return;
   if( client.connected() )
   {
-    if (callbackFlag == true )
+    client.loop();
+    replayBacklog();
+    return;
+  }
+  if( mqttWasConnected )
+  {
+    mqttWasConnected = false;
+    mqttOutages++;
+  }
+  if( wifiState == WIFI_UP && (int32_t)( millis() - mqttRetryDue ) >= 0 )
+  {
+    reconnectNB();
+    if( client.connected() )
     {
-      //publish results
+      mqttWasConnected = true;
+      mqttBackoff = MQTT_RECONNECT_PERIOD;
+      client.subscribe (inTopic);
       publishHealth();
-      callbackFlag = false;
     }
-    client.loop();
+    else
+    {
+      mqttRetryDue = millis() + mqttBackoff;
+      mqttBackoff = ( mqttBackoff * 2 < MQTT_RECONNECT_MAX ) ? mqttBackoff * 2 : MQTT_RECONNECT_MAX;
+    }
   }
-  else
+}
+
+//Step analogue outputs towards their targets
+void taskRamp( void )
+{
+  rampOutputs();
+}
+
+//Write-behind of configuration changes to EEPROM
+void taskEepromFlush( void )
+{
+  flushConfig();
+}
+
+//Debounce input changes and publish them. Also reads the inputs if INT is held low but its edge was missed
+void taskInputs( void )
+{
+  uint8_t changed;
+  if( inputMask == 0 )
+    return;
+  if( digitalRead( EXPANDER_INT_PIN ) == LOW )
+    inputSample();
+  changed = inputDebounce();
+  if( changed != 0 )
+    publishInputChanges( changed );
+}
+
+//Write queued relay changes to the expander, and retry any that failed. Woken as soon as a change is queued.
+void taskI2c( void )
+{
+  expanderFlush();
+}
+
+//Read the next power monitor binding into its switch - see Webrelay_sensors.h
+void taskSensors( void )
+{
+  sensorSample();
+}
+
+//Drain the log buffer to Serial and syslog - see Webrelay_log.h
+void taskLog( void )
+{
+  logDrain( myHostname );
+}
+
+void taskHealth( void )
+{
+  if( client.connected() )
   {
-    reconnectNB();
-    client.subscribe (inTopic);
+    publishHealth();
+    publishWear();
   }
-  
-  //Handle web requests
-  server.handleClient();
- 
 }
 
 /* MQTT callback for subscription and topic.
@@ -334,8 +545,100 @@ void loop()
  */
 void callback(char* topic, byte* payload, unsigned int length) 
 {  
-  //set callback flag
-  callbackFlag = true;  
+  //Handled by the event task once client.loop() returns
+  events.post( EVENT_MQTT );
+}
+
+/*
+ * Publish a message for each input switch whose debounced state has changed 
+ * under ~/skybadger/sensors/switch/<host>
+ * Changes that can't be published now are queued for the mqtt task to replay - see Webrelay_backlog.h
+ */
+void publishInputChanges( uint8_t changed )
+{
+  String timestamp;
+  bool state;
+  
+  getTimeAsString2( timestamp );
+  for( int i = 0; i < EXPANDER_PINS && i < numSwitches; i++ )
+  {
+    if( !( changed & ( 1 << i ) ) )
+      continue;
+    state = switchOn( switchEntry[i] );
+    if( backlogCount > 0 || !client.connected() || !publishSwitchState( i, state, timestamp.c_str(), false ) )
+      backlogPush( timestamp.c_str(), i, state );
+  }
+}
+
+bool publishSwitchState( int index, bool state, const char* timestamp, bool replayed )
+{
+  String outTopic;
+  String output;
+  bool sent;
+
+  outTopic = outSenseTopic;
+  outTopic.concat( "switch/" );
+  outTopic.concat( myHostname );
+  
+  DynamicJsonBuffer jsonBuffer(256);
+  JsonObject& root = jsonBuffer.createObject();
+  root["Time"] = timestamp;
+  root["Switch"] = index;
+  root["Name"] = switchEntry[index]->switchName;
+  root["State"] = state;
+  if( replayed )
+    root["Replayed"] = true;
+  root.printTo( output );
+  uint32_t publishStart = micros();
+  sent = client.publish( outTopic.c_str(), output.c_str() );  
+  histRecord( &mqttPublishHist, micros() - publishStart );
+  return sent;
+}
+
+//Publish a few of the changes queued while the broker was away, oldest first
+void replayBacklog( void )
+{
+  BacklogEntry* e;
+  for( int n = 0; n < MQTT_REPLAY_BATCH && ( e = backlogFront() ) != nullptr; n++ )
+  {
+    if( !publishSwitchState( e->index, e->state, e->time, true ) )
+      break;
+    backlogPop();
+    backlogReplayed++;
+  }
+}
+
+/*
+ * Publish the wear counters of each switch whose counters have changed since they were last published, one message
+ * per switch to stay inside the MQTT packet size limit, under ~/skybadger/sensors/wear/<host>
+ */
+void publishWear( void )
+{
+  String outTopic;
+  String output;
+  String timestamp;
+
+  outTopic = outSenseTopic;
+  outTopic.concat( "wear/" );
+  outTopic.concat( myHostname );
+  getTimeAsString2( timestamp );
+  for( int i = 0; i < numSwitches && i < MAX_WEAR_SWITCHES; i++ )
+  {
+    wearSync( i, switchEntry[i]->maxLevel );
+    if( !( wearChanged & ( 1 << i ) ) )
+      continue;
+    DynamicJsonBuffer jsonBuffer(256);
+    JsonObject& root = jsonBuffer.createObject();
+    root["Time"] = timestamp;
+    root["Switch"] = i;
+    root["Actuations"] = wear[i].actuations;
+    root["OnTime"] = wear[i].onSeconds;
+    root["LastChange"] = wear[i].lastChange;
+    output = "";
+    root.printTo( output );
+    if( client.publish( outTopic.c_str(), output.c_str() ) )
+      wearChanged &= ~( 1 << i );
+  }
 }
 
 /*
@@ -364,50 +667,49 @@ void callback(char* topic, byte* payload, unsigned int length)
   //Put a notice out regarding device health
   outTopic = outHealthTopic;
   outTopic.concat( myHostname );
+  uint32_t publishStart = micros();
   client.publish( outTopic.c_str(), output.c_str() );  
-  Serial.printf( "topic: %s, published with value %s \n", outTopic.c_str(), output.c_str() );
+  histRecord( &mqttPublishHist, micros() - publishStart );
+  LOGD( "topic: %s, published with value %s", outTopic.c_str(), output.c_str() );
+
+#if defined HEALTH_METRICS
+  //Metrics summary goes in its own message to stay inside the MQTT packet size limit
+  output = "";
+  JsonObject& metrics = jsonBuffer.createObject();
+  metrics["heap"] = ESP.getFreeHeap();
+  metrics["heapLow"] = heapLowWater;
+  metrics["frag"] = ESP.getHeapFragmentation();
+  metrics["loopMax"] = loopHist.max;
+  metrics["reqs"] = transactionId;
+  metrics.printTo( output );
+  outTopic.concat( "/metrics" );
+  client.publish( outTopic.c_str(), output.c_str() );  
+#endif
  }
  
  void handleDiscovery( int udpBytesCount )
  {
     char inBytes[64];
-    String message;
     DiscoveryPacket discoveryPacket;
- 
-    DynamicJsonBuffer jsonBuffer(256);
-    JsonObject& root = jsonBuffer.createObject();
     
-    Serial.printf("UDP: %i bytes received from %s:%i\n", udpBytesCount, Udp.remoteIP().toString().c_str(), Udp.remotePort() );
+    LOGD( "UDP: %i bytes received from %s:%i", udpBytesCount, Udp.remoteIP().toString().c_str(), Udp.remotePort() );
 
     // We've received a packet, read the data from it
+    if ( udpBytesCount > (int) sizeof( inBytes ) )
+      udpBytesCount = sizeof( inBytes );
     Udp.read( inBytes, udpBytesCount); // read the packet into the buffer
-
-    // display the packet contents
-    for (int i = 0; i < udpBytesCount; i++ )
-    {
-      Serial.print( inBytes[i]);
-      if (i % 32 == 0)
-      {
-        Serial.println();
-      }
-      else Serial.print(' ');
-    } // end for
-    Serial.println();
    
     //Is it for us ?
-    char protocol[16];
+    char protocol[17];
     strncpy( protocol, (char*) inBytes, 16);
-    if ( strcasecmp( discoveryPacket.protocol, protocol ) == 0 )
+    protocol[16] = '\0';
+    if ( strncasecmp( discoveryPacket.protocol, protocol, strlen( discoveryPacket.protocol ) ) == 0 )
     {
+      //Respond with the cached discovery message - only rebuilt when the configuration changes
+      if( !mgmtCacheValid )
+        buildManagementCache();
       Udp.beginPacket( Udp.remoteIP(), Udp.remotePort() );
-      //Respond with discovery message
-      root["IPAddress"] = WiFi.localIP().toString().c_str();
-      root["Type"] = DriverType;
-      root["AlpacaPort"] = 80;
-      root["Name"] = WiFi.hostname();
-      root["UniqueID"] = system_get_chip_id();
-      root.printTo( message );
-      Udp.write( message.c_str(), sizeof( message.c_str() ) * sizeof(char) );
+      Udp.write( discoveryResponse.c_str(), discoveryResponse.length() );
       Udp.endPacket();   
     }
  }
@@ -11,8 +11,10 @@ Use of a DAC requires (presumably) an i2C DAC or an onboard DAC tied to a pin.
 
 In use of the ASCOM Api 
 All URLs include an argument 'Id' which contains the number of the switch attached to this device instance
-The switch device number is in the path itself. Hence the getUriField function
-Internally this code keeps the state of the switch in the switchEntry structure and uses (value != 1.0F) to mean false. 
+The switch device number is in the path itself. The router in Webrelay_router.h parses it and points 'dev' at that device's slice of the switch table, 
+so handlers take switch ids local to the device and look them up with deviceSwitch().
+Internally this code keeps the state of each switch in its switchEntry as 'level', a whole number of steps above the
+switch's min - see Webrelay_switchtypes.h. A boolean switch is on when its level isn't 0, as switchOn() reports.
 
  To do:
  Debug, trial
@@ -37,6 +39,23 @@ Internally this code keeps the state of the switch in the switchEntry structure
 #include <Wire.h>
 #include "AlpacaErrorConsts.h"
 #include "ASCOMAPISwitch_rest.h"
+#include "Webrelay_i2c.h"
+#include "Webrelay_timerwheel.h"
+#include "Webrelay_inputs.h"
+#include "Webrelay_command.h"
+#include "Webrelay_switchtypes.h"
+
+//Relays can be switched off automatically or pulsed on and off - see startSwitchTimer().
+enum SwitchTimerMode { TIMER_NONE, TIMER_AUTO_OFF, TIMER_PULSE };
+typedef struct
+{
+  enum SwitchTimerMode mode = TIMER_NONE;
+  bool phaseOn = false;
+  uint16_t cycles = 0;   //pulses still to finish, 0 to pulse until cancelled
+  uint32_t onTime = 0;   //msecs
+  uint32_t offTime = 0;  //msecs
+} SwitchTimer;
+SwitchTimer switchTimer[WHEEL_MAX_ENTRIES];
 
 
 //Function definitions
@@ -50,6 +69,279 @@ void handlerCanWrite(void);
 void handlerSwitchState(void);
 void handlerSwitchDescription(void);
 void handlerSwitchName(void);
+void handlerHostStatus(void);
+void handlerTrace(void);
+void handlerMetrics(void);
+void layoutDevices(void);
+SwitchEntry* deviceSwitch( int switchID );
+void writeAnalogue( int index );
+void rampOutputs( void );
+bool setRelayState( int index, bool state );
+void noteRelayState( int index, bool state );
+void restoreOutputs( void );
+bool startSwitchTimer( int index, enum SwitchTimerMode mode, uint32_t onTime, uint32_t offTime, uint16_t cycles );
+void cancelSwitchTimer( int index );
+void onSwitchTimer( int index );
+void switchTimerTick( void );
+void switchTimerStatus( int index, JsonObject& entry );
+void handlerSwitchPulse(void);
+void handlerRules(void);
+void onSchedule( int index );
+enum RuleResult applyRelayMask( uint32_t mask, uint32_t on );
+enum RuleResult applyScene( int index );
+int runCommands( const char* text, bool execute, String& result, bool& state, String& errMsg );
+int runCommand( Command& cmd, bool execute, String& result, bool& state, const char*& error );
+int deviceCommand( const String& command, String& result, bool& state, String& errMsg );
+void saveScene( int index );
+uint8_t fastApply( FastFrame& frame );
+void fastUdpPoll( void );
+void handlerSchedules(void);
+void handlerSensors(void);
+
+/*
+ * Returns the switch entry for a switch id local to the device number currently being addressed.
+ * Range check the switch id against dev->numSwitches first.
+ */
+inline SwitchEntry* deviceSwitch( int switchID )
+{
+    return switchEntry[ dev->firstSwitch + switchID ];
+}
+
+/*
+ * Drive the hardware for an analogue switch from its current value. index is the host switch index.
+ * PWM uses the ESP's own pins - only those not already used for I2C or serial on either module are allowed.
+ * There's no DAC hardware yet so DAC values are only held in the switch table.
+ */
+void writeAnalogue( int index )
+{
+    SwitchEntry* se = switchEntry[index];
+    int duty;
+    wearNote( index, se->level, se->maxLevel );
+    if( switchBackend( se->type ) != BACKEND_PWM )
+      return;
+    switch( se->pin )
+    {
+      case 4: case 5: case 12: case 13: case 14: case 15:
+        if( se->maxLevel > 0 )
+        {
+          duty = (int) ( ( se->level * PWMRANGE ) / se->maxLevel );
+          analogWrite( se->pin, duty );
+        }
+        break;
+      default:
+        break;
+    }
+}
+
+/*
+ * Called from the ramp task every RAMP_PERIOD msecs to step each analogue output towards its target.
+ * Does nothing but compare values when no output is moving.
+ */
+void rampOutputs( void )
+{
+    for( int i = 0; i < numSwitches; i++ )
+    {
+      SwitchEntry* se = switchEntry[i];
+      SwitchLevel delta;
+      
+      if( se->level == se->rampTarget || !switchCan( se->type, OP_RAMP ) )
+        continue;
+
+      delta = ( RAMP_TIME > 0 ) ? ( se->maxLevel * RAMP_PERIOD ) / RAMP_TIME : se->maxLevel;
+      if( delta < 1 )
+        delta = 1;
+      if( se->rampTarget > se->level )
+        se->level = ( se->rampTarget - se->level > delta ) ? se->level + delta : se->rampTarget;
+      else
+        se->level = ( se->level - se->rampTarget > delta ) ? se->level - delta : se->rampTarget;
+      writeAnalogue( i );
+    }
+}
+
+/*
+ * Drive a relay to a new state. Every change of relay state - from a request or from a switch timer - goes through here.
+ * index is the host switch index, which is also the expander pin. 
+ * Returns false if the change was not made, including when it is refused by an interlock rule - use ruleCheck() first 
+ * to find out why.
+ */
+bool setRelayState( int index, bool state )
+{
+    if( index < 0 || index >= numSwitches || !switchCan( switchEntry[index]->type, OP_STATE ) )
+      return false;
+    if( ruleCheck( index, state ) != RULE_OK )
+    {
+      DEBUGS1( "setRelayState: interlock refused change to switch " ); DEBUGSL1( index );
+      return false;
+    }
+    expanderQueuePin( index, state );
+    //Kept so the relay comes back in the same state after a restart - see markRelayDirty() and restoreOutputs()
+    bool changed = ( switchOn( switchEntry[index] ) != state );
+    switchEntry[index]->level = (state) ? 1 : 0;
+    if( changed )
+      markRelayDirty();
+    noteRelayState( index, state );
+    return true;
+}
+
+//Every relay change is noted here once it has been made - for the interlock rules and the wear counters
+void noteRelayState( int index, bool state )
+{
+    ruleNoteState( index, state );
+    wearNote( index, (state) ? 1 : 0, 1 );
+}
+
+/*
+ * Set the outputs from the values read from EEPROM, first thing at boot. Relay levels go into the expander output
+ * byte, which i2cSetup() writes as soon as the bus is started. PWM outputs are driven straight away.
+ */
+void restoreOutputs( void )
+{
+    uint8_t out = 0xFF;
+    for( int i = 0; i < numSwitches; i++ )
+    {
+      switch( switchBackend( switchEntry[i]->type ) )
+      {
+        case BACKEND_EXPANDER_OUT:
+          if( i < 8 && !switchOn( switchEntry[i] ) )
+            out &= ~( 1 << i );
+          //Not a change - the relay held its state - so the wear counters are seeded rather than counting it
+          ruleNoteState( i, switchOn( switchEntry[i] ) );
+          wearSeed( i, ( switchOn( switchEntry[i] ) ) ? 1 : 0 );
+          break;
+        case BACKEND_PWM:
+        case BACKEND_NONE:
+          switchEntry[i]->rampTarget = switchEntry[i]->level; 
+          wearSeed( i, switchEntry[i]->level );
+          writeAnalogue( i );
+          break;
+        case BACKEND_EXPANDER_IN: //left high to be read - see inputSetup()
+        default:
+          break;
+      }
+    }
+    expanderOut = out;
+}
+
+/*
+ * Turn a relay on and arrange for the timer wheel to turn it off again.
+ * TIMER_AUTO_OFF turns it off after onTime. TIMER_PULSE repeats onTime on, offTime off for cycles pulses,
+ * or until cancelled if cycles is 0. Any timer already running on the switch is replaced.
+ */
+bool startSwitchTimer( int index, enum SwitchTimerMode mode, uint32_t onTime, uint32_t offTime, uint16_t cycles )
+{
+    SwitchTimer* st;
+    
+    if( index < 0 || index >= WHEEL_MAX_ENTRIES || onTime == 0 || onTime > SWITCH_TIMER_MAX || offTime > SWITCH_TIMER_MAX || mode == TIMER_NONE )
+      return false;
+    st = &switchTimer[index];
+    st->mode = mode;
+    st->onTime = onTime;
+    st->offTime = offTime;
+    st->cycles = cycles;
+    st->phaseOn = true;
+    if( !setRelayState( index, true ) )
+    {
+      st->mode = TIMER_NONE;
+      return false;
+    }
+    return wheelSchedule( index, onTime );
+}
+
+//Stop any timer on the switch, leaving the relay as it is
+void cancelSwitchTimer( int index )
+{
+    if( index < 0 || index >= WHEEL_MAX_ENTRIES )
+      return;
+    wheelCancel( index );
+    switchTimer[index].mode = TIMER_NONE;
+}
+
+//Timer wheel callback - a switch timer has expired
+void onSwitchTimer( int index )
+{
+    SwitchTimer* st = &switchTimer[index];
+    
+    switch( st->mode )
+    {
+      case TIMER_AUTO_OFF:
+        setRelayState( index, false );
+        st->mode = TIMER_NONE;
+        break;
+      case TIMER_PULSE:
+        if( st->phaseOn )
+        {
+          //If an interlock holds the relay on the pulse train stops here
+          if( !setRelayState( index, false ) )
+            st->mode = TIMER_NONE;
+          else if( st->cycles == 1 )
+            st->mode = TIMER_NONE;
+          else
+          {
+            if( st->cycles > 1 )
+              st->cycles--;
+            st->phaseOn = false;
+            wheelSchedule( index, st->offTime );
+          }
+        }
+        else if( setRelayState( index, true ) )
+        {
+          st->phaseOn = true;
+          wheelSchedule( index, st->onTime );
+        }
+        else
+          st->mode = TIMER_NONE;
+        break;
+      case TIMER_NONE:
+      default:
+        break;
+    }
+}
+
+//Called from the event task on each timeoutTimer tick
+void switchTimerTick( void )
+{
+    wheelAdvance( millis(), onSwitchTimer );
+}
+
+//Add any pending timer on the switch to a getswitch or status response
+void switchTimerStatus( int index, JsonObject& entry )
+{
+    if( index < 0 || index >= WHEEL_MAX_ENTRIES || switchTimer[index].mode == TIMER_NONE )
+      return;
+    entry["TimerMode"] = ( switchTimer[index].mode == TIMER_PULSE ) ? "pulse" : "autooff";
+    entry["TimerRemaining"] = wheelRemaining( index );
+    if( switchTimer[index].mode == TIMER_PULSE )
+      entry["PulsesRemaining"] = (int) switchTimer[index].cycles;
+}
+
+/*
+ * Split the host switch table into contiguous slices, one per ALPACA device number.
+ * Switches are shared out evenly, with any remainder given to the last device.
+ */
+void layoutDevices(void)
+{
+    int i;
+    int perDevice;
+    
+    if( numDevices < 1 || numDevices > MAX_ALPACA_DEVICES )
+      numDevices = 1;
+    perDevice = numSwitches / numDevices;
+
+    for( i = 0; i < numDevices; i++ )
+    {
+      alpacaDevice[i].firstSwitch = i * perDevice;
+      alpacaDevice[i].numSwitches = ( i == numDevices - 1 ) ? numSwitches - ( i * perDevice ) : perDevice;
+    }
+    for( ; i < MAX_ALPACA_DEVICES; i++ )
+    {
+      alpacaDevice[i].firstSwitch = 0;
+      alpacaDevice[i].numSwitches = 0;
+      closeDeviceSessions( i );
+    }
+    hostDevice.firstSwitch = 0;
+    hostDevice.numSwitches = numSwitches;
+    invalidateManagementCache();
+}
 
 /*
  * This function will write a copy of the provided deviceEntry structure into the internal memory array. 
@@ -61,27 +353,23 @@ void copySwitch( SwitchEntry* sourceSe, SwitchEntry* targetSe )
     strncpy( targetSe->switchName, sourceSe->switchName, MAX_NAME_LENGTH);
     targetSe->writeable   = sourceSe->writeable;
     targetSe->type        = SWITCH_RELAY_NO;
-    targetSe->min         = sourceSe->min;
-    targetSe->max         = sourceSe->max;
-    targetSe->step        = sourceSe->step;
-    targetSe->value       = sourceSe->value;
+    targetSe->level       = sourceSe->level;
+    switchSetRange( targetSe, sourceSe->min, sourceSe->max, sourceSe->step );
 }
 
 void initSwitch( SwitchEntry* targetSe )
 {
     String output;
-    output = "Default description";
+    output = F("Default description");
     strncpy( targetSe->description, output.c_str(), MAX_NAME_LENGTH);
 
-    output = "Switch Name";
+    output = F("Switch Name");
     strncpy( targetSe->switchName, output.c_str(), MAX_NAME_LENGTH);
 
     targetSe->writeable   = false;
     targetSe->type        = SWITCH_RELAY_NO;
-    targetSe->min         = 0.0F;
-    targetSe->max         = 0.0F;
-    targetSe->step        = 1.0F;
-    targetSe->value       = 0.0F;
+    targetSe->level       = 0;
+    switchSetRange( targetSe, 0.0F, 0.0F, 1.0F );
 }
 /*
  * This function re-sizes the existing switchEntry array by re-allocating memory and copying if required. 
@@ -165,8 +453,8 @@ void handlerMaxswitch(void)
 
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "MaxSwitch", Success , "" );    
-    root["Value"] = numSwitches;
+    jsonResponseBuilder( root, clientID, transID, F("MaxSwitch"), Success , "" );    
+    root["Value"] = dev->numSwitches;
     
     root.printTo(message);
     server.send(200, "text/json", message);
@@ -182,31 +470,31 @@ void handlerCanWrite(void)
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
     int statusCode = 400;
     int switchID = -1;
-    String argToSearchFor = "Id";
+    const __FlashStringHelper* argToSearchFor = F("Id");
 
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "CanWrite", Success , "" );    
+    jsonResponseBuilder( root, clientID, transID, F("CanWrite"), Success , "" );    
 
     if( hasArgIC( argToSearchFor, server, false ) )
     {
       switchID = server.arg(argToSearchFor).toInt();
-      if ( switchID >= 0 && switchID < numSwitches ) 
+      if ( switchID >= 0 && switchID < dev->numSwitches ) 
       {
-        root["Value"] = switchEntry[switchID]->writeable;
+        root["Value"] = deviceSwitch(switchID)->writeable;
         statusCode = 200;
       }
       else
       {
         statusCode = 400;
-        root["ErrorMessage"] = "Argument switch Id out of range";
+        root["ErrorMessage"] = F("Argument switch Id out of range");
         root["ErrorNumber"] = (int) invalidValue ; 
       }
     }
     else
     {
         statusCode = 400;
-        root["ErrorMessage"] = "Missing switchID argument";
+        root["ErrorMessage"] = F("Missing switchID argument");
         root["ErrorNumber"] = (int) invalidOperation ;       
     }
     root.printTo(message);
@@ -223,15 +511,16 @@ void handlerSwitchState(void)
     uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
     int returnCode = 200;
-    double switchValue; 
     bool bValue;
     bool newState = false;
     int switchID = -1;
-    String argToSearchFor[2] = {"Id", "State"};
+    long duration = 0;
+    enum RuleResult interlock = RULE_OK;
+    const __FlashStringHelper* argToSearchFor[3] = {F("Id"), F("State"), F("Duration")};
     
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "SwitchState", Success , "" );    
+    jsonResponseBuilder( root, clientID, transID, F("SwitchState"), Success , "" );    
 
     if( hasArgIC( argToSearchFor[0], server, false ) )
       switchID = server.arg( argToSearchFor[0] ).toInt();
@@ -246,63 +535,91 @@ void handlerSwitchState(void)
     }
  
     DEBUGS1( "SwitchID:"); DEBUGSL1( switchID); 
-    if ( switchID >= 0 && switchID < numSwitches )
+    if ( switchID >= 0 && switchID < dev->numSwitches )
     {
       if( server.method() == HTTP_GET  )
       {
-        switch ( switchEntry[switchID]->type ) 
+        if( switchIsBoolean( deviceSwitch(switchID)->type ) )
         {
-          case SWITCH_RELAY_NO:
-          case SWITCH_RELAY_NC:
-            switchValue = switchEntry[switchID]->value;
-            if ( switchValue != 1.0F ) 
-              bValue = false;
-            else 
-              bValue = true;      
+            bValue = switchOn( deviceSwitch(switchID) );
             root["Value"] =  bValue;  
+            if( switchCan( deviceSwitch(switchID)->type, OP_STATE ) )
+              root["Applied"] = expanderPinApplied( dev->firstSwitch + switchID );
+            switchTimerStatus( dev->firstSwitch + switchID, root );
             returnCode = 200;
-            break;
-          case SWITCH_PWM:
-          case SWITCH_ANALG_DAC:
-          default:
+        }
+        else
+        {
             returnCode = 400;
-            root["ErrorMessage"] = "Invalid state retrieval for switch type - not boolean"  ;
+            root["ErrorMessage"] = F("Invalid state retrieval for switch type - not boolean")  ;
             root["ErrorNumber"] = invalidValue ;
-          break;
         }
       }
       else if (server.method() == HTTP_PUT && hasArgIC( argToSearchFor[1], server, false ) )
       {
-        switch( switchEntry[switchID]->type )
+        if( switchCan( deviceSwitch(switchID)->type, OP_STATE ) )
         {
-          case SWITCH_RELAY_NO:
-          case SWITCH_RELAY_NC:
               DEBUGSL1( "Found relay to set");
               if( server.arg( argToSearchFor[1] ).equalsIgnoreCase( "true" ) )
                 newState = true;
               else
                 newState = false;
-              switchDevice.write( switchID, (newState) ? 1 : 0 );
-              switchEntry[switchID]->value = (newState)? 1.0F : 0.0F;
-              returnCode = 200;              
-            break;
-          case SWITCH_PWM:
-          case SWITCH_ANALG_DAC:
-          default:
+              //Optional Duration in msecs turns the relay off again on its own
+              if( hasArgIC( argToSearchFor[2], server, false ) )
+                duration = server.arg( argToSearchFor[2] ).toInt();
+              
+              if( duration < 0 || duration > SWITCH_TIMER_MAX )
+              {
+                returnCode = 400;
+                root["ErrorMessage"] = F("Invalid Duration - 0 to 86400000 msecs");
+                root["ErrorNumber"] = invalidValue ;
+              }
+              else if( ( interlock = ruleCheck( dev->firstSwitch + switchID, newState ) ) != RULE_OK )
+              {
+                returnCode = 400;
+                root["ErrorMessage"] = flashTableEntry( ruleResultText, interlock );
+                root["ErrorNumber"] = invalidOperation ;
+              }
+              else
+              {
+                cancelSwitchTimer( dev->firstSwitch + switchID );
+                if( newState && duration > 0 && !startSwitchTimer( dev->firstSwitch + switchID, TIMER_AUTO_OFF, (uint32_t) duration, 0, 1 ) )
+                {
+                  returnCode = 400;
+                  root["ErrorMessage"] = F("Unable to start timer for this switch");
+                  root["ErrorNumber"] = invalidOperation ;
+                }
+                else
+                {
+                  if( !( newState && duration > 0 ) )
+                    setRelayState( dev->firstSwitch + switchID, newState );
+                  //The change is queued for the i2c task - Applied shows whether the expander has it yet
+                  root["Applied"] = expanderPinApplied( dev->firstSwitch + switchID );
+                  returnCode = 200;              
+                }
+              }
+        }
+        else if( switchIsBoolean( deviceSwitch(switchID)->type ) )
+        {
+            returnCode = 400;
+            root["ErrorMessage"] = F("Switch is a read-only input")  ;
+            root["ErrorNumber"] = invalidOperation ;
+        }
+        else
+        {
             returnCode = 400;
-            root["ErrorMessage"] = "Invalid state for non-boolean switch type"  ;
+            root["ErrorMessage"] = F("Invalid state for non-boolean switch type")  ;
             root["ErrorNumber"] = invalidOperation ;
-            break;
         }
       } 
       else
       {
          String output = "";
-         Serial.println( "Error: method not available" );
+         LOGW( "setswitch: method %i not available", server.method() );
          root["ErrorNumber"] = invalidOperation;
-         output = "http verb:";
+         output = F("http verb:");
          output += server.method();
-         output += " not available";
+         output += F(" not available");
          root["ErrorMessage"] = output; 
          returnCode = 400;
       }  
@@ -310,7 +627,7 @@ void handlerSwitchState(void)
     else
     {
         returnCode = 400;
-        root["ErrorMessage"] = "Invalid switch ID as argument";
+        root["ErrorMessage"] = F("Invalid switch ID as argument");
         root["ErrorNumber"] = invalidValue ;
     }
 
@@ -319,6 +636,84 @@ void handlerSwitchState(void)
     return;
 }
 
+//Non-ascom function
+//PUT /switch/{device_number}/setswitchpulse
+//Pulse a relay on for OnTime msecs then off for OffTime msecs, Count times. Count 0 pulses until the switch is next set.
+//OffTime defaults to OnTime and Count to 1. Times are up to SWITCH_TIMER_MAX, a day.
+//The call returns straight away - the timer wheel does the switching.
+void handlerSwitchPulse(void)
+{
+    String message;
+    uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
+    uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
+    int returnCode = 200;
+    int switchID = -1;
+    long onTime = 0;
+    long offTime = 0;
+    int count = 1;
+    enum RuleResult interlock = RULE_OK;
+    const __FlashStringHelper* argToSearchFor[4] = {F("Id"), F("OnTime"), F("OffTime"), F("Count")};
+    
+    DynamicJsonBuffer jsonBuffer(256);
+    JsonObject& root = jsonBuffer.createObject();
+    jsonResponseBuilder( root, clientID, transID, F("SwitchPulse"), Success, "" );    
+
+    if( !hasArgIC( argToSearchFor[0], server, false ) || !hasArgIC( argToSearchFor[1], server, false ) )
+    {
+      returnCode = 400;
+      root["ErrorMessage"] = F("Missing argument - Id and OnTime are required");
+      root["ErrorNumber"] = invalidOperation ;
+    }
+    else
+    {
+      switchID = server.arg( argToSearchFor[0] ).toInt();
+      onTime = server.arg( argToSearchFor[1] ).toInt();
+      offTime = onTime;
+      if( hasArgIC( argToSearchFor[2], server, false ) )
+        offTime = server.arg( argToSearchFor[2] ).toInt();
+      if( hasArgIC( argToSearchFor[3], server, false ) )
+        count = server.arg( argToSearchFor[3] ).toInt();
+      
+      if( switchID < 0 || switchID >= dev->numSwitches )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Invalid switch ID as argument");
+        root["ErrorNumber"] = invalidValue ;
+      }
+      else if( !switchCan( deviceSwitch(switchID)->type, OP_PULSE ) )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Pulse is only available for relay switch types");
+        root["ErrorNumber"] = invalidOperation ;
+      }
+      else if( onTime <= 0 || onTime > SWITCH_TIMER_MAX || offTime < 0 || offTime > SWITCH_TIMER_MAX ||
+               count < 0 || count > 65535 || ( count != 1 && offTime == 0 ) )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Invalid OnTime, OffTime or Count");
+        root["ErrorNumber"] = invalidValue ;
+      }
+      else if( ( interlock = ruleCheck( dev->firstSwitch + switchID, true ) ) != RULE_OK )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = flashTableEntry( ruleResultText, interlock );
+        root["ErrorNumber"] = invalidOperation ;
+      }
+      else if( !startSwitchTimer( dev->firstSwitch + switchID, TIMER_PULSE, (uint32_t) onTime, (uint32_t) offTime, (uint16_t) count ) )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Unable to start timer for this switch");
+        root["ErrorNumber"] = invalidOperation ;
+      }
+      else
+        switchTimerStatus( dev->firstSwitch + switchID, root );
+    }
+    
+    root.printTo(message);
+    server.send(returnCode, "text/json", message);
+    return;
+}
+
 //GET ​/switch​/{device_number}​/getswitchdescription
 //Gets the description of the specified switch device
 void handlerSwitchDescription(void)
@@ -327,29 +722,29 @@ void handlerSwitchDescription(void)
     uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
     int returnCode = 200;
-    String argToSearchFor = "Id";
+    const __FlashStringHelper* argToSearchFor = F("Id");
     int switchID = -1;
           
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "SwitchDescription", Success, "" );    
+    jsonResponseBuilder( root, clientID, transID, F("SwitchDescription"), Success, "" );    
 
     if( hasArgIC( argToSearchFor, server, false ) )
     {
       switchID = server.arg( argToSearchFor ).toInt();
-      if( switchID >=0 && switchID < numSwitches )
-          root["Value"] = switchEntry[switchID]->description;
+      if( switchID >=0 && switchID < dev->numSwitches )
+          root["Value"] = deviceSwitch(switchID)->description;
       else
       {
          root["ErrorNumber"] = invalidValue;
-         root["ErrorMessage"] = "Out of range argument: switchID"; 
+         root["ErrorMessage"] = F("Out of range argument: switchID"); 
          returnCode = 400;    
       }
     }  
     else
     {
        root["ErrorNumber"] = invalidOperation;
-       root["ErrorMessage"] = "Missing argument: switchID"; 
+       root["ErrorMessage"] = F("Missing argument: switchID"); 
        returnCode = 400;    
     }
 
@@ -369,19 +764,19 @@ void handlerSwitchName(void)
     int returnCode = 200;
     int switchID;
     String newName =  "";
-    String argToSearchFor[2] = {"Id", "Name"};
+    const __FlashStringHelper* argToSearchFor[2] = {F("Id"), F("Name")};
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "SwitchName", Success, "" );    
+    jsonResponseBuilder( root, clientID, transID, F("SwitchName"), Success, "" );    
     
     if( hasArgIC( argToSearchFor[0], server, false ) )
     {
       switchID = server.arg(argToSearchFor[0]).toInt();
-      if ( switchID >= 0 && switchID < numSwitches  )
+      if ( switchID >= 0 && switchID < dev->numSwitches  )
       {
         if ( server.method() == HTTP_GET )
         {
-            root["Value"] = switchEntry[switchID]->switchName;
+            root["Value"] = deviceSwitch(switchID)->switchName;
             returnCode = 200;
         }
         else if( server.method() == HTTP_PUT && hasArgIC( argToSearchFor[1], server, false ) )
@@ -389,23 +784,24 @@ void handlerSwitchName(void)
             int sLen = strlen( server.arg( argToSearchFor[1] ).c_str() );
             if ( sLen > MAX_NAME_LENGTH -1 )
             {
-              root["ErrorMessage"]= "Switch name too long";
+              root["ErrorMessage"]= F("Switch name too long");
               root["ErrorNumber"] = invalidValue ;
               returnCode = 400;
             }
             else
             {
-              if ( switchEntry[switchID]->switchName != nullptr ) 
-                free( switchEntry[switchID]->switchName );
-              switchEntry[switchID]->switchName  = (char*) calloc( MAX_NAME_LENGTH, sizeof(char) );
-              strcpy( switchEntry[switchID]->switchName, server.arg( argToSearchFor[1] ).c_str() );
+              if ( deviceSwitch(switchID)->switchName != nullptr ) 
+                free( deviceSwitch(switchID)->switchName );
+              deviceSwitch(switchID)->switchName  = (char*) calloc( MAX_NAME_LENGTH, sizeof(char) );
+              strcpy( deviceSwitch(switchID)->switchName, server.arg( argToSearchFor[1] ).c_str() );
+              markConfigDirty();
             }                    
         }
         else
         {
            //Invalid http verb 
            returnCode = 400;
-           root["ErrorMessage"]= "Invalid HTTP verb found";
+           root["ErrorMessage"]= F("Invalid HTTP verb found");
            root["ErrorNumber"] = invalidOperation;
         }
       }
@@ -413,7 +809,7 @@ void handlerSwitchName(void)
       {
         //invalid switch id 
         returnCode = 400;
-        root["ErrorMessage"]= "Invalid switch ID - outside range";
+        root["ErrorMessage"]= F("Invalid switch ID - outside range");
         root["ErrorNumber"] = invalidValue ;
       }
     }
@@ -421,7 +817,7 @@ void handlerSwitchName(void)
     {
       //invalid switch id 
       returnCode = 400;
-      root["ErrorMessage"]= "Missing switch ID";
+      root["ErrorMessage"]= F("Missing switch ID");
       root["ErrorNumber"] = invalidOperation ;
     }
 
@@ -442,10 +838,10 @@ void handlerSwitchType(void)
     int returnCode = 200;
     int switchID;
     String newName =  "";
-    String argToSearchFor[2] = {"Id", "Name"};
+    const __FlashStringHelper* argToSearchFor[2] = {F("Id"), F("Name")};
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "SwitchType", 0, "" );    
+    jsonResponseBuilder( root, clientID, transID, F("SwitchType"), 0, "" );    
     
     if( hasArgIC( argToSearchFor[0], server, false ) )
     {
@@ -454,49 +850,86 @@ void handlerSwitchType(void)
     else
     {
        returnCode = 400;
-       root["ErrorMessage"]= "Missing switchID argument";
+       root["ErrorMessage"]= F("Missing switchID argument");
        root["ErrorNumber"] = invalidValue ;     
        root.printTo(message);
        server.send(returnCode, "text/json", message);
        return;
     }
      
-    if ( switchID >= 0 && switchID < numSwitches  )
+    if ( switchID >= 0 && switchID < dev->numSwitches  )
     {
       if ( server.method() == HTTP_GET )
       {
-          root["Value"] = switchEntry[switchID]->type;
+          root["Value"] = deviceSwitch(switchID)->type;
       }
       else if( server.method() == HTTP_PUT && hasArgIC( argToSearchFor[1], server, false ) )
       {
-          enum SwitchType newType = ( enum SwitchType ) server.arg(argToSearchFor[1]).toInt();          
-          switch( newType )
+          int newType = server.arg(argToSearchFor[1]).toInt();
+          SwitchEntry* se = deviceSwitch(switchID);
+          if( newType < 0 || newType >= SWITCH_TYPES )
           {
-          case SWITCH_RELAY_NO:
-          case SWITCH_RELAY_NC:
-          case SWITCH_ANALG_DAC:
-          case SWITCH_PWM:
-              switchEntry[switchID]->type = (enum SwitchType) newType;
-              returnCode = 200;
-              break;
-          default:
-              root["ErrorMessage"]= "Invalid switch type not found ";
+              root["ErrorMessage"]= F("Invalid switch type not found ");
+              root["ErrorNumber"] = invalidValue ;
+              returnCode = 400;
+          }
+          else if( switchBackend( (enum SwitchType) newType ) == BACKEND_EXPANDER_IN && dev->firstSwitch + switchID >= EXPANDER_PINS )
+          {
+              root["ErrorMessage"]= F("Only expander pins can be inputs");
+              root["ErrorNumber"] = invalidValue ;
+              returnCode = 400;
+          }
+          else if( switchBackend( (enum SwitchType) newType ) == BACKEND_SENSOR && newType != se->type )
+          {
+              root["ErrorMessage"]= F("A switch becomes a sensor when a power monitor is bound to it - see /sensors");
               root["ErrorNumber"] = invalidValue ;
               returnCode = 400;
-              break;
+          }
+          else
+          {
+              int index = dev->firstSwitch + switchID;
+              bool backendChanged = ( switchBackend( (enum SwitchType) newType ) != switchBackend( se->type ) );
+              cancelSwitchTimer( index );
+              //A sensor switch changed to another type stops reading its power monitor
+              if( newType != se->type )
+                removeSensor( sensorFind( index ) );
+              //A switch moved to another backend starts off - the old output is turned off first
+              if( backendChanged )
+              {
+                se->level = se->rampTarget = 0;
+                writeAnalogue( index );
+              }
+              //Moving between boolean and analogue types starts from the new type's default range
+              if( switchIsBoolean( (enum SwitchType) newType ) != switchIsBoolean( se->type ) )
+              {
+                se->level = se->rampTarget = 0;
+                switchSetRange( se, 0.0F, switchTraits[newType].defaultMax, 1.0F );
+              }
+              se->type = (enum SwitchType) newType;
+              se->writeable = ( switchTraits[newType].ops != 0 );
+              if( backendChanged )
+              {
+                //The pin follows - a relay is driven off, anything else left high as restoreOutputs() leaves it
+                expanderQueuePin( index, switchBackend( se->type ) != BACKEND_EXPANDER_OUT );
+                ruleNoteState( index, false );
+                markRelayDirty();
+              }
+              inputRefreshMask();
+              markConfigDirty();
+              returnCode = 200;
           }
       }
       else
       {
          returnCode = 400;
-         root["ErrorMessage"]= "Invalid HTTP verb or arguments found";
+         root["ErrorMessage"]= F("Invalid HTTP verb or arguments found");
          root["ErrorNumber"] = invalidOperation ;
       }
     }
     else
     {
        returnCode = 400;
-       root["ErrorMessage"]= "Argument switchID out of range";
+       root["ErrorMessage"]= F("Argument switchID out of range");
        root["ErrorNumber"] = invalidValue ;
     }
     root.printTo(message);
@@ -513,13 +946,14 @@ void handlerSwitchValue(void)
     uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
     int returnCode = 200;
-    float value = 0.0F;
+    double value = 0.0;
+    SwitchLevel level;
     uint32_t switchID = 0;
-    String argToSearchFor[2] = {"Id", "Value"};
+    const __FlashStringHelper* argToSearchFor[2] = {F("Id"), F("Value")};
     
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "SwitchValue", 0, "" );    
+    jsonResponseBuilder( root, clientID, transID, F("SwitchValue"), 0, "" );    
     
     if ( hasArgIC( argToSearchFor[0], server, false ) )
     {
@@ -527,7 +961,7 @@ void handlerSwitchValue(void)
     }
     else
     {
-      root["ErrorMessage"] = "Missing argument - switchID ";
+      root["ErrorMessage"] = F("Missing argument - switchID ");
       root["ErrorNumber"] = invalidValue ;
       returnCode = 400;      
       root.printTo(message);
@@ -535,76 +969,63 @@ void handlerSwitchValue(void)
       return;      
     }
       
-    if ( switchID >= 0 && switchID < (uint32_t) numSwitches )
+    if ( switchID >= 0 && switchID < (uint32_t) dev->numSwitches )
     {
         if( server.method() == HTTP_GET )
         {
-          switch( switchEntry[switchID]->type )
+          if( !switchIsBoolean( deviceSwitch(switchID)->type ) )
           {
-            case SWITCH_PWM: 
-            case SWITCH_ANALG_DAC:
-                  //e.g. analogue_write( 256, 15);
-            //Not supported yet - need to be able to add pin mapping to this & requires
-            //More pins than a simple ESP8266 & PCF8574A combo
-                    root["Value"] = switchEntry[switchID]->value;
-                  returnCode = 200;
-                  break;                
-            case SWITCH_RELAY_NO:
-            case SWITCH_RELAY_NC:
-                  returnCode = 400;
-                  root["ErrorMessage"] = "Invalid analogue operation for binary/boolean switch type";
-                  root["ErrorNumber"] = invalidOperation ;
-                  break;
-            default:
-              break;           
+            root["Value"] = switchValue( deviceSwitch(switchID), deviceSwitch(switchID)->level );
+            returnCode = 200;
+          }
+          else
+          {
+            returnCode = 400;
+            root["ErrorMessage"] = F("Invalid analogue operation for binary/boolean switch type");
+            root["ErrorNumber"] = invalidOperation ;
           }
         }
         else if( server.method() == HTTP_PUT && hasArgIC( argToSearchFor[1], server, false ) )
         {
-          value = (float) server.arg( argToSearchFor[1] ).toDouble();
-          switch( switchEntry[switchID]->type ) 
+          value = server.arg( argToSearchFor[1] ).toDouble();
+          if( switchCan( deviceSwitch(switchID)->type, OP_VALUE ) )
           {
-            case SWITCH_PWM: 
-            //Not supported yet - need to be able to add pin mapping to this & requires
-            //More pins than a simple ESP8266 & PCF8574A combo
-                  if ( value >= switchEntry[switchID]->min && 
-                       value <= switchEntry[switchID]->max )
-                  {
-                    switchEntry[switchID]->value = value;
-                    //e.g. analogue_write( switchEntry[switchID]->pin, switchEntry[switchID]->pin );
-                  }
-                  returnCode = 200;
-                  break;
-                  
-            case SWITCH_RELAY_NO:
-            case SWITCH_RELAY_NC:
-                  returnCode = 400;
-                  root["ErrorMessage"] = "Invalid analogue operation for binary/boolean switch type";
-                  root["ErrorNumber"] = invalidOperation ;
-                  break;
-            case SWITCH_ANALG_DAC:
-                  if ( value >= switchEntry[switchID]->min && 
-                       value <= switchEntry[switchID]->max )
-                  {
-                    switchEntry[switchID]->value = value;
-                    //e.g. analogue_write( switchEntry[switchID]->pin, switchEntry[switchID]->pin );
-                  }
-                  returnCode = 200;
-                  break;
-            default:
-              break;
+            //PWM output is on the ESP pin given by 'pin' - the ramp task moves the output to the new value
+            if( switchLevel( deviceSwitch(switchID), value, level ) )
+            {
+              deviceSwitch(switchID)->rampTarget = level;
+              returnCode = 200;
+            }
+            else
+            {
+              returnCode = 400;
+              root["ErrorMessage"] = F("Value outside the switch's range");
+              root["ErrorNumber"] = invalidValue ;
+            }
+          }
+          else if( switchCan( deviceSwitch(switchID)->type, OP_STATE ) )
+          {
+            returnCode = 400;
+            root["ErrorMessage"] = F("Invalid analogue operation for binary/boolean switch type");
+            root["ErrorNumber"] = invalidOperation ;
+          }
+          else
+          {
+            returnCode = 400;
+            root["ErrorMessage"] = F("Switch is read-only");
+            root["ErrorNumber"] = invalidOperation ;
           }
         }
         else
         {
            returnCode = 400;
-           root["ErrorMessage"] = "Invalid HTTP verb method for this URI or missing output value";
+           root["ErrorMessage"] = F("Invalid HTTP verb method for this URI or missing output value");
            root["ErrorNumber"] = invalidOperation ;
         }
     }
     else
     {
-      root["ErrorMessage"] = "SwitchID value out of range.";
+      root["ErrorMessage"] = F("SwitchID value out of range.");
       root["ErrorNumber"] = invalidValue ;
       returnCode = 400;
     }            
@@ -623,27 +1044,27 @@ void handlerMinSwitchValue(void)
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
     int returnCode = 200;
     int switchID  = -1;
-    String argToSearchFor = "id";
+    const __FlashStringHelper* argToSearchFor = F("id");
     
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "MinSwitchValue", Success, "" );    
+    jsonResponseBuilder( root, clientID, transID, F("MinSwitchValue"), Success, "" );    
     
     if ( hasArgIC( argToSearchFor, server, false  ) )
     {
       switchID = server.arg( argToSearchFor ).toInt();
-      if( switchID >= 0 && switchID < numSwitches )
-        root.set("Value", switchEntry[switchID]->min );
+      if( switchID >= 0 && switchID < dev->numSwitches )
+        root.set("Value", deviceSwitch(switchID)->min );
       else
       {
-        root["ErrorMessage"] = "SwitchID value out of range.";
+        root["ErrorMessage"] = F("SwitchID value out of range.");
         root["ErrorNumber"] = invalidValue ;
         returnCode = 400;        
       }
     }
     else
     {
-      root["ErrorMessage"] = "SwitchID argument missing .";
+      root["ErrorMessage"] = F("SwitchID argument missing .");
       root["ErrorNumber"] = invalidOperation ;
       returnCode = 400;
     }
@@ -661,30 +1082,30 @@ void handlerMaxSwitchValue(void)
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
     int returnCode = 200;
     int switchID  = -1;
-    String argToSearchFor = "Id";
+    const __FlashStringHelper* argToSearchFor = F("Id");
     
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "MaxSwitchValue", 0, "" );    
+    jsonResponseBuilder( root, clientID, transID, F("MaxSwitchValue"), 0, "" );    
 
     if ( hasArgIC(argToSearchFor, server, false ) )
     {
       switchID = server.arg(argToSearchFor).toInt();
-      if ( switchID >= 0 && switchID < numSwitches )
+      if ( switchID >= 0 && switchID < dev->numSwitches )
       {
-        root["value"] = (double) switchEntry[switchID]->max;
+        root["value"] = (double) deviceSwitch(switchID)->max;
         returnCode = 200;
       }
       else
       {
-        root["ErrorMessage"] = "SwitchID value out of range.";
+        root["ErrorMessage"] = F("SwitchID value out of range.");
         root["ErrorNumber"] = invalidValue ;
         returnCode = 400;              
       }
     }
     else
     {
-       root["ErrorMessage"] = "Missing switchID argument.";
+       root["ErrorMessage"] = F("Missing switchID argument.");
        root["ErrorNumber"] = invalidOperation  ;
        returnCode = 400;
     }
@@ -702,30 +1123,30 @@ void handlerSwitchStep(void)
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
     uint32_t switchID = -1;
     int returnCode = 200;
-    String argToSearchFor = "Id";
+    const __FlashStringHelper* argToSearchFor = F("Id");
     
     DynamicJsonBuffer jsonBuffer(256);
     JsonObject& root = jsonBuffer.createObject();
-    jsonResponseBuilder( root, clientID, transID, "SwitchStep", 0, "" );    
+    jsonResponseBuilder( root, clientID, transID, F("SwitchStep"), 0, "" );    
 
     if ( hasArgIC(argToSearchFor, server, false ) )
     {
       switchID = server.arg(argToSearchFor).toInt();
-      if( switchID >= 0 && switchID < (uint32_t) numSwitches ) 
+      if( switchID >= 0 && switchID < (uint32_t) dev->numSwitches ) 
       {
-        root["value"] = switchEntry[switchID]->step;
+        root["value"] = deviceSwitch(switchID)->step;
         returnCode = 200;
       }
       else
       {
-         root["ErrorMessage"] = "SwitchID out of range.";
+         root["ErrorMessage"] = F("SwitchID out of range.");
          root["ErrorNumber"] = invalidValue ;
          returnCode = 400;
       }
     }
     else
     {
-       root["ErrorMessage"] = "Missing switchID argument.";
+       root["ErrorMessage"] = F("Missing switchID argument.");
        root["ErrorNumber"] = invalidOperation ;
        returnCode = 400;    
     }
@@ -745,7 +1166,7 @@ void handlerNotFound()
   uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
   DynamicJsonBuffer jsonBuffer(250);
   JsonObject& root = jsonBuffer.createObject();
-  jsonResponseBuilder( root, clientID, transID, "HandlerNotFound", invalidOperation , "No REST handler found for argument - check ASCOM Switch v2 specification" );    
+  jsonResponseBuilder( root, clientID, transID, F("HandlerNotFound"), invalidOperation , F("No REST handler found for argument - check ASCOM Switch v2 specification") );    
   root["Value"] = 0;
   root.printTo(message);
   server.send(responseCode, "text/json", message);
@@ -760,7 +1181,7 @@ void handlerNotImplemented()
 
   DynamicJsonBuffer jsonBuffer(250);
   JsonObject& root = jsonBuffer.createObject();
-  jsonResponseBuilder( root, clientID, transID, "HandlerNotFound", notImplemented  , "No REST handler implemented for argument - check ASCOM Dome v2 specification" );    
+  jsonResponseBuilder( root, clientID, transID, F("HandlerNotFound"), notImplemented  , F("No REST handler implemented for argument - check ASCOM Dome v2 specification") );    
   root["Value"] = 0;
   root.printTo(message);
   server.send(responseCode, "text/json", message);
@@ -779,104 +1200,1298 @@ void handlerStatus(void)
     DynamicJsonBuffer jsonBuffer(512);
     JsonObject& root = jsonBuffer.createObject();
     JsonArray& entries = root.createNestedArray( "switches" );
-    jsonResponseBuilder( root, clientID, transID, "Status", 0, "" );    
+    jsonResponseBuilder( root, clientID, transID, F("Status"), 0, "" );    
     
     root["time"] = getTimeAsString( timeString );
     root["host"] = myHostname;
+    if( dev != &hostDevice )
+      root["device"] = deviceNumber;
+    
+    JsonObject& i2c = root.createNestedObject( "i2c" );
+    i2c["present"]    = switchPresent;
+    i2c["clock"]      = i2cClock;
+    i2c["errors"]     = i2cErrors;
+    i2c["retries"]    = i2cRetries;
+    i2c["failures"]   = i2cFailures;
+    i2c["recoveries"] = i2cRecoveries;
+    i2c["pending"]    = expanderDirty;
+
+    JsonObject& network = root.createNestedObject( "network" );
+    network["wifi"]          = ( wifiState == WIFI_UP );
+    network["outages"]       = wifiOutages;
+    network["lastOutage"]    = wifiLastOutage;
+    network["restartWindow"] = wifiRestartWindow;
+    network["mqtt"]          = client.connected();
+    network["mqttOutages"]   = mqttOutages;
+    network["backlog"]       = backlogCount;
+    network["fastPort"]      = ( fastEnabled() ) ? fastPort : 0;
+
+    JsonObject& update = root.createNestedObject( "update" );
+    update["state"]      = flashTableEntry( otaStateNames, otaState );
+    update["written"]    = otaWritten;
+    update["size"]       = otaSize;
+    update["error"]      = otaError;
+    update["trial"]      = ( otaRtc.trial == OTA_TRIAL_RUNNING );
+    update["rollback"]   = ( otaRtc.trial == OTA_TRIAL_ROLLBACK );
+    update["trialBoots"] = ( otaRtc.trial != OTA_TRIAL_NONE ) ? otaRtc.boots : 0;
     
-    for( i = 0; i < numSwitches; i++ )
+    for( i = dev->firstSwitch; i < dev->firstSwitch + dev->numSwitches; i++ )
     {
       //Can I re-use a single object or do I need to create a new one each time? 
       JsonObject& entry = jsonBuffer.createObject();
+      entry["id"]          = i - dev->firstSwitch;
       entry["description"] = switchEntry[i]->description;
       entry["name"]        = switchEntry[i]->switchName;
       entry["type"]        = (int) switchEntry[i]->type;      
+      entry["typeName"]    = flashTableEntry( switchTypes, switchEntry[i]->type );
       entry["pin"]         = (int) switchEntry[i]->pin;      
       entry.set("writeable", switchEntry[i]->writeable );
       entry["min"]         = switchEntry[i]->min;
       entry["max"]         = switchEntry[i]->max;
       entry["step"]        = switchEntry[i]->step;
-      if( switchEntry[i]->type == SWITCH_RELAY_NO || switchEntry[i]->type == SWITCH_RELAY_NC )
+      if( switchCan( switchEntry[i]->type, OP_STATE ) )
       {
-        entry["state"]     = (switchEntry[i]->value == 1.0F ) ? true : false ;
+        entry["state"]     = switchOn( switchEntry[i] );
+        entry["applied"]   = expanderPinApplied( i );
+        switchTimerStatus( i, entry );
+      }
+      else if( switchIsBoolean( switchEntry[i]->type ) )
+      {
+        entry["state"]     = switchOn( switchEntry[i] );
+        if( i < EXPANDER_PINS )
+        {
+          entry["changes"] = inputChanges[i];
+          entry["edges"]   = inputEdges[i];
+        }
       }
       else 
-        entry["value"]     = switchEntry[i]->value; //Needs check limits to 1-1024, DAC and PWM limits. 
+        entry["value"]     = switchValue( switchEntry[i], switchEntry[i]->level );
+      if( switchBackend( switchEntry[i]->type ) == BACKEND_SENSOR && sensorFind( i ) >= 0 )
+      {
+        entry["sampleMin"] = sensorFilter[ sensorFind( i ) ].min;
+        entry["sampleMax"] = sensorFilter[ sensorFind( i ) ].max;
+      }
+      if( i < MAX_WEAR_SWITCHES )
+      {
+        wearSync( i, switchEntry[i]->maxLevel );
+        entry["actuations"] = wear[i].actuations;
+        entry[ ( switchIsBoolean( switchEntry[i]->type ) ) ? "onTime" : "dutySeconds" ] = wear[i].onSeconds;
+        entry["lastChange"] = wear[i].lastChange;
+      }
       entries.add( entry );
     }
-    Serial.println( message);
     root.prettyPrintTo(message);
     server.send(returnCode, "text/json", message);
     return;
 }
 
-/*
- * Handler to do custom setup that can't be done without a windows ascom driver setup form. 
- */
- void handlerSetup(void) 
- {
-    String message, timeString, err= "";
+//GET /status
+//Host level status - lists the switches of every device number served by this host
+void handlerHostStatus(void)
+{
+    hostDevice.numSwitches = numSwitches;
+    dev = &hostDevice;
+    handlerStatus();
+}
+
+//GET /switch/{device_number}/trace
+//Returns the most recent requests from the trace ring buffer, oldest first. Optional argument Count limits the number returned.
+//The response is sent in chunks so the whole buffer never has to be held as one string.
+void handlerTrace(void)
+{
+    String message;
     uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
     uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
-    uint32_t switchID = -1;
+    const __FlashStringHelper* argToSearchFor = F("Count");
+    int count = ( traceCount < TRACE_BUFFER_SIZE ) ? traceCount : TRACE_BUFFER_SIZE;
+    int i, index;
     
-    int returnCode = 400;
-    String argToSearchFor[] = { "hostname", "numSwitches"};
-     
-    if ( server.method() == HTTP_GET )
+    if( hasArgIC( argToSearchFor, server, false ) )
     {
-        message = setupFormBuilder( message, err );      
-        returnCode = 200;    
+      int requested = server.arg( argToSearchFor ).toInt();
+      if( requested >= 0 && requested < count )
+        count = requested;
     }
-    else if ( server.method() == HTTP_POST || server.method() == HTTP_PUT )
-    {
-        if( hasArgIC( argToSearchFor[0], server, false )  )
-        {
-          String newHostname = server.arg(argToSearchFor[0]) ;
-          //process form variables.
-          if( newHostname.length() > 0 && newHostname.length() < MAX_NAME_LENGTH-1 )
-          {
-            //process new hostname
-            strncpy( myHostname, newHostname.c_str(), MAX_NAME_LENGTH );
-          }
+    
+    message.reserve( 1024 );
+    message = F("{\"ClientTransactionID\":");
+    message += transID;
+    message += F(",\"ClientID\":");
+    message += clientID;
+    message += F(",\"ServerTransactionID\":");
+    message += transactionId;
+    message += F(",\"ErrorNumber\":0,\"ErrorMessage\":\"\",\"Value\":[");
+    
+    server.setContentLength( CONTENT_LENGTH_UNKNOWN );
+    server.send( 200, "application/json", "" );
 
-          message = setupFormBuilder( message, err );      
-          returnCode = 200;    
-          saveToEeprom();
-          server.send(returnCode, "text/html", message);
-          device.reset();
-        }
-        else if( hasArgIC( argToSearchFor[1], server, false ) )
-        {
-          int newNumSwitches = server.arg(argToSearchFor[1]).toInt();
-          if( newNumSwitches >= 0 && newNumSwitches <=16 )
-          {
-            //update the switches
-            ;;
-          err = "Switch resizing not yet ready";
-          message = setupFormBuilder( message, err );      
-          returnCode = 200;    
-          }
-        }
-    }
-    else
+    index = ( traceHead + TRACE_BUFFER_SIZE - count ) % TRACE_BUFFER_SIZE;
+    for( i = 0; i < count; i++ )
     {
-      err = "Bad HTTP request verb";
-      message = setupFormBuilder( message, err );      
+      TraceEntry* entry = &traceBuffer[index];
+      if( i > 0 )
+        message += ',';
+      message += F("{\"ServerTransactionID\":");
+      message += entry->serverTransID;
+      message += F(",\"ClientID\":");
+      message += entry->clientID;
+      message += F(",\"Method\":\"");
+      message += traceMethodName( entry->method );
+      message += F("\",\"Id\":");
+      message += (int) entry->switchID;
+      message += F(",\"Latency\":");
+      message += entry->latency;
+      message += F(",\"Result\":");
+      message += (int) entry->result;
+      message += '}';
+      index = ( index + 1 ) % TRACE_BUFFER_SIZE;
+      
+      if( message.length() > 900 )
+      {
+        server.sendContent( message );
+        message = "";
+      }
     }
-    server.send(returnCode, "text/html", message);
+    message += F("]}");
+    server.sendContent( message );
+    server.sendContent( "" );
     return;
- }
+}
 
- void handlerSetupSwitches(void) 
- {
-    String message, timeString, err= "";
-    uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
-    uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
-    uint32_t switchID = -1;
+//GET /metrics
+//Run time metrics in Prometheus text format - latency histograms in usecs, heap and session figures.
+void handlerMetrics(void)
+{
+    String message;
+    char label[40];
+    
+    message.reserve( 1024 );
+    server.setContentLength( CONTENT_LENGTH_UNKNOWN );
+    server.send( 200, "text/plain; version=0.0.4", "" );
+
+    message  = F("# TYPE alpaca_request_duration_us histogram\n");
+    for( int i = 0; i < MAX_ROUTE_HISTOGRAMS; i++ )
+    {
+      if( routeHist[i].count == 0 )
+        continue;
+      snprintf_P( label, sizeof( label ), PSTR( "method=\"%s\"" ), traceMethodName( i ) );
+      metricsHistogramText( message, "alpaca_request_duration_us", label, &routeHist[i] );
+      if( message.length() > 700 )
+      {
+        server.sendContent( message );
+        message = "";
+      }
+    }
+    message += F("# TYPE i2c_write_duration_us histogram\n");
+    metricsHistogramText( message, "i2c_write_duration_us", nullptr, &i2cWriteHist );
+    message += F("# TYPE i2c_read_duration_us histogram\n");
+    metricsHistogramText( message, "i2c_read_duration_us", nullptr, &i2cReadHist );
+    server.sendContent( message );
+    
+    message  = F("# TYPE eeprom_commit_duration_us histogram\n");
+    metricsHistogramText( message, "eeprom_commit_duration_us", nullptr, &eepromCommitHist );
+    message += F("# TYPE mqtt_publish_duration_us histogram\n");
+    metricsHistogramText( message, "mqtt_publish_duration_us", nullptr, &mqttPublishHist );
+    message += F("# TYPE loop_duration_us histogram\n");
+    metricsHistogramText( message, "loop_duration_us", nullptr, &loopHist );
+    message += F("# TYPE fast_udp_duration_us histogram\n");
+    metricsHistogramText( message, "fast_udp_duration_us", nullptr, &fastUdpHist );
+    server.sendContent( message );
+
+    message  = F("# TYPE loop_duration_max_us gauge\nloop_duration_max_us ");
+    message += loopHist.max;
+    message += F("\n# TYPE heap_free_bytes gauge\nheap_free_bytes ");
+    message += ESP.getFreeHeap();
+    message += F("\n# TYPE heap_low_water_bytes gauge\nheap_low_water_bytes ");
+    message += heapLowWater;
+    message += F("\n# TYPE heap_after_setup_bytes gauge\nheap_after_setup_bytes ");
+    message += heapAfterSetup;
+    message += F("\n# TYPE heap_fragmentation_percent gauge\nheap_fragmentation_percent ");
+    message += ESP.getHeapFragmentation();
+    message += F("\n# TYPE heap_max_block_bytes gauge\nheap_max_block_bytes ");
+    message += ESP.getMaxFreeBlockSize();
+    message += F("\n# TYPE i2c_clock_hz gauge\ni2c_clock_hz ");
+    message += i2cClock;
+    message += F("\n# TYPE i2c_errors_total counter\ni2c_errors_total ");
+    message += i2cErrors;
+    message += F("\n# TYPE i2c_retries_total counter\ni2c_retries_total ");
+    message += i2cRetries;
+    message += F("\n# TYPE i2c_failures_total counter\ni2c_failures_total ");
+    message += i2cFailures;
+    message += F("\n# TYPE i2c_recoveries_total counter\ni2c_recoveries_total ");
+    message += i2cRecoveries;
+    message += F("\n# TYPE i2c_fallbacks_total counter\ni2c_fallbacks_total ");
+    message += i2cFallbacks;
+    message += F("\n# TYPE expander_changes_queued_total counter\nexpander_changes_queued_total ");
+    message += expanderQueued;
+    message += F("\n# TYPE expander_writes_total counter\nexpander_writes_total ");
+    message += expanderWrites;
+    message += F("\n# TYPE http_requests_total counter\nhttp_requests_total ");
+    message += server.requests;
+    message += F("\n# TYPE http_refused_total counter\nhttp_refused_total ");
+    message += server.refused;
+    message += F("\n# TYPE http_timeouts_total counter\nhttp_timeouts_total ");
+    message += server.timeouts;
+    message += F("\n# TYPE http_bad_requests_total counter\nhttp_bad_requests_total ");
+    message += server.badRequests;
+    message += F("\n# TYPE http_connections gauge\nhttp_connections ");
+    message += server.activeConnections();
+    message += F("\n# TYPE log_lines_total counter\nlog_lines_total ");
+    message += logLines;
+    message += F("\n# TYPE log_dropped_total counter\nlog_dropped_total ");
+    message += logDropped;
+    message += F("\n# TYPE log_syslog_sent_total counter\nlog_syslog_sent_total ");
+    message += logSyslogSent;
+    message += F("\n# TYPE ota_updates_total counter\nota_updates_total ");
+    message += otaUpdates;
+    message += F("\n# TYPE ota_failures_total counter\nota_failures_total ");
+    message += otaFailures;
+    message += F("\n# TYPE fast_udp_frames_total counter\nfast_udp_frames_total ");
+    message += fastFrames;
+    message += F("\n# TYPE fast_udp_bad_frames_total counter\nfast_udp_bad_frames_total ");
+    message += fastBadFrames;
+    message += F("\n# TYPE fast_udp_auth_failures_total counter\nfast_udp_auth_failures_total ");
+    message += fastAuthFailures;
+    message += F("\n# TYPE fast_udp_stale_total counter\nfast_udp_stale_total ");
+    message += fastStale;
+    message += F("\n# TYPE alpaca_transactions_total counter\nalpaca_transactions_total ");
+    message += transactionId;
+    message += F("\n# TYPE alpaca_sessions gauge\n");
+    for( int i = 0; i < numDevices; i++ )
+    {
+      message += F("alpaca_sessions{device=\"");
+      message += i;
+      message += F("\"} ");
+      message += countSessions( i );
+      message += '\n';
+    }
+    server.sendContent( message );
+
+    message  = F("# TYPE task_runs_total counter\n# TYPE task_time_us_total counter\n# TYPE task_max_us gauge\n");
+    message += F("# TYPE task_overruns_total counter\n# TYPE task_late_total counter\n");
+    for( int i = 0; i < numTasks; i++ )
+    {
+      snprintf_P( label, sizeof( label ), PSTR( "{task=\"%s\"} " ), task[i].name );
+      message += F("task_runs_total");
+      message += label;
+      message += task[i].runs;
+      message += F("\ntask_time_us_total");
+      message += label;
+      metricsAppendU64( message, task[i].totalTime );
+      message += F("\ntask_max_us");
+      message += label;
+      message += task[i].maxTime;
+      message += F("\ntask_overruns_total");
+      message += label;
+      message += task[i].overruns;
+      message += F("\ntask_late_total");
+      message += label;
+      message += task[i].late;
+      message += '\n';
+    }
+    message += F("# TYPE wifi_connected gauge\nwifi_connected ");
+    message += ( wifiState == WIFI_UP ) ? 1 : 0;
+    message += F("\n# TYPE wifi_outages_total counter\nwifi_outages_total ");
+    message += wifiOutages;
+    message += F("\n# TYPE wifi_outage_ms_total counter\nwifi_outage_ms_total ");
+    message += wifiOutageTime;
+    message += F("\n# TYPE mqtt_outages_total counter\nmqtt_outages_total ");
+    message += mqttOutages;
+    message += F("\n# TYPE mqtt_backlog gauge\nmqtt_backlog ");
+    message += backlogCount;
+    message += F("\n# TYPE mqtt_backlog_dropped_total counter\nmqtt_backlog_dropped_total ");
+    message += backlogDropped;
+    message += F("\n# TYPE mqtt_replayed_total counter\nmqtt_replayed_total ");
+    message += backlogReplayed;
+    message += '\n';
+    message += F("# TYPE scenes_applied_total counter\nscenes_applied_total ");
+    message += scenesApplied;
+    message += F("\n# TYPE schedule_fired_total counter\nschedule_fired_total ");
+    message += scheduleFired;
+    message += '\n';
+    message += F("# TYPE switch_actuations_total counter\n# TYPE switch_on_seconds_total counter\n");
+    for( int i = 0; i < numSwitches && i < MAX_WEAR_SWITCHES; i++ )
+    {
+      wearSync( i, switchEntry[i]->maxLevel );
+      snprintf_P( label, sizeof( label ), PSTR( "{switch=\"%d\"} " ), i );
+      message += F("switch_actuations_total");
+      message += label;
+      message += wear[i].actuations;
+      message += F("\nswitch_on_seconds_total");
+      message += label;
+      message += wear[i].onSeconds;
+      message += '\n';
+    }
+    message += F("# TYPE sensor_average gauge\n# TYPE sensor_reads_total counter\n# TYPE sensor_errors_total counter\n");
+    for( int i = 0; i < numSensors; i++ )
+    {
+      snprintf_P( label, sizeof( label ), PSTR( "{switch=\"%d\"} " ), sensor[i].target );
+      message += F("sensor_average");
+      message += label;
+      message += sensorAverage( sensorFilter[i] );
+      message += F("\nsensor_reads_total");
+      message += label;
+      message += sensorFilter[i].reads;
+      message += F("\nsensor_errors_total");
+      message += label;
+      message += sensorFilter[i].errors;
+      message += '\n';
+    }
+    message += F("# TYPE boot_stage_ms gauge\n");
+    for( int i = 0; i < BOOT_STAGES; i++ )
+    {
+      if( bootStageTime[i] == 0 )
+        continue;
+      message += F("boot_stage_ms{stage=\"");
+      message += flashTableEntry( bootStageNames, i );
+      message += F("\"} ");
+      message += bootStageTime[i];
+      message += '\n';
+    }
+    message += F("# TYPE uptime_seconds counter\nuptime_seconds ");
+    message += millis() / 1000;
+    message += '\n';
+    server.sendContent( message );
+    server.sendContent( "" );
+    return;
+}
+
+//GET /rules
+//PUT /rules
+//DELETE /rules
+//List, add or remove interlock rules. Switch numbers are host switch indexes as listed by /status.
+//PUT takes Type (exclusive, requires or delayafter), Switch, Other and for delayafter Delay in msecs. 
+//DELETE takes Index, the position of the rule in the list. Changes are saved to EEPROM shortly afterwards.
+void handlerRules(void)
+{
+    String message;
+    uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
+    uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
+    int returnCode = 200;
+    const __FlashStringHelper* argToSearchFor[5] = {F("Type"), F("Switch"), F("Other"), F("Delay"), F("Index")};
+    
+    DynamicJsonBuffer jsonBuffer(512);
+    JsonObject& root = jsonBuffer.createObject();
+    jsonResponseBuilder( root, clientID, transID, F("Rules"), Success, "" );    
+
+    if( server.method() == HTTP_PUT || server.method() == HTTP_POST )
+    {
+      int type = RULE_NONE;
+      if( hasArgIC( argToSearchFor[0], server, false ) )
+      {
+        for( int i = RULE_EXCLUSIVE; i <= RULE_DELAY_AFTER; i++ )
+        {
+          if( strcasecmp_P( server.arg( argToSearchFor[0] ).c_str(), flashTableText( ruleTypeNames, i ) ) == 0 )
+            type = i;
+        }
+      }
+      if( type == RULE_NONE || !hasArgIC( argToSearchFor[1], server, false ) || !hasArgIC( argToSearchFor[2], server, false ) )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Missing or invalid argument - Type, Switch and Other are required");
+        root["ErrorNumber"] = invalidValue ;
+      }
+      else
+      {
+        int target = server.arg( argToSearchFor[1] ).toInt();
+        int other = server.arg( argToSearchFor[2] ).toInt();
+        uint32_t delay = ( hasArgIC( argToSearchFor[3], server, false ) ) ? (uint32_t) server.arg( argToSearchFor[3] ).toInt() : 0;
+        if( target < 0 || target >= numSwitches || other < 0 || other >= numSwitches || !addRule( (uint8_t) type, target, other, delay ) )
+        {
+          returnCode = 400;
+          root["ErrorMessage"] = F("Unable to add rule - check switch numbers and the number of rules");
+          root["ErrorNumber"] = invalidValue ;
+        }
+        else
+          markConfigDirty();
+      }
+    }
+    else if( server.method() == HTTP_DELETE )
+    {
+      if( !hasArgIC( argToSearchFor[4], server, false ) || !removeRule( server.arg( argToSearchFor[4] ).toInt() ) )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Missing or out of range rule Index");
+        root["ErrorNumber"] = invalidValue ;
+      }
+      else
+        markConfigDirty();
+    }
+    
+    JsonArray& entries = root.createNestedArray( "Value" );
+    for( int i = 0; i < numRules; i++ )
+    {
+      JsonObject& entry = entries.createNestedObject();
+      entry["Type"]   = flashTableEntry( ruleTypeNames, rule[i].type );
+      entry["Switch"] = (int) rule[i].target;
+      entry["Other"]  = (int) rule[i].other;
+      if( rule[i].type == RULE_DELAY_AFTER )
+        entry["Delay"] = rule[i].delay;
+    }
+    
+    root.printTo(message);
+    server.send(returnCode, "text/json", message);
+    return;
+}
+
+/*
+ * Set the relays in mask (host switch indexes) to the levels of the same bits of on, as one change. The change is
+ * checked against the interlock rules as a whole, so either every relay changes or, if a rule refuses it, none do.
+ * The levels go to the expander in a single write. Timers on the relays are cancelled. Switches in the mask that
+ * aren't relays are left alone.
+ */
+enum RuleResult applyRelayMask( uint32_t mask, uint32_t on )
+{
+    SwitchEntry* se;
+    uint32_t to = relayOnMask;
+    uint8_t level = 0, levelMask = 0;
+    enum RuleResult result;
+    bool state, changed = false;
+    int i;
+
+    for( i = 0; i < numSwitches && i < MAX_INTERLOCK_SWITCHES; i++ )
+    {
+      if( !( mask & ( 1UL << i ) ) || !switchCan( switchEntry[i]->type, OP_STATE ) )
+        mask &= ~( 1UL << i );
+    }
+    to = ( relayOnMask & ~mask ) | ( on & mask );
+    result = ruleCheckMask( relayOnMask, to );
+    if( result != RULE_OK )
+      return result;
+
+    for( i = 0; i < numSwitches && i < MAX_INTERLOCK_SWITCHES; i++ )
+    {
+      if( !( mask & ( 1UL << i ) ) )
+        continue;
+      se = switchEntry[i];
+      state = ( on & ( 1UL << i ) ) != 0;
+      cancelSwitchTimer( i );
+      if( i < 8 )
+      {
+        levelMask |= ( 1 << i );
+        if( state )
+          level |= ( 1 << i );
+      }
+      changed |= ( switchOn( se ) != state );
+      se->level = ( state ) ? 1 : 0;
+      noteRelayState( i, state );
+    }
+    expanderQueueMask( level, levelMask );
+    //As for setRelayState() - kept in RTC memory at once, saved in EEPROM later
+    if( changed )
+      markRelayDirty();
+    return RULE_OK;
+}
+
+/*
+ * Apply a scene as one change - the relays all or nothing through applyRelayMask(), then analogue outputs ramp to
+ * their scene values.
+ */
+enum RuleResult applyScene( int index )
+{
+    Scene* sc = &scene[index];
+    SwitchEntry* se;
+    uint32_t mask = 0, on = 0;
+    enum RuleResult result;
+    int i, count = ( numSwitches < MAX_SCENE_SWITCHES ) ? numSwitches : MAX_SCENE_SWITCHES;
+
+    for( i = 0; i < count; i++ )
+    {
+      mask |= ( 1UL << i );
+      if( sc->level[i] != 0 )
+        on |= ( 1UL << i );
+    }
+    result = applyRelayMask( mask, on );
+    if( result != RULE_OK )
+      return result;
+
+    for( i = 0; i < count; i++ )
+    {
+      se = switchEntry[i];
+      if( switchCan( se->type, OP_VALUE ) && sc->level[i] >= 0 && sc->level[i] <= se->maxLevel )
+        se->rampTarget = sc->level[i];
+    }
+    scenesApplied++;
+    return RULE_OK;
+}
+
+/*
+ * Apply a FAST_SET frame - see Webrelay_fastudp.h. Every switch addressed is checked before anything changes. The
+ * relays change as one through applyRelayMask() and the expander is written here rather than by the i2c task, so the
+ * reply reports what the expander actually holds.
+ */
+uint8_t fastApply( FastFrame& frame )
+{
+    SwitchEntry* se;
+    uint32_t relays = 0;
+    bool changed = false;
+    int i;
+
+    if( frame.mask >> ( ( numSwitches < FAST_SWITCHES ) ? numSwitches : FAST_SWITCHES ) )
+      return FAST_INVALID;
+    for( i = 0; i < numSwitches && i < FAST_SWITCHES; i++ )
+    {
+      if( !( frame.mask & ( 1 << i ) ) )
+        continue;
+      se = switchEntry[i];
+      if( switchCan( se->type, OP_STATE ) )
+        relays |= ( 1UL << i );
+      else if( !switchCan( se->type, OP_VALUE ) || frame.value[i] > se->maxLevel )
+        return FAST_INVALID;
+    }
+    if( applyRelayMask( relays, frame.state ) != RULE_OK )
+      return FAST_REFUSED;
+
+    for( i = 0; i < numSwitches && i < FAST_SWITCHES; i++ )
+    {
+      se = switchEntry[i];
+      if( !( frame.mask & ( 1 << i ) ) || !switchCan( se->type, OP_VALUE ) )
+        continue;
+      changed |= ( se->level != frame.value[i] );
+      se->level = se->rampTarget = frame.value[i];
+      writeAnalogue( i );
+    }
+    //Analogue values are configuration - the relays were saved by applyRelayMask()
+    if( changed )
+      markConfigDirty();
+    expanderFlush();
+    return FAST_OK;
+}
+
+//Answer the frames waiting on the fast control port. Called by the fastudp task.
+void fastUdpPoll( void )
+{
+    FastFrame frame;
+    uint32_t start;
+    int size, i;
+
+    for( int n = 0; n < FAST_BATCH && ( size = fastUdp.parsePacket() ) > 0; n++ )
+    {
+      start = micros();
+      if( !fastReceive( size, frame ) )
+        continue;
+      frame.status = fastCheckSequence( frame );
+      if( frame.status == FAST_OK && frame.type == FAST_SET )
+        frame.status = fastApply( frame );
+
+      frame.state = (uint16_t) relayOnMask;
+      frame.applied = ~( expanderOut ^ expanderApplied );
+      frame.switches = (uint8_t) numSwitches;
+      for( i = 0; i < FAST_SWITCHES; i++ )
+        frame.value[i] = ( i < numSwitches ) ? (uint16_t) switchEntry[i]->level : 0;
+      fastSend( frame );
+      histRecord( &fastUdpHist, micros() - start );
+    }
+}
+
+//Store the switches' current values in a scene - analogue outputs store the value they are ramping to
+void saveScene( int index )
+{
+    int count = ( numSwitches < MAX_SCENE_SWITCHES ) ? numSwitches : MAX_SCENE_SWITCHES;
+    for( int i = 0; i < count; i++ )
+    {
+      if( switchCan( switchEntry[i]->type, OP_RAMP ) )
+        scene[index].level[i] = switchEntry[i]->rampTarget;
+      else
+        scene[index].level[i] = switchEntry[i]->level;
+    }
+}
+
+/*
+ * Check or run one parsed command against the switches of the device number addressed. With execute false only
+ * checks the command can be run. Returns an ALPACA error number with error set, to text in flash.
+ */
+int runCommand( Command& cmd, bool execute, String& result, bool& state, const char*& error )
+{
+    char name[SCENE_NAME_LENGTH];
+    uint32_t mask = 0;
+    int i, sceneIndex, first = cmd.first, last = cmd.last;
+    SwitchLevel level = 0;
+    bool all = ( cmd.last == COMMAND_ALL );
+    SwitchEntry* se;
+    enum RuleResult interlock;
+
+    if( cmd.verb == VERB_SCENE )
+    {
+      if( cmd.name.length >= SCENE_NAME_LENGTH )
+      {
+        error = PSTR( "no scene with that name" );
+        return invalidValue;
+      }
+      memcpy( name, cmd.name.start, cmd.name.length );
+      name[cmd.name.length] = '\0';
+      sceneIndex = findScene( name );
+      if( sceneIndex < 0 )
+      {
+        error = PSTR( "no scene with that name" );
+        return invalidValue;
+      }
+      if( execute && ( interlock = applyScene( sceneIndex ) ) != RULE_OK )
+      {
+        error = flashTableText( ruleResultText, interlock );
+        return invalidOperation;
+      }
+      return Success;
+    }
+
+    if( all )
+      last = dev->numSwitches - 1;
+    if( last >= dev->numSwitches )
+    {
+      error = PSTR( "switch id out of range" );
+      return invalidValue;
+    }
+
+    for( i = first; i <= last; i++ )
+    {
+      se = deviceSwitch( i );
+      bool relay = switchCan( se->type, OP_STATE );
+      bool analogue = switchCan( se->type, OP_VALUE );
+      switch( cmd.verb )
+      {
+        case VERB_SET:
+        case VERB_PULSE:
+          if( !relay )
+          {
+            if( all )
+              continue;
+            error = PSTR( "only relays can be set on or off or pulsed" );
+            return invalidOperation;
+          }
+          break;
+        case VERB_VALUE:
+          if( !analogue )
+          {
+            if( all )
+              continue;
+            error = PSTR( "only analogue outputs take a value" );
+            return invalidOperation;
+          }
+          if( !switchLevel( se, cmd.value, level ) )
+          {
+            error = PSTR( "value out of range" );
+            return invalidValue;
+          }
+          break;
+        default:
+          break;
+      }
+      if( !execute )
+        continue;
+
+      switch( cmd.verb )
+      {
+        case VERB_SET:
+          mask |= ( 1UL << ( dev->firstSwitch + i ) );
+          break;
+        case VERB_VALUE:
+          se->rampTarget = level;
+          break;
+        case VERB_PULSE:
+          if( ( interlock = ruleCheck( dev->firstSwitch + i, true ) ) != RULE_OK )
+          {
+            error = flashTableText( ruleResultText, interlock );
+            return invalidOperation;
+          }
+          if( !startSwitchTimer( dev->firstSwitch + i, TIMER_PULSE, cmd.onTime, cmd.offTime, cmd.count ) )
+          {
+            error = PSTR( "unable to start timer" );
+            return invalidOperation;
+          }
+          break;
+        case VERB_GET:
+          if( result.length() > 0 )
+            result += ' ';
+          result += i;
+          result += '=';
+          if( switchIsBoolean( se->type ) )
+          {
+            state = switchOn( se );
+            result += ( state ) ? "on" : "off";
+          }
+          else
+            result += switchValue( se, se->level );
+          break;
+        default:
+          break;
+      }
+    }
+
+    if( execute && cmd.verb == VERB_SET && ( interlock = applyRelayMask( mask, ( cmd.state ) ? mask : 0 ) ) != RULE_OK )
+    {
+      error = flashTableText( ruleResultText, interlock );
+      return invalidOperation;
+    }
+    return Success;
+}
+
+/*
+ * Run a command text - the whole text is parsed and checked before anything is changed, so a typo in the last
+ * statement doesn't leave the first ones done. Statements then run in order, stopping at the first that fails,
+ * e.g. if an interlock refuses it. result collects the output of get statements and state is the last relay state
+ * read by get, or true if there was none.
+ */
+int runCommands( const char* text, bool execute, String& result, bool& state, String& errMsg )
+{
+    Command cmd;
+    const char* p = text;
+    const char* error;
+    int err = Success;
+    int statement = 0;
+
+    while( *p != '\0' && err == Success )
+    {
+      statement++;
+      if( !commandParse( p, cmd, error ) )
+        err = invalidValue;
+      else if( cmd.verb != VERB_NONE )
+        err = runCommand( cmd, execute, result, state, error );
+    }
+    if( err != Success )
+    {
+      errMsg = F("Statement ");
+      errMsg += statement;
+      errMsg += F(": ");
+      errMsg += FPSTR( error );
+    }
+    return err;
+}
+
+//Used by the CommandBlind, CommandBool and CommandString calls
+int deviceCommand( const String& command, String& result, bool& state, String& errMsg )
+{
+    int err;
+    state = true;
+    err = runCommands( command.c_str(), false, result, state, errMsg );
+    if( err == Success )
+      err = runCommands( command.c_str(), true, result, state, errMsg );
+    return err;
+}
+
+/*
+ * ALPACA Actions supported by the switch:
+ *  ApplyScene  - Parameters is the scene name. "Scene:<name>" with no parameters does the same.
+ *  SaveScene   - stores every switch's current value as the named scene, replacing any with that name.
+ *  DeleteScene - removes the named scene.
+ *  set, value, pulse, scene, get - a command statement with the arguments in Parameters - see Webrelay_command.h.
+ * Action names are matched ignoring case.
+ */
+int deviceAction( const String& action, const String& parameters, String& result, String& errMsg )
+{
+    String name = parameters;
+    int index;
+    enum RuleResult interlock;
+
+    name.trim();
+    if( action.length() > 6 && action.substring( 0, 6 ).equalsIgnoreCase( "Scene:" ) )
+      return deviceAction( "ApplyScene", action.substring( 6 ), result, errMsg );
+
+    if( action.equalsIgnoreCase( "ApplyScene" ) )
+    {
+      index = findScene( name.c_str() );
+      if( index < 0 )
+      {
+        errMsg = F("No scene named ");
+        errMsg += name;
+        return invalidValue;
+      }
+      interlock = applyScene( index );
+      if( interlock != RULE_OK )
+      {
+        errMsg = flashTableEntry( ruleResultText, interlock );
+        return invalidOperation;
+      }
+      result = scene[index].name;
+      return Success;
+    }
+    else if( action.equalsIgnoreCase( "SaveScene" ) )
+    {
+      index = addScene( name.c_str() );
+      if( index < 0 )
+      {
+        errMsg = F("Scene names must be 1 to 15 characters without ':' and there can be at most 8 scenes");
+        return invalidValue;
+      }
+      saveScene( index );
+      markConfigDirty();
+      result = scene[index].name;
+      return Success;
+    }
+    else if( action.equalsIgnoreCase( "DeleteScene" ) )
+    {
+      if( !removeScene( findScene( name.c_str() ) ) )
+      {
+        errMsg = F("No scene named ");
+        errMsg += name;
+        return invalidValue;
+      }
+      markConfigDirty();
+      return Success;
+    }
+    for( int i = VERB_SET; i < COMMAND_VERBS; i++ )
+    {
+      if( strcasecmp_P( action.c_str(), flashTableText( commandVerbNames, i ) ) == 0 )
+      {
+        bool state;
+        //Parameters must be a single statement's arguments
+        if( parameters.indexOf( ';' ) >= 0 || parameters.indexOf( '\n' ) >= 0 )
+        {
+          errMsg = F("Parameters must not contain ';'");
+          return invalidValue;
+        }
+        return deviceCommand( action + " " + parameters, result, state, errMsg );
+      }
+    }
+    errMsg = F("Action not supported");
+    return notImplemented;
+}
+
+void deviceSupportedActions( JsonArray& actions )
+{
+    String name;
+    actions.add( "ApplyScene" );
+    actions.add( "SaveScene" );
+    actions.add( "DeleteScene" );
+    for( int i = VERB_SET; i < COMMAND_VERBS; i++ )
+      actions.add( flashTableEntry( commandVerbNames, i ) );
+    for( int i = 0; i < numScenes; i++ )
+    {
+      name = F("Scene:");
+      name += scene[i].name;
+      actions.add( name );
+    }
+}
+
+/*
+ * Called by scheduleRun() for each schedule entry that is due. Relay changes go through setRelayState so the
+ * interlock rules still apply - a refused change is just skipped until the entry next fires.
+ */
+void onSchedule( int index )
+{
+    ScheduleEntry* e = &schedule[index];
+    SwitchEntry* se;
+    SwitchLevel level;
+
+    if( e->target >= numSwitches )
+      return;
+    se = switchEntry[e->target];
+    if( switchCan( se->type, OP_STATE ) )
+    {
+      if( e->action == SCHED_VALUE )
+        return;
+      cancelSwitchTimer( e->target );
+      if( !setRelayState( e->target, e->action == SCHED_ON ) )
+      {
+        DEBUGS1( "onSchedule: change refused for switch " ); DEBUGSL1( e->target );
+      }
+    }
+    else if( switchCan( se->type, OP_VALUE ) )
+    {
+      if( e->action == SCHED_VALUE && switchLevel( se, e->value, level ) )
+        se->rampTarget = level;
+      else if( e->action != SCHED_VALUE )
+        se->rampTarget = ( e->action == SCHED_ON ) ? se->maxLevel : 0;
+    }
+}
+
+//GET /schedules
+//PUT /schedules
+//DELETE /schedules
+//List, add or remove schedule entries, and set the site used for sunrise and sunset. Switch numbers are host switch indexes.
+//PUT takes Switch, Action (on, off or value), Value for value actions, Days as a mask (1 Sunday ... 64 Saturday, default every day)
+//and either Hour and Minute (each a number or * for every one) or Base (sunrise or sunset) and Offset in minutes.
+//PUT with Latitude and Longitude in degrees (north and east positive) sets the site. DELETE takes Index. Changes are saved to EEPROM shortly afterwards.
+void handlerSchedules(void)
+{
+    String message;
+    uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
+    uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
+    int returnCode = 200;
+    const __FlashStringHelper* argToSearchFor[11] = {F("Switch"), F("Action"), F("Value"), F("Days"), F("Hour"), F("Minute"), F("Base"), F("Offset"), F("Index"), F("Latitude"), F("Longitude")};
+    
+    DynamicJsonBuffer jsonBuffer(1024);
+    JsonObject& root = jsonBuffer.createObject();
+    jsonResponseBuilder( root, clientID, transID, F("Schedules"), Success, "" );    
+
+    if( ( server.method() == HTTP_PUT || server.method() == HTTP_POST ) && 
+        hasArgIC( argToSearchFor[9], server, false ) && hasArgIC( argToSearchFor[10], server, false ) )
+    {
+      float latitude = (float) server.arg( argToSearchFor[9] ).toDouble();
+      float longitude = (float) server.arg( argToSearchFor[10] ).toDouble();
+      if( latitude < -90.0F || latitude > 90.0F || longitude < -180.0F || longitude > 180.0F )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Latitude or Longitude out of range");
+        root["ErrorNumber"] = invalidValue ;
+      }
+      else
+      {
+        siteLatitude = latitude;
+        siteLongitude = longitude;
+        scheduleStale = true;
+        markConfigDirty();
+      }
+    }
+    else if( server.method() == HTTP_PUT || server.method() == HTTP_POST )
+    {
+      ScheduleEntry entry;
+      int action = -1;
+      int base = SCHED_CLOCK;
+      int target = ( hasArgIC( argToSearchFor[0], server, false ) ) ? server.arg( argToSearchFor[0] ).toInt() : -1;
+      
+      if( hasArgIC( argToSearchFor[1], server, false ) )
+      {
+        for( int i = SCHED_OFF; i <= SCHED_VALUE; i++ )
+        {
+          if( strcasecmp_P( server.arg( argToSearchFor[1] ).c_str(), flashTableText( scheduleActionNames, i ) ) == 0 )
+            action = i;
+        }
+      }
+      if( hasArgIC( argToSearchFor[6], server, false ) )
+      {
+        base = -1;
+        for( int i = SCHED_CLOCK; i <= SCHED_SUNSET; i++ )
+        {
+          if( strcasecmp_P( server.arg( argToSearchFor[6] ).c_str(), flashTableText( scheduleBaseNames, i ) ) == 0 )
+            base = i;
+        }
+      }
+      entry.target = (uint8_t) target;
+      entry.action = (uint8_t) action;
+      entry.base   = (uint8_t) base;
+      entry.days   = ( hasArgIC( argToSearchFor[3], server, false ) ) ? (uint8_t) server.arg( argToSearchFor[3] ).toInt() : SCHED_ALL_DAYS;
+      entry.hour   = ( !hasArgIC( argToSearchFor[4], server, false ) || server.arg( argToSearchFor[4] ) == "*" ) ? SCHED_ANY : (uint8_t) server.arg( argToSearchFor[4] ).toInt();
+      entry.minute = ( !hasArgIC( argToSearchFor[5], server, false ) || server.arg( argToSearchFor[5] ) == "*" ) ? SCHED_ANY : (uint8_t) server.arg( argToSearchFor[5] ).toInt();
+      entry.offset = ( hasArgIC( argToSearchFor[7], server, false ) ) ? (int16_t) server.arg( argToSearchFor[7] ).toInt() : 0;
+      entry.value  = ( hasArgIC( argToSearchFor[2], server, false ) ) ? (float) server.arg( argToSearchFor[2] ).toDouble() : 0.0F;
+      if( base == SCHED_CLOCK && !hasArgIC( argToSearchFor[4], server, false ) && !hasArgIC( argToSearchFor[5], server, false ) )
+        base = -1; //a clock entry needs at least one of Hour and Minute
+
+      if( target < 0 || target >= numSwitches || action < 0 || base < 0 || 
+          ( action == SCHED_VALUE && !hasArgIC( argToSearchFor[2], server, false ) ) || !addSchedule( entry ) )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Unable to add schedule - Switch, Action and either Hour/Minute or Base are required, and the table may be full");
+        root["ErrorNumber"] = invalidValue ;
+      }
+      else
+        markConfigDirty();
+    }
+    else if( server.method() == HTTP_DELETE )
+    {
+      if( !hasArgIC( argToSearchFor[8], server, false ) || !removeSchedule( server.arg( argToSearchFor[8] ).toInt() ) )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Missing or out of range schedule Index");
+        root["ErrorNumber"] = invalidValue ;
+      }
+      else
+        markConfigDirty();
+    }
+    
+    //Make the next fire times shown up to date with any change made above
+    //now is UTC - the schedule counts device clock time, see Webrelay_schedule.h
+    if( scheduleStale && now >= SCHED_VALID_TIME )
+      scheduleReindex( now + SCHED_UTC_OFFSET );
+    root["Latitude"] = siteLatitude;
+    root["Longitude"] = siteLongitude;
+    JsonArray& entries = root.createNestedArray( "Value" );
+    for( int i = 0; i < numSchedules; i++ )
+    {
+      JsonObject& entry = entries.createNestedObject();
+      entry["Switch"] = (int) schedule[i].target;
+      entry["Action"] = flashTableEntry( scheduleActionNames, schedule[i].action );
+      if( schedule[i].action == SCHED_VALUE )
+        entry["Value"] = schedule[i].value;
+      entry["Days"]   = (int) schedule[i].days;
+      entry["Base"]   = flashTableEntry( scheduleBaseNames, schedule[i].base );
+      if( schedule[i].base == SCHED_CLOCK )
+      {
+        if( schedule[i].hour == SCHED_ANY )
+          entry["Hour"] = "*";
+        else
+          entry["Hour"] = (int) schedule[i].hour;
+        if( schedule[i].minute == SCHED_ANY )
+          entry["Minute"] = "*";
+        else
+          entry["Minute"] = (int) schedule[i].minute;
+      }
+      else
+        entry["Offset"] = (int) schedule[i].offset;
+      entry["Next"] = (uint32_t) scheduleNextFire[i]; //device clock secs, 0 if not due within a week or the clock isn't set
+    }
+    
+    root.printTo(message);
+    server.send(returnCode, "text/json", message);
+    return;
+}
+
+//GET, PUT, DELETE /sensors
+//Power monitor bindings - see Webrelay_sensors.h. PUT binds a channel to a switch, making it a read-only Sensor switch.
+void handlerSensors(void)
+{
+    String message;
+    uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
+    uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
+    int returnCode = 200;
+    const __FlashStringHelper* argToSearchFor[7] = {F("Switch"), F("Chip"), F("Address"), F("Channel"), F("Quantity"), F("Shunt"), F("Index")};
+    
+    DynamicJsonBuffer jsonBuffer(1024);
+    JsonObject& root = jsonBuffer.createObject();
+    jsonResponseBuilder( root, clientID, transID, F("Sensors"), Success, "" );    
+
+    if( server.method() == HTTP_PUT || server.method() == HTTP_POST )
+    {
+      SensorBinding binding;
+      int chip = SENSOR_INA219;
+      int quantity = SENSOR_CURRENT;
+      int target = ( hasArgIC( argToSearchFor[0], server, false ) ) ? server.arg( argToSearchFor[0] ).toInt() : -1;
+      
+      if( hasArgIC( argToSearchFor[1], server, false ) )
+      {
+        chip = -1;
+        for( int i = SENSOR_INA219; i <= SENSOR_INA3221; i++ )
+        {
+          if( strcasecmp_P( server.arg( argToSearchFor[1] ).c_str(), flashTableText( sensorChipNames, i ) ) == 0 )
+            chip = i;
+        }
+      }
+      if( hasArgIC( argToSearchFor[4], server, false ) )
+      {
+        quantity = -1;
+        for( int i = SENSOR_CURRENT; i <= SENSOR_POWER; i++ )
+        {
+          if( strcasecmp_P( server.arg( argToSearchFor[4] ).c_str(), flashTableText( sensorQuantityNames, i ) ) == 0 )
+            quantity = i;
+        }
+      }
+      binding.target   = (uint8_t) target;
+      binding.chip     = (uint8_t) chip;
+      binding.quantity = (uint8_t) quantity;
+      //Address as decimal or 0x hex
+      binding.address  = ( hasArgIC( argToSearchFor[2], server, false ) ) ? (uint8_t) strtol( server.arg( argToSearchFor[2] ).c_str(), nullptr, 0 ) : 0x40;
+      binding.channel  = ( hasArgIC( argToSearchFor[3], server, false ) ) ? (uint8_t) server.arg( argToSearchFor[3] ).toInt() : 0;
+      binding.shunt    = ( hasArgIC( argToSearchFor[5], server, false ) ) ? (uint16_t) server.arg( argToSearchFor[5] ).toInt() : 100;
+
+      if( target < 0 || target >= numSwitches || chip < 0 || quantity < 0 || addSensor( binding ) < 0 )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Unable to bind sensor - Switch is required, Chip, Address, Channel, Quantity and Shunt must suit each other, and the table may be full");
+        root["ErrorNumber"] = invalidValue ;
+      }
+      else
+      {
+        //The switch reads the sensor from now on - its range is the quantity's full scale in whole units
+        SwitchEntry* se = switchEntry[target];
+        int32_t min, max;
+        cancelSwitchTimer( target );
+        sensorRange( binding, min, max );
+        se->type = SWITCH_SENSOR;
+        se->writeable = false;
+        ruleNoteState( target, false );
+        se->level = se->rampTarget = 0;
+        switchSetRange( se, (float) min, (float) max, 1.0F );
+        inputRefreshMask();
+        markConfigDirty();
+      }
+    }
+    else if( server.method() == HTTP_DELETE )
+    {
+      int index = ( hasArgIC( argToSearchFor[6], server, false ) ) ? server.arg( argToSearchFor[6] ).toInt() : -1;
+      int target = ( index >= 0 && index < numSensors ) ? sensor[index].target : -1;
+      if( !removeSensor( index ) )
+      {
+        returnCode = 400;
+        root["ErrorMessage"] = F("Missing or out of range sensor Index");
+        root["ErrorNumber"] = invalidValue ;
+      }
+      else
+      {
+        //Left as a Sensor switch until its type is changed, reading zero
+        if( target < numSwitches )
+          switchEntry[target]->level = switchEntry[target]->rampTarget = 0;
+        markConfigDirty();
+      }
+    }
+    
+    JsonArray& entries = root.createNestedArray( "Value" );
+    for( int i = 0; i < numSensors; i++ )
+    {
+      JsonObject& entry = entries.createNestedObject();
+      entry["Switch"]   = (int) sensor[i].target;
+      entry["Chip"]     = flashTableEntry( sensorChipNames, sensor[i].chip );
+      entry["Address"]  = (int) sensor[i].address;
+      entry["Channel"]  = (int) sensor[i].channel;
+      entry["Quantity"] = flashTableEntry( sensorQuantityNames, sensor[i].quantity );
+      entry["Unit"]     = flashTableEntry( sensorUnitNames, sensor[i].quantity );
+      entry["Shunt"]    = (int) sensor[i].shunt;
+      entry["Average"]  = sensorAverage( sensorFilter[i] );
+      entry["Min"]      = sensorFilter[i].min;
+      entry["Max"]      = sensorFilter[i].max;
+      entry["Reads"]    = sensorFilter[i].reads;
+      entry["Errors"]   = sensorFilter[i].errors;
+    }
+    
+    root.printTo(message);
+    server.send(returnCode, "text/json", message);
+    return;
+}
+
+/*
+ * Handler to do custom setup that can't be done without a windows ascom driver setup form. 
+ */
+ void handlerSetup(void) 
+ {
+    String message, timeString, err= "";
+    uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
+    uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
+    uint32_t switchID = -1;
+    
+    int returnCode = 400;
+    const __FlashStringHelper* argToSearchFor[] = { F("hostname"), F("numSwitches"), F("numDevices"), F("restartWindow"), F("fastPort"), F("fastKey"), F("syslogServer"), F("syslogPort"), F("rollbackUrl") };
+     
+    if ( server.method() == HTTP_GET )
+    {
+        message = setupFormBuilder( message, err );      
+        returnCode = 200;    
+    }
+    else if ( server.method() == HTTP_POST || server.method() == HTTP_PUT )
+    {
+        if( hasArgIC( argToSearchFor[0], server, false )  )
+        {
+          String newHostname = server.arg(argToSearchFor[0]) ;
+          //process form variables.
+          if( newHostname.length() > 0 && newHostname.length() < MAX_NAME_LENGTH-1 )
+          {
+            //process new hostname
+            strncpy( myHostname, newHostname.c_str(), MAX_NAME_LENGTH );
+            invalidateManagementCache();
+          }
+
+          //The new name is taken up at the restart, once this page has gone out
+          message = setupFormBuilder( message, err );      
+          returnCode = 200;    
+          saveToEeprom();
+          scheduleRestart();
+        }
+        else if( hasArgIC( argToSearchFor[1], server, false ) )
+        {
+          int newNumSwitches = server.arg(argToSearchFor[1]).toInt();
+          if( newNumSwitches >= 0 && newNumSwitches <= MAX_SWITCHES )
+          {
+            //update the switches
+            ;;
+          err = F("Switch resizing not yet ready");
+          message = setupFormBuilder( message, err );      
+          returnCode = 200;    
+          }
+        }
+        else if( hasArgIC( argToSearchFor[2], server, false ) )
+        {
+          int newNumDevices = server.arg(argToSearchFor[2]).toInt();
+          if( newNumDevices >= 1 && newNumDevices <= MAX_ALPACA_DEVICES && newNumDevices <= numSwitches )
+          {
+            numDevices = newNumDevices;
+            layoutDevices();
+            saveToEeprom();
+          }
+          else
+            err = F("Device count out of range");
+          message = setupFormBuilder( message, err );      
+          returnCode = 200;    
+        }
+        else if( hasArgIC( argToSearchFor[3], server, false ) )
+        {
+          int newWindow = server.arg(argToSearchFor[3]).toInt();
+          if( newWindow >= 0 && newWindow <= WIFI_RESTART_WINDOW_MAX )
+          {
+            wifiRestartWindow = newWindow;
+            saveToEeprom();
+          }
+          else
+            err = F("Restart window out of range");
+          message = setupFormBuilder( message, err );      
+          returnCode = 200;    
+        }
+        else if( hasArgIC( argToSearchFor[4], server, false ) )
+        {
+          int newPort = server.arg(argToSearchFor[4]).toInt();
+          String newKey = server.arg(argToSearchFor[5]);
+          if( newPort < 0 || newPort > 65535 || ( newPort > 0 && ( newPort == udpPort || newPort == 80 ) ) )
+            err = F("Fast control port out of range or in use");
+          else if( newKey.length() >= FAST_KEY_LENGTH )
+            err = F("Fast control key too long");
+          else
+          {
+            if( servicesStarted && fastEnabled() )
+              fastUdp.stop();
+            //A blank key leaves the current one
+            if( newKey.length() > 0 )
+              fastSetKey( newKey.c_str() );
+            fastPort = newPort;
+            if( servicesStarted && fastEnabled() )
+              fastUdp.begin( fastPort );
+            saveToEeprom();
+          }
+          message = setupFormBuilder( message, err );      
+          returnCode = 200;    
+        }
+        else if( hasArgIC( argToSearchFor[6], server, false ) )
+        {
+          IPAddress newServer;
+          String serverArg = server.arg(argToSearchFor[6]);
+          int newPort = ( hasArgIC( argToSearchFor[7], server, false ) ) ? server.arg(argToSearchFor[7]).toInt() : LOG_SYSLOG_PORT;
+          //A blank server turns syslog off
+          if( serverArg.length() > 0 && !newServer.fromString( serverArg.c_str() ) )
+            err = F("Syslog server is not an IP address");
+          else if( newPort < 1 || newPort > 65535 )
+            err = F("Syslog port out of range");
+          else
+          {
+            logSyslogServer = ( serverArg.length() > 0 ) ? (uint32_t) newServer : 0;
+            logSyslogPort = newPort;
+            //Only lines logged from now on go to the new server
+            logSyslogTail = logHead;
+            saveToEeprom();
+          }
+          message = setupFormBuilder( message, err );      
+          returnCode = 200;    
+        }
+        else if( hasArgIC( argToSearchFor[8], server, false ) )
+        {
+          String newUrl = server.arg(argToSearchFor[8]);
+          //A blank URL turns rollback off. ESP8266httpUpdate fetches plain http only.
+          if( newUrl.length() >= OTA_URL_LENGTH )
+            err = F("Rollback URL too long");
+          else if( newUrl.length() > 0 && !newUrl.startsWith( F("http://") ) )
+            err = F("Rollback URL must start with http://");
+          else
+          {
+            strcpy( otaRollbackUrl, newUrl.c_str() );
+            saveToEeprom();
+          }
+          message = setupFormBuilder( message, err );      
+          returnCode = 200;    
+        }
+    }
+    else
+    {
+      err = F("Bad HTTP request verb");
+      message = setupFormBuilder( message, err );      
+    }
+    server.send(returnCode, "text/html", message);
+    return;
+ }
+
+ void handlerSetupSwitches(void) 
+ {
+    String message, timeString, err= "";
+    uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
+    uint32_t transID = (uint32_t)server.arg("ClientTransactionID").toInt();
+    uint32_t switchID = -1;
     int i;
     int returnCode = 200;
-    String argToSearchFor[] = { "Id","switchName", "type", "max", "min", "step", "writeable", "value", "description" };
+    const __FlashStringHelper* argToSearchFor[] = { F("Id"),F("switchName"), F("type"), F("max"), F("min"), F("step"), F("writeable"), F("value"), F("description") };
     
     if ( server.method() == HTTP_POST || server.method() == HTTP_PUT )
     {
@@ -888,7 +2503,7 @@ void handlerStatus(void)
           {
             ;;
           }
-          err = "Not yet implemented";
+          err = F("Not yet implemented");
           returnCode = 200;
         }       
     }
@@ -908,56 +2523,124 @@ String& setupFormBuilder( String& htmlForm, String& errMsg )
 {
   String hostname = WiFi.hostname();
   
-  htmlForm = "<!DocType html><html lang=en ><head></head><meta charset=\"utf-8\">";
-  htmlForm += "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">";
-  htmlForm += "<link rel=\"stylesheet\" href=\"https://maxcdn.bootstrapcdn.com/bootstrap/4.3.1/css/bootstrap.min.css\">";
-  htmlForm += "<script src=\"https://ajax.googleapis.com/ajax/libs/jquery/3.4.1/jquery.min.js\"></script>";
-  htmlForm += "<script src=\"https://cdnjs.cloudflare.com/ajax/libs/popper.js/1.14.7/umd/popper.min.js\"></script>";
-  htmlForm += "<script src=\"https://maxcdn.bootstrapcdn.com/bootstrap/4.3.1/js/bootstrap.min.js\"></script>";
-  htmlForm += "<body><div class=\"container\">";
+  htmlForm = F("<!DocType html><html lang=en ><head></head><meta charset=\"utf-8\">");
+  htmlForm += F("<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
+  htmlForm += F("<link rel=\"stylesheet\" href=\"https://maxcdn.bootstrapcdn.com/bootstrap/4.3.1/css/bootstrap.min.css\">");
+  htmlForm += F("<script src=\"https://ajax.googleapis.com/ajax/libs/jquery/3.4.1/jquery.min.js\"></script>");
+  htmlForm += F("<script src=\"https://cdnjs.cloudflare.com/ajax/libs/popper.js/1.14.7/umd/popper.min.js\"></script>");
+  htmlForm += F("<script src=\"https://maxcdn.bootstrapcdn.com/bootstrap/4.3.1/js/bootstrap.min.js\"></script>");
+  htmlForm += F("<body><div class=\"container\">");
   
-  htmlForm += "<div class=\"row\" id=\"topbar\" bgcolor='A02222'>";
-  htmlForm += "<p> This is the setup page for the Skybadger <a href=\"https://www.ascom-standards.org\">ASCOM</a> Switch device 'espRLY01' which uses the <a href=\"https://www.ascom-standards.org/api\">ALPACA</a> v1.0 API</b>";
-  htmlForm += "</div>";
+  htmlForm += F("<div class=\"row\" id=\"topbar\" bgcolor='A02222'>");
+  htmlForm += F("<p> This is the setup page for the Skybadger <a href=\"https://www.ascom-standards.org\">ASCOM</a> Switch device 'espRLY01' which uses the <a href=\"https://www.ascom-standards.org/api\">ALPACA</a> v1.0 API</b>");
+  htmlForm += F("</div>");
 
   if( errMsg != NULL && errMsg.length() > 0 ) 
   {
-    htmlForm += "<div class=\"row\" id=\"errorbar\" bgcolor='A02222'>";
-    htmlForm += "<b>Error Message </b>";
-    htmlForm += "</div>";
-    htmlForm += "<hr>";
+    htmlForm += F("<div class=\"row\" id=\"errorbar\" bgcolor='A02222'>");
+    htmlForm += F("<b>Error Message </b>");
+    htmlForm += F("</div>");
+    htmlForm += F("<hr>");
   }
  
   //Device settings hostname and number of switches on this device
-  htmlForm += "<div class=\"row\" id=\"deviceAttrib\" bgcolor='blue'>\n";
-  htmlForm += "<h2> Enter new hostname for device</h2><br/>";
-  htmlForm += "<p>Changing the hostname will cause the device to reboot and may change the IP address!</p>\n";
-  htmlForm += "<form action=\"http://";
+  htmlForm += F("<div class=\"row\" id=\"deviceAttrib\" bgcolor='blue'>\n");
+  htmlForm += F("<h2> Enter new hostname for device</h2><br/>");
+  htmlForm += F("<p>Changing the hostname will cause the device to reboot and may change the IP address!</p>\n");
+  htmlForm += F("<form action=\"http://");
   htmlForm.concat( myHostname );
-  htmlForm += "/setup/\" method=\"POST\" id=\"hostname\" >\n";
-  htmlForm += "<input type=\"text\" name=\"hostname\" value=\"";
+  htmlForm += F("/setup/\" method=\"POST\" id=\"hostname\" >\n");
+  htmlForm += F("<input type=\"text\" name=\"hostname\" value=\"");
   htmlForm.concat( myHostname );
-  htmlForm += "\">\n";
+  htmlForm += F("\">\n");
 
-  htmlForm += "<h2>Update switches</h2><br/>";
-  htmlForm += "<p>Upscaling will copy the existing setup to the new setup but you will need to edit the added switches. </p>";
-  htmlForm += "<p>Downscaling will delete the configuration for the switches dropped</p><br>";
-  htmlForm += "<p>New switch count: <input type=\"number\" name=\"numSwitches\" min=\"1\" max=\"16\" value=\"8\"></p>";
-  htmlForm += "<input type=\"submit\" value=\"Submit\"> </form> </div>";
+  htmlForm += F("<h2>Update switches</h2><br/>");
+  htmlForm += F("<p>Upscaling will copy the existing setup to the new setup but you will need to edit the added switches. </p>");
+  htmlForm += F("<p>Downscaling will delete the configuration for the switches dropped</p><br>");
+  htmlForm += F("<p>New switch count: <input type=\"number\" name=\"numSwitches\" min=\"1\" max=\"16\" value=\"8\"></p>");
+  htmlForm += F("<input type=\"submit\" value=\"Submit\"> </form> </div>");
 
-  htmlForm += "<div class=\"col-sm-2\"> ";
-  htmlForm += "<form action=\"http://";
+  htmlForm += F("<div class=\"row\" id=\"deviceCount\" bgcolor='blue'>\n");
+  htmlForm += F("<form action=\"http://");
+  htmlForm.concat( myHostname );
+  htmlForm += F("/api/v1/switch/0/setup\" method=\"POST\" id=\"devices\" >\n");
+  htmlForm += F("<h2>ALPACA device numbers</h2><br/>");
+  htmlForm += F("<p>The switches are shared evenly between this many ALPACA switch devices (/switch/0, /switch/1 ...)</p>");
+  htmlForm += F("<p>Device count: <input type=\"number\" name=\"numDevices\" min=\"1\" max=\"");
+  htmlForm.concat( MAX_ALPACA_DEVICES );
+  htmlForm += F("\" value=\"");
+  htmlForm.concat( numDevices );
+  htmlForm += F("\"></p>");
+  htmlForm += F("<input type=\"submit\" value=\"Submit\"> </form> </div>");
+
+  htmlForm += F("<div class=\"row\" id=\"restartWindow\" bgcolor='blue'>\n");
+  htmlForm += F("<form action=\"http://");
+  htmlForm.concat( myHostname );
+  htmlForm += F("/api/v1/switch/0/setup\" method=\"POST\" id=\"restart\" >\n");
+  htmlForm += F("<h2>WiFi restart window</h2><br/>");
+  htmlForm += F("<p>Minutes without WiFi before the device restarts, 0 for never. Relays and timers keep running while WiFi is down.</p>");
+  htmlForm += F("<p>Minutes: <input type=\"number\" name=\"restartWindow\" min=\"0\" max=\"");
+  htmlForm.concat( WIFI_RESTART_WINDOW_MAX );
+  htmlForm += F("\" value=\"");
+  htmlForm.concat( wifiRestartWindow );
+  htmlForm += F("\"></p>");
+  htmlForm += F("<input type=\"submit\" value=\"Submit\"> </form> </div>");
+
+  htmlForm += F("<div class=\"row\" id=\"fastControl\" bgcolor='blue'>\n");
+  htmlForm += F("<form action=\"http://");
+  htmlForm.concat( myHostname );
+  htmlForm += F("/api/v1/switch/0/setup\" method=\"POST\" id=\"fast\" >\n");
+  htmlForm += F("<h2>Fast UDP control</h2><br/>");
+  htmlForm += F("<p>UDP port for signed binary switch frames, 0 for off. Leave the key blank to keep the current one.</p>");
+  htmlForm += F("<p>Port: <input type=\"number\" name=\"fastPort\" min=\"0\" max=\"65535\" value=\"");
+  htmlForm.concat( fastPort );
+  htmlForm += F("\"></p>");
+  htmlForm += F("<p>Key: <input type=\"password\" name=\"fastKey\" maxlength=\"");
+  htmlForm.concat( FAST_KEY_LENGTH - 1 );
+  htmlForm += F("\"></p>");
+  htmlForm += F("<input type=\"submit\" value=\"Submit\"> </form> </div>");
+
+  htmlForm += F("<div class=\"row\" id=\"syslog\" bgcolor='blue'>\n");
+  htmlForm += F("<form action=\"http://");
+  htmlForm.concat( myHostname );
+  htmlForm += F("/api/v1/switch/0/setup\" method=\"POST\" id=\"syslog\" >\n");
+  htmlForm += F("<h2>Syslog</h2><br/>");
+  htmlForm += F("<p>Server to send the log to over UDP as well as the serial port. Leave it blank for off.</p>");
+  htmlForm += F("<p>Server: <input type=\"text\" name=\"syslogServer\" value=\"");
+  if( logSyslogEnabled() )
+    htmlForm += IPAddress( logSyslogServer ).toString();
+  htmlForm += F("\"></p>");
+  htmlForm += F("<p>Port: <input type=\"number\" name=\"syslogPort\" min=\"1\" max=\"65535\" value=\"");
+  htmlForm.concat( logSyslogPort );
+  htmlForm += F("\"></p>");
+  htmlForm += F("<input type=\"submit\" value=\"Submit\"> </form> </div>");
+
+  htmlForm += F("<div class=\"row\" id=\"rollback\" bgcolor='blue'>\n");
+  htmlForm += F("<form action=\"http://");
+  htmlForm.concat( myHostname );
+  htmlForm += F("/api/v1/switch/0/setup\" method=\"POST\" id=\"rollback\" >\n");
+  htmlForm += F("<h2>Firmware rollback</h2><br/>");
+  htmlForm += F("<p>http:// URL of the last good image, downloaded if an update keeps restarting before it passes its health check. Leave it blank for none.</p>");
+  htmlForm += F("<p>URL: <input type=\"text\" name=\"rollbackUrl\" maxlength=\"");
+  htmlForm.concat( OTA_URL_LENGTH - 1 );
+  htmlForm += F("\" value=\"");
+  htmlForm += otaRollbackUrl;
+  htmlForm += F("\"></p>");
+  htmlForm += F("<input type=\"submit\" value=\"Submit\"> </form> </div>");
+
+  htmlForm += F("<div class=\"col-sm-2\"> ");
+  htmlForm += F("<form action=\"http://");
   htmlForm += myHostname;
-  htmlForm += "/api/v1/switch/setup/switch\">";
-  htmlForm += "<h2>Switch configuration </h2>";
-  htmlForm += "<br><p>In order to configure the switches, select the switch you need below.</p>";
+  htmlForm += F("/api/v1/switch/setup/switch\">");
+  htmlForm += F("<h2>Switch configuration </h2>");
+  htmlForm += F("<br><p>In order to configure the switches, select the switch you need below.</p>");
   
   htmlForm += "";
-  htmlForm += "<input type=\"radio\" name=\"switchNum\" value=\"0\" checked > 0 <br>";
+  htmlForm += F("<input type=\"radio\" name=\"switchNum\" value=\"0\" checked > 0 <br>");
 //      <input type="radio" name="switchNum" value="1" > 1 <br>
-  htmlForm += "<input type=\"submit\" value=\"Submit\">";
-  htmlForm += "</form>";
-  htmlForm += "</div >";
+  htmlForm += F("<input type=\"submit\" value=\"Submit\">");
+  htmlForm += F("</form>");
+  htmlForm += F("</div >");
 
 /*   
   <!DocType html>
@@ -1105,7 +2788,7 @@ String& setupFormBuilder( String& htmlForm, String& errMsg )
   htmlForm += "<input type=\"submit\" value=\"submit\">\n</form>\n";
 
   */
-  htmlForm += "</body>\n</html>\n";
+  htmlForm += F("</body>\n</html>\n");
 
   return htmlForm;
 }
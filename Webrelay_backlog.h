@@ -0,0 +1,66 @@
+/*
+Webrelay_backlog.h
+Switch state changes waiting to be published over MQTT.
+A change made while the broker can't be reached - WiFi is down or the broker is away - is kept in a small ring
+buffer with the time it happened, and the mqtt task replays the buffer, oldest first, once the broker is back. Later
+changes are queued behind any still waiting, so subscribers always see them in order. When the buffer is full the
+oldest change is dropped and counted. Entries are fixed size so the buffer never allocates.
+Broker outages are counted here as well - WiFi outages are counted in Webrelay_wifi.h.
+*/
+#ifndef _WEBRELAY_BACKLOG_H_
+#define _WEBRELAY_BACKLOG_H_
+
+#include "Webrelay_common.h"
+
+#define MQTT_BACKLOG 16
+#define MQTT_REPLAY_BATCH 4  //messages replayed per run of the mqtt task
+
+typedef struct
+{
+  char time[32];  //as published
+  uint8_t index;  //host switch index
+  bool state;
+} BacklogEntry;
+
+BacklogEntry backlog[MQTT_BACKLOG];
+int backlogHead = 0;  //oldest entry
+int backlogCount = 0;
+uint32_t backlogDropped = 0;
+uint32_t backlogReplayed = 0;
+uint32_t mqttOutages = 0;
+
+//Function definitions
+void backlogPush( const char* time, int index, bool state );
+BacklogEntry* backlogFront( void );
+void backlogPop( void );
+
+void backlogPush( const char* time, int index, bool state )
+{
+  BacklogEntry* e;
+  if( backlogCount == MQTT_BACKLOG )
+  {
+    backlogPop();
+    backlogDropped++;
+  }
+  e = &backlog[ ( backlogHead + backlogCount ) % MQTT_BACKLOG ];
+  strncpy( e->time, time, sizeof( e->time ) - 1 );
+  e->time[ sizeof( e->time ) - 1 ] = '\0';
+  e->index = (uint8_t) index;
+  e->state = state;
+  backlogCount++;
+}
+
+//Oldest change still waiting, nullptr if none
+BacklogEntry* backlogFront( void )
+{
+  return ( backlogCount > 0 ) ? &backlog[backlogHead] : nullptr;
+}
+
+void backlogPop( void )
+{
+  if( backlogCount == 0 )
+    return;
+  backlogHead = ( backlogHead + 1 ) % MQTT_BACKLOG;
+  backlogCount--;
+}
+#endif
@@ -0,0 +1,239 @@
+/*
+Webrelay_command.h
+Parser for the switch command language taken by Action and the Command* calls, so a client can make a set of
+changes in one round trip, e.g.
+  set 0-3 on; value 5 512; pulse 2 500; scene park; get 0-7
+Statements are separated by ';' or new lines. Each is a verb and its arguments:
+  set <switches> on|off                     - relays
+  value <switches> <value>                  - analogue outputs
+  pulse <switches> <on> [<off> [<count>]]   - relays, msecs up to a day - as setswitchpulse, a single pulse by default
+  scene <name>                              - apply a saved scene
+  get <switches>                            - report the switches' states or values
+<switches> is a switch id, a range a-b, or * for every switch of the device number addressed.
+The tokenizer works in place on the command text - tokens are pointers and lengths into it - so parsing never
+allocates. commandParse() reads one statement at a time; the caller parses the whole text once to check it before
+anything is changed and then again to run it - see runCommands().
+*/
+#ifndef _WEBRELAY_COMMAND_H_
+#define _WEBRELAY_COMMAND_H_
+
+#include <stdlib.h>
+#include "Webrelay_common.h"
+#include "Webrelay_flash.h"
+
+enum CommandVerb { VERB_NONE, VERB_SET, VERB_VALUE, VERB_PULSE, VERB_SCENE, VERB_GET };
+//Names in flash, in enum order - read with flashTableText() or flashTableEntry()
+const char commandVerbNone[] PROGMEM = "";
+const char commandVerbSet[] PROGMEM = "set";
+const char commandVerbValue[] PROGMEM = "value";
+const char commandVerbPulse[] PROGMEM = "pulse";
+const char commandVerbScene[] PROGMEM = "scene";
+const char commandVerbGet[] PROGMEM = "get";
+const char* const commandVerbNames[] PROGMEM =
+{
+  commandVerbNone, commandVerbSet, commandVerbValue, commandVerbPulse, commandVerbScene, commandVerbGet
+};
+#define COMMAND_VERBS 6
+#define COMMAND_ALL 0xFF   //switch range of *
+
+typedef struct
+{
+  const char* start;
+  uint8_t length;
+} CommandToken;
+
+typedef struct
+{
+  uint8_t verb;       //CommandVerb
+  uint8_t first;      //switch range, device switch ids - last is COMMAND_ALL for *
+  uint8_t last;
+  bool state;         //set
+  float value;        //value
+  uint32_t onTime;    //pulse
+  uint32_t offTime;
+  uint16_t count;
+  CommandToken name;  //scene
+} Command;
+
+//Function definitions
+bool commandToken( const char*& p, CommandToken& token );
+bool tokenIs( const CommandToken& token, PGM_P word );
+bool tokenToLong( const CommandToken& token, long& value );
+bool tokenToFloat( const CommandToken& token, float& value );
+bool tokenToRange( const CommandToken& token, uint8_t& first, uint8_t& last );
+bool commandParse( const char*& p, Command& cmd, const char*& error );
+
+/*
+ * Read the next token of the current statement. Returns false at the end of the statement, leaving p at its
+ * separator, or at the end of the text.
+ */
+bool commandToken( const char*& p, CommandToken& token )
+{
+  while( *p == ' ' || *p == '\t' || *p == '\r' )
+    p++;
+  if( *p == '\0' || *p == ';' || *p == '\n' )
+    return false;
+  token.start = p;
+  while( *p != '\0' && *p != ';' && *p != '\n' && *p != ' ' && *p != '\t' && *p != '\r' )
+    p++;
+  token.length = ( p - token.start > 255 ) ? 255 : (uint8_t)( p - token.start );
+  return true;
+}
+
+//Case insensitive match of the whole token against a word in flash
+bool tokenIs( const CommandToken& token, PGM_P word )
+{
+  return ( strlen_P( word ) == token.length && strncasecmp_P( token.start, word, token.length ) == 0 );
+}
+
+bool tokenToLong( const CommandToken& token, long& value )
+{
+  char* end;
+  value = strtol( token.start, &end, 10 );
+  return ( end == token.start + token.length );
+}
+
+bool tokenToFloat( const CommandToken& token, float& value )
+{
+  char* end;
+  value = strtof( token.start, &end );
+  return ( end == token.start + token.length );
+}
+
+//A switch id, a range a-b or *
+bool tokenToRange( const CommandToken& token, uint8_t& first, uint8_t& last )
+{
+  char* end;
+  long a, b;
+
+  if( tokenIs( token, PSTR( "*" ) ) )
+  {
+    first = 0;
+    last = COMMAND_ALL;
+    return true;
+  }
+  a = strtol( token.start, &end, 10 );
+  if( end == token.start )
+    return false;
+  b = a;
+  if( end < token.start + token.length && *end == '-' )
+  {
+    const char* from = end + 1;
+    b = strtol( from, &end, 10 );
+    if( end == from )
+      return false;
+  }
+  if( end != token.start + token.length || a < 0 || b < a || b >= COMMAND_ALL )
+    return false;
+  first = (uint8_t) a;
+  last = (uint8_t) b;
+  return true;
+}
+
+/*
+ * Parse the statement at p into cmd and move p past its separator. An empty statement gives VERB_NONE.
+ * Returns false with error set, to text in flash, if the statement isn't valid. Switch ids are only checked against
+ * the switch table when the command is run.
+ */
+bool commandParse( const char*& p, Command& cmd, const char*& error )
+{
+  CommandToken verb, arg;
+  long number;
+  int i;
+
+  memset( &cmd, 0, sizeof( Command ) );
+  error = PSTR( "" );
+  if( !commandToken( p, verb ) )
+  {
+    if( *p != '\0' )
+      p++;
+    return true;
+  }
+  for( i = VERB_SET; i < COMMAND_VERBS; i++ )
+  {
+    if( tokenIs( verb, flashTableText( commandVerbNames, i ) ) )
+      cmd.verb = i;
+  }
+
+  switch( cmd.verb )
+  {
+    case VERB_SET:
+    case VERB_VALUE:
+    case VERB_PULSE:
+    case VERB_GET:
+      if( !commandToken( p, arg ) || !tokenToRange( arg, cmd.first, cmd.last ) )
+      {
+        error = PSTR( "expected a switch id, range a-b or *" );
+        return false;
+      }
+      break;
+    case VERB_SCENE:
+      if( !commandToken( p, cmd.name ) )
+      {
+        error = PSTR( "expected a scene name" );
+        return false;
+      }
+      break;
+    default:
+      error = PSTR( "unknown verb" );
+      return false;
+  }
+
+  switch( cmd.verb )
+  {
+    case VERB_SET:
+      if( !commandToken( p, arg ) || !( tokenIs( arg, PSTR( "on" ) ) || tokenIs( arg, PSTR( "off" ) ) ) )
+      {
+        error = PSTR( "expected on or off" );
+        return false;
+      }
+      cmd.state = tokenIs( arg, PSTR( "on" ) );
+      break;
+    case VERB_VALUE:
+      if( !commandToken( p, arg ) || !tokenToFloat( arg, cmd.value ) )
+      {
+        error = PSTR( "expected a value" );
+        return false;
+      }
+      break;
+    case VERB_PULSE:
+      if( !commandToken( p, arg ) || !tokenToLong( arg, number ) || number <= 0 || number > SWITCH_TIMER_MAX )
+      {
+        error = PSTR( "expected an on time in msecs, up to a day" );
+        return false;
+      }
+      cmd.onTime = cmd.offTime = (uint32_t) number;
+      cmd.count = 1;
+      if( commandToken( p, arg ) )
+      {
+        if( !tokenToLong( arg, number ) || number <= 0 || number > SWITCH_TIMER_MAX )
+        {
+          error = PSTR( "expected an off time in msecs, up to a day" );
+          return false;
+        }
+        cmd.offTime = (uint32_t) number;
+        if( commandToken( p, arg ) )
+        {
+          if( !tokenToLong( arg, number ) || number < 0 || number > 65535 )
+          {
+            error = PSTR( "expected a pulse count, 0 for no limit" );
+            return false;
+          }
+          cmd.count = (uint16_t) number;
+        }
+      }
+      break;
+    default:
+      break;
+  }
+
+  if( commandToken( p, arg ) )
+  {
+    error = PSTR( "too many arguments" );
+    return false;
+  }
+  if( *p != '\0' )
+    p++;
+  return true;
+}
+#endif
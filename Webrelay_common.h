@@ -10,36 +10,59 @@ ASCOM project common variables
 
 const int MAX_NAME_LENGTH = 25;
 #define DEFAULT_NUM_SWITCHES 8;
+#define MAX_SWITCHES 16 //most switches the host can have - the tables kept per switch are sized to it
 const int defaultNumSwitches = DEFAULT_NUM_SWITCHES;
 
 //ASCOM driver common variables 
 unsigned int transactionId;
-unsigned int connectedClient = -1;
-bool connected = false;
-const String DriverName = "Skybadger.ESPSwitch";
-const String DriverVersion = "0.0.1";
-const String DriverInfo = "Skybadger.ESPSwitch RESTful native device. ";
-const String Description = "Skybadger ESP2866-based wireless ASCOM switch device";
-const String InterfaceVersion = "2";
-const String DriverType = "Switch";
+//Kept in flash - use FPSTR() to read them, see Webrelay_flash.h
+const char DriverName[] PROGMEM = "Skybadger.ESPSwitch";
+const char DriverVersion[] PROGMEM = "0.0.1";
+const char DriverInfo[] PROGMEM = "Skybadger.ESPSwitch RESTful native device. ";
+const char Description[] PROGMEM = "Skybadger ESP2866-based wireless ASCOM switch device";
+const char InterfaceVersion[] PROGMEM = "2";
+const char DriverType[] PROGMEM = "Switch";
 
+#ifndef TZ
 #define TZ              0       // (utc+) TZ in hours
+#endif
+#ifndef DST_MN
 #define DST_MN          00      // use 60mn for summer time in some countries
+#endif
 #define TZ_MN           ((TZ)*60)
 #define TZ_SEC          ((TZ)*3600)
 #define DST_SEC         ((DST_MN)*60)
 
-const String switchTypes[] = {"PWM","Relay_NO","DAC","Relay_NC"};
-enum SwitchType { SWITCH_PWM, SWITCH_RELAY_NO, SWITCH_RELAY_NC, SWITCH_ANALG_DAC };
+//Names in the same order as the enum. SWITCH_INPUT is a read-only expander pin - see Webrelay_inputs.h
+//SWITCH_SENSOR is a read-only reading from a power monitor - see Webrelay_sensors.h
+//A table of names in flash - read with flashTableEntry()
+const char switchTypePwm[] PROGMEM = "PWM";
+const char switchTypeRelayNo[] PROGMEM = "Relay_NO";
+const char switchTypeRelayNc[] PROGMEM = "Relay_NC";
+const char switchTypeDac[] PROGMEM = "DAC";
+const char switchTypeInput[] PROGMEM = "Input";
+const char switchTypeSensor[] PROGMEM = "Sensor";
+const char* const switchTypes[] PROGMEM = { switchTypePwm, switchTypeRelayNo, switchTypeRelayNc, switchTypeDac, switchTypeInput, switchTypeSensor };
+enum SwitchType { SWITCH_PWM, SWITCH_RELAY_NO, SWITCH_RELAY_NC, SWITCH_ANALG_DAC, SWITCH_INPUT, SWITCH_SENSOR };
 
 /*
  Typical values for PWM And ADC are 0 - 1024/1024, PWM in terms of fraction of the wave is high 
  and DAC in terms of the output voltage as a fraction of Vcc. 
  
  */
+//Switch values are held as whole steps above the switch's min - see Webrelay_switchtypes.h
+typedef int32_t SwitchLevel;
+
 //define the max resolution available to control a DAC or PWM
 #define MAX_DIGITAL_STEPS 1024 
 
+//Analogue outputs ramp to a new value - RAMP_TIME is the msecs taken for a full scale change, 0 for no ramp.
+#define RAMP_TIME 500
+#define RAMP_PERIOD 20 //msecs between ramp steps
+
+//Longest on or off time a switch timer takes - setswitch Duration, setswitchpulse and the pulse command
+#define SWITCH_TIMER_MAX 86400000L //msecs - a day
+
 typedef struct 
 {
   char* description = nullptr;
@@ -47,17 +70,28 @@ typedef struct
   enum SwitchType type = SWITCH_RELAY_NO;
   int pin = -1; //Use for DAC and PWM outputs
   bool writeable = true;
-  float min = 0.0;
+  float min = 0.0;            //ALPACA range - see Webrelay_switchtypes.h, set with switchSetRange()
   float max = 1.0;
   float step = 1.0;
-  float value = 0.0F;
+  SwitchLevel level = 0;      //value as steps above min
+  SwitchLevel rampTarget = 0; //Analogue outputs ramp from level towards this - not stored
+  SwitchLevel maxLevel = 1;   //steps from min to max - not stored
 } SwitchEntry;
 
+//Each ALPACA device number served by this host presents a contiguous slice of the switch table.
+//Connected clients are tracked per device number in the session table - see Webrelay_sessions.h
+#define MAX_ALPACA_DEVICES 4
+typedef struct
+{
+  int firstSwitch = 0;
+  int numSwitches = 0;
+} AlpacaDevice;
+
 //UDP discovery service responder struct.
 #define ALPACA_DISCOVERY_PORT 32227
 struct DiscoveryPacket
  {
-  const char* protocol = "alpadiscovery1" ;
+  const char* protocol = "alpacadiscovery1" ;
   byte version; //1-9, A-Z
   byte reserved[48];
  }; 
@@ -5,16 +5,121 @@ File to define the eeprom variable save/restor operations for the ASCOM switch w
 #define _WEBRELAY_EEPROM_H_
 
 #include "Webrelay_common.h"
+#include "Webrelay_switchtypes.h"
 #include "DebugSerial.h"
+#include "Webrelay_rules.h"
+#include "Webrelay_wifi.h"
+#include "Webrelay_schedule.h"
+#include "Webrelay_scenes.h"
+#include "Webrelay_fastudp.h"
+#include "Webrelay_wear.h"
+#include "Webrelay_sensors.h"
+#include "Webrelay_log.h"
+#include "Webrelay_ota.h"
 //#include "eeprom.h"
 //#include "EEPROMAnything.h"
 
-const byte magic = '*';
+//The magic byte also marks the layout. Images written before values were held as steps used '*' and stored switch and
+//scene values as floats in the same place - they are converted as they are read and saved again in the new layout.
+const byte magic = '+';
+const byte magicFloatValues = '*';
+static_assert( sizeof( float ) == sizeof( SwitchLevel ), "Converted values must fit where the floats were" );
+//Bytes of flash reserved for the EEPROM emulation - enough for 16 switches plus the rule, schedule and scene tables
+#define EEPROM_SIZE 4096
+
+//Configuration changes made through the API are written behind, once no more have arrived for CONFIG_FLUSH_DELAY
+#define CONFIG_FLUSH_DELAY 5000 //msecs
+bool configDirty = false;
+uint32_t configDirtySince = 0;
+
+//Relay states change far more often than the configuration and every commit rewrites the whole flash sector, so they
+//are kept out of the write behind. Each change goes into RTC memory straight away, which survives a restart, a crash
+//or the watchdog but not a power cut, and setupFromEeprom() prefers it to the EEPROM copy. The EEPROM copy is brought
+//up to date no more than once a RELAY_SAVE_PERIOD, with any other save, and before a planned restart - so after a power
+//cut the relays come back as they were up to that long before.
+#define RELAY_SAVE_PERIOD 3600000 //msecs, as for the wear counters
+#define RELAY_RTC_OFFSET ( OTA_RTC_OFFSET + sizeof( OtaRtcRecord ) / 4 ) //4 byte blocks, after the OTA trial record
+#define RELAY_RTC_MAGIC 0x5253u   //'RS'
+typedef struct
+{
+  uint32_t magic;
+  uint32_t count;   //numSwitches when written
+  uint32_t states;  //bit per switch, set for a relay that is on
+  uint32_t check;   //magic ^ count ^ states
+} RelayRtcRecord;
+bool relayDirty = false;          //relay states changed since they were last saved in EEPROM
+uint32_t relaySavedAt = 0;
 
 //definitions
 void setDefaults(void );
 void saveToEeprom(void);
 void setupFromEeprom(void);
+void markConfigDirty(void);
+void markRelayDirty(void);
+bool relaySaveDue(void);
+void relayRestoreRtc(void);
+void flushConfig(void);
+
+void markConfigDirty( void )
+{
+  configDirty = true;
+  configDirtySince = millis();
+}
+
+//Called from setRelayState() after every change
+void markRelayDirty( void )
+{
+  RelayRtcRecord record;
+
+  relayDirty = true;
+  record.magic = RELAY_RTC_MAGIC;
+  record.count = numSwitches;
+  record.states = 0;
+  for( int i = 0; i < numSwitches && i < 32; i++ )
+  {
+    if( switchBackend( switchEntry[i]->type ) == BACKEND_EXPANDER_OUT && switchOn( switchEntry[i] ) )
+      record.states |= ( 1UL << i );
+  }
+  record.check = record.magic ^ record.count ^ record.states;
+  ESP.rtcUserMemoryWrite( RELAY_RTC_OFFSET, (uint32_t*) &record, sizeof( record ) );
+}
+
+bool relaySaveDue( void )
+{
+  return ( relayDirty && ( millis() - relaySavedAt ) > RELAY_SAVE_PERIOD );
+}
+
+//Take the relay states from RTC memory if they were left there by this configuration - newer than the EEPROM copy
+void relayRestoreRtc( void )
+{
+  RelayRtcRecord record;
+
+  if( !ESP.rtcUserMemoryRead( RELAY_RTC_OFFSET, (uint32_t*) &record, sizeof( record ) ) )
+    return;
+  if( record.magic != RELAY_RTC_MAGIC || record.check != ( record.magic ^ record.count ^ record.states ) || record.count != (uint32_t) numSwitches )
+    return;
+  for( int i = 0; i < numSwitches && i < 32; i++ )
+  {
+    if( switchBackend( switchEntry[i]->type ) != BACKEND_EXPANDER_OUT )
+      continue;
+    SwitchLevel level = ( record.states & ( 1UL << i ) ) ? 1 : 0;
+    if( switchEntry[i]->level != level )
+    {
+      switchEntry[i]->level = level;
+      relayDirty = true;
+    }
+  }
+  DEBUGSL1( "relayRestoreRtc: relay states taken from RTC memory" );
+}
+
+void flushConfig( void )
+{
+  if( ( configDirty && ( millis() - configDirtySince ) > CONFIG_FLUSH_DELAY ) || wearSaveDue() || relaySaveDue() )
+  {
+    saveToEeprom();
+    configDirty = false;
+  }
+}
 
 void setDefaults( void )
 {
@@ -33,6 +138,22 @@ void setDefaults( void )
   strcpy ( thisID, myHostname );
 
   udpPort = ALPACA_DISCOVERY_PORT;
+  numDevices = 1;
+  numRules = 0;
+  compileRules();
+  wifiChannel = 0;
+  wifiRestartWindow = WIFI_RESTART_WINDOW;
+  numSchedules = 0;
+  siteLatitude = 0.0F;
+  siteLongitude = 0.0F;
+  numScenes = 0;
+  fastPort = 0;
+  fastSetKey( "" );
+  wearReset();
+  numSensors = 0;
+  logSyslogServer = 0;
+  logSyslogPort = LOG_SYSLOG_PORT;
+  otaRollbackUrl[0] = '\0';
   
   //Allocate storage for Number of Switch settings
   numSwitches = defaultNumSwitches;
@@ -56,39 +177,23 @@ void setDefaults( void )
     switchEntry[i]->writeable = true;    
     switchEntry[i]->type = SWITCH_RELAY_NO;
     switchEntry[i]->pin = 0;
-    switchEntry[i]->min = 0.0F;
-    switchEntry[i]->max = 1.0F;
-    switchEntry[i]->step = 1.0F;
-    switchEntry[i]->value = 0.0F;
+    switchEntry[i]->level = 0;
+    switchSetRange( switchEntry[i], 0.0F, 1.0F, 1.0F );
   }
 
-//#if defined DEBUG
   //Read them back for checking  - also available via status command.
-  Serial.printf( "Switches %i: \n" , numSwitches );
-  Serial.printf( "Hostname %s: \n" , myHostname );
-  Serial.printf( "Discovery port %i: \n" , udpPort );
+  LOGD( "Switches %i, hostname %s, discovery port %i", numSwitches, myHostname, udpPort );
   for ( i=0;i < numSwitches; i++ )
   {
-    String output;
-    Serial.printf( "Switch %i: \n" , i) ;
-    Serial.printf( "Desc %s \n" , switchEntry[i]->description );
-    Serial.printf( "Name %s \n" , switchEntry[i]->switchName );  
-    Serial.printf( "Type %i \n", switchEntry[i]->type );
-    Serial.printf( "Pin %i \n", switchEntry[i]->pin );
-    Serial.printf( "Min %2.2f \n", switchEntry[i]->min );
-    Serial.printf( "Max %2.2f \n", switchEntry[i]->max );
-    Serial.printf( "Step %2.2f \n", switchEntry[i]->step );
-    Serial.printf( "Value %2.2f \n", switchEntry[i]->value );
-    Serial.printf( "Writeable %i \n", switchEntry[i]->writeable );     
-  }
-//#endif
+    LOGD( "Switch %i: desc %s, name %s, type %i, pin %i", i, switchEntry[i]->description, switchEntry[i]->switchName, switchEntry[i]->type, switchEntry[i]->pin );
+    LOGD( "Switch %i: min %2.2f, max %2.2f, step %2.2f, level %i, writeable %i", i, switchEntry[i]->min, switchEntry[i]->max, switchEntry[i]->step, switchEntry[i]->level, switchEntry[i]->writeable );
+  }
   DEBUGSL1( "setDefaults: exiting" );
 }
 
 void saveToEeprom( void )
 {
   int eepromAddr = 0;
-  const char magic = '*';
 
   DEBUGSL1( "savetoEeprom: Entered ");
    
@@ -117,8 +222,8 @@ void saveToEeprom( void )
     eepromAddr += sizeof( switchEntry[i]->max );
     EEPROMWriteAnything( eepromAddr, switchEntry[i]->step );
     eepromAddr += sizeof( switchEntry[i]->step );
-    EEPROMWriteAnything( eepromAddr, switchEntry[i]->value );
-    eepromAddr += sizeof( switchEntry[i]->value );
+    EEPROMWriteAnything( eepromAddr, switchEntry[i]->level );
+    eepromAddr += sizeof( switchEntry[i]->level );
     
     EEPROMWriteString( eepromAddr, switchEntry[i]->switchName, MAX_NAME_LENGTH );
     eepromAddr += MAX_NAME_LENGTH * sizeof( char);    
@@ -133,25 +238,124 @@ void saveToEeprom( void )
   
   DEBUGS1( "Written hostname: ");DEBUGSL1( myHostname );
 
+  //ALPACA device numbers
+  EEPROMWriteAnything( eepromAddr, numDevices );
+  eepromAddr += sizeof(int);  
+  DEBUGS1( "Written numDevices: ");DEBUGSL1( numDevices );
+
+  //Interlock rules
+  EEPROMWriteAnything( eepromAddr, numRules );
+  eepromAddr += sizeof(int);  
+  for ( int i = 0; i < numRules; i++ )
+  {
+    EEPROMWriteAnything( eepromAddr, rule[i] );
+    eepromAddr += sizeof( Rule );
+  }
+  DEBUGS1( "Written numRules: ");DEBUGSL1( numRules );
+
+  //Access point last joined, for a fast reconnect
+  EEPROMWriteAnything( eepromAddr, wifiChannel );
+  eepromAddr += sizeof(int);  
+  EEPROMWriteAnything( eepromAddr, wifiBssid );
+  eepromAddr += sizeof( wifiBssid );
+  DEBUGS1( "Written wifiChannel: ");DEBUGSL1( wifiChannel );
+  EEPROMWriteAnything( eepromAddr, wifiRestartWindow );
+  eepromAddr += sizeof(int);  
+  DEBUGS1( "Written wifiRestartWindow: ");DEBUGSL1( wifiRestartWindow );
+
+  //Switch schedule and the site it works out sunrise and sunset for
+  EEPROMWriteAnything( eepromAddr, siteLatitude );
+  eepromAddr += sizeof( siteLatitude );
+  EEPROMWriteAnything( eepromAddr, siteLongitude );
+  eepromAddr += sizeof( siteLongitude );
+  EEPROMWriteAnything( eepromAddr, numSchedules );
+  eepromAddr += sizeof(int);  
+  for ( int i = 0; i < numSchedules; i++ )
+  {
+    EEPROMWriteAnything( eepromAddr, schedule[i] );
+    eepromAddr += sizeof( ScheduleEntry );
+  }
+  DEBUGS1( "Written numSchedules: ");DEBUGSL1( numSchedules );
+
+  //Scenes
+  EEPROMWriteAnything( eepromAddr, numScenes );
+  eepromAddr += sizeof(int);  
+  for ( int i = 0; i < numScenes; i++ )
+  {
+    EEPROMWriteAnything( eepromAddr, scene[i] );
+    eepromAddr += sizeof( Scene );
+  }
+  DEBUGS1( "Written numScenes: ");DEBUGSL1( numScenes );
+
+  //Fast UDP control port and its key
+  EEPROMWriteAnything( eepromAddr, fastPort );
+  eepromAddr += sizeof(int);  
+  EEPROMWriteAnything( eepromAddr, fastKey );
+  eepromAddr += sizeof( fastKey );
+  DEBUGS1( "Written fastPort: ");DEBUGSL1( fastPort );
+
+  //Wear counters, brought up to date first
+  int wearCount = ( numSwitches < MAX_WEAR_SWITCHES ) ? numSwitches : MAX_WEAR_SWITCHES;
+  EEPROMWriteAnything( eepromAddr, wearCount );
+  eepromAddr += sizeof(int);  
+  for ( int i = 0; i < wearCount; i++ )
+  {
+    wearSync( i, switchEntry[i]->maxLevel );
+    EEPROMWriteAnything( eepromAddr, wear[i] );
+    eepromAddr += sizeof( WearCounter );
+  }
+  wearDirty = false;
+  wearSavedAt = millis();
+  relayDirty = false;
+  relaySavedAt = millis();
+  DEBUGS1( "Written wearCount: ");DEBUGSL1( wearCount );
+
+  //Power monitor bindings
+  EEPROMWriteAnything( eepromAddr, numSensors );
+  eepromAddr += sizeof(int);
+  for ( int i = 0; i < numSensors; i++ )
+  {
+    EEPROMWriteAnything( eepromAddr, sensor[i] );
+    eepromAddr += sizeof( SensorBinding );
+  }
+  DEBUGS1( "Written numSensors: ");DEBUGSL1( numSensors );
+
+  //Syslog destination
+  EEPROMWriteAnything( eepromAddr, logSyslogServer );
+  eepromAddr += sizeof( logSyslogServer );
+  EEPROMWriteAnything( eepromAddr, logSyslogPort );
+  eepromAddr += sizeof( logSyslogPort );
+  DEBUGS1( "Written logSyslogPort: ");DEBUGSL1( logSyslogPort );
+
+  //Image to download if an update fails its trial
+  EEPROMWriteAnything( eepromAddr, otaRollbackUrl );
+  eepromAddr += sizeof( otaRollbackUrl );
+  DEBUGS1( "Written otaRollbackUrl: ");DEBUGSL1( otaRollbackUrl );
+
   //Magic number write for first time. 
   EEPROM.put( 0, magic );
 
+  uint32_t commitStart = micros();
   EEPROM.commit();
+  histRecord( &eepromCommitHist, micros() - commitStart );
 
-  //Test readback of contents
-  String input = "";
+#if LOG_LEVEL >= LOG_DEBUG
+  //Test readback of contents, a line of 50 bytes at a time
+  char row[51];
   char ch;
   for ( int i = 0; i < 500 ; i++ )
   {
     ch = (char) EEPROM.read( i );
     if ( ch == '\0' )
       ch = '~';
-    if ( (i % 50 ) == 0 )
-      input.concat( "\n\r" );
-    input.concat( ch );
+    row[ i % 50 ] = ch;
+    if ( (i % 50 ) == 49 )
+    {
+      row[50] = '\0';
+      LOGD( "EEPROM contents after %03i: %s", i - 49, row );
+    }
   }
-  
-  Serial.printf( "EEPROM contents after: \n %s \n", input.c_str() );
+#endif
   DEBUGSL1( "saveToEeprom: exiting ");
 }
 
@@ -160,12 +364,14 @@ void setupFromEeprom( void )
   int eepromAddr = 0;
     
   DEBUGSL1( "setUpFromEeprom: Entering ");
+  EEPROM.begin( EEPROM_SIZE );
   byte myMagic = '\0';
   //Setup internal variables - read from EEPROM.
   EEPROM.get( eepromAddr=0, myMagic );
   DEBUGS1( "Read magic: ");DEBUGSL1( myMagic );
   
-  if ( (byte) myMagic != magic ) //initialise
+  bool floatValues = ( (byte) myMagic == magicFloatValues );
+  if ( (byte) myMagic != magic && !floatValues ) //initialise
   {
     setDefaults();
     saveToEeprom();
@@ -176,14 +382,25 @@ void setupFromEeprom( void )
   //Num Switches 
   EEPROM.get( eepromAddr = 1, numSwitches );
   eepromAddr  += sizeof(int);
+  //A count the tables can't hold means the rest of the record can't be trusted either
+  if( numSwitches < 0 || numSwitches > MAX_SWITCHES )
+  {
+    LOGW( "Switch count %i in EEPROM out of range - wrote defaults", numSwitches );
+    setDefaults();
+    saveToEeprom();
+    return;
+  }
 
   //UDP port 
   EEPROM.get( eepromAddr, udpPort );
   eepromAddr  += sizeof(int);
 
   //switch entries
+  switchEntry = (SwitchEntry**) calloc( sizeof( SwitchEntry* ), numSwitches );
   for ( int i=0; i< numSwitches; i++ )
   {
+    switchEntry[i]= (SwitchEntry*) calloc( sizeof( SwitchEntry ), 1 );
+    
     EEPROMReadAnything( eepromAddr, switchEntry[i]->type );
     eepromAddr += sizeof( switchEntry[i]->type );
     EEPROMReadAnything( eepromAddr, switchEntry[i]->pin );
@@ -196,8 +413,20 @@ void setupFromEeprom( void )
     eepromAddr += sizeof( switchEntry[i]->max );
     EEPROMReadAnything( eepromAddr, switchEntry[i]->step );
     eepromAddr += sizeof( switchEntry[i]->step );
-    EEPROMReadAnything( eepromAddr, switchEntry[i]->value );
-    eepromAddr += sizeof( switchEntry[i]->value );
+    if( floatValues )
+    {
+      float value;
+      EEPROMReadAnything( eepromAddr, value );
+      switchSetRange( switchEntry[i], switchEntry[i]->min, switchEntry[i]->max, switchEntry[i]->step );
+      if( !switchLevel( switchEntry[i], value, switchEntry[i]->level ) )
+        switchEntry[i]->level = 0;
+    }
+    else
+      EEPROMReadAnything( eepromAddr, switchEntry[i]->level );
+    eepromAddr += sizeof( switchEntry[i]->level );
+    switchSetRange( switchEntry[i], switchEntry[i]->min, switchEntry[i]->max, switchEntry[i]->step );
+    if( switchEntry[i]->level < 0 )
+      switchEntry[i]->level = 0;
     
     if( switchEntry[i]->switchName != nullptr )
       free( switchEntry[i]->switchName );
@@ -217,14 +446,161 @@ void setupFromEeprom( void )
     free( myHostname );
   myHostname = (char*) calloc( MAX_NAME_LENGTH, sizeof( char ) );  
   EEPROMReadString( eepromAddr, myHostname, MAX_NAME_LENGTH );
+  eepromAddr += MAX_NAME_LENGTH;  
   DEBUGS1( "Read hostname: ");DEBUGSL1( myHostname );
 
+  //ALPACA device numbers - older images didn't store this so range check it.
+  EEPROMReadAnything( eepromAddr, numDevices );
+  eepromAddr += sizeof(int);  
+  if( numDevices < 1 || numDevices > MAX_ALPACA_DEVICES )
+    numDevices = 1;
+  DEBUGS1( "Read numDevices: ");DEBUGSL1( numDevices );
+
+  //Interlock rules - also missing from older images
+  EEPROMReadAnything( eepromAddr, numRules );
+  eepromAddr += sizeof(int);  
+  if( numRules < 0 || numRules > MAX_RULES )
+    numRules = 0;
+  for ( int i = 0; i < numRules; i++ )
+  {
+    EEPROMReadAnything( eepromAddr, rule[i] );
+    eepromAddr += sizeof( Rule );
+    if( rule[i].type > RULE_DELAY_AFTER )
+      rule[i].type = RULE_NONE;
+  }
+  compileRules();
+  DEBUGS1( "Read numRules: ");DEBUGSL1( numRules );
+
+  //Cached access point - older images don't have one, so anything but a valid channel means scan
+  EEPROMReadAnything( eepromAddr, wifiChannel );
+  eepromAddr += sizeof(int);  
+  EEPROMReadAnything( eepromAddr, wifiBssid );
+  eepromAddr += sizeof( wifiBssid );
+  if( wifiChannel < 1 || wifiChannel > 14 )
+    wifiChannel = 0;
+  DEBUGS1( "Read wifiChannel: ");DEBUGSL1( wifiChannel );
+  EEPROMReadAnything( eepromAddr, wifiRestartWindow );
+  eepromAddr += sizeof(int);  
+  if( wifiRestartWindow < 0 || wifiRestartWindow > WIFI_RESTART_WINDOW_MAX )
+    wifiRestartWindow = WIFI_RESTART_WINDOW;
+  DEBUGS1( "Read wifiRestartWindow: ");DEBUGSL1( wifiRestartWindow );
+
+  //Switch schedule - also missing from older images
+  EEPROMReadAnything( eepromAddr, siteLatitude );
+  eepromAddr += sizeof( siteLatitude );
+  EEPROMReadAnything( eepromAddr, siteLongitude );
+  eepromAddr += sizeof( siteLongitude );
+  if( !( siteLatitude >= -90.0F && siteLatitude <= 90.0F && siteLongitude >= -180.0F && siteLongitude <= 180.0F ) )
+  {
+    siteLatitude = 0.0F;
+    siteLongitude = 0.0F;
+  }
+  EEPROMReadAnything( eepromAddr, numSchedules );
+  eepromAddr += sizeof(int);  
+  if( numSchedules < 0 || numSchedules > MAX_SCHEDULES )
+    numSchedules = 0;
+  for ( int i = 0; i < numSchedules; i++ )
+  {
+    EEPROMReadAnything( eepromAddr, schedule[i] );
+    eepromAddr += sizeof( ScheduleEntry );
+  }
+  scheduleStale = true;
+  DEBUGS1( "Read numSchedules: ");DEBUGSL1( numSchedules );
+
+  //Scenes - also missing from older images
+  EEPROMReadAnything( eepromAddr, numScenes );
+  eepromAddr += sizeof(int);  
+  if( numScenes < 0 || numScenes > MAX_SCENES )
+    numScenes = 0;
+  for ( int i = 0; i < numScenes; i++ )
+  {
+    EEPROMReadAnything( eepromAddr, scene[i] );
+    eepromAddr += sizeof( Scene );
+    scene[i].name[ SCENE_NAME_LENGTH - 1 ] = '\0';
+    for( int j = 0; floatValues && j < MAX_SCENE_SWITCHES; j++ )
+    {
+      float value;
+      memcpy( &value, &scene[i].level[j], sizeof( value ) );
+      if( j >= numSwitches || !switchLevel( switchEntry[j], value, scene[i].level[j] ) )
+        scene[i].level[j] = 0;
+    }
+  }
+  DEBUGS1( "Read numScenes: ");DEBUGSL1( numScenes );
+
+  //Fast UDP control - also missing from older images, so off unless the port is valid
+  EEPROMReadAnything( eepromAddr, fastPort );
+  eepromAddr += sizeof(int);  
+  EEPROMReadAnything( eepromAddr, fastKey );
+  eepromAddr += sizeof( fastKey );
+  if( fastPort < 0 || fastPort > 65535 )
+    fastPort = 0;
+  fastSetKey( fastKey );
+  DEBUGS1( "Read fastPort: ");DEBUGSL1( fastPort );
+
+  //Wear counters - also missing from older images, so start from zero unless there is one for each switch
+  int wearCount = 0;
+  wearReset();
+  EEPROMReadAnything( eepromAddr, wearCount );
+  eepromAddr += sizeof(int);  
+  if( wearCount == ( ( numSwitches < MAX_WEAR_SWITCHES ) ? numSwitches : MAX_WEAR_SWITCHES ) )
+  {
+    for ( int i = 0; i < wearCount; i++ )
+    {
+      EEPROMReadAnything( eepromAddr, wear[i] );
+      eepromAddr += sizeof( WearCounter );
+    }
+  }
+  DEBUGS1( "Read wearCount: ");DEBUGSL1( wearCount );
+
+  //Power monitor bindings - also missing from older images. Any that don't check out are dropped.
+  int sensorCount = 0;
+  numSensors = 0;
+  EEPROMReadAnything( eepromAddr, sensorCount );
+  eepromAddr += sizeof(int);  
+  if( sensorCount < 0 || sensorCount > MAX_SENSORS )
+    sensorCount = 0;
+  for ( int i = 0; i < sensorCount; i++ )
+  {
+    SensorBinding binding;
+    EEPROMReadAnything( eepromAddr, binding );
+    eepromAddr += sizeof( SensorBinding );
+    if( binding.target < numSwitches )
+      addSensor( binding );
+  }
+  DEBUGS1( "Read numSensors: ");DEBUGSL1( numSensors );
+
+  //Syslog destination - missing from older images too, which turns it off
+  EEPROMReadAnything( eepromAddr, logSyslogServer );
+  eepromAddr += sizeof( logSyslogServer );
+  EEPROMReadAnything( eepromAddr, logSyslogPort );
+  eepromAddr += sizeof( logSyslogPort );
+  if( logSyslogPort < 1 || logSyslogPort > 65535 || logSyslogServer == 0xFFFFFFFF )
+  {
+    logSyslogServer = 0;
+    logSyslogPort = LOG_SYSLOG_PORT;
+  }
+  DEBUGS1( "Read logSyslogPort: ");DEBUGSL1( logSyslogPort );
+
+  //Rollback image URL - erased flash reads as 0xFF, so anything that isn't a URL is dropped
+  EEPROMReadAnything( eepromAddr, otaRollbackUrl );
+  eepromAddr += sizeof( otaRollbackUrl );
+  otaRollbackUrl[OTA_URL_LENGTH - 1] = '\0';
+  if( strncmp( otaRollbackUrl, "http://", 7 ) != 0 )
+    otaRollbackUrl[0] = '\0';
+  DEBUGS1( "Read otaRollbackUrl: ");DEBUGSL1( otaRollbackUrl );
+
   //Setup MQTT client id based on hostname
   if ( thisID != nullptr ) 
      free ( thisID );
   thisID = (char*) calloc( MAX_NAME_LENGTH, sizeof( char)  );       
   strcpy ( thisID, myHostname );
 
+  relayRestoreRtc();
+  if( floatValues )
+  {
+    DEBUGSL1( "setupFromEeprom: converted values to steps - saving in the new layout" );
+    saveToEeprom();
+  }
   DEBUGSL1( "setupFromEeprom: exiting" );
 }
 #endif
@@ -0,0 +1,109 @@
+/*
+Webrelay_eventqueue.h
+Lock-free single producer, single consumer ring queue for passing typed events into loop().
+Timer callbacks, the MQTT callback and GPIO interrupts post events here instead of setting flags, so events aren't
+lost if several arrive before loop() sees them and each event can carry a small payload.
+The queue is a fixed array - posting and reading never allocate and never block. If the queue is full the event is
+dropped and counted rather than overwriting one not yet read.
+
+Only one context may post into a given queue and only one may read it. On the ESP8266 the SDK timer callbacks and the
+MQTT callback (called from within client.loop()) never pre-empt each other or loop(), so they count as one producer
+and share a queue. GPIO interrupts can pre-empt anything, so they must post into a queue of their own.
+The head and tail indexes are free running and only ever written by one side, with acquire/release ordering on the
+index updates, so the same code can be run on the host for testing.
+*/
+#ifndef _WEBRELAY_EVENTQUEUE_H_
+#define _WEBRELAY_EVENTQUEUE_H_
+
+#include <stdint.h>
+
+#if !defined ICACHE_RAM_ATTR
+#define ICACHE_RAM_ATTR
+#endif
+
+enum EventType
+{
+  EVENT_NONE = 0,
+  EVENT_TICK,           //periodic timer
+  EVENT_TIMER_WHEEL,    //timeoutTimer tick - advance the switch timer wheel
+  EVENT_SESSION_EXPIRY, //time to check for idle client sessions
+  EVENT_MQTT,           //message received on a subscribed topic
+  EVENT_GPIO,           //pin interrupt - arg8 is the pin
+};
+
+typedef struct
+{
+  uint8_t type;
+  uint8_t arg8;
+  uint16_t arg16;
+  uint32_t arg;
+} Event;
+
+template <uint16_t N> class EventQueue
+{
+  static_assert( N >= 2 && ( N & ( N - 1 ) ) == 0, "EventQueue size must be a power of 2" );
+
+  public:
+  //Producer side. Returns false and counts the event as dropped if the queue is full.
+  ICACHE_RAM_ATTR bool post( uint8_t type, uint8_t arg8 = 0, uint16_t arg16 = 0, uint32_t arg = 0 )
+  {
+    uint16_t head = __atomic_load_n( &_head, __ATOMIC_RELAXED );
+    uint16_t tail = __atomic_load_n( &_tail, __ATOMIC_ACQUIRE );
+    if( (uint16_t)( head - tail ) >= N )
+    {
+      _dropped++;
+      return false;
+    }
+    Event* e = &_buffer[ head & ( N - 1 ) ];
+    e->type = type;
+    e->arg8 = arg8;
+    e->arg16 = arg16;
+    e->arg = arg;
+    __atomic_store_n( &_head, (uint16_t)( head + 1 ), __ATOMIC_RELEASE );
+    return true;
+  }
+
+  //Consumer side. Returns false if there is nothing to read.
+  bool get( Event& event )
+  {
+    uint16_t tail = __atomic_load_n( &_tail, __ATOMIC_RELAXED );
+    uint16_t head = __atomic_load_n( &_head, __ATOMIC_ACQUIRE );
+    if( head == tail )
+      return false;
+    event = _buffer[ tail & ( N - 1 ) ];
+    __atomic_store_n( &_tail, (uint16_t)( tail + 1 ), __ATOMIC_RELEASE );
+    return true;
+  }
+
+  //Consumer side. Reads up to max events in one go, returns the number read.
+  int drain( Event* events, int max )
+  {
+    uint16_t tail = __atomic_load_n( &_tail, __ATOMIC_RELAXED );
+    uint16_t head = __atomic_load_n( &_head, __ATOMIC_ACQUIRE );
+    int count = 0;
+    while( tail != head && count < max )
+    {
+      events[count++] = _buffer[ tail & ( N - 1 ) ];
+      tail++;
+    }
+    __atomic_store_n( &_tail, tail, __ATOMIC_RELEASE );
+    return count;
+  }
+
+  uint16_t size( void )
+  {
+    return (uint16_t)( __atomic_load_n( &_head, __ATOMIC_ACQUIRE ) - __atomic_load_n( &_tail, __ATOMIC_ACQUIRE ) );
+  }
+
+  uint32_t dropped( void )
+  {
+    return _dropped;
+  }
+
+  private:
+  Event _buffer[N];
+  uint16_t _head = 0;
+  uint16_t _tail = 0;
+  volatile uint32_t _dropped = 0;
+};
+#endif
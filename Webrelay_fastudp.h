@@ -0,0 +1,156 @@
+/*
+Webrelay_fastudp.h
+Optional binary switch control over UDP, for clients such as camera shutter sync and flat panel triggers that need a
+relay change in a millisecond or two rather than the tens of msecs an HTTP request takes on the ESP8266.
+It listens on its own port, set on the setup page together with a shared key, and is off while either is unset.
+Every datagram is one fixed size FastFrame, little endian as the ESP8266 is, signed with HMAC-SHA256 over everything
+before the mac using the shared key. Frames that are the wrong size or fail the check are counted and dropped without
+a reply, so the port can't be used to reflect traffic.
+ FAST_SET - switches whose bit is set in mask take the relay level from the same bit of state, or value[i] for an
+            analogue output - in steps above the switch's min, as the switch table holds it. The relays change as one, through the interlock rules, and go to the expander in the
+            same call, before the reply is sent. Analogue outputs are written at once, without ramping.
+ FAST_GET - changes nothing, just gets a reply.
+Each is answered by a FAST_ACK carrying the status, the relay states, the expander pins that hold the level asked for
+(applied), and every switch's value - so the reply shows the state actually applied.
+Each boot picks a random session number which goes in every reply. A FAST_SET must carry the current session and a
+sequence number higher than the last one accepted in that session, so a captured frame can't be replayed, even after
+a restart. A FAST_SET that fails this gets a FAST_STALE reply with the session and the last sequence number accepted,
+so the client can carry on from there - a FAST_GET is the way to learn the session to start with.
+Host switch indexes are used - bit i of mask is switchEntry[i] - whichever ALPACA device the switch is served as.
+*/
+#ifndef _WEBRELAY_FASTUDP_H_
+#define _WEBRELAY_FASTUDP_H_
+
+#include <WiFiUdp.h>
+#include <bearssl/bearssl_hmac.h>
+#include "Webrelay_common.h"
+#include "Webrelay_metrics.h"
+#include "DebugSerial.h"
+
+#define FAST_VERSION 1
+#define FAST_SWITCHES MAX_SWITCHES //switches a frame covers
+#define FAST_MAC_LENGTH 32
+#define FAST_KEY_LENGTH 32   //including the terminating null
+#define FAST_BATCH 4         //frames handled per run of the fastudp task
+
+static_assert( FAST_SWITCHES <= 16, "a frame's mask and state are 16 bits" );
+
+enum FastType { FAST_SET = 1, FAST_GET, FAST_ACK };
+enum FastStatus { FAST_OK, FAST_STALE, FAST_INVALID, FAST_REFUSED };
+
+typedef struct
+{
+  uint8_t magic[2];   //'W' 'R'
+  uint8_t version;
+  uint8_t type;       //FastType
+  uint32_t session;
+  uint32_t seq;
+  uint16_t mask;      //switches addressed
+  uint16_t state;     //relay levels - on in a FAST_ACK
+  uint8_t status;     //FastStatus, FAST_ACK only
+  uint8_t applied;    //FAST_ACK - expander pins holding the level asked for
+  uint8_t switches;   //FAST_ACK - numSwitches
+  uint8_t reserved;
+  uint16_t value[FAST_SWITCHES];
+  uint8_t mac[FAST_MAC_LENGTH];
+} __attribute__((packed)) FastFrame;
+
+WiFiUDP fastUdp;
+int fastPort = 0;                  //0 for off - stored in EEPROM
+char fastKey[FAST_KEY_LENGTH];     //stored in EEPROM
+br_hmac_key_context fastKeyContext;
+uint32_t fastSession = 0;          //picked once WiFi is up, when the hardware random number generator is seeded
+uint32_t fastLastSeq = 0;
+uint32_t fastFrames = 0;           //frames answered
+uint32_t fastBadFrames = 0;        //wrong size or format
+uint32_t fastAuthFailures = 0;
+uint32_t fastStale = 0;
+LatencyHistogram fastUdpHist;      //receipt to reply sent
+
+//Function definitions
+bool fastEnabled( void );
+void fastSetKey( const char* key );
+void fastMac( const FastFrame& frame, uint8_t* mac );
+bool fastReceive( int size, FastFrame& frame );
+uint8_t fastCheckSequence( FastFrame& frame );
+void fastSend( FastFrame& frame );
+
+bool fastEnabled( void )
+{
+  return ( fastPort > 0 && fastKey[0] != '\0' );
+}
+
+//Set the shared key and work out the HMAC key schedule once, rather than for every frame
+void fastSetKey( const char* key )
+{
+  if( key != fastKey )
+    strncpy( fastKey, key, FAST_KEY_LENGTH - 1 );
+  fastKey[FAST_KEY_LENGTH - 1] = '\0';
+  br_hmac_key_init( &fastKeyContext, &br_sha256_vtable, fastKey, strlen( fastKey ) );
+}
+
+void fastMac( const FastFrame& frame, uint8_t* mac )
+{
+  br_hmac_context ctx;
+  br_hmac_init( &ctx, &fastKeyContext, 0 );
+  br_hmac_update( &ctx, &frame, offsetof( FastFrame, mac ) );
+  br_hmac_out( &ctx, mac );
+}
+
+/*
+ * Read the datagram parsePacket() found into frame and check it. Returns false, and counts why, if it isn't a
+ * well formed frame signed with the shared key.
+ */
+bool fastReceive( int size, FastFrame& frame )
+{
+  uint8_t mac[FAST_MAC_LENGTH];
+  uint8_t diff = 0;
+
+  if( size != sizeof( FastFrame ) || fastUdp.read( (unsigned char*) &frame, sizeof( FastFrame ) ) != sizeof( FastFrame ) ||
+      frame.magic[0] != 'W' || frame.magic[1] != 'R' || frame.version != FAST_VERSION ||
+      ( frame.type != FAST_SET && frame.type != FAST_GET ) )
+  {
+    fastBadFrames++;
+    return false;
+  }
+  fastMac( frame, mac );
+  //Compare every byte so the time taken doesn't tell how much of the mac was right
+  for( int i = 0; i < FAST_MAC_LENGTH; i++ )
+    diff |= mac[i] ^ frame.mac[i];
+  if( diff != 0 )
+  {
+    fastAuthFailures++;
+    return false;
+  }
+  return true;
+}
+
+//FAST_STALE if a FAST_SET isn't for this session or has been seen before
+uint8_t fastCheckSequence( FastFrame& frame )
+{
+  if( frame.type == FAST_GET )
+    return FAST_OK;
+  if( frame.session != fastSession || frame.seq <= fastLastSeq )
+  {
+    DEBUGS1( "fastCheckSequence: stale frame " ); DEBUGSL1( frame.seq );
+    fastStale++;
+    return FAST_STALE;
+  }
+  fastLastSeq = frame.seq;
+  return FAST_OK;
+}
+
+//Sign the reply and send it back to where the request came from
+void fastSend( FastFrame& frame )
+{
+  frame.type = FAST_ACK;
+  frame.session = fastSession;
+  if( frame.status == FAST_STALE )
+    frame.seq = fastLastSeq;
+  fastMac( frame, frame.mac );
+  fastUdp.beginPacket( fastUdp.remoteIP(), fastUdp.remotePort() );
+  fastUdp.write( (const uint8_t*) &frame, sizeof( FastFrame ) );
+  fastUdp.endPacket();
+  fastFrames++;
+}
+#endif
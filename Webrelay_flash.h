@@ -0,0 +1,35 @@
+/*
+Webrelay_flash.h
+Keeping constant text out of RAM. The ESP8266 copies string literals and other const data into its 80KB of DRAM at
+boot, so every message, name and page fragment takes heap for good whether it is used or not. Text that never
+changes is kept in flash instead:
+ - literals used once are written F("...") - String, Print, ArduinoJson, hasArgIC(), server.arg() and
+   jsonResponseBuilder() all take them, copying the text out when it is used, so handlers keep their argument
+   names as F() pointers rather than Strings;
+ - format strings are PSTR("...") and go to the _P functions, e.g. snprintf_P() and Serial.printf_P();
+ - text named in several places is a PROGMEM char array, read through FPSTR();
+ - tables of names or messages are PROGMEM arrays of pointers to PROGMEM arrays, read with flashTableText() or
+   flashTableEntry().
+Flash can only be read 32 bits at a time, so text in flash must never be read as a plain char* - only through the
+_P functions or as a __FlashStringHelper.
+Keyword tables the parsers match against, such as the command verbs, are flash tables too, compared with
+strcasecmp_P() or, for the command tokenizer, strncasecmp_P() - see tokenIs().
+*/
+#ifndef _WEBRELAY_FLASH_H_
+#define _WEBRELAY_FLASH_H_
+
+//Function definitions
+PGM_P flashTableText( const char* const table[], int index );
+const __FlashStringHelper* flashTableEntry( const char* const table[], int index );
+
+//Entry of a PROGMEM table - the pointer is in flash as well as the text it points to
+inline PGM_P flashTableText( const char* const table[], int index )
+{
+  return (PGM_P) pgm_read_ptr( &table[index] );
+}
+
+inline const __FlashStringHelper* flashTableEntry( const char* const table[], int index )
+{
+  return FPSTR( flashTableText( table, index ) );
+}
+#endif
@@ -0,0 +1,783 @@
+/*
+Webrelay_httpserver.h
+Non-blocking HTTP server for the ALPACA API, in place of ESP8266WebServer.
+ESP8266WebServer::handleClient() serves one client at a time and waits while it reads the headers and body, so one
+slow client on poor WiFi holds up every other client and the MQTT keepalive. This server keeps a WiFiServer
+listening and up to HTTP_MAX_CONNECTIONS connections open at once. Each pass of handleClient() accepts a new
+connection if there is one and then, for each connection, reads only the bytes that have already arrived into that
+connection's parse state machine - request line, headers, body - and writes only as much of a response as the TCP
+send buffer will take. Nothing waits for the network, except when a large chunked response has to be pushed out
+to stay inside its buffer.
+Every buffer is a fixed size per connection: a request line, header line or body longer than HTTP_LINE_MAX gets an
+error response and the connection closed, as does a connection that goes quiet for HTTP_IDLE_TIMEOUT.
+Once a request has been read its arguments (query string and form body) are decoded into the connection's argument
+pool, and the handler is called exactly as ESP8266WebServer would call it - handlers use the same on(), arg(),
+method(), send(), setContentLength() and sendContent() calls as before. Argument names are matched ignoring case,
+as ALPACA requires. Each response closes its connection.
+Handlers are found from the on() table first, then the dispatchers added with addHandler() - which parse the URI
+themselves - and then the not found handler.
+A body too big to hold - a firmware image - can be taken by a stream handler added with onStream(). Its body isn't
+buffered: each pass hands the stream handler the next HTTP_STREAM_BUDGET bytes or less as they arrive, so other
+requests and tasks carry on between the pieces.
+*/
+#ifndef _WEBRELAY_HTTPSERVER_H_
+#define _WEBRELAY_HTTPSERVER_H_
+
+#include <ESP8266WiFi.h>
+#include <ESP8266WebServer.h> //HTTPMethod and CONTENT_LENGTH_UNKNOWN
+#include "Webrelay_common.h"
+#include "DebugSerial.h"
+
+#define HTTP_MAX_CONNECTIONS 4
+#define HTTP_LINE_MAX 256      //longest request line, header line or body
+#define HTTP_URI_MAX 96
+#define HTTP_ARG_POOL 384      //decoded argument names and values
+#define HTTP_MAX_ARGS 12
+#define HTTP_MAX_ROUTES 16
+#define HTTP_MAX_DISPATCHERS 2
+#define HTTP_READ_CHUNK 64     //bytes read from a connection at a time
+#define HTTP_READ_BUDGET 512   //bytes read from one connection per pass
+#define HTTP_IDLE_TIMEOUT 5000 //msecs
+#define HTTP_OUTPUT_HIGH_WATER 1460 //bytes of response held before it is pushed out
+#define HTTP_STREAM_BUDGET 1460 //bytes of a streamed body passed on per pass
+#define HTTP_MAX_STREAMS 1
+
+enum HttpParseState { HTTP_IDLE, HTTP_REQUEST_LINE, HTTP_HEADERS, HTTP_BODY, HTTP_STREAM, HTTP_RESPONDING };
+
+typedef void (*HttpHandlerFunction)(void);
+
+const char httpBusyResponse[] PROGMEM = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+
+//A handler that works out from the method and URI whether a request is its own - e.g. the ALPACA router
+class HttpDispatcher
+{
+  public:
+  virtual ~HttpDispatcher() {}
+  //Returns false if the request isn't for this dispatcher
+  virtual bool dispatch( HTTPMethod method, const char* uri ) = 0;
+};
+
+//A handler that takes a request body of any length piece by piece as it arrives - e.g. the OTA updater
+class HttpStreamHandler
+{
+  public:
+  virtual ~HttpStreamHandler() {}
+  //Headers read - the request arguments are available. Send a response and return false to refuse the body.
+  virtual bool begin( size_t length ) = 0;
+  //The next piece of the body. Returns false to stop reading it.
+  virtual bool write( const uint8_t* data, size_t length ) = 0;
+  //The whole body has been passed on, or write() stopped it - send the response
+  virtual void end( void ) = 0;
+  //The connection closed or went quiet before the end of the body
+  virtual void abort( void ) = 0;
+};
+
+typedef struct
+{
+  const char* uri;
+  HTTPMethod method;
+  HttpHandlerFunction fn;
+} HttpRoute;
+
+typedef struct
+{
+  const char* uri;
+  HTTPMethod method;
+  HttpStreamHandler* handler;
+} HttpStreamRoute;
+
+typedef struct
+{
+  uint16_t name;  //offsets into the argument pool
+  uint16_t value;
+} HttpArg;
+
+typedef struct
+{
+  WiFiClient client;
+  uint8_t state = HTTP_IDLE;
+  HTTPMethod method;
+  char line[HTTP_LINE_MAX];
+  uint16_t lineLen;
+  char uri[HTTP_URI_MAX];
+  char pool[HTTP_ARG_POOL];
+  uint16_t poolLen;
+  HttpArg arg[HTTP_MAX_ARGS];
+  uint8_t numArgs;
+  int32_t contentLength;
+  bool formBody;
+  bool chunked;         //response length not known in advance - the body ends when the connection closes
+  HttpStreamHandler* stream; //taking the body, while in HTTP_STREAM
+  int32_t remaining;    //bytes of a streamed body still to come
+  uint32_t lastActivity;
+  String out;           //response not yet taken by the TCP send buffer
+} HttpConnection;
+
+class HttpServer
+{
+  public:
+  HttpServer( int port ) : _listener( port ) {}
+
+  void begin( void )
+  {
+    for( int i = 0; i < HTTP_MAX_CONNECTIONS; i++ )
+      _conn[i].state = HTTP_IDLE;
+    _listener.begin();
+    _listener.setNoDelay( true );
+  }
+
+  void on( const char* uri, HttpHandlerFunction fn )
+  {
+    on( uri, HTTP_ANY, fn );
+  }
+
+  void on( const char* uri, HTTPMethod method, HttpHandlerFunction fn )
+  {
+    if( _numRoutes >= HTTP_MAX_ROUTES )
+      return;
+    _route[_numRoutes].uri = uri;
+    _route[_numRoutes].method = method;
+    _route[_numRoutes].fn = fn;
+    _numRoutes++;
+  }
+
+  //Requests with a body to uri go to handler as they arrive - see HttpStreamHandler
+  void onStream( const char* uri, HTTPMethod method, HttpStreamHandler* handler )
+  {
+    if( _numStreams >= HTTP_MAX_STREAMS )
+      return;
+    _stream[_numStreams].uri = uri;
+    _stream[_numStreams].method = method;
+    _stream[_numStreams].handler = handler;
+    _numStreams++;
+  }
+
+  void onNotFound( HttpHandlerFunction fn )
+  {
+    _notFound = fn;
+  }
+
+  void addHandler( HttpDispatcher* dispatcher )
+  {
+    if( _numDispatchers < HTTP_MAX_DISPATCHERS )
+      _dispatcher[_numDispatchers++] = dispatcher;
+  }
+
+  //Called every pass of the http task - never waits for the network
+  void handleClient( void )
+  {
+    accept();
+    for( int i = 0; i < HTTP_MAX_CONNECTIONS; i++ )
+    {
+      if( _conn[i].state != HTTP_IDLE )
+        service( _conn[i] );
+    }
+  }
+
+  //Request accessors for the handler being called
+  HTTPMethod method( void )
+  {
+    return ( _current != nullptr ) ? _current->method : HTTP_GET;
+  }
+
+  String uri( void )
+  {
+    return ( _current != nullptr ) ? String( _current->uri ) : String( "" );
+  }
+
+  int args( void )
+  {
+    return ( _current != nullptr ) ? _current->numArgs : 0;
+  }
+
+  String argName( int i )
+  {
+    if( _current == nullptr || i < 0 || i >= _current->numArgs )
+      return String( "" );
+    return String( &_current->pool[ _current->arg[i].name ] );
+  }
+
+  String arg( int i )
+  {
+    if( _current == nullptr || i < 0 || i >= _current->numArgs )
+      return String( "" );
+    return String( &_current->pool[ _current->arg[i].value ] );
+  }
+
+  String arg( const char* name )
+  {
+    return arg( findArg( name ) );
+  }
+
+  String arg( const String& name )
+  {
+    return arg( findArg( name.c_str() ) );
+  }
+
+  //Argument names kept in flash - see Webrelay_flash.h
+  String arg( const __FlashStringHelper* name )
+  {
+    return arg( findArg_P( (PGM_P) name ) );
+  }
+
+  bool hasArg( const char* name )
+  {
+    return findArg( name ) >= 0;
+  }
+
+  bool hasArg( const String& name )
+  {
+    return findArg( name.c_str() ) >= 0;
+  }
+
+  bool hasArg( const __FlashStringHelper* name )
+  {
+    return findArg_P( (PGM_P) name ) >= 0;
+  }
+
+  //Response calls for the handler being called
+  void setContentLength( size_t length )
+  {
+    _contentLength = length;
+  }
+
+  void send( int code, const char* contentType, const String& content )
+  {
+    send( code, contentType, content.c_str(), content.length() );
+  }
+
+  void send( int code, const char* contentType, const char* content = "" )
+  {
+    send( code, contentType, content, strlen( content ) );
+  }
+
+  void sendContent( const String& content )
+  {
+    if( _current == nullptr || content.length() == 0 )
+      return;
+    _current->out += content;
+    if( _current->out.length() > HTTP_OUTPUT_HIGH_WATER )
+      push( *_current );
+  }
+
+  int activeConnections( void )
+  {
+    int count = 0;
+    for( int i = 0; i < HTTP_MAX_CONNECTIONS; i++ )
+    {
+      if( _conn[i].state != HTTP_IDLE )
+        count++;
+    }
+    return count;
+  }
+
+  uint16_t responseCode = 0;    //of the last response sent, for the request trace
+  uint32_t requests = 0;
+  uint32_t refused = 0;         //connections turned away because every slot was in use
+  uint32_t timeouts = 0;
+  uint32_t badRequests = 0;
+
+  private:
+  WiFiServer _listener;
+  HttpConnection _conn[HTTP_MAX_CONNECTIONS];
+  HttpConnection* _current = nullptr;
+  HttpRoute _route[HTTP_MAX_ROUTES];
+  int _numRoutes = 0;
+  HttpDispatcher* _dispatcher[HTTP_MAX_DISPATCHERS];
+  int _numDispatchers = 0;
+  HttpStreamRoute _stream[HTTP_MAX_STREAMS];
+  int _numStreams = 0;
+  HttpHandlerFunction _notFound = nullptr;
+  size_t _contentLength = 0;
+
+  void accept( void )
+  {
+    WiFiClient incoming = _listener.available();
+    if( !incoming )
+      return;
+
+    for( int i = 0; i < HTTP_MAX_CONNECTIONS; i++ )
+    {
+      HttpConnection& c = _conn[i];
+      if( c.state == HTTP_IDLE )
+      {
+        c.client = incoming;
+        c.client.setNoDelay( true );
+        c.state = HTTP_REQUEST_LINE;
+        c.lineLen = 0;
+        c.uri[0] = '\0';
+        c.poolLen = 0;
+        c.numArgs = 0;
+        c.contentLength = 0;
+        c.formBody = false;
+        c.chunked = false;
+        c.stream = nullptr;
+        c.remaining = 0;
+        c.out = "";
+        c.lastActivity = millis();
+        return;
+      }
+    }
+    refused++;
+    incoming.write_P( httpBusyResponse, sizeof( httpBusyResponse ) - 1 );
+    incoming.stop();
+  }
+
+  void close( HttpConnection& c )
+  {
+    if( c.state == HTTP_STREAM && c.stream != nullptr )
+      c.stream->abort();
+    c.stream = nullptr;
+    c.client.stop();
+    c.out = "";
+    c.state = HTTP_IDLE;
+  }
+
+  void service( HttpConnection& c )
+  {
+    uint8_t buf[HTTP_READ_CHUNK];
+    int budget = ( c.state == HTTP_STREAM ) ? HTTP_STREAM_BUDGET : HTTP_READ_BUDGET;
+
+    if( c.state == HTTP_RESPONDING )
+    {
+      drain( c );
+      if( c.out.length() == 0 )
+        close( c );
+      else if( ( millis() - c.lastActivity ) > HTTP_IDLE_TIMEOUT )
+      {
+        timeouts++;
+        close( c );
+      }
+      return;
+    }
+
+    while( budget > 0 && c.state != HTTP_RESPONDING && c.client.available() > 0 )
+    {
+      int count = c.client.read( buf, ( budget < HTTP_READ_CHUNK ) ? budget : HTTP_READ_CHUNK );
+      if( count <= 0 )
+        break;
+      budget -= count;
+      c.lastActivity = millis();
+      for( int i = 0; i < count && c.state != HTTP_RESPONDING; i++ )
+      {
+        //The rest of what was read is body for the stream handler
+        if( c.state == HTTP_STREAM )
+        {
+          streamBody( c, &buf[i], count - i );
+          break;
+        }
+        feed( c, (char) buf[i] );
+      }
+    }
+
+    if( c.state == HTTP_RESPONDING )
+      return;
+    if( !c.client.connected() )
+      close( c );
+    else if( ( millis() - c.lastActivity ) > HTTP_IDLE_TIMEOUT )
+    {
+      timeouts++;
+      close( c );
+    }
+  }
+
+  //Parse state machine - one byte at a time
+  void feed( HttpConnection& c, char ch )
+  {
+    if( c.state == HTTP_BODY )
+    {
+      c.line[c.lineLen++] = ch;
+      if( c.lineLen >= c.contentLength )
+        complete( c );
+      return;
+    }
+
+    if( ch == '\r' )
+      return;
+    if( ch != '\n' )
+    {
+      if( c.lineLen >= HTTP_LINE_MAX - 1 )
+        fail( c, ( c.state == HTTP_REQUEST_LINE ) ? 414 : 431 );
+      else
+        c.line[c.lineLen++] = ch;
+      return;
+    }
+
+    c.line[c.lineLen] = '\0';
+    if( c.state == HTTP_REQUEST_LINE )
+    {
+      if( c.lineLen > 0 && !parseRequestLine( c ) )
+        return;
+      c.lineLen = 0;
+      return;
+    }
+
+    //HTTP_HEADERS
+    if( c.lineLen == 0 )
+    {
+      if( c.contentLength > 0 && startStream( c ) )
+        return;
+      if( c.contentLength >= HTTP_LINE_MAX )
+        fail( c, 413 );
+      else if( c.contentLength > 0 )
+        c.state = HTTP_BODY;
+      else
+        complete( c );
+      return;
+    }
+    if( strncasecmp( c.line, "Content-Length:", 15 ) == 0 )
+      c.contentLength = atol( &c.line[15] );
+    else if( strncasecmp( c.line, "Content-Type:", 13 ) == 0 )
+      c.formBody = ( strstr( &c.line[13], "x-www-form-urlencoded" ) != nullptr );
+    c.lineLen = 0;
+  }
+
+  bool parseRequestLine( HttpConnection& c )
+  {
+    char* path = strchr( c.line, ' ' );
+    char* version;
+    char* query;
+
+    if( path == nullptr )
+    {
+      fail( c, 400 );
+      return false;
+    }
+    *path++ = '\0';
+    version = strchr( path, ' ' );
+    if( version != nullptr )
+      *version = '\0';
+
+    if( strcmp( c.line, "GET" ) == 0 )
+      c.method = HTTP_GET;
+    else if( strcmp( c.line, "PUT" ) == 0 )
+      c.method = HTTP_PUT;
+    else if( strcmp( c.line, "POST" ) == 0 )
+      c.method = HTTP_POST;
+    else if( strcmp( c.line, "DELETE" ) == 0 )
+      c.method = HTTP_DELETE;
+    else if( strcmp( c.line, "PATCH" ) == 0 )
+      c.method = HTTP_PATCH;
+    else if( strcmp( c.line, "OPTIONS" ) == 0 )
+      c.method = HTTP_OPTIONS;
+    else
+    {
+      fail( c, 405 );
+      return false;
+    }
+
+    query = strchr( path, '?' );
+    if( query != nullptr )
+      *query++ = '\0';
+    if( strlen( path ) >= HTTP_URI_MAX )
+    {
+      fail( c, 414 );
+      return false;
+    }
+    strcpy( c.uri, path );
+    if( query != nullptr && !parseArgs( c, query, strlen( query ) ) )
+    {
+      fail( c, 400 );
+      return false;
+    }
+    c.state = HTTP_HEADERS;
+    c.contentLength = 0;
+    return true;
+  }
+
+  //Decode name=value&name=value into the argument pool. Returns false if it doesn't fit.
+  bool parseArgs( HttpConnection& c, const char* s, size_t len )
+  {
+    const char* end = s + len;
+    while( s < end )
+    {
+      const char* next = (const char*) memchr( s, '&', end - s );
+      const char* equals;
+      if( next == nullptr )
+        next = end;
+      if( next > s )
+      {
+        if( c.numArgs >= HTTP_MAX_ARGS )
+          return false;
+        equals = (const char*) memchr( s, '=', next - s );
+        c.arg[c.numArgs].name = c.poolLen;
+        if( !decode( c, s, ( equals != nullptr ) ? equals : next ) )
+          return false;
+        c.arg[c.numArgs].value = c.poolLen;
+        if( !decode( c, ( equals != nullptr ) ? equals + 1 : next, next ) )
+          return false;
+        c.numArgs++;
+      }
+      s = next + 1;
+    }
+    return true;
+  }
+
+  bool decode( HttpConnection& c, const char* s, const char* end )
+  {
+    while( s < end )
+    {
+      char ch = *s++;
+      if( ch == '+' )
+        ch = ' ';
+      else if( ch == '%' && end - s >= 2 && isxdigit( s[0] ) && isxdigit( s[1] ) )
+      {
+        char hex[3] = { s[0], s[1], '\0' };
+        ch = (char) strtol( hex, nullptr, 16 );
+        s += 2;
+      }
+      if( c.poolLen >= HTTP_ARG_POOL - 1 )
+        return false;
+      c.pool[c.poolLen++] = ch;
+    }
+    if( c.poolLen >= HTTP_ARG_POOL )
+      return false;
+    c.pool[c.poolLen++] = '\0';
+    return true;
+  }
+
+  bool addArg( HttpConnection& c, const char* name, const char* value, size_t len )
+  {
+    size_t nameLen = strlen( name ) + 1;
+    if( c.numArgs >= HTTP_MAX_ARGS || c.poolLen + nameLen + len + 1 > HTTP_ARG_POOL )
+      return false;
+    c.arg[c.numArgs].name = c.poolLen;
+    memcpy( &c.pool[c.poolLen], name, nameLen );
+    c.poolLen += nameLen;
+    c.arg[c.numArgs].value = c.poolLen;
+    memcpy( &c.pool[c.poolLen], value, len );
+    c.poolLen += len;
+    c.pool[c.poolLen++] = '\0';
+    c.numArgs++;
+    return true;
+  }
+
+  int findArg( const char* name )
+  {
+    if( _current == nullptr )
+      return -1;
+    for( int i = 0; i < _current->numArgs; i++ )
+    {
+      if( strcasecmp( &_current->pool[ _current->arg[i].name ], name ) == 0 )
+        return i;
+    }
+    return -1;
+  }
+
+  int findArg_P( PGM_P name )
+  {
+    if( _current == nullptr )
+      return -1;
+    for( int i = 0; i < _current->numArgs; i++ )
+    {
+      if( strcasecmp_P( &_current->pool[ _current->arg[i].name ], name ) == 0 )
+        return i;
+    }
+    return -1;
+  }
+
+  //Request fully read - decode the body and call the handler
+  void complete( HttpConnection& c )
+  {
+    bool handled = false;
+
+    if( c.contentLength > 0 )
+    {
+      bool ok = ( c.formBody ) ? parseArgs( c, c.line, c.lineLen ) : addArg( c, "plain", c.line, c.lineLen );
+      if( !ok )
+      {
+        fail( c, 413 );
+        return;
+      }
+    }
+
+    requests++;
+    _current = &c;
+    _contentLength = 0;
+    responseCode = 0;
+    c.state = HTTP_RESPONDING;
+
+    for( int i = 0; i < _numRoutes && !handled; i++ )
+    {
+      if( strcmp( _route[i].uri, c.uri ) == 0 && ( _route[i].method == HTTP_ANY || _route[i].method == c.method ) )
+      {
+        _route[i].fn();
+        handled = true;
+      }
+    }
+    for( int i = 0; i < _numDispatchers && !handled; i++ )
+      handled = _dispatcher[i]->dispatch( c.method, c.uri );
+    if( !handled )
+    {
+      if( _notFound != nullptr )
+        _notFound();
+      else
+        send( 404, "text/plain", "Not found" );
+    }
+    if( responseCode == 0 )
+      send( 500, "text/plain", "No response" );
+
+    _current = nullptr;
+    drain( c );
+  }
+
+  //Hand the body to a stream handler if one is added for the request. Returns false if there isn't one.
+  bool startStream( HttpConnection& c )
+  {
+    HttpStreamHandler* handler = nullptr;
+
+    for( int i = 0; i < _numStreams && handler == nullptr; i++ )
+    {
+      if( strcmp( _stream[i].uri, c.uri ) == 0 && ( _stream[i].method == HTTP_ANY || _stream[i].method == c.method ) )
+        handler = _stream[i].handler;
+    }
+    if( handler == nullptr )
+      return false;
+
+    requests++;
+    _current = &c;
+    _contentLength = 0;
+    responseCode = 0;
+    if( handler->begin( c.contentLength ) )
+    {
+      c.state = HTTP_STREAM;
+      c.stream = handler;
+      c.remaining = c.contentLength;
+    }
+    else
+    {
+      c.state = HTTP_RESPONDING;
+      if( responseCode == 0 )
+        send( 500, "text/plain", "No response" );
+    }
+    _current = nullptr;
+    if( c.state == HTTP_RESPONDING )
+      drain( c );
+    return true;
+  }
+
+  void streamBody( HttpConnection& c, const uint8_t* data, int count )
+  {
+    if( count > c.remaining )
+      count = c.remaining;
+    c.remaining -= count;
+    if( !c.stream->write( data, count ) || c.remaining == 0 )
+    {
+      _current = &c;
+      _contentLength = 0;
+      responseCode = 0;
+      c.state = HTTP_RESPONDING;
+      c.stream->end();
+      c.stream = nullptr;
+      if( responseCode == 0 )
+        send( 500, "text/plain", "No response" );
+      _current = nullptr;
+      drain( c );
+    }
+  }
+
+  void fail( HttpConnection& c, int code )
+  {
+    HttpConnection* previous = _current;
+    badRequests++;
+    _current = &c;
+    _contentLength = 0;
+    c.state = HTTP_RESPONDING;
+    send( code, "text/plain", "" );
+    _current = previous;
+    drain( c );
+  }
+
+  void send( int code, const char* contentType, const char* content, size_t length )
+  {
+    if( _current == nullptr )
+      return;
+    HttpConnection& c = *_current;
+
+    responseCode = code;
+    c.chunked = ( _contentLength == CONTENT_LENGTH_UNKNOWN );
+    c.out.reserve( 128 + length );
+    c.out = "HTTP/1.1 ";
+    c.out += code;
+    c.out += ' ';
+    c.out += reason( code );
+    c.out += F("\r\nContent-Type: ");
+    c.out += contentType;
+    c.out += F("\r\nConnection: close\r\n");
+    if( !c.chunked )
+    {
+      c.out += F("Content-Length: ");
+      c.out += (unsigned int) length;
+      c.out += F("\r\n");
+    }
+    c.out += F("\r\n");
+    c.out += content;
+  }
+
+  //Write as much of the response as the TCP send buffer will take without waiting
+  void drain( HttpConnection& c )
+  {
+    size_t space = c.client.availableForWrite();
+    size_t length = c.out.length();
+    if( length == 0 || space == 0 )
+      return;
+    if( space > length )
+      space = length;
+    size_t written = c.client.write( (const uint8_t*) c.out.c_str(), space );
+    if( written > 0 )
+    {
+      c.out.remove( 0, written );
+      c.lastActivity = millis();
+    }
+  }
+
+  //Push out a response that has grown past its buffer - waits for the network
+  void push( HttpConnection& c )
+  {
+    size_t written = c.client.write( (const uint8_t*) c.out.c_str(), c.out.length() );
+    c.out.remove( 0, written );
+    c.lastActivity = millis();
+  }
+
+  static const char* reason( int code )
+  {
+    switch( code )
+    {
+      case 200: return "OK";
+      case 400: return "Bad Request";
+      case 404: return "Not Found";
+      case 405: return "Method Not Allowed";
+      case 409: return "Conflict";
+      case 413: return "Payload Too Large";
+      case 414: return "URI Too Long";
+      case 431: return "Request Header Fields Too Large";
+      case 500: return "Internal Server Error";
+      default:  return "";
+    }
+  }
+};
+
+//Case insensitive argument check for handlers written for ESP8266WebServer - see JSONHelperFunctions.h
+bool hasArgIC( String& check, HttpServer& ss, bool caseSensitive )
+{
+  for( int i = 0; i < ss.args(); i++ )
+  {
+    if( ( caseSensitive ) ? ss.argName( i ).equals( check ) : ss.argName( i ).equalsIgnoreCase( check ) )
+      return true;
+  }
+  return false;
+}
+
+//As above for a name kept in flash, so handlers needn't copy their argument names into Strings
+bool hasArgIC( const __FlashStringHelper* check, HttpServer& ss, bool caseSensitive )
+{
+  String name;
+  for( int i = 0; i < ss.args(); i++ )
+  {
+    name = ss.argName( i );
+    if( ( caseSensitive ) ? strcmp_P( name.c_str(), (PGM_P) check ) == 0 : strcasecmp_P( name.c_str(), (PGM_P) check ) == 0 )
+      return true;
+  }
+  return false;
+}
+#endif
@@ -0,0 +1,267 @@
+/*
+Webrelay_i2c.h
+I2C transport for the PCF8574 switch expander.
+All expander reads and writes go through here. Each transaction's result is checked and a failed one is retried up
+to I2C_RETRIES times with a doubling backoff, so a glitch on a long cable run doesn't lose a relay change.
+If SDA is found held low between attempts a slave is stuck part way through a byte, so the bus is recovered by
+clocking SCL until it lets go and sending a STOP, before the Wire library is restarted.
+The bus runs at I2C_FAST_CLOCK if the expander answers at that rate at start up, otherwise at I2C_SLOW_CLOCK. If
+transactions keep failing after retries at the fast rate it drops to the slow rate for good.
+Relay changes don't wait for the bus. expanderQueuePin() only updates the output byte requested and wakes the i2c
+task, which writes it to the expander - so a slow or stretched bus never holds up an HTTP response, and any number of
+changes made before the task runs are merged into one transaction for the expander. The byte the expander last
+acknowledged is kept separately, so each pin can be reported as applied or still pending. If the write fails after
+all its retries the i2c task writes it again until the expander takes it - relays end up in the state that was
+asked for rather than an unknown one.
+Other devices on the bus, such as the power monitors in Webrelay_sensors.h, are read a register at a time with
+i2cReadRegister(). Those reads aren't retried - they are repeated samples, and a missed one is just skipped.
+Error, retry, failure and recovery counts are reported by /status and /metrics.
+*/
+#ifndef _WEBRELAY_I2C_H_
+#define _WEBRELAY_I2C_H_
+
+#include <Wire.h>
+#include "Webrelay_common.h"
+#include "Webrelay_metrics.h"
+#include "Webrelay_scheduler.h"
+#include "DebugSerial.h"
+
+//I2C setup SDA pin 0, SCL pin 2 on ESP-01
+//I2C setup SDA pin 5, SCL pin 4 on ESP-12
+#define I2C_SDA_PIN 0
+#define I2C_SCL_PIN 2
+#define I2C_FAST_CLOCK 400000
+#define I2C_SLOW_CLOCK 100000
+#define I2C_RETRIES 3            //further attempts after the first
+#define I2C_BACKOFF 100          //usecs before the first retry, doubled for each one after
+#define I2C_FALLBACK_FAILURES 3  //consecutive failed transactions at the fast rate before dropping to the slow rate
+
+uint32_t i2cClock = I2C_FAST_CLOCK;
+uint8_t expanderOut = 0xFF;      //output byte last requested - input pins are kept high
+uint8_t expanderApplied = 0xFF;  //output byte last acknowledged by the expander
+bool expanderDirty = false;      //expanderOut hasn't reached the expander yet
+uint32_t expanderQueued = 0;     //pin changes queued
+uint32_t expanderWrites = 0;     //write transactions sent for them
+int i2cTaskId = -1;              //scheduler task that writes queued changes
+uint32_t i2cErrors = 0;          //failed attempts
+uint32_t i2cRetries = 0;
+uint32_t i2cFailures = 0;        //transactions that failed after all their retries
+uint32_t i2cRecoveries = 0;
+uint32_t i2cFallbacks = 0;
+int i2cConsecutiveFailures = 0;
+
+//Function definitions
+bool i2cSetup( void );
+bool i2cBusRecover( void );
+bool i2cTransaction( bool write, uint8_t& value );
+bool expanderWrite8( uint8_t value );
+bool expanderWritePin( uint8_t pin, bool level );
+void expanderQueuePin( uint8_t pin, bool level );
+void expanderQueueMask( uint8_t value, uint8_t mask );
+bool expanderPinApplied( uint8_t pin );
+bool expanderRead8( uint8_t& value );
+void expanderFlush( void );
+bool i2cReadRegister( uint8_t address, uint8_t reg, uint16_t& value );
+
+/*
+ * Start the bus at the fast rate and check the expander answers, falling back to the slow rate if it doesn't.
+ * expanderOut is written to the expander as soon as the bus starts. Returns whether the expander was found.
+ */
+bool i2cSetup( void )
+{
+  uint8_t value;
+
+  Wire.begin( I2C_SDA_PIN, I2C_SCL_PIN );
+  //initial switch state setup - set pins high to read inputs, drive pins low for low outputs.
+  switchDevice.begin( expanderOut );
+
+  i2cClock = I2C_FAST_CLOCK;
+  Wire.setClock( i2cClock );
+  if( !i2cTransaction( false, value ) )
+  {
+    DEBUGSL1( "i2cSetup: no answer at fast clock - trying slow clock" );
+    i2cClock = I2C_SLOW_CLOCK;
+    Wire.setClock( i2cClock );
+    i2cConsecutiveFailures = 0;
+    if( !i2cTransaction( false, value ) )
+      return false;
+  }
+  //Write the outputs again now the rate is settled, so the byte the expander holds is known to be applied
+  return expanderWrite8( expanderOut );
+}
+
+/*
+ * Free a bus with SDA held low by a slave that lost count of SCL - clock SCL until the slave lets go of SDA
+ * then send a STOP. Pins are driven open drain by switching between output low and input.
+ */
+bool i2cBusRecover( void )
+{
+  bool recovered;
+
+  i2cRecoveries++;
+  pinMode( I2C_SDA_PIN, INPUT_PULLUP );
+  pinMode( I2C_SCL_PIN, INPUT_PULLUP );
+  delayMicroseconds( 5 );
+  for( int i = 0; i < 16 && digitalRead( I2C_SDA_PIN ) == LOW; i++ )
+  {
+    pinMode( I2C_SCL_PIN, OUTPUT );
+    digitalWrite( I2C_SCL_PIN, LOW );
+    delayMicroseconds( 5 );
+    pinMode( I2C_SCL_PIN, INPUT_PULLUP );
+    delayMicroseconds( 5 );
+  }
+  //STOP - SDA rising while SCL is high
+  pinMode( I2C_SDA_PIN, OUTPUT );
+  digitalWrite( I2C_SDA_PIN, LOW );
+  delayMicroseconds( 5 );
+  pinMode( I2C_SDA_PIN, INPUT_PULLUP );
+  delayMicroseconds( 5 );
+  recovered = ( digitalRead( I2C_SDA_PIN ) == HIGH && digitalRead( I2C_SCL_PIN ) == HIGH );
+
+  Wire.begin( I2C_SDA_PIN, I2C_SCL_PIN );
+  Wire.setClock( i2cClock );
+  DEBUGS1( "i2cBusRecover: recovered: " ); DEBUGSL1( recovered );
+  return recovered;
+}
+
+/*
+ * One expander read or write with retries. The time taken, including any retries, is counted in the I2C histograms.
+ */
+bool i2cTransaction( bool write, uint8_t& value )
+{
+  uint32_t start = micros();
+  bool ok = false;
+
+  for( int attempt = 0; attempt <= I2C_RETRIES && !ok; attempt++ )
+  {
+    if( attempt > 0 )
+    {
+      i2cRetries++;
+      delayMicroseconds( I2C_BACKOFF << ( attempt - 1 ) );
+      if( digitalRead( I2C_SDA_PIN ) == LOW )
+        i2cBusRecover();
+    }
+    if( write )
+      switchDevice.write8( value );
+    else
+      value = switchDevice.read8();
+    ok = ( switchDevice.lastError() == PCF8574_OK );
+    if( !ok )
+      i2cErrors++;
+  }
+  histRecord( ( write ) ? &i2cWriteHist : &i2cReadHist, micros() - start );
+
+  if( ok )
+  {
+    i2cConsecutiveFailures = 0;
+    return true;
+  }
+
+  i2cFailures++;
+  if( ++i2cConsecutiveFailures >= I2C_FALLBACK_FAILURES && i2cClock > I2C_SLOW_CLOCK )
+  {
+    DEBUGSL1( "i2cTransaction: repeated failures - dropping to slow clock" );
+    i2cClock = I2C_SLOW_CLOCK;
+    Wire.setClock( i2cClock );
+    i2cFallbacks++;
+    i2cConsecutiveFailures = 0;
+  }
+  return false;
+}
+
+//Write the output byte now, waiting for the bus
+bool expanderWrite8( uint8_t value )
+{
+  expanderOut = value;
+  expanderWrites++;
+  if( i2cTransaction( true, value ) )
+    expanderApplied = value;
+  expanderDirty = ( expanderOut != expanderApplied );
+  return !expanderDirty;
+}
+
+bool expanderWritePin( uint8_t pin, bool level )
+{
+  uint8_t value = expanderOut;
+  if( pin >= 8 )
+    return false;
+  if( level )
+    value |= ( 1 << pin );
+  else
+    value &= ~( 1 << pin );
+  return expanderWrite8( value );
+}
+
+//Request a pin change without waiting for the bus - the i2c task writes it
+void expanderQueuePin( uint8_t pin, bool level )
+{
+  if( pin >= 8 )
+    return;
+  if( level )
+    expanderOut |= ( 1 << pin );
+  else
+    expanderOut &= ~( 1 << pin );
+  expanderQueued++;
+  expanderDirty = ( expanderOut != expanderApplied );
+  if( expanderDirty )
+    schedulerWake( i2cTaskId );
+}
+
+//Request several pin changes as one - the pins in mask take their levels from value
+void expanderQueueMask( uint8_t value, uint8_t mask )
+{
+  expanderOut = ( expanderOut & ~mask ) | ( value & mask );
+  expanderQueued++;
+  expanderDirty = ( expanderOut != expanderApplied );
+  if( expanderDirty )
+    schedulerWake( i2cTaskId );
+}
+
+//True once the expander has acknowledged the level last requested for the pin
+bool expanderPinApplied( uint8_t pin )
+{
+  if( pin >= 8 )
+    return true;
+  return !( ( expanderOut ^ expanderApplied ) & ( 1 << pin ) );
+}
+
+bool expanderRead8( uint8_t& value )
+{
+  return i2cTransaction( false, value );
+}
+
+//Called from the i2c task - write any queued changes, or again if the last write failed
+void expanderFlush( void )
+{
+  if( expanderDirty )
+    expanderWrite8( expanderOut );
+}
+
+/*
+ * Read a 16 bit register, most significant byte first, from the device at address. The register number is written
+ * and the two bytes read after a repeated start. A failed read is counted with the expander's errors, and frees the
+ * bus if it has been left held low, but isn't retried.
+ */
+bool i2cReadRegister( uint8_t address, uint8_t reg, uint16_t& value )
+{
+  uint32_t start = micros();
+  bool ok;
+
+  Wire.beginTransmission( address );
+  Wire.write( reg );
+  ok = ( Wire.endTransmission( false ) == 0 && Wire.requestFrom( address, (uint8_t) 2 ) == 2 );
+  if( ok )
+  {
+    value = (uint16_t)( Wire.read() << 8 );
+    value |= (uint16_t) Wire.read();
+  }
+  else
+  {
+    i2cErrors++;
+    if( digitalRead( I2C_SDA_PIN ) == LOW )
+      i2cBusRecover();
+  }
+  histRecord( &i2cReadHist, micros() - start );
+  return ok;
+}
+#endif
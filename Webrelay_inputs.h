@@ -0,0 +1,149 @@
+/*
+Webrelay_inputs.h
+Input switches - expander pins used to read e.g. roof limit switches or a rain detector, presented as read-only
+ALPACA switches of type SWITCH_INPUT.
+The PCF8574 pulls its INT line low whenever an input pin changes and releases it when the port is read. INT is wired
+to EXPANDER_INT_PIN and its falling edge posts an event for the event task, so the bus is only read when something
+has changed rather than being polled.
+Contacts bounce, so a change is only accepted once the inputs have read the same for INPUT_DEBOUNCE msecs. Every
+raw change seen is counted as well, so short pulses that the debounce filters out still show up in the counts.
+Accepted changes are published over MQTT by the input task.
+Input pins are written high so the expander's weak pull up lets them be read. Only the 8 expander pins can be inputs.
+*/
+#ifndef _WEBRELAY_INPUTS_H_
+#define _WEBRELAY_INPUTS_H_
+
+#include "Webrelay_common.h"
+#include "Webrelay_eventqueue.h"
+#include "Webrelay_i2c.h"
+#include "Webrelay_switchtypes.h"
+#include "DebugSerial.h"
+
+//GPIO 3 is RX on the ESP8266-01, free as serial is only used to transmit
+#define EXPANDER_INT_PIN 3
+#define EXPANDER_PINS 8
+#define INPUT_DEBOUNCE 30 //msecs the inputs must be steady before a change is accepted
+
+uint8_t inputMask = 0;      //expander pins configured as inputs
+uint8_t inputRaw = 0;       //last value read
+uint8_t inputStable = 0;    //debounced value
+bool inputPending = false;  //raw value has changed and is waiting out the debounce time
+uint32_t inputChangeTime = 0;
+uint32_t inputEdges[EXPANDER_PINS];   //raw changes seen
+uint32_t inputChanges[EXPANDER_PINS]; //debounced changes accepted
+
+//Function definitions
+void inputSetup( void );
+void inputRefreshMask( void );
+void onExpanderInterrupt( void );
+void inputSample( void );
+void inputNoteRaw( uint8_t raw );
+uint8_t inputDebounce( void );
+uint8_t inputRead( void );
+
+/*
+ * Work out which pins are inputs from the switch table and make sure they are released high. New input pins are
+ * released through the i2c task like any other pin change, so until it has written them they still read low - they
+ * are read again after the debounce time rather than taken from the read here.
+ */
+void inputRefreshMask( void )
+{
+  uint8_t mask = 0;
+  uint8_t released;
+  for( int i = 0; i < numSwitches && i < EXPANDER_PINS; i++ )
+  {
+    if( switchBackend( switchEntry[i]->type ) == BACKEND_EXPANDER_IN )
+      mask |= ( 1 << i );
+  }
+  released = mask & ~inputMask;
+  if( released != 0 )
+    expanderQueueMask( 0xFF, released );
+  inputMask = mask;
+  inputRaw = inputRead();
+  inputStable = inputRaw;
+  inputPending = expanderDirty;
+  inputChangeTime = millis();
+  for( int i = 0; i < numSwitches && i < EXPANDER_PINS; i++ )
+  {
+    if( inputMask & ( 1 << i ) )
+      switchEntry[i]->level = ( inputStable & ( 1 << i ) ) ? 1 : 0;
+  }
+}
+
+void inputSetup( void )
+{
+  pinMode( EXPANDER_INT_PIN, INPUT_PULLUP );
+  inputRefreshMask();
+  attachInterrupt( digitalPinToInterrupt( EXPANDER_INT_PIN ), onExpanderInterrupt, FALLING );
+}
+
+//Interrupt handler for the expander INT line - the work is done by the event task
+ICACHE_RAM_ATTR void onExpanderInterrupt( void )
+{
+  isrEvents.post( EVENT_GPIO, EXPANDER_INT_PIN );
+}
+
+//If the read fails the last value read is returned so nothing appears to change
+uint8_t inputRead( void )
+{
+  uint8_t value;
+  if( !expanderRead8( value ) )
+    return inputRaw;
+  return value & inputMask;
+}
+
+//Read the inputs after INT has signalled a change - reading also releases INT
+void inputSample( void )
+{
+  if( inputMask == 0 )
+    return;
+  inputNoteRaw( inputRead() );
+}
+
+//Count the raw changes and restart the debounce time
+void inputNoteRaw( uint8_t raw )
+{
+  uint8_t changed = raw ^ inputRaw;
+  if( changed == 0 )
+    return;
+  for( int i = 0; i < EXPANDER_PINS; i++ )
+  {
+    if( changed & ( 1 << i ) )
+      inputEdges[i]++;
+  }
+  inputRaw = raw;
+  inputChangeTime = millis();
+  inputPending = true;
+}
+
+/*
+ * Called regularly - once the inputs have been steady for the debounce time they are read again to confirm and
+ * the debounced state updated. Returns a mask of the inputs whose debounced state changed.
+ */
+uint8_t inputDebounce( void )
+{
+  uint8_t raw, changed;
+  if( !inputPending || ( millis() - inputChangeTime ) < INPUT_DEBOUNCE )
+    return 0;
+
+  raw = inputRead();
+  if( raw != inputRaw )
+  {
+    //Still moving - wait again
+    inputNoteRaw( raw );
+    return 0;
+  }
+  inputPending = false;
+  changed = ( raw ^ inputStable ) & inputMask;
+  inputStable = raw;
+  for( int i = 0; i < numSwitches && i < EXPANDER_PINS; i++ )
+  {
+    if( changed & ( 1 << i ) )
+    {
+      inputChanges[i]++;
+      switchEntry[i]->level = ( inputStable & ( 1 << i ) ) ? 1 : 0;
+    }
+  }
+  return changed;
+}
+#endif
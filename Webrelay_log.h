@@ -0,0 +1,320 @@
+/*
+Webrelay_log.h
+Logging that never waits for the serial port. At 115200 baud a line of text takes a millisecond or more to go out,
+and Serial.print() blocks once the UART's 128 byte FIFO is full, so printing from a request handler held up the loop.
+Instead each message is formatted into a ring buffer in one go and the log task drains it in the background:
+ - to Serial, no more than the FIFO has room for, so the task never blocks;
+ - optionally to a syslog server as UDP datagrams (RFC 3164, facility local0), a few lines per run, while WiFi is up.
+Levels are LOG_ERROR, LOG_WARN, LOG_INFO and LOG_DEBUG. LOG_LEVEL sets the most detailed level built in - anything
+finer compiles to nothing, arguments and format strings included. Define it before this file is included, e.g.
+-DLOG_LEVEL=LOG_DEBUG, to see the debug lines. It defaults to LOG_INFO.
+ LOGE(), LOGW(), LOGI() and LOGD() take a printf format, which is kept in flash, and its arguments.
+ DEBUGS1() and DEBUGSL1() from DebugSerial.h are redefined here as LOG_DEBUG messages - a line is built up from the
+ DEBUGS1() parts and goes into the buffer when DEBUGSL1() ends it.
+Each line is stored as "<millis> <level letter> <text>\n". A line that doesn't fit in the free space is dropped whole
+and counted, so a burst of logging loses lines rather than holding anything up. Lines longer than LOG_LINE_LENGTH
+are cut short. Call logFlush() before a restart to get out whatever is still buffered.
+The syslog server and port are set on the setup page and stored in EEPROM after the sensor bindings.
+*/
+#ifndef _WEBRELAY_LOG_H_
+#define _WEBRELAY_LOG_H_
+
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include "DebugSerial.h"
+
+#define LOG_NONE  0
+#define LOG_ERROR 1
+#define LOG_WARN  2
+#define LOG_INFO  3
+#define LOG_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+#define LOG_BUFFER_SIZE 2048  //must be a power of two
+#define LOG_LINE_LENGTH 128   //including the terminating null
+#define LOG_SYSLOG_BATCH 4    //lines sent per run of the log task
+#define LOG_SYSLOG_PORT 514
+#define LOG_FACILITY 16       //local0
+
+#if LOG_LEVEL >= LOG_ERROR
+#define LOGE( format, ... ) logPrintf( LOG_ERROR, PSTR( format ), ##__VA_ARGS__ )
+#else
+#define LOGE( format, ... ) do {} while( 0 )
+#endif
+#if LOG_LEVEL >= LOG_WARN
+#define LOGW( format, ... ) logPrintf( LOG_WARN, PSTR( format ), ##__VA_ARGS__ )
+#else
+#define LOGW( format, ... ) do {} while( 0 )
+#endif
+#if LOG_LEVEL >= LOG_INFO
+#define LOGI( format, ... ) logPrintf( LOG_INFO, PSTR( format ), ##__VA_ARGS__ )
+#else
+#define LOGI( format, ... ) do {} while( 0 )
+#endif
+
+#undef DEBUGS1
+#undef DEBUGSL1
+#if LOG_LEVEL >= LOG_DEBUG
+#define LOGD( format, ... ) logPrintf( LOG_DEBUG, PSTR( format ), ##__VA_ARGS__ )
+#define DEBUGS1( x )  logPart( x )
+#define DEBUGSL1( x ) do { logPart( x ); logEndLine(); } while( 0 )
+#else
+#define LOGD( format, ... ) do {} while( 0 )
+#define DEBUGS1( x )  do {} while( 0 )
+#define DEBUGSL1( x ) do {} while( 0 )
+#endif
+
+const char logLevelLetter[] = { '-', 'E', 'W', 'I', 'D' };
+const uint8_t logSeverity[] = { 0, 3, 4, 6, 7 }; //syslog err, warning, info, debug
+
+char logBuffer[LOG_BUFFER_SIZE];
+uint16_t logHead = 0;        //free running indexes - taken modulo LOG_BUFFER_SIZE when used
+uint16_t logSerialTail = 0;
+uint16_t logSyslogTail = 0;
+char logPartial[LOG_LINE_LENGTH]; //DEBUGS1() parts of the line not yet ended
+int logPartialLength = 0;
+uint32_t logLines = 0;
+uint32_t logDropped = 0;
+uint32_t logSyslogSent = 0;
+
+WiFiUDP logUdp;
+uint32_t logSyslogServer = 0;       //IP address, 0 for off - stored in EEPROM
+int logSyslogPort = LOG_SYSLOG_PORT; //stored in EEPROM
+
+//Function definitions
+bool logSyslogEnabled( void );
+uint16_t logUsed( void );
+void logCommit( int level, const char* text );
+void logPrintf( int level, PGM_P format, ... );
+void logPart( const char* text );
+void logPart( const __FlashStringHelper* text );
+void logPart( const String& text );
+void logPart( char value );
+void logPart( int value );
+void logPart( unsigned int value );
+void logPart( long value );
+void logPart( unsigned long value );
+void logPart( double value );
+void logEndLine( void );
+void logDrainSerial( void );
+void logDrainSyslog( const char* hostname );
+void logDrain( const char* hostname );
+void logFlush( void );
+
+bool logSyslogEnabled( void )
+{
+  return ( logSyslogServer != 0 && logSyslogPort > 0 );
+}
+
+//Bytes held for whichever output is furthest behind
+uint16_t logUsed( void )
+{
+  uint16_t used = logHead - logSerialTail;
+  uint16_t syslogUsed = logHead - logSyslogTail;
+
+  if( logSyslogEnabled() && syslogUsed > used )
+    used = syslogUsed;
+  return used;
+}
+
+//Add a whole line to the buffer, or drop it if there isn't room
+void logCommit( int level, const char* text )
+{
+  char header[16];
+  int headerLength;
+  int textLength = strlen( text );
+  int length;
+
+  headerLength = snprintf_P( header, sizeof( header ), PSTR( "%lu %c " ), (unsigned long) millis(), logLevelLetter[level] );
+  length = headerLength + textLength + 1;
+  if( length > LOG_BUFFER_SIZE - logUsed() )
+  {
+    logDropped++;
+    return;
+  }
+  for( int i = 0; i < headerLength; i++ )
+    logBuffer[ logHead++ & ( LOG_BUFFER_SIZE - 1 ) ] = header[i];
+  for( int i = 0; i < textLength; i++ )
+    logBuffer[ logHead++ & ( LOG_BUFFER_SIZE - 1 ) ] = text[i];
+  logBuffer[ logHead++ & ( LOG_BUFFER_SIZE - 1 ) ] = '\n';
+  logLines++;
+}
+
+void logPrintf( int level, PGM_P format, ... )
+{
+  char line[LOG_LINE_LENGTH];
+  va_list args;
+
+  va_start( args, format );
+  vsnprintf_P( line, sizeof( line ), format, args );
+  va_end( args );
+  logCommit( level, line );
+}
+
+void logPart( const char* text )
+{
+  int length = strlen( text );
+
+  if( length > LOG_LINE_LENGTH - 1 - logPartialLength )
+    length = LOG_LINE_LENGTH - 1 - logPartialLength;
+  memcpy( &logPartial[logPartialLength], text, length );
+  logPartialLength += length;
+  logPartial[logPartialLength] = '\0';
+}
+
+void logPart( const __FlashStringHelper* text )
+{
+  int length = strlen_P( (PGM_P) text );
+
+  if( length > LOG_LINE_LENGTH - 1 - logPartialLength )
+    length = LOG_LINE_LENGTH - 1 - logPartialLength;
+  memcpy_P( &logPartial[logPartialLength], (PGM_P) text, length );
+  logPartialLength += length;
+  logPartial[logPartialLength] = '\0';
+}
+
+void logPart( const String& text )
+{
+  logPart( text.c_str() );
+}
+
+void logPart( char value )
+{
+  char text[2] = { value, '\0' };
+  logPart( text );
+}
+
+void logPart( int value )
+{
+  logPart( (long) value );
+}
+
+void logPart( unsigned int value )
+{
+  logPart( (unsigned long) value );
+}
+
+void logPart( long value )
+{
+  char text[12];
+  snprintf_P( text, sizeof( text ), PSTR( "%ld" ), value );
+  logPart( text );
+}
+
+void logPart( unsigned long value )
+{
+  char text[12];
+  snprintf_P( text, sizeof( text ), PSTR( "%lu" ), value );
+  logPart( text );
+}
+
+void logPart( double value )
+{
+  char text[16];
+  snprintf_P( text, sizeof( text ), PSTR( "%.2f" ), value );
+  logPart( text );
+}
+
+void logEndLine( void )
+{
+  logCommit( LOG_DEBUG, logPartial );
+  logPartialLength = 0;
+  logPartial[0] = '\0';
+}
+
+//Write out as much as the UART FIFO will take without waiting
+void logDrainSerial( void )
+{
+  int room = Serial.availableForWrite();
+  int start;
+  int length;
+
+  while( room > 0 && logSerialTail != logHead )
+  {
+    start = logSerialTail & ( LOG_BUFFER_SIZE - 1 );
+    length = (uint16_t)( logHead - logSerialTail );
+    //Up to the end of the buffer at most, the rest goes on the next time round
+    if( length > LOG_BUFFER_SIZE - start )
+      length = LOG_BUFFER_SIZE - start;
+    if( length > room )
+      length = room;
+    Serial.write( (const uint8_t*) &logBuffer[start], length );
+    logSerialTail += length;
+    room -= length;
+  }
+}
+
+/*
+ * Send the next few whole lines to the syslog server, one datagram each, as "<PRI>hostname webrelay: text".
+ * The timestamp and level letter are left off - the priority carries the level and the server adds the time.
+ * Lines logged while syslog is off or WiFi is down are skipped rather than held, so they don't fill the buffer.
+ */
+void logDrainSyslog( const char* hostname )
+{
+  char line[LOG_LINE_LENGTH + 16];
+  int length;
+  int level;
+  char c;
+  char* text;
+
+  if( !logSyslogEnabled() || WiFi.status() != WL_CONNECTED )
+  {
+    logSyslogTail = logHead;
+    return;
+  }
+  for( int n = 0; n < LOG_SYSLOG_BATCH && logSyslogTail != logHead; n++ )
+  {
+    length = 0;
+    while( logSyslogTail != logHead )
+    {
+      c = logBuffer[ logSyslogTail++ & ( LOG_BUFFER_SIZE - 1 ) ];
+      if( c == '\n' )
+        break;
+      if( length < (int) sizeof( line ) - 1 )
+        line[length++] = c;
+    }
+    line[length] = '\0';
+
+    //Past the millis to the level letter
+    text = strchr( line, ' ' );
+    if( text == nullptr || text[1] == '\0' )
+      continue;
+    for( level = LOG_DEBUG; level > LOG_NONE && logLevelLetter[level] != text[1]; level-- )
+      ;
+    text += ( text[2] == ' ' ) ? 3 : 2;
+
+    logUdp.beginPacket( IPAddress( logSyslogServer ), logSyslogPort );
+    logUdp.printf_P( PSTR( "<%u>%s webrelay: %s" ), LOG_FACILITY * 8 + logSeverity[level], hostname, text );
+    logUdp.endPacket();
+    logSyslogSent++;
+  }
+}
+
+//Called from the log task
+void logDrain( const char* hostname )
+{
+  logDrainSerial();
+  logDrainSyslog( hostname );
+}
+
+//Write out everything buffered, waiting for the UART - only for use just before a restart
+void logFlush( void )
+{
+  int start;
+  int length;
+
+  while( logSerialTail != logHead )
+  {
+    start = logSerialTail & ( LOG_BUFFER_SIZE - 1 );
+    length = (uint16_t)( logHead - logSerialTail );
+    if( length > LOG_BUFFER_SIZE - start )
+      length = LOG_BUFFER_SIZE - start;
+    Serial.write( (const uint8_t*) &logBuffer[start], length );
+    logSerialTail += length;
+  }
+  Serial.flush();
+}
+#endif
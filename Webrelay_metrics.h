@@ -0,0 +1,131 @@
+/*
+Webrelay_metrics.h
+Lightweight run time instrumentation for the hot paths.
+Latencies are counted into fixed bucket histograms - recording a sample is a short compare loop and a few adds,
+with no allocation - so it can stay enabled in normal use. Histograms are kept for each router method, for I2C
+expander writes and reads, EEPROM commits, MQTT publishes and for each pass of loop().
+Heap low water mark is sampled every pass of loop(); fragmentation is read when the metrics are reported. Free heap
+once setup() has finished is kept too, so builds can be compared for the RAM a change gains or costs.
+Everything is reported in Prometheus text format by GET /metrics and a summary is published with publishHealth().
+*/
+#ifndef _WEBRELAY_METRICS_H_
+#define _WEBRELAY_METRICS_H_
+
+#include "Webrelay_common.h"
+
+//Comment out to leave the metrics summary out of the MQTT health message
+#define HEALTH_METRICS
+
+//Bucket upper bounds in usecs. There is an implied final +Inf bucket.
+#define HIST_BUCKETS 8
+const uint32_t histBounds[HIST_BUCKETS] = { 250, 500, 1000, 2500, 5000, 10000, 50000, 250000 };
+
+//Must be at least as big as the router method table
+#define MAX_ROUTE_HISTOGRAMS 32
+
+typedef struct
+{
+  uint32_t bucket[HIST_BUCKETS + 1];
+  uint32_t count;
+  uint32_t max;
+  uint64_t sum;
+} LatencyHistogram;
+
+LatencyHistogram routeHist[MAX_ROUTE_HISTOGRAMS];
+LatencyHistogram i2cWriteHist;
+LatencyHistogram i2cReadHist;
+LatencyHistogram eepromCommitHist;
+LatencyHistogram mqttPublishHist;
+LatencyHistogram loopHist;
+uint32_t heapLowWater = 0xFFFFFFFF;
+uint32_t heapAfterSetup = 0;
+
+//Function definitions
+void histRecord( LatencyHistogram* hist, uint32_t usecs );
+void sampleHeap( void );
+void metricsHistogramText( String& out, const char* name, const char* label, LatencyHistogram* hist );
+void metricsAppendU64( String& out, uint64_t value );
+
+void histRecord( LatencyHistogram* hist, uint32_t usecs )
+{
+  int i = 0;
+  while( i < HIST_BUCKETS && usecs > histBounds[i] )
+    i++;
+  hist->bucket[i]++;
+  hist->count++;
+  hist->sum += usecs;
+  if( usecs > hist->max )
+    hist->max = usecs;
+}
+
+void sampleHeap( void )
+{
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if( freeHeap < heapLowWater )
+    heapLowWater = freeHeap;
+}
+
+//String has no 64 bit conversion
+void metricsAppendU64( String& out, uint64_t value )
+{
+  char digits[21];
+  int i = sizeof( digits ) - 1;
+  digits[i] = '\0';
+  do
+  {
+    digits[--i] = '0' + ( value % 10 );
+    value /= 10;
+  } while( value > 0 );
+  out += &digits[i];
+}
+
+/*
+ * Append one histogram in Prometheus text exposition format - bucket counts are cumulative.
+ * label is the text to add inside the braces e.g. method="getswitch", or nullptr for none.
+ */
+void metricsHistogramText( String& out, const char* name, const char* label, LatencyHistogram* hist )
+{
+  uint32_t cumulative = 0;
+  for( int i = 0; i <= HIST_BUCKETS; i++ )
+  {
+    cumulative += hist->bucket[i];
+    out += name;
+    out += F("_bucket{");
+    if( label != nullptr )
+    {
+      out += label;
+      out += ',';
+    }
+    out += F("le=\"");
+    if( i < HIST_BUCKETS )
+      out += histBounds[i];
+    else
+      out += F("+Inf");
+    out += F("\"} ");
+    out += cumulative;
+    out += '\n';
+  }
+  out += name;
+  out += F("_sum");
+  if( label != nullptr )
+  {
+    out += '{';
+    out += label;
+    out += '}';
+  }
+  out += ' ';
+  metricsAppendU64( out, hist->sum );
+  out += '\n';
+  out += name;
+  out += F("_count");
+  if( label != nullptr )
+  {
+    out += '{';
+    out += label;
+    out += '}';
+  }
+  out += ' ';
+  out += hist->count;
+  out += '\n';
+}
+#endif
@@ -0,0 +1,259 @@
+/*
+Webrelay_ota.h
+Firmware updates that leave the equipment on the relays undisturbed.
+ - The image is POSTed to /update on the API port as the raw request body, with its MD5 in the md5 argument, e.g.
+   curl --data-binary @webrelay.bin "http://espASW01/update?md5=$(md5sum webrelay.bin | cut -c1-32)"
+   The http task writes it to flash a piece at a time as it arrives, so switch requests, MQTT and the timers carry
+   on in between - see HttpStreamHandler. Only one update runs at a time.
+ - Update.end() checks the MD5 of what was written, and an image that doesn't match is never installed.
+ - Once it is, the device restarts OTA_RESTART_DELAY later, when the response has gone out. The switch table and wear
+   counters are saved just before, so the saved relay states are the live ones. The PCF8574 holds its pins through
+   the restart and setup() puts the outputs back from the saved state before anything else, so no relay changes.
+ - The new image is on trial until it has had the network services up for OTA_HEALTH_PERIOD. Trial boots are counted
+   in RTC memory, which survives a restart but not a power cut. An image that restarts OTA_TRIAL_BOOTS times without
+   passing - crashing, hitting the watchdog or failing to get the services up within OTA_HEALTH_TIMEOUT - is rolled back.
+ - The ESP8266 has only one image slot - a new image is copied over the old one when it restarts - so rolling back
+   means downloading the previous image again, from the rollback URL set on the setup page. Point it at the last
+   good build. The download takes a few seconds, during which the loop waits, but the relays hold their state as for
+   any restart. With no URL set the trial is ended and the failure logged.
+The rollback URL is stored in EEPROM after the syslog settings.
+*/
+#ifndef _WEBRELAY_OTA_H_
+#define _WEBRELAY_OTA_H_
+
+#include <ESP8266WiFi.h>
+#include <Updater.h>
+#include <ESP8266httpUpdate.h>
+#include "Webrelay_common.h"
+#include "Webrelay_httpserver.h"
+#include "Webrelay_log.h"
+
+#define OTA_RESTART_DELAY 1000     //msecs from the image being accepted to the restart
+#define OTA_HEALTH_PERIOD 60000    //msecs a new image must have the services up for to pass its trial
+#define OTA_HEALTH_TIMEOUT 300000  //msecs a new image may take to get the services up before it is restarted
+#define OTA_TRIAL_BOOTS 3          //boots without passing before a new image is rolled back
+#define OTA_ROLLBACK_RETRY 60000   //msecs between attempts to download the rollback image
+#define OTA_URL_LENGTH 96          //including the terminating null
+#define OTA_RTC_OFFSET 0           //4 byte blocks into the RTC user memory
+#define OTA_RTC_MAGIC 0x5752u      //'WR'
+
+enum OtaState { OTA_IDLE, OTA_WRITING, OTA_RESTARTING, OTA_FAILED };
+//Names for /status in flash - read with flashTableEntry()
+const char otaStateIdle[] PROGMEM = "idle";
+const char otaStateWriting[] PROGMEM = "writing";
+const char otaStateRestarting[] PROGMEM = "restarting";
+const char otaStateFailed[] PROGMEM = "failed";
+const char* const otaStateNames[] PROGMEM = { otaStateIdle, otaStateWriting, otaStateRestarting, otaStateFailed };
+enum OtaTrial { OTA_TRIAL_NONE, OTA_TRIAL_RUNNING, OTA_TRIAL_ROLLBACK };
+
+//Kept in RTC memory across restarts
+typedef struct
+{
+  uint32_t magic;
+  uint32_t trial;  //OtaTrial
+  uint32_t boots;  //boots of the image on trial
+  uint32_t check;  //magic ^ trial ^ boots - the RTC memory is random after a power cut
+} OtaRtcRecord;
+
+char otaRollbackUrl[OTA_URL_LENGTH]; //stored in EEPROM
+uint8_t otaState = OTA_IDLE;
+uint32_t otaSize = 0;                //bytes in the image being written
+uint32_t otaWritten = 0;
+uint32_t otaStarted = 0;             //millis() the upload started
+uint32_t otaRestartAt = 0;           //millis() to restart at, while OTA_RESTARTING
+uint8_t otaError = 0;                //Updater error code of the last failure
+uint32_t otaUpdates = 0;             //images accepted
+uint32_t otaFailures = 0;
+OtaRtcRecord otaRtc;                 //this boot's trial state
+uint32_t otaRollbackTried = 0;       //millis() of the last rollback download, 0 for none yet
+
+//Function definitions
+void saveToEeprom( void );
+bool otaReadRtc( OtaRtcRecord& record );
+void otaWriteRtc( uint32_t trial, uint32_t boots );
+void otaBoot( void );
+void otaRestart( void );
+void otaRollback( void );
+void otaPoll( void );
+
+class OtaUpdater : public HttpStreamHandler
+{
+  public:
+  bool begin( size_t length )
+  {
+    String md5 = server.arg( "md5" );
+
+    if( otaState == OTA_WRITING || otaState == OTA_RESTARTING )
+    {
+      server.send( 409, "text/plain", F("Update already in progress") );
+      return false;
+    }
+    if( md5.length() != 32 )
+    {
+      server.send( 400, "text/plain", F("md5 argument of 32 hex digits required") );
+      return false;
+    }
+    if( length > ESP.getFreeSketchSpace() )
+    {
+      server.send( 413, "text/plain", F("Image larger than the free flash") );
+      return false;
+    }
+    if( !Update.begin( length, U_FLASH ) || !Update.setMD5( md5.c_str() ) )
+    {
+      otaFail();
+      server.send( 500, "text/plain", F("Unable to start update") );
+      return false;
+    }
+    otaState = OTA_WRITING;
+    otaSize = length;
+    otaWritten = 0;
+    otaStarted = millis();
+    LOGI( "OTA: receiving %u byte image", otaSize );
+    return true;
+  }
+
+  bool write( const uint8_t* data, size_t length )
+  {
+    if( Update.write( (uint8_t*) data, length ) != length )
+      return false;
+    otaWritten += length;
+    return true;
+  }
+
+  //Update.end() checks the MD5, and abandons an image that is short
+  void end( void )
+  {
+    String message;
+
+    if( otaWritten != otaSize || !Update.end() )
+    {
+      otaFail();
+      message = F("Update failed, error ");
+      message += otaError;
+      server.send( 400, "text/plain", message );
+      return;
+    }
+    otaUpdates++;
+    otaState = OTA_RESTARTING;
+    otaRestartAt = millis() + OTA_RESTART_DELAY;
+    otaWriteRtc( OTA_TRIAL_RUNNING, 0 );
+    LOGI( "OTA: image accepted in %lu msecs - restarting", (unsigned long)( millis() - otaStarted ) );
+    server.send( 200, "text/plain", F("Update accepted - restarting") );
+  }
+
+  void abort( void )
+  {
+    Update.end();
+    otaFail();
+  }
+
+  private:
+  void otaFail( void )
+  {
+    otaError = Update.getError();
+    otaFailures++;
+    otaState = OTA_FAILED;
+    LOGW( "OTA: update failed after %u of %u bytes, error %u", otaWritten, otaSize, otaError );
+  }
+};
+
+OtaUpdater ota;
+
+bool otaReadRtc( OtaRtcRecord& record )
+{
+  if( !ESP.rtcUserMemoryRead( OTA_RTC_OFFSET, (uint32_t*) &record, sizeof( record ) ) )
+    return false;
+  return ( record.magic == OTA_RTC_MAGIC && record.check == ( record.magic ^ record.trial ^ record.boots ) );
+}
+
+void otaWriteRtc( uint32_t trial, uint32_t boots )
+{
+  otaRtc.magic = OTA_RTC_MAGIC;
+  otaRtc.trial = trial;
+  otaRtc.boots = boots;
+  otaRtc.check = otaRtc.magic ^ otaRtc.trial ^ otaRtc.boots;
+  ESP.rtcUserMemoryWrite( OTA_RTC_OFFSET, (uint32_t*) &otaRtc, sizeof( otaRtc ) );
+}
+
+//Called from setup() once the outputs are restored - count another boot of an image on trial
+void otaBoot( void )
+{
+  if( !otaReadRtc( otaRtc ) || otaRtc.trial == OTA_TRIAL_NONE )
+  {
+    otaRtc.trial = OTA_TRIAL_NONE;
+    return;
+  }
+  if( otaRtc.trial == OTA_TRIAL_RUNNING && otaRtc.boots >= OTA_TRIAL_BOOTS )
+  {
+    LOGE( "OTA: new image restarted %u times without passing its health check - rolling back", otaRtc.boots );
+    otaWriteRtc( OTA_TRIAL_ROLLBACK, otaRtc.boots );
+  }
+  else
+    otaWriteRtc( otaRtc.trial, otaRtc.boots + 1 );
+  LOGI( "OTA: image on trial, boot %u", otaRtc.boots );
+}
+
+//Save the live switch state and restart - setup() puts it back before anything else
+void otaRestart( void )
+{
+  saveToEeprom();
+  logFlush();
+  device.restart();
+}
+
+//Fetch the previous image again and restart into it. Waits for the download.
+void otaRollback( void )
+{
+  t_httpUpdate_return result;
+
+  otaRollbackTried = ( millis() > 0 ) ? millis() : 1;
+  if( otaRollbackUrl[0] == '\0' )
+  {
+    LOGE( "OTA: no rollback URL set - keeping the new image" );
+    otaWriteRtc( OTA_TRIAL_NONE, 0 );
+    return;
+  }
+  LOGW( "OTA: downloading rollback image from %s", otaRollbackUrl );
+  logFlush();
+  ESPhttpUpdate.rebootOnUpdate( false );
+  result = ESPhttpUpdate.update( String( otaRollbackUrl ) );
+  if( result != HTTP_UPDATE_OK )
+  {
+    otaFailures++;
+    LOGE( "OTA: rollback download failed: %s", ESPhttpUpdate.getLastErrorString().c_str() );
+    return;
+  }
+  otaWriteRtc( OTA_TRIAL_NONE, 0 );
+  otaRestart();
+}
+
+//Called from the updater task
+void otaPoll( void )
+{
+  if( otaState == OTA_RESTARTING && (int32_t)( millis() - otaRestartAt ) >= 0 )
+    otaRestart();
+
+  switch( otaRtc.trial )
+  {
+    case OTA_TRIAL_RUNNING:
+      if( servicesStarted && ( millis() - bootStageTime[BOOT_SERVICES] ) >= OTA_HEALTH_PERIOD )
+      {
+        LOGI( "OTA: new image passed its health check" );
+        otaWriteRtc( OTA_TRIAL_NONE, 0 );
+      }
+      else if( !servicesStarted && millis() >= OTA_HEALTH_TIMEOUT )
+      {
+        LOGW( "OTA: new image has no network services - restarting" );
+        otaRestart();
+      }
+      break;
+    case OTA_TRIAL_ROLLBACK:
+      //The download needs WiFi - wait for it, however long it takes
+      if( WiFi.status() == WL_CONNECTED && ( otaRollbackTried == 0 || ( millis() - otaRollbackTried ) >= OTA_ROLLBACK_RETRY ) )
+        otaRollback();
+      break;
+    default:
+      break;
+  }
+}
+#endif
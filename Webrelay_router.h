@@ -0,0 +1,155 @@
+/*
+Webrelay_router.h
+Request router for the ALPACA switch API. 
+All switch URLs have the form /api/v1/switch/{device_number}/{method}. Rather than registering every method 
+once per device number with server.on(), a single dispatcher parses the device number straight out of the URI and 
+finds the method by binary search of a sorted table. That costs less per request than the web server's linear 
+walk of its handler list did for the single device, however many device numbers are configured.
+The handler selects the device being addressed by setting 'dev' and 'deviceNumber' before calling the method handler. 
+Each request is stamped with the next ServerTransactionID and recorded in the trace ring buffer once handled. 
+It also refreshes the client's session and refuses PUTs that re-use an old ClientTransactionID, so the individual 
+handlers don't have to. 
+*/
+#ifndef _WEBRELAY_ROUTER_H_
+#define _WEBRELAY_ROUTER_H_
+
+#include "Webrelay_httpserver.h"
+#include "Webrelay_common.h"
+#include "Webrelay_sessions.h"
+#include "Webrelay_trace.h"
+#include "Webrelay_metrics.h"
+#include "DebugSerial.h"
+
+typedef void (*RouteHandler)(void);
+typedef struct
+{
+  const char* name;
+  HTTPMethod method;
+  RouteHandler handler;
+} AlpacaRoute;
+
+//Keep this table sorted by name - it is binary searched. 
+const AlpacaRoute alpacaRoutes[] = 
+{
+  { "action",               HTTP_PUT, handleAction },
+  { "canwrite",             HTTP_GET, handlerCanWrite },
+  { "commandblind",         HTTP_PUT, handleCommandBlind },
+  { "commandbool",          HTTP_PUT, handleCommandBool },
+  { "commandstring",        HTTP_PUT, handleCommandString },
+  { "connected",            HTTP_ANY, handleConnected },
+  { "description",          HTTP_GET, handleDescriptionGet },
+  { "driverinfo",           HTTP_GET, handleDriverInfoGet },
+  { "driverversion",        HTTP_GET, handleDriverVersionGet },
+  { "getswitch",            HTTP_GET, handlerSwitchState },
+  { "getswitchdescription", HTTP_GET, handlerSwitchDescription },
+  { "getswitchname",        HTTP_GET, handlerSwitchName },
+  { "getswitchtype",        HTTP_GET, handlerSwitchType },
+  { "getswitchvalue",       HTTP_GET, handlerSwitchValue },
+  { "interfaceversion",     HTTP_GET, handleInterfaceVersionGet },
+  { "maxswitch",            HTTP_GET, handlerMaxswitch },
+  { "maxswitchvalue",       HTTP_GET, handlerMaxSwitchValue },
+  { "minswitchvalue",       HTTP_GET, handlerMinSwitchValue },
+  { "name",                 HTTP_GET, handleNameGet },
+  { "setswitch",            HTTP_PUT, handlerSwitchState },
+  { "setswitchname",        HTTP_PUT, handlerSwitchName },
+  { "setswitchpulse",       HTTP_PUT, handlerSwitchPulse },
+  { "setswitchtype",        HTTP_PUT, handlerSwitchType },
+  { "setswitchvalue",       HTTP_PUT, handlerSwitchValue },
+  { "setup",                HTTP_ANY, handlerSetup },
+  { "setupSwitches",        HTTP_ANY, handlerSetupSwitches },
+  { "status",               HTTP_ANY, handlerStatus },
+  { "supportedactions",     HTTP_GET, handleSupportedActionsGet },
+  { "switchstep",           HTTP_GET, handlerSwitchStep },
+  { "trace",                HTTP_GET, handlerTrace },
+};
+const int numAlpacaRoutes = sizeof( alpacaRoutes ) / sizeof( AlpacaRoute );
+static_assert( sizeof( alpacaRoutes ) / sizeof( AlpacaRoute ) <= MAX_ROUTE_HISTOGRAMS, "Increase MAX_ROUTE_HISTOGRAMS to cover the route table" );
+const char alpacaSwitchPrefix[] = "/api/v1/switch/";
+
+class AlpacaSwitchRouter : public HttpDispatcher 
+{
+  public:
+  /*
+   * Parse /api/v1/switch/{device_number}/{method} - returns the route table index or -1.
+   * The device number is returned through devNum. 
+   */
+  static int parse( const char* uri, int& devNum )
+  {
+    const char* p = uri;
+    int lo = 0, hi = numAlpacaRoutes - 1;
+    
+    if( strncasecmp( p, alpacaSwitchPrefix, sizeof( alpacaSwitchPrefix ) - 1 ) != 0 )
+      return -1;
+    p += sizeof( alpacaSwitchPrefix ) - 1;
+    
+    if( *p < '0' || *p > '9' )
+      return -1;
+    devNum = 0;
+    while( *p >= '0' && *p <= '9' )
+      devNum = ( devNum * 10 ) + ( *p++ - '0' );
+    if( *p++ != '/' || devNum >= numDevices )
+      return -1;
+    
+    while( lo <= hi )
+    {
+      int mid = ( lo + hi ) / 2;
+      int cmp = strcasecmp( p, alpacaRoutes[mid].name );
+      if( cmp == 0 )
+        return mid;
+      else if( cmp < 0 )
+        hi = mid - 1;
+      else 
+        lo = mid + 1;
+    }
+    return -1;
+  }
+
+  bool dispatch( HTTPMethod requestMethod, const char* requestUri ) override
+  {
+    _route = parse( requestUri, _devNum );
+    if( _route < 0 || ( alpacaRoutes[_route].method != HTTP_ANY && alpacaRoutes[_route].method != requestMethod ) )
+      return false;
+    
+    uint32_t start = micros();
+    uint32_t serverTransID = nextServerTransactionId();
+    deviceNumber = _devNum;
+    dev = &alpacaDevice[_devNum];
+    server.responseCode = 0;
+    
+    uint32_t clientID = (uint32_t)server.arg("ClientID").toInt();
+    uint32_t transID = ( requestMethod == HTTP_PUT ) ? (uint32_t)server.arg("ClientTransactionID").toInt() : 0;
+    if( touchSession( _devNum, clientID, transID ) == SESSION_STALE )
+    {
+      String message;
+      DynamicJsonBuffer jsonBuffer(256);
+      JsonObject& root = jsonBuffer.createObject();
+      jsonResponseBuilder( root, clientID, transID, alpacaRoutes[_route].name, invalidValue, F("ClientTransactionID already used by this client") );
+      root.printTo( message );
+      server.send( 400, "application/json", message );
+    }
+    else
+      alpacaRoutes[_route].handler();
+
+    uint32_t latency = micros() - start;
+    String switchArg = server.arg("Id");
+    traceRecord( serverTransID, clientID, (uint8_t) _route, ( switchArg.length() > 0 ) ? switchArg.toInt() : -1, 
+                 server.responseCode, latency );
+    if( _route < MAX_ROUTE_HISTOGRAMS )
+      histRecord( &routeHist[_route], latency );
+    return true;
+  }
+
+  private:
+  int _route = -1;
+  int _devNum = 0;
+};
+
+AlpacaSwitchRouter alpacaRouter;
+
+const char* traceMethodName( uint8_t method )
+{
+  if( method < numAlpacaRoutes )
+    return alpacaRoutes[method].name;
+  return "unknown";
+}
+#endif
@@ -0,0 +1,236 @@
+/*
+Webrelay_rules.h
+Interlock rules between switches, checked on the device before a relay change reaches the expander.
+Rules are kept in a small table stored in EEPROM after the switch settings. Each rule names a switch and another
+switch it depends on:
+ RULE_EXCLUSIVE   - the two switches are never on together, e.g. roof open and roof close.
+ RULE_REQUIRES    - the switch can only be on while the other is on, and the other can't be turned off under it,
+                    e.g. camera power requires mount power.
+ RULE_DELAY_AFTER - the switch can only be turned on once the other has been on for at least delay msecs.
+When the table is loaded or changed it is compiled into a bitmask per switch, so checking a change is a few mask
+operations against the mask of relays that are currently on, however many rules there are. Only delay-after rules
+need the time each of the other switches came on - each is compiled into a (switch, other, delay) entry, so a switch
+that waits on several others waits the right time for each.
+Switch numbers are host switch indexes - the same as the expander pins - not ids local to an ALPACA device number.
+*/
+#ifndef _WEBRELAY_RULES_H_
+#define _WEBRELAY_RULES_H_
+
+#include "Webrelay_common.h"
+#include "Webrelay_flash.h"
+#include "DebugSerial.h"
+
+#define MAX_RULES 16
+#define MAX_INTERLOCK_SWITCHES 32 //one bit each in the rule masks
+
+enum RuleType { RULE_NONE, RULE_EXCLUSIVE, RULE_REQUIRES, RULE_DELAY_AFTER };
+//Names in flash - read with flashTableText() or flashTableEntry()
+const char ruleTypeNone[] PROGMEM = "none";
+const char ruleTypeExclusive[] PROGMEM = "exclusive";
+const char ruleTypeRequires[] PROGMEM = "requires";
+const char ruleTypeDelayAfter[] PROGMEM = "delayafter";
+const char* const ruleTypeNames[] PROGMEM = { ruleTypeNone, ruleTypeExclusive, ruleTypeRequires, ruleTypeDelayAfter };
+
+enum RuleResult { RULE_OK, RULE_EXCLUDED, RULE_MISSING_REQUIRED, RULE_HAS_DEPENDENT, RULE_TOO_SOON };
+//Error messages in flash - read with flashTableText() or flashTableEntry()
+const char ruleResultOk[] PROGMEM = "";
+const char ruleResultExcluded[] PROGMEM = "Refused by interlock - an exclusive switch is on";
+const char ruleResultMissingRequired[] PROGMEM = "Refused by interlock - a required switch is off";
+const char ruleResultHasDependent[] PROGMEM = "Refused by interlock - a switch that requires this one is on";
+const char ruleResultTooSoon[] PROGMEM = "Refused by interlock - a required switch has not been on long enough";
+const char* const ruleResultText[] PROGMEM =
+{
+  ruleResultOk, ruleResultExcluded, ruleResultMissingRequired, ruleResultHasDependent, ruleResultTooSoon
+};
+
+typedef struct
+{
+  uint8_t type;     //RuleType
+  uint8_t target;   //switch the rule applies to
+  uint8_t other;    //switch it depends on
+  uint8_t reserved;
+  uint32_t delay;   //msecs, delay-after rules only
+} Rule;
+
+Rule rule[MAX_RULES];
+int numRules = 0;
+
+//Compiled rules - bit n is switch n
+uint32_t excludeMask[MAX_INTERLOCK_SWITCHES];   //must all be off for the switch to turn on
+uint32_t requireMask[MAX_INTERLOCK_SWITCHES];   //must all be on for the switch to turn on
+uint32_t dependentMask[MAX_INTERLOCK_SWITCHES]; //must all be off for the switch to turn off
+uint32_t delayMask[MAX_INTERLOCK_SWITCHES];     //must all have been on for their ruleDelay time for the switch to turn on
+
+typedef struct
+{
+  uint8_t target;
+  uint8_t other;
+  uint32_t delay;   //longest delay-after rule for the pair
+} RuleDelay;
+
+RuleDelay ruleDelay[MAX_RULES];
+int numRuleDelays = 0;
+uint32_t relayOnMask = 0;
+uint32_t relayOnSince[MAX_INTERLOCK_SWITCHES];
+
+//Function definitions
+void ruleAddDelay( uint8_t target, uint8_t other, uint32_t delay );
+void compileRules( void );
+bool addRule( uint8_t type, int target, int other, uint32_t delay );
+bool removeRule( int index );
+enum RuleResult ruleCheck( int index, bool state );
+enum RuleResult ruleCheckMask( uint32_t from, uint32_t to );
+void ruleNoteState( int index, bool state );
+
+//Compiled delay for a pair of switches - two rules for the same pair keep the longer delay
+void ruleAddDelay( uint8_t target, uint8_t other, uint32_t delay )
+{
+  for( int i = 0; i < numRuleDelays; i++ )
+  {
+    if( ruleDelay[i].target == target && ruleDelay[i].other == other )
+    {
+      if( delay > ruleDelay[i].delay )
+        ruleDelay[i].delay = delay;
+      return;
+    }
+  }
+  if( numRuleDelays >= MAX_RULES )
+    return;
+  ruleDelay[numRuleDelays].target = target;
+  ruleDelay[numRuleDelays].other = other;
+  ruleDelay[numRuleDelays].delay = delay;
+  numRuleDelays++;
+}
+
+void compileRules( void )
+{
+  int i;
+
+  for( i = 0; i < MAX_INTERLOCK_SWITCHES; i++ )
+  {
+    excludeMask[i] = 0;
+    requireMask[i] = 0;
+    dependentMask[i] = 0;
+    delayMask[i] = 0;
+  }
+  numRuleDelays = 0;
+
+  for( i = 0; i < numRules; i++ )
+  {
+    Rule* r = &rule[i];
+    if( r->target >= MAX_INTERLOCK_SWITCHES || r->other >= MAX_INTERLOCK_SWITCHES || r->target == r->other )
+      continue;
+    switch( r->type )
+    {
+      case RULE_EXCLUSIVE:
+        excludeMask[r->target] |= ( 1UL << r->other );
+        excludeMask[r->other]  |= ( 1UL << r->target );
+        break;
+      case RULE_DELAY_AFTER:
+        delayMask[r->target] |= ( 1UL << r->other );
+        ruleAddDelay( r->target, r->other, r->delay );
+        //fall through - the other switch has to be on too
+      case RULE_REQUIRES:
+        requireMask[r->target]  |= ( 1UL << r->other );
+        dependentMask[r->other] |= ( 1UL << r->target );
+        break;
+      default:
+        break;
+    }
+  }
+  DEBUGS1( "compileRules: rules compiled: " ); DEBUGSL1( numRules );
+}
+
+bool addRule( uint8_t type, int target, int other, uint32_t delay )
+{
+  if( numRules >= MAX_RULES || type == RULE_NONE || type > RULE_DELAY_AFTER ||
+      target < 0 || target >= MAX_INTERLOCK_SWITCHES || other < 0 || other >= MAX_INTERLOCK_SWITCHES || target == other )
+    return false;
+  rule[numRules].type = type;
+  rule[numRules].target = (uint8_t) target;
+  rule[numRules].other = (uint8_t) other;
+  rule[numRules].reserved = 0;
+  rule[numRules].delay = ( type == RULE_DELAY_AFTER ) ? delay : 0;
+  numRules++;
+  compileRules();
+  return true;
+}
+
+bool removeRule( int index )
+{
+  if( index < 0 || index >= numRules )
+    return false;
+  for( int i = index; i < numRules - 1; i++ )
+    rule[i] = rule[i+1];
+  numRules--;
+  compileRules();
+  return true;
+}
+
+/*
+ * Check a change of the set of relays that are on from 'from' to 'to', e.g. for a batch of switch changes.
+ * Only the switches that change are checked, so a state that already breaks a rule (e.g. at power up) doesn't
+ * block unrelated changes.
+ */
+enum RuleResult ruleCheckMask( uint32_t from, uint32_t to )
+{
+  uint32_t turningOn = to & ~from;
+  uint32_t turningOff = from & ~to;
+  uint32_t now = millis();
+  int i;
+
+  while( turningOn != 0 )
+  {
+    i = __builtin_ctz( turningOn );
+    turningOn &= turningOn - 1;
+
+    if( excludeMask[i] & to )
+      return RULE_EXCLUDED;
+    if( requireMask[i] & ~to )
+      return RULE_MISSING_REQUIRED;
+    if( delayMask[i] != 0 )
+    {
+      for( int k = 0; k < numRuleDelays; k++ )
+      {
+        RuleDelay* d = &ruleDelay[k];
+        if( d->target != i || d->delay == 0 )
+          continue;
+        //Anything only coming on in this change hasn't been on for long enough
+        if( !( from & ( 1UL << d->other ) ) || ( now - relayOnSince[d->other] ) < d->delay )
+          return RULE_TOO_SOON;
+      }
+    }
+  }
+
+  while( turningOff != 0 )
+  {
+    i = __builtin_ctz( turningOff );
+    turningOff &= turningOff - 1;
+    if( dependentMask[i] & to )
+      return RULE_HAS_DEPENDENT;
+  }
+  return RULE_OK;
+}
+
+enum RuleResult ruleCheck( int index, bool state )
+{
+  if( index < 0 || index >= MAX_INTERLOCK_SWITCHES )
+    return RULE_OK;
+  return ruleCheckMask( relayOnMask, (state) ? ( relayOnMask | ( 1UL << index ) ) : ( relayOnMask & ~( 1UL << index ) ) );
+}
+
+//Keep track of which relays are on, and since when, for checking rules. A switch changed from a relay to another
+//type is noted as off, so it can't hold up the switches interlocked with it.
+void ruleNoteState( int index, bool state )
+{
+  if( index < 0 || index >= MAX_INTERLOCK_SWITCHES )
+    return;
+  if( state && !( relayOnMask & ( 1UL << index ) ) )
+  {
+    relayOnMask |= ( 1UL << index );
+    relayOnSince[index] = millis();
+  }
+  else if( !state )
+    relayOnMask &= ~( 1UL << index );
+}
+#endif
@@ -0,0 +1,74 @@
+/*
+Webrelay_scenes.h
+Named scenes - a stored target value for every switch on the host, e.g. "imaging", "flats", "park" or "all off".
+A scene is saved from the switches' current values and applied with a single ALPACA Action, so a client changes
+the whole observatory state in one request instead of a string of setswitch calls that can fail part way through.
+Applying is all or nothing: the relay part of the scene is checked against the interlock rules as one change and
+then goes to the expander as one write, and analogue outputs ramp to their scene values - see applyScene().
+Scenes cover every switch on the host whichever device number the Action arrives on. Input switches are ignored.
+Scenes are stored in EEPROM after the schedule table.
+*/
+#ifndef _WEBRELAY_SCENES_H_
+#define _WEBRELAY_SCENES_H_
+
+#include "Webrelay_common.h"
+
+#define MAX_SCENES 8
+#define SCENE_NAME_LENGTH 16
+#define MAX_SCENE_SWITCHES MAX_SWITCHES
+
+typedef struct
+{
+  char name[SCENE_NAME_LENGTH];
+  SwitchLevel level[MAX_SCENE_SWITCHES]; //steps - see Webrelay_switchtypes.h
+} Scene;
+
+Scene scene[MAX_SCENES];
+int numScenes = 0;
+uint32_t scenesApplied = 0;
+
+//Function definitions
+int findScene( const char* name );
+int addScene( const char* name );
+bool removeScene( int index );
+
+//Scene names are matched ignoring case, as ALPACA action names are. Returns -1 if not found.
+int findScene( const char* name )
+{
+  for( int i = 0; i < numScenes; i++ )
+  {
+    if( strncasecmp( scene[i].name, name, SCENE_NAME_LENGTH ) == 0 )
+      return i;
+  }
+  return -1;
+}
+
+//Returns the scene with this name, adding it if there isn't one. Returns -1 if the name is unusable or the table is full.
+int addScene( const char* name )
+{
+  int index;
+  size_t length = strlen( name );
+
+  if( length == 0 || length >= SCENE_NAME_LENGTH || strchr( name, ':' ) != nullptr )
+    return -1;
+  index = findScene( name );
+  if( index >= 0 )
+    return index;
+  if( numScenes >= MAX_SCENES )
+    return -1;
+  index = numScenes++;
+  memset( &scene[index], 0, sizeof( Scene ) );
+  strcpy( scene[index].name, name );
+  return index;
+}
+
+bool removeScene( int index )
+{
+  if( index < 0 || index >= numScenes )
+    return false;
+  for( int i = index; i < numScenes - 1; i++ )
+    scene[i] = scene[i+1];
+  numScenes--;
+  return true;
+}
+#endif
@@ -0,0 +1,213 @@
+/*
+Webrelay_schedule.h
+Timetable for the switches, run on the device from the NTP clock so it keeps going with no client connected.
+Each entry turns a switch on or off, or sets an analogue value, on the days of the week in its day mask, either
+ - at a clock time, cron style - the hour and/or minute can be SCHED_ANY to fire every hour or every minute, or
+ - at sunrise or sunset plus an offset in minutes (negative for before), worked out on the device for the
+   site latitude and longitude.
+The table is stored in EEPROM after the other settings. Each entry's next fire time is worked out when the table
+changes and again after it fires, and the earliest of them is kept, so the 250 msec clock tick only compares the
+time against that one value - the entries are only looked at when one is due. The next fire times are worked out
+afresh whenever the clock is first set or jumps, so setting the clock doesn't fire a day's worth of old entries.
+Times are in the device's clock time - see TZ in Webrelay_common.h. time() gives UTC, so scheduleRun() adds
+SCHED_UTC_OFFSET to it first, and every time_t here after that - day starts, fire times, the "Next" reported by
+/api/v1/schedules - counts device clock seconds. Sunrise and sunset use the NOAA approximation, good to a minute or
+two, which is plenty for dew heaters and lights.
+*/
+#ifndef _WEBRELAY_SCHEDULE_H_
+#define _WEBRELAY_SCHEDULE_H_
+
+#include <math.h>
+#include <time.h>
+#include "Webrelay_common.h"
+#include "Webrelay_flash.h"
+#include "DebugSerial.h"
+
+#define MAX_SCHEDULES 16
+#define SCHED_ANY 0xFF              //hour or minute wildcard
+#define SCHED_ALL_DAYS 0x7F
+#define SCHED_VALID_TIME 1577836800 //2020-01-01 - anything earlier means the clock hasn't been set yet
+#define SCHED_MAX_JUMP 3600         //secs - a bigger step in the clock works the next fire times out again
+#define SCHED_UTC_OFFSET ( TZ_SEC + DST_SEC ) //device clock time less UTC
+
+enum ScheduleAction { SCHED_OFF, SCHED_ON, SCHED_VALUE };
+//Names in flash, in enum order - read with flashTableText() or flashTableEntry()
+const char scheduleActionOff[] PROGMEM = "off";
+const char scheduleActionOn[] PROGMEM = "on";
+const char scheduleActionValue[] PROGMEM = "value";
+const char* const scheduleActionNames[] PROGMEM = { scheduleActionOff, scheduleActionOn, scheduleActionValue };
+enum ScheduleBase { SCHED_CLOCK, SCHED_SUNRISE, SCHED_SUNSET };
+const char scheduleBaseClock[] PROGMEM = "clock";
+const char scheduleBaseSunrise[] PROGMEM = "sunrise";
+const char scheduleBaseSunset[] PROGMEM = "sunset";
+const char* const scheduleBaseNames[] PROGMEM = { scheduleBaseClock, scheduleBaseSunrise, scheduleBaseSunset };
+
+typedef struct
+{
+  uint8_t target;   //host switch index
+  uint8_t action;   //ScheduleAction
+  uint8_t base;     //ScheduleBase
+  uint8_t days;     //bit 0 Sunday to bit 6 Saturday
+  uint8_t hour;     //clock entries - 0-23 or SCHED_ANY
+  uint8_t minute;   //clock entries - 0-59 or SCHED_ANY
+  int16_t offset;   //sunrise/sunset entries - minutes
+  float value;      //SCHED_VALUE entries
+} ScheduleEntry;
+
+typedef void (*ScheduleCallback)( int index );
+
+ScheduleEntry schedule[MAX_SCHEDULES];
+int numSchedules = 0;
+float siteLatitude = 0.0F;   //degrees, north positive
+float siteLongitude = 0.0F;  //degrees, east positive
+
+time_t scheduleNextFire[MAX_SCHEDULES]; //0 if the entry never fires
+time_t scheduleNext = 0;                //earliest of them
+time_t scheduleLast = 0;                //time last checked
+bool scheduleStale = true;              //next fire times need working out again
+uint32_t scheduleFired = 0;
+
+//Function definitions
+bool addSchedule( ScheduleEntry& entry );
+bool removeSchedule( int index );
+void scheduleReindex( time_t now );
+time_t scheduleNextTime( ScheduleEntry& e, time_t after );
+bool sunEventTime( time_t dayStart, bool rising, time_t& when );
+void scheduleRun( time_t utc, ScheduleCallback fn );
+
+bool addSchedule( ScheduleEntry& entry )
+{
+  if( numSchedules >= MAX_SCHEDULES || entry.action > SCHED_VALUE || entry.base > SCHED_SUNSET ||
+      ( entry.days & SCHED_ALL_DAYS ) == 0 ||
+      ( entry.hour > 23 && entry.hour != SCHED_ANY ) || ( entry.minute > 59 && entry.minute != SCHED_ANY ) ||
+      entry.offset < -720 || entry.offset > 720 )
+    return false;
+  schedule[numSchedules++] = entry;
+  scheduleStale = true;
+  return true;
+}
+
+bool removeSchedule( int index )
+{
+  if( index < 0 || index >= numSchedules )
+    return false;
+  for( int i = index; i < numSchedules - 1; i++ )
+    schedule[i] = schedule[i+1];
+  numSchedules--;
+  scheduleStale = true;
+  return true;
+}
+
+/*
+ * Time a sunrise or sunset happens on the day starting at dayStart, both in device clock time.
+ * Returns false if the sun doesn't rise or set that day at the site latitude.
+ */
+bool sunEventTime( time_t dayStart, bool rising, time_t& when )
+{
+  struct tm day;
+  float gamma, eqTime, decl, lat, cosHA, ha, minutes;
+
+  gmtime_r( &dayStart, &day );
+  gamma = 2.0F * (float) M_PI / 365.0F * (float) day.tm_yday;
+  eqTime = 229.18F * ( 0.000075F + 0.001868F * cosf( gamma ) - 0.032077F * sinf( gamma )
+                      - 0.014615F * cosf( 2 * gamma ) - 0.040849F * sinf( 2 * gamma ) );
+  decl = 0.006918F - 0.399912F * cosf( gamma ) + 0.070257F * sinf( gamma ) - 0.006758F * cosf( 2 * gamma )
+         + 0.000907F * sinf( 2 * gamma ) - 0.002697F * cosf( 3 * gamma ) + 0.00148F * sinf( 3 * gamma );
+  lat = siteLatitude * (float) M_PI / 180.0F;
+  //90.833 degrees allows for refraction and the size of the sun's disc
+  cosHA = cosf( 90.833F * (float) M_PI / 180.0F ) / ( cosf( lat ) * cosf( decl ) ) - tanf( lat ) * tanf( decl );
+  if( cosHA < -1.0F || cosHA > 1.0F )
+    return false;
+  ha = acosf( cosHA ) * 180.0F / (float) M_PI;
+  minutes = 720.0F - 4.0F * ( siteLongitude + ( ( rising ) ? ha : -ha ) ) - eqTime; //UTC
+  when = dayStart + (time_t)( minutes * 60.0F ) + SCHED_UTC_OFFSET;
+  return true;
+}
+
+/*
+ * The first time after 'after' that the entry fires, 0 if it doesn't fire within the next week.
+ */
+time_t scheduleNextTime( ScheduleEntry& e, time_t after )
+{
+  time_t dayStart = after - ( after % 86400 );
+  time_t hourStart, candidate;
+  int hour;
+
+  for( int d = 0; d <= 7; d++, dayStart += 86400 )
+  {
+    //1 Jan 1970 was a Thursday
+    if( !( e.days & ( 1 << ( ( dayStart / 86400 + 4 ) % 7 ) ) ) )
+      continue;
+    if( e.base == SCHED_CLOCK )
+    {
+      for( hour = ( e.hour == SCHED_ANY ) ? 0 : e.hour; hour < 24; hour++ )
+      {
+        hourStart = dayStart + hour * 3600;
+        if( e.minute != SCHED_ANY )
+          candidate = hourStart + e.minute * 60;
+        else
+          candidate = ( after < hourStart ) ? hourStart : after - ( after % 60 ) + 60; //next whole minute
+        if( candidate > after && candidate < hourStart + 3600 )
+          return candidate;
+        if( e.hour != SCHED_ANY )
+          break;
+      }
+    }
+    else
+    {
+      //The sun's time moves a little from day to day so work it out for each day
+      if( sunEventTime( dayStart, e.base == SCHED_SUNRISE, candidate ) )
+      {
+        candidate += e.offset * 60;
+        if( candidate > after )
+          return candidate;
+      }
+    }
+  }
+  return 0;
+}
+
+//Work out every entry's next fire time and the earliest of them
+void scheduleReindex( time_t now )
+{
+  scheduleNext = 0;
+  for( int i = 0; i < numSchedules; i++ )
+  {
+    scheduleNextFire[i] = scheduleNextTime( schedule[i], now );
+    if( scheduleNextFire[i] != 0 && ( scheduleNext == 0 || scheduleNextFire[i] < scheduleNext ) )
+      scheduleNext = scheduleNextFire[i];
+  }
+  scheduleStale = false;
+  DEBUGS1( "scheduleReindex: next fire " ); DEBUGSL1( (uint32_t) scheduleNext );
+}
+
+/*
+ * Called on every clock tick with time(), which is UTC. Calls fn for each entry that is due, then works out when those
+ * entries fire next.
+ */
+void scheduleRun( time_t utc, ScheduleCallback fn )
+{
+  time_t now = utc + SCHED_UTC_OFFSET;
+
+  if( utc < SCHED_VALID_TIME )
+    return;
+  if( scheduleStale || now < scheduleLast || ( now - scheduleLast ) > SCHED_MAX_JUMP )
+    scheduleReindex( now );
+  scheduleLast = now;
+  if( scheduleNext == 0 || now < scheduleNext )
+    return;
+
+  scheduleNext = 0;
+  for( int i = 0; i < numSchedules; i++ )
+  {
+    if( scheduleNextFire[i] != 0 && scheduleNextFire[i] <= now )
+    {
+      scheduleFired++;
+      fn( i );
+      scheduleNextFire[i] = scheduleNextTime( schedule[i], now );
+    }
+    if( scheduleNextFire[i] != 0 && ( scheduleNext == 0 || scheduleNextFire[i] < scheduleNext ) )
+      scheduleNext = scheduleNextFire[i];
+  }
+}
+#endif
@@ -0,0 +1,122 @@
+/*
+Webrelay_scheduler.h
+Small cooperative scheduler run from loop().
+Tasks are plain functions that do a bounded amount of work and return. Each has a priority (0 is highest), a period
+between runs and a run time budget. Each pass of schedulerRun() runs the due tasks in priority order until the pass
+has used SCHED_PASS_BUDGET usecs, after which due tasks are left for a later pass - so a burst of background work
+can't hold up request handling for long. A due task whose deadline (its due time plus one period) has passed runs
+regardless of the pass budget, so background work is always guaranteed to make progress.
+Run counts, total and max run time, budget overruns and late starts are kept per task and reported by /metrics.
+The scheduler itself never allocates.
+*/
+#ifndef _WEBRELAY_SCHEDULER_H_
+#define _WEBRELAY_SCHEDULER_H_
+
+#include "Webrelay_common.h"
+
+#define MAX_TASKS 16
+#define SCHED_PASS_BUDGET 20000 //usecs per pass of loop() before remaining due tasks are deferred
+
+typedef void (*TaskFunction)(void);
+
+typedef struct
+{
+  const char* name;
+  TaskFunction fn;
+  uint8_t priority;
+  uint32_t period;    //msecs between runs, 0 to run every pass
+  uint32_t budget;    //usecs a single run is expected to take
+  uint32_t due;       //millis() when next due
+  uint32_t runs;
+  uint32_t overruns;  //runs that took longer than budget
+  uint32_t late;      //runs started after their deadline
+  uint32_t maxTime;   //usecs
+  uint64_t totalTime; //usecs
+} Task;
+
+Task task[MAX_TASKS];
+int numTasks = 0;
+
+//Function definitions
+int schedulerAdd( const char* name, TaskFunction fn, uint8_t priority, uint32_t period, uint32_t budget );
+void schedulerRun( void );
+void schedulerWake( int taskId );
+int schedulerFind( const char* name );
+
+/*
+ * Register a task - keeps the task table in priority order. Returns the task id or -1 if the table is full.
+ * Task ids are only stable once all tasks have been added.
+ */
+int schedulerAdd( const char* name, TaskFunction fn, uint8_t priority, uint32_t period, uint32_t budget )
+{
+  int i;
+  if( numTasks >= MAX_TASKS )
+    return -1;
+
+  for( i = numTasks; i > 0 && task[i-1].priority > priority; i-- )
+    task[i] = task[i-1];
+
+  memset( &task[i], 0, sizeof( Task ) );
+  task[i].name = name;
+  task[i].fn = fn;
+  task[i].priority = priority;
+  task[i].period = period;
+  task[i].budget = budget;
+  task[i].due = millis();
+  numTasks++;
+  return i;
+}
+
+//Make a task due now, e.g. when an event arrives for it.
+void schedulerWake( int taskId )
+{
+  if( taskId >= 0 && taskId < numTasks )
+    task[taskId].due = millis();
+}
+
+//Look up a task id by name, once all the tasks have been added. Returns -1 if not found.
+int schedulerFind( const char* name )
+{
+  for( int i = 0; i < numTasks; i++ )
+  {
+    if( strcmp( task[i].name, name ) == 0 )
+      return i;
+  }
+  return -1;
+}
+
+void schedulerRun( void )
+{
+  uint32_t passStart = micros();
+  uint32_t now = millis();
+
+  for( int i = 0; i < numTasks; i++ )
+  {
+    Task* t = &task[i];
+    if( (int32_t)( now - t->due ) < 0 )
+      continue;
+
+    bool overdue = (int32_t)( now - t->due ) > (int32_t) t->period && t->period > 0;
+    if( !overdue && ( micros() - passStart ) > SCHED_PASS_BUDGET )
+      continue;
+
+    uint32_t start = micros();
+    t->fn();
+    uint32_t elapsed = micros() - start;
+
+    t->runs++;
+    t->totalTime += elapsed;
+    if( elapsed > t->maxTime )
+      t->maxTime = elapsed;
+    if( elapsed > t->budget )
+      t->overruns++;
+    if( overdue )
+      t->late++;
+
+    //Keep to the period's phase unless we've fallen more than a period behind
+    t->due += t->period;
+    if( (int32_t)( now - t->due ) > 0 )
+      t->due = now + t->period;
+  }
+}
+#endif
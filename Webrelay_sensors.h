@@ -0,0 +1,256 @@
+/*
+Webrelay_sensors.h
+Current and voltage sensing with I2C power monitors on the expander's bus, so a client can see that a relay really
+powered its load - a dew heater drawing current, say. Supported chips:
+ INA219  - one channel, address 0x40-0x4F. Shunt voltage LSB 10uV (+-320mV), bus voltage LSB 4mV (32V).
+ INA3221 - three channels, address 0x40-0x43. Shunt voltage LSB 40uV (+-163.8mV), bus voltage LSB 8mV (26V).
+Both are left in the continuous conversion mode they power up in, so nothing is ever written to them. Current is
+worked out here from the shunt voltage and the shunt resistance given when the sensor is bound - uV / milliohms is mA -
+rather than with the INA219's calibration register, so both chips are read the same way.
+Each binding ties one channel and quantity - current in mA, bus voltage in mV or power in mW - to a switch, which
+becomes a read-only analogue switch of type SWITCH_SENSOR with a range of the quantity in whole units.
+The sensors task reads one binding per run, in turn, so a bus read never holds up anything else for long. Each
+binding keeps a moving average of its last SENSOR_WINDOW samples, and their min and max, and every sample moves the
+average into the switch's level - so getswitchvalue answers from the switch table at once, as for any other switch,
+and never waits for the bus. A failed read is counted and skipped, and the average carries on from the samples it has.
+Host switch indexes are used. Bindings are stored in EEPROM after the wear counters.
+*/
+#ifndef _WEBRELAY_SENSORS_H_
+#define _WEBRELAY_SENSORS_H_
+
+#include "Webrelay_common.h"
+#include "Webrelay_switchtypes.h"
+#include "Webrelay_i2c.h"
+#include "DebugSerial.h"
+
+#define MAX_SENSORS 8
+#define MAX_SENSOR_SWITCHES MAX_SWITCHES
+#define SENSOR_WINDOW 8    //samples in the moving average
+#define SENSOR_PERIOD 25   //msecs between reads - each binding is read every SENSOR_PERIOD * numSensors
+
+//Shunt voltage registers - the bus voltage register follows each
+#define INA219_SHUNT 0x01
+#define INA3221_SHUNT 0x01 //channel 1 - each later channel's pair of registers follows on
+
+//Names in flash, in enum order - read with flashTableText() or flashTableEntry()
+enum SensorChip { SENSOR_INA219, SENSOR_INA3221 };
+const char sensorChipIna219[] PROGMEM = "INA219";
+const char sensorChipIna3221[] PROGMEM = "INA3221";
+const char* const sensorChipNames[] PROGMEM = { sensorChipIna219, sensorChipIna3221 };
+enum SensorQuantity { SENSOR_CURRENT, SENSOR_VOLTAGE, SENSOR_POWER };
+const char sensorQuantityCurrent[] PROGMEM = "current";
+const char sensorQuantityVoltage[] PROGMEM = "voltage";
+const char sensorQuantityPower[] PROGMEM = "power";
+const char* const sensorQuantityNames[] PROGMEM = { sensorQuantityCurrent, sensorQuantityVoltage, sensorQuantityPower };
+const char sensorUnitMa[] PROGMEM = "mA";
+const char sensorUnitMv[] PROGMEM = "mV";
+const char sensorUnitMw[] PROGMEM = "mW";
+const char* const sensorUnitNames[] PROGMEM = { sensorUnitMa, sensorUnitMv, sensorUnitMw };
+
+typedef struct
+{
+  uint8_t target;   //host switch index
+  uint8_t chip;     //SensorChip
+  uint8_t address;
+  uint8_t channel;  //0-2 on an INA3221, 0 on an INA219
+  uint8_t quantity; //SensorQuantity
+  uint16_t shunt;   //milliohms
+} SensorBinding;
+
+//Not stored
+typedef struct
+{
+  int32_t sample[SENSOR_WINDOW];
+  int32_t sum;
+  int32_t min;      //of the samples in the window
+  int32_t max;
+  uint8_t next;
+  uint8_t count;
+  uint32_t reads;
+  uint32_t errors;
+} SensorFilter;
+
+SensorBinding sensor[MAX_SENSORS];
+SensorFilter sensorFilter[MAX_SENSORS];
+int numSensors = 0;
+int sensorNext = 0; //binding the sensors task reads next
+
+//Function definitions
+bool sensorValid( const SensorBinding& b );
+void sensorRange( const SensorBinding& b, int32_t& min, int32_t& max );
+int sensorFind( int target );
+int addSensor( const SensorBinding& b );
+bool removeSensor( int index );
+bool sensorRead( const SensorBinding& b, int32_t& value );
+void sensorFilterAdd( SensorFilter& f, int32_t value );
+int32_t sensorAverage( const SensorFilter& f );
+void sensorSample( void );
+
+bool sensorValid( const SensorBinding& b )
+{
+  if( b.target >= MAX_SENSOR_SWITCHES || b.quantity > SENSOR_POWER || b.shunt == 0 )
+    return false;
+  if( b.chip == SENSOR_INA219 )
+    return ( b.address >= 0x40 && b.address <= 0x4F && b.channel == 0 );
+  if( b.chip == SENSOR_INA3221 )
+    return ( b.address >= 0x40 && b.address <= 0x43 && b.channel <= 2 );
+  return false;
+}
+
+//Full scale of the binding's quantity in whole mA, mV or mW - current can flow either way through the shunt
+void sensorRange( const SensorBinding& b, int32_t& min, int32_t& max )
+{
+  int32_t current = ( ( b.chip == SENSOR_INA219 ) ? 320000 : 163800 ) / b.shunt; //full scale shunt uV / milliohms
+  int32_t voltage = ( b.chip == SENSOR_INA219 ) ? 32000 : 26000;
+
+  switch( b.quantity )
+  {
+    case SENSOR_CURRENT: min = -current; max = current; break;
+    case SENSOR_VOLTAGE: min = 0;        max = voltage; break;
+    default:             min = -( current * ( voltage / 1000 ) ); max = current * ( voltage / 1000 ); break;
+  }
+}
+
+//Binding for a switch, -1 if it has none
+int sensorFind( int target )
+{
+  for( int i = 0; i < numSensors; i++ )
+  {
+    if( sensor[i].target == target )
+      return i;
+  }
+  return -1;
+}
+
+//Bind a sensor, replacing any binding the switch already has. Returns the binding's index, or -1 if it isn't valid or the table is full.
+int addSensor( const SensorBinding& b )
+{
+  int index;
+
+  if( !sensorValid( b ) )
+    return -1;
+  index = sensorFind( b.target );
+  if( index < 0 )
+  {
+    if( numSensors >= MAX_SENSORS )
+      return -1;
+    index = numSensors++;
+  }
+  sensor[index] = b;
+  memset( &sensorFilter[index], 0, sizeof( SensorFilter ) );
+  return index;
+}
+
+bool removeSensor( int index )
+{
+  if( index < 0 || index >= numSensors )
+    return false;
+  for( int i = index; i < numSensors - 1; i++ )
+  {
+    sensor[i] = sensor[i+1];
+    sensorFilter[i] = sensorFilter[i+1];
+  }
+  numSensors--;
+  return true;
+}
+
+//One sample of the binding's quantity. Power takes a read of each register, so the two are a few hundred usecs apart.
+bool sensorRead( const SensorBinding& b, int32_t& value )
+{
+  uint16_t raw;
+  uint8_t shuntReg = ( b.chip == SENSOR_INA219 ) ? INA219_SHUNT : INA3221_SHUNT + 2 * b.channel;
+  int32_t current = 0;
+  int32_t voltage = 0;
+
+  if( b.quantity != SENSOR_VOLTAGE )
+  {
+    if( !i2cReadRegister( b.address, shuntReg, raw ) )
+      return false;
+    //Both are two's complement - the INA3221 keeps its 13 bits in the top of the register
+    if( b.chip == SENSOR_INA219 )
+      current = ( (int32_t)(int16_t) raw * 10 ) / b.shunt;
+    else
+      current = ( (int32_t)( (int16_t) raw >> 3 ) * 40 ) / b.shunt;
+  }
+  if( b.quantity != SENSOR_CURRENT )
+  {
+    //Bus voltage is the register after the shunt voltage on both chips. Its low 3 bits are flags, or unused.
+    if( !i2cReadRegister( b.address, shuntReg + 1, raw ) )
+      return false;
+    if( b.chip == SENSOR_INA219 )
+      voltage = (int32_t)( raw >> 3 ) * 4;
+    else
+      voltage = (int32_t)( (int16_t) raw >> 3 ) * 8;
+  }
+  switch( b.quantity )
+  {
+    case SENSOR_CURRENT: value = current; break;
+    case SENSOR_VOLTAGE: value = voltage; break;
+    //mA times mV overflows 32 bits for a shunt of a few milliohms at full scale
+    default:             value = (int32_t)( ( (int64_t) current * voltage ) / 1000 ); break;
+  }
+  return true;
+}
+
+//Add a sample to the window, dropping the oldest once it is full. The min and max are found again from the window.
+void sensorFilterAdd( SensorFilter& f, int32_t value )
+{
+  if( f.count == SENSOR_WINDOW )
+    f.sum -= f.sample[f.next];
+  else
+    f.count++;
+  f.sample[f.next] = value;
+  f.sum += value;
+  f.next = ( f.next + 1 ) % SENSOR_WINDOW;
+
+  f.min = f.max = value;
+  for( int i = 0; i < f.count; i++ )
+  {
+    if( f.sample[i] < f.min )
+      f.min = f.sample[i];
+    if( f.sample[i] > f.max )
+      f.max = f.sample[i];
+  }
+}
+
+int32_t sensorAverage( const SensorFilter& f )
+{
+  return ( f.count > 0 ) ? f.sum / f.count : 0;
+}
+
+/*
+ * Called from the sensors task - read the next binding and move its average into its switch's level.
+ * An average outside the switch's range reads as the end of the range.
+ */
+void sensorSample( void )
+{
+  int i;
+  int32_t value;
+  SwitchEntry* se;
+  SwitchLevel level;
+
+  if( numSensors == 0 )
+    return;
+  if( sensorNext >= numSensors )
+    sensorNext = 0;
+  i = sensorNext++;
+
+  if( !sensorRead( sensor[i], value ) )
+  {
+    sensorFilter[i].errors++;
+    return;
+  }
+  sensorFilter[i].reads++;
+  sensorFilterAdd( sensorFilter[i], value );
+
+  if( sensor[i].target >= numSwitches )
+    return;
+  se = switchEntry[ sensor[i].target ];
+  if( switchBackend( se->type ) != BACKEND_SENSOR )
+    return;
+  value = sensorAverage( sensorFilter[i] );
+  if( !switchLevel( se, (double) value, level ) )
+    level = ( value < se->min ) ? 0 : se->maxLevel;
+  se->level = se->rampTarget = level;
+}
+#endif
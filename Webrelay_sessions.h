@@ -0,0 +1,136 @@
+/*
+Webrelay_sessions.h
+Client session table for the ALPACA 'Connected' semantics.
+Several clients (imaging program, scheduler, safety monitor) may be connected to the same device number at once.
+Each connected client has an entry in a fixed size table keyed by device number and ClientID, so lookups are a short
+scan of a static array and never allocate.
+Sessions that have not been used for SESSION_IDLE_TIMEOUT are expired from loop() when timeoutTimer fires.
+Each session remembers the last ClientTransactionID seen so replayed or out of order PUT requests can be refused.
+A ClientTransactionID of 0 means the client doesn't number its transactions and is not checked.
+*/
+#ifndef _WEBRELAY_SESSIONS_H_
+#define _WEBRELAY_SESSIONS_H_
+
+#include "Webrelay_common.h"
+#include "DebugSerial.h"
+
+#define MAX_CLIENT_SESSIONS 8
+#define SESSION_IDLE_TIMEOUT ( 30UL * 60UL * 1000UL ) //msecs
+#define SESSION_EXPIRY_PERIOD 10000                //msecs between expiry checks using timeoutTimer
+
+enum SessionStatus { SESSION_NONE, SESSION_OK, SESSION_STALE };
+
+typedef struct
+{
+  bool inUse = false;
+  uint8_t device = 0;
+  uint32_t clientID = 0;
+  uint32_t lastTransID = 0;
+  unsigned long lastSeen = 0;
+} ClientSession;
+
+ClientSession clientSession[MAX_CLIENT_SESSIONS];
+
+//Function definitions
+ClientSession* findSession( int device, uint32_t clientID );
+ClientSession* openSession( int device, uint32_t clientID );
+void closeSession( ClientSession* session );
+void closeDeviceSessions( int device );
+int countSessions( int device );
+enum SessionStatus touchSession( int device, uint32_t clientID, uint32_t transID );
+void expireSessions( void );
+
+ClientSession* findSession( int device, uint32_t clientID )
+{
+  for( int i = 0; i < MAX_CLIENT_SESSIONS; i++ )
+  {
+    if( clientSession[i].inUse && clientSession[i].clientID == clientID && clientSession[i].device == device )
+      return &clientSession[i];
+  }
+  return nullptr;
+}
+
+/*
+ * Returns the existing session for this client or a new one. Returns nullptr if the table is full.
+ */
+ClientSession* openSession( int device, uint32_t clientID )
+{
+  ClientSession* session = findSession( device, clientID );
+  if( session != nullptr )
+    return session;
+
+  for( int i = 0; i < MAX_CLIENT_SESSIONS; i++ )
+  {
+    if( !clientSession[i].inUse )
+    {
+      session = &clientSession[i];
+      session->inUse = true;
+      session->device = (uint8_t) device;
+      session->clientID = clientID;
+      session->lastTransID = 0;
+      session->lastSeen = millis();
+      return session;
+    }
+  }
+  return nullptr;
+}
+
+void closeSession( ClientSession* session )
+{
+  if( session != nullptr )
+    session->inUse = false;
+}
+
+void closeDeviceSessions( int device )
+{
+  for( int i = 0; i < MAX_CLIENT_SESSIONS; i++ )
+  {
+    if( clientSession[i].device == device )
+      clientSession[i].inUse = false;
+  }
+}
+
+int countSessions( int device )
+{
+  int count = 0;
+  for( int i = 0; i < MAX_CLIENT_SESSIONS; i++ )
+  {
+    if( clientSession[i].inUse && clientSession[i].device == device )
+      count++;
+  }
+  return count;
+}
+
+/*
+ * Record activity for a client's session and validate its transaction id.
+ * Returns SESSION_NONE if the client is not connected, SESSION_STALE if the transaction id has gone backwards.
+ */
+enum SessionStatus touchSession( int device, uint32_t clientID, uint32_t transID )
+{
+  ClientSession* session = findSession( device, clientID );
+  if( session == nullptr )
+    return SESSION_NONE;
+
+  session->lastSeen = millis();
+  if( transID != 0 )
+  {
+    if( transID <= session->lastTransID )
+      return SESSION_STALE;
+    session->lastTransID = transID;
+  }
+  return SESSION_OK;
+}
+
+void expireSessions( void )
+{
+  unsigned long now = millis();
+  for( int i = 0; i < MAX_CLIENT_SESSIONS; i++ )
+  {
+    if( clientSession[i].inUse && ( now - clientSession[i].lastSeen ) > SESSION_IDLE_TIMEOUT )
+    {
+      DEBUGS1( "expireSessions: expired idle client " ); DEBUGSL1( clientSession[i].clientID );
+      clientSession[i].inUse = false;
+    }
+  }
+}
+#endif
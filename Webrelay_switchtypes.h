@@ -0,0 +1,91 @@
+/*
+Webrelay_switchtypes.h
+What each switch type can do, and how switch values are held.
+Values are held as a whole number of steps above the switch's min - level 0 is min and maxLevel is max - so a relay
+is 0 or 1 and a PWM output 0 to 1023, and nothing on the switching paths needs floating point, which the ESP8266
+only has in software. ALPACA values are doubles - they are converted to and from levels only where a request is
+read or a response written, by switchLevel() and switchValue(). min, max and step are kept as they were given.
+Per type behaviour is a row of switchTraits[] - whether the switch is boolean, the operations it takes and the
+hardware that drives it - so handlers ask what a switch can do rather than listing types, and a new switch type is a
+new row. The rows are in SwitchType order, as are the names in switchTypes[].
+*/
+#ifndef _WEBRELAY_SWITCHTYPES_H_
+#define _WEBRELAY_SWITCHTYPES_H_
+
+#include "Webrelay_common.h"
+
+//Operations a switch type takes
+#define OP_STATE     0x01 //set on and off - setswitch
+#define OP_VALUE     0x02 //set to a value - setswitchvalue
+#define OP_PULSE     0x04 //switch timers and pulses
+#define OP_RAMP      0x08 //moves to a new value over RAMP_TIME
+#define OP_INTERLOCK 0x10 //checked against the interlock rules
+
+enum SwitchBackend { BACKEND_EXPANDER_OUT, BACKEND_EXPANDER_IN, BACKEND_PWM, BACKEND_NONE, BACKEND_SENSOR };
+
+typedef struct
+{
+  bool boolean;
+  uint8_t ops;
+  uint8_t backend;  //SwitchBackend
+  float defaultMax; //range a switch is given when it changes to this type, from 0 in steps of 1
+} SwitchTraits;
+
+constexpr SwitchTraits switchTraits[] =
+{
+  //boolean, operations,                        backend,              default max
+  { false,   OP_VALUE | OP_RAMP,                 BACKEND_PWM,          MAX_DIGITAL_STEPS - 1 }, //SWITCH_PWM
+  { true,    OP_STATE | OP_PULSE | OP_INTERLOCK, BACKEND_EXPANDER_OUT, 1 },                     //SWITCH_RELAY_NO
+  { true,    OP_STATE | OP_PULSE | OP_INTERLOCK, BACKEND_EXPANDER_OUT, 1 },                     //SWITCH_RELAY_NC
+  { false,   OP_VALUE | OP_RAMP,                 BACKEND_NONE,         MAX_DIGITAL_STEPS - 1 }, //SWITCH_ANALG_DAC - no DAC hardware yet
+  { true,    0,                                  BACKEND_EXPANDER_IN,  1 },                     //SWITCH_INPUT
+  { false,   0,                                  BACKEND_SENSOR,       MAX_DIGITAL_STEPS - 1 }, //SWITCH_SENSOR - range set when bound
+};
+#define SWITCH_TYPES 6
+static_assert( sizeof( switchTraits ) / sizeof( switchTraits[0] ) == SWITCH_TYPES, "switchTraits needs a row for each SwitchType" );
+
+constexpr bool switchIsBoolean( enum SwitchType type ) { return switchTraits[type].boolean; }
+constexpr bool switchCan( enum SwitchType type, uint8_t op ) { return ( switchTraits[type].ops & op ) != 0; }
+constexpr uint8_t switchBackend( enum SwitchType type ) { return switchTraits[type].backend; }
+
+//Function definitions
+void switchSetRange( SwitchEntry* se, float min, float max, float step );
+bool switchLevel( const SwitchEntry* se, double value, SwitchLevel& level );
+double switchValue( const SwitchEntry* se, SwitchLevel level );
+bool switchOn( const SwitchEntry* se );
+
+//Set the ALPACA range and work out the number of steps in it. Levels outside the new range are brought inside it.
+void switchSetRange( SwitchEntry* se, float min, float max, float step )
+{
+  se->min = min;
+  se->max = max;
+  se->step = ( step > 0.0F ) ? step : 1.0F;
+  se->maxLevel = ( max > min ) ? (SwitchLevel)( ( max - min ) / se->step + 0.5F ) : 0;
+  if( se->level > se->maxLevel )
+    se->level = se->maxLevel;
+  if( se->rampTarget > se->maxLevel )
+    se->rampTarget = se->maxLevel;
+}
+
+//The level nearest an ALPACA value. Returns false if the value is outside the switch's range.
+bool switchLevel( const SwitchEntry* se, double value, SwitchLevel& level )
+{
+  if( !( value >= se->min && value <= se->max ) )
+    return false;
+  level = (SwitchLevel)( ( value - se->min ) / se->step + 0.5 );
+  if( level > se->maxLevel )
+    level = se->maxLevel;
+  return true;
+}
+
+double switchValue( const SwitchEntry* se, SwitchLevel level )
+{
+  return (double) se->min + (double) level * se->step;
+}
+
+//State of a boolean switch
+inline bool switchOn( const SwitchEntry* se )
+{
+  return se->level != 0;
+}
+#endif
@@ -0,0 +1,150 @@
+/*
+Webrelay_timerwheel.h
+Hashed timer wheel used to run any number of pending switch expiries off the single timeoutTimer tick.
+The wheel has WHEEL_SLOTS slots, one per WHEEL_TICK msecs. An entry is linked into the slot its expiry falls in,
+with a count of whole revolutions still to go, so scheduling and cancelling are O(1) and each tick only looks at
+the entries in one slot. Delays longer than one revolution just wait out the extra revolutions.
+Entries are a fixed array indexed by the caller's id (the host switch index) linked through array indexes, so the
+wheel never allocates. Expired entries are unlinked before the callback is made, so the callback may reschedule.
+The wheel is advanced from loop() against millis() rather than counting timer events, so it catches up if ticks
+are late or an event is dropped.
+*/
+#ifndef _WEBRELAY_TIMERWHEEL_H_
+#define _WEBRELAY_TIMERWHEEL_H_
+
+#include "Webrelay_common.h"
+
+#define WHEEL_TICK 50         //msecs per slot - the resolution of switch timers
+#define WHEEL_SLOTS 64        //power of 2 - one revolution is WHEEL_SLOTS * WHEEL_TICK msecs
+#define WHEEL_MAX_ENTRIES MAX_SWITCHES //one per switch
+
+static_assert( ( WHEEL_SLOTS & ( WHEEL_SLOTS - 1 ) ) == 0, "WHEEL_SLOTS must be a power of 2" );
+
+typedef void (*WheelCallback)( int id );
+
+typedef struct
+{
+  int8_t next;
+  int8_t prev;
+  uint8_t slot;
+  bool linked;
+  uint32_t rounds;  //whole revolutions still to go before expiry
+  uint32_t due;     //millis() at expiry, for reporting
+} WheelEntry;
+
+WheelEntry wheelEntry[WHEEL_MAX_ENTRIES];
+int8_t wheelSlot[WHEEL_SLOTS];
+uint32_t wheelTick = 0;   //ticks processed so far
+uint32_t wheelTime = 0;   //millis() of the last tick processed
+bool wheelStarted = false;
+
+//Function definitions
+void wheelInit( void );
+bool wheelSchedule( int id, uint32_t delay );
+void wheelCancel( int id );
+bool wheelPending( int id );
+uint32_t wheelRemaining( int id );
+void wheelAdvance( uint32_t now, WheelCallback fn );
+
+void wheelInit( void )
+{
+  for( int i = 0; i < WHEEL_SLOTS; i++ )
+    wheelSlot[i] = -1;
+  for( int i = 0; i < WHEEL_MAX_ENTRIES; i++ )
+    wheelEntry[i].linked = false;
+  wheelTick = 0;
+  wheelTime = millis();
+  wheelStarted = true;
+}
+
+/*
+ * Schedule id to expire after delay msecs, replacing any expiry already pending for it.
+ * Delays are rounded up to whole ticks. Returns false if id is out of range.
+ */
+bool wheelSchedule( int id, uint32_t delay )
+{
+  uint32_t ticks;
+  WheelEntry* e;
+
+  if( id < 0 || id >= WHEEL_MAX_ENTRIES )
+    return false;
+  if( !wheelStarted )
+    wheelInit();
+  wheelCancel( id );
+
+  ticks = ( delay + WHEEL_TICK - 1 ) / WHEEL_TICK;
+  if( ticks == 0 )
+    ticks = 1;
+
+  e = &wheelEntry[id];
+  e->slot = ( wheelTick + ticks ) & ( WHEEL_SLOTS - 1 );
+  e->rounds = ( ticks - 1 ) / WHEEL_SLOTS;
+  e->due = wheelTime + ( ticks * WHEEL_TICK );
+  e->prev = -1;
+  e->next = wheelSlot[e->slot];
+  if( e->next >= 0 )
+    wheelEntry[e->next].prev = id;
+  wheelSlot[e->slot] = id;
+  e->linked = true;
+  return true;
+}
+
+void wheelCancel( int id )
+{
+  WheelEntry* e;
+
+  if( id < 0 || id >= WHEEL_MAX_ENTRIES || !wheelEntry[id].linked )
+    return;
+  e = &wheelEntry[id];
+  if( e->prev >= 0 )
+    wheelEntry[e->prev].next = e->next;
+  else
+    wheelSlot[e->slot] = e->next;
+  if( e->next >= 0 )
+    wheelEntry[e->next].prev = e->prev;
+  e->linked = false;
+}
+
+bool wheelPending( int id )
+{
+  return ( id >= 0 && id < WHEEL_MAX_ENTRIES && wheelEntry[id].linked );
+}
+
+//Msecs until id expires, 0 if nothing is pending
+uint32_t wheelRemaining( int id )
+{
+  int32_t remaining;
+  if( !wheelPending( id ) )
+    return 0;
+  remaining = (int32_t)( wheelEntry[id].due - millis() );
+  return ( remaining > 0 ) ? remaining : 0;
+}
+
+/*
+ * Process every tick up to now, calling fn for each entry that expires.
+ */
+void wheelAdvance( uint32_t now, WheelCallback fn )
+{
+  int8_t id, next;
+
+  if( !wheelStarted )
+    wheelInit();
+
+  while( (int32_t)( now - wheelTime ) >= WHEEL_TICK )
+  {
+    wheelTime += WHEEL_TICK;
+    wheelTick++;
+    for( id = wheelSlot[ wheelTick & ( WHEEL_SLOTS - 1 ) ]; id >= 0; id = next )
+    {
+      next = wheelEntry[id].next;
+      if( wheelEntry[id].rounds > 0 )
+      {
+        wheelEntry[id].rounds--;
+        continue;
+      }
+      wheelCancel( id );
+      fn( id );
+    }
+  }
+}
+#endif
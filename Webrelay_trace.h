@@ -0,0 +1,52 @@
+/*
+Webrelay_trace.h
+Request tracing for the ALPACA switch API.
+Every request handled by the router is given the next ServerTransactionID and, once the response has been sent,
+a fixed size record of it is written into a ring buffer in RAM - client id, method, switch id, latency and the HTTP
+result code. The ring buffer keeps the last TRACE_BUFFER_SIZE requests and is read back with /api/v1/switch/0/trace.
+Recording a request is a handful of stores into a static array so it costs next to nothing per request.
+*/
+#ifndef _WEBRELAY_TRACE_H_
+#define _WEBRELAY_TRACE_H_
+
+#include "Webrelay_common.h"
+
+#define TRACE_BUFFER_SIZE 256
+
+typedef struct
+{
+  uint32_t serverTransID;
+  uint32_t clientID;
+  uint32_t latency;  //usecs from start of request handling to response sent
+  uint16_t result;   //HTTP response code
+  uint8_t method;    //Router table index
+  int8_t switchID;   //-1 if the request didn't address a switch
+} TraceEntry;
+
+TraceEntry traceBuffer[TRACE_BUFFER_SIZE];
+uint16_t traceHead = 0;
+uint32_t traceCount = 0;
+
+//Function definitions
+uint32_t nextServerTransactionId( void );
+void traceRecord( uint32_t serverTransID, uint32_t clientID, uint8_t method, int switchID, uint16_t result, uint32_t latency );
+const char* traceMethodName( uint8_t method );
+
+uint32_t nextServerTransactionId( void )
+{
+  return ++transactionId;
+}
+
+void traceRecord( uint32_t serverTransID, uint32_t clientID, uint8_t method, int switchID, uint16_t result, uint32_t latency )
+{
+  TraceEntry* entry = &traceBuffer[traceHead];
+  entry->serverTransID = serverTransID;
+  entry->clientID = clientID;
+  entry->method = method;
+  entry->switchID = (int8_t) switchID;
+  entry->result = result;
+  entry->latency = latency;
+  traceHead = ( traceHead + 1 ) % TRACE_BUFFER_SIZE;
+  traceCount++;
+}
+#endif
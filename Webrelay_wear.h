@@ -0,0 +1,107 @@
+/*
+Webrelay_wear.h
+Wear and duty counters for each switch, so relays can be replaced on their actual use rather than a guess.
+ actuations - times the switch has turned on or off. An analogue output counts going between zero and non-zero.
+ onSeconds  - time on. For an analogue output the level is integrated over time, so it is the time at full scale -
+              a heater's energy is this times its full power.
+ lastChange - clock time of the last actuation, 0 if the clock wasn't set yet.
+wearNote() is called with the new level every time a switch's output changes - see noteRelayState() and
+writeAnalogue() - and does a fixed amount of work. Outputs restored at boot are started with wearSeed() instead. Time is kept to the msec between changes and only whole seconds
+are added to the counters.
+The counters are saved in EEPROM with the other settings, whenever those are saved. Counts and on time that have
+built up with nothing else saved go out every WEAR_SAVE_PERIOD - relay states are held back the same way, see
+markRelayDirty() - which keeps flash writes to a couple of dozen a day at most. A power cut loses at most that much.
+*/
+#ifndef _WEBRELAY_WEAR_H_
+#define _WEBRELAY_WEAR_H_
+
+#include <time.h>
+#include "Webrelay_common.h"
+
+#define MAX_WEAR_SWITCHES MAX_SWITCHES
+#define WEAR_SAVE_PERIOD 3600000  //msecs
+
+typedef struct
+{
+  uint32_t actuations;
+  uint32_t onSeconds;
+  uint32_t lastChange;
+} WearCounter;
+
+WearCounter wear[MAX_WEAR_SWITCHES];
+//Not stored
+SwitchLevel wearLevel[MAX_WEAR_SWITCHES];   //level last noted
+uint32_t wearSince[MAX_WEAR_SWITCHES];      //millis() the level was last integrated to
+uint64_t wearAccumulated[MAX_WEAR_SWITCHES]; //level msecs not yet added to onSeconds
+bool wearDirty = false;                     //counters changed since they were last saved
+uint32_t wearSavedAt = 0;
+uint16_t wearChanged = 0;                   //switches whose counters changed since they were last published
+
+//Function definitions
+void wearReset( void );
+void wearNote( int index, SwitchLevel level, SwitchLevel maxLevel );
+void wearSeed( int index, SwitchLevel level );
+void wearSync( int index, SwitchLevel maxLevel );
+bool wearSaveDue( void );
+
+void wearReset( void )
+{
+  memset( wear, 0, sizeof( wear ) );
+  memset( wearLevel, 0, sizeof( wearLevel ) );
+  memset( wearAccumulated, 0, sizeof( wearAccumulated ) );
+}
+
+//Integrate the level up to now and add any whole seconds at full scale to onSeconds
+void wearSync( int index, SwitchLevel maxLevel )
+{
+  uint32_t now = millis();
+  uint64_t fullScale;
+
+  if( index < 0 || index >= MAX_WEAR_SWITCHES )
+    return;
+  if( wearLevel[index] > 0 )
+  {
+    wearAccumulated[index] += (uint64_t) wearLevel[index] * ( now - wearSince[index] );
+    fullScale = (uint64_t)( ( maxLevel > 0 ) ? maxLevel : 1 ) * 1000;
+    if( wearAccumulated[index] >= fullScale )
+    {
+      wear[index].onSeconds += (uint32_t)( wearAccumulated[index] / fullScale );
+      wearAccumulated[index] %= fullScale;
+      wearDirty = true;
+      wearChanged |= ( 1 << index );
+    }
+  }
+  wearSince[index] = now;
+}
+
+//Called with a switch's new level whenever its output changes
+void wearNote( int index, SwitchLevel level, SwitchLevel maxLevel )
+{
+  if( index < 0 || index >= MAX_WEAR_SWITCHES || level == wearLevel[index] )
+    return;
+  wearSync( index, maxLevel );
+  if( ( level != 0 ) != ( wearLevel[index] != 0 ) )
+  {
+    wear[index].actuations++;
+    wear[index].lastChange = (uint32_t) time( nullptr );
+    wearDirty = true;
+    wearChanged |= ( 1 << index );
+  }
+  wearLevel[index] = level;
+}
+
+//Start from the level an output was restored to at boot - it was already at that level before, so it isn't counted
+void wearSeed( int index, SwitchLevel level )
+{
+  if( index < 0 || index >= MAX_WEAR_SWITCHES )
+    return;
+  wearLevel[index] = level;
+  wearSince[index] = millis();
+}
+
+//True when on time has built up unsaved for WEAR_SAVE_PERIOD
+bool wearSaveDue( void )
+{
+  return ( wearDirty && ( millis() - wearSavedAt ) > WEAR_SAVE_PERIOD );
+}
+#endif
@@ -0,0 +1,160 @@
+/*
+Webrelay_wifi.h
+Station WiFi connection manager. Nothing here blocks, and losing the connection never stops the relays - the
+outputs, timers and inputs carry on while the network is away and the device keeps trying to get it back.
+The channel and BSSID of the access point last joined are kept in EEPROM. Each attempt starts straight at that
+access point, which skips the scan of every channel and usually gets an address in well under a second. If it
+hasn't connected within WIFI_FAST_TIMEOUT the cached access point is assumed gone (e.g. the client should roam) and a
+normal scan is started. A scan that hasn't connected within WIFI_SCAN_TIMEOUT is dropped and the next attempt
+waits a backoff that doubles from WIFI_BACKOFF_MIN up to WIFI_BACKOFF_MAX, so a missing access point isn't
+hammered.
+wifiPoll() is called by the network task to follow the connection. Outages are counted and timed. The device only
+restarts once it has been without WiFi for the configured restart window, in minutes - 0 never restarts.
+The SDK's own copy of the station settings and its auto reconnect are turned off so each connect doesn't write flash
+and only one thing is driving the connection - the cache is only saved when the access point actually changes.
+*/
+#ifndef _WEBRELAY_WIFI_H_
+#define _WEBRELAY_WIFI_H_
+
+#include <ESP8266WiFi.h>
+#include "Webrelay_common.h"
+#include "DebugSerial.h"
+
+#define WIFI_FAST_TIMEOUT 3000    //msecs to wait on the cached access point before scanning
+#define WIFI_SCAN_TIMEOUT 20000   //msecs to wait on a scan before backing off
+#define WIFI_BACKOFF_MIN 1000     //msecs
+#define WIFI_BACKOFF_MAX 60000
+#define WIFI_RESTART_WINDOW 30    //default minutes without WiFi before restarting
+#define WIFI_RESTART_WINDOW_MAX 1440
+
+enum WifiState { WIFI_IDLE, WIFI_FAST, WIFI_SCAN, WIFI_WAIT, WIFI_UP };
+enum WifiEvent { WIFI_EVENT_NONE, WIFI_EVENT_CONNECTED, WIFI_EVENT_LOST };
+
+int wifiChannel = 0;        //cached access point - channel 0 means nothing cached
+uint8_t wifiBssid[6];
+int wifiRestartWindow = WIFI_RESTART_WINDOW; //minutes, 0 for never - stored in EEPROM
+enum WifiState wifiState = WIFI_IDLE;
+uint32_t wifiStartTime = 0; //millis() the current attempt started
+uint32_t wifiRetryDue = 0;
+uint32_t wifiBackoff = WIFI_BACKOFF_MIN;
+uint32_t wifiDownSince = 0; //millis() the connection was lost, or boot
+bool wifiFast = false;      //last connection was made to the cached access point
+uint32_t wifiConnects = 0;
+uint32_t wifiOutages = 0;
+uint32_t wifiOutageTime = 0; //msecs, outages that have ended
+uint32_t wifiLastOutage = 0; //msecs
+
+//Function definitions
+void wifiBegin( void );
+void wifiConnect( void );
+enum WifiEvent wifiPoll( void );
+bool wifiRememberAP( void );
+bool wifiRestartDue( void );
+
+void wifiBegin( void )
+{
+  WiFi.persistent( false );
+  WiFi.setAutoReconnect( false );
+  WiFi.hostname( myHostname );
+  WiFi.mode( WIFI_STA );
+  wifiDownSince = millis();
+  wifiConnect();
+}
+
+//Start a connection attempt - to the cached access point if there is one
+void wifiConnect( void )
+{
+  wifiStartTime = millis();
+  if( wifiChannel > 0 )
+  {
+    DEBUGS1( "wifiConnect: fast connect on channel " ); DEBUGSL1( wifiChannel );
+    WiFi.begin( ssid1, password1, wifiChannel, wifiBssid );
+    wifiState = WIFI_FAST;
+  }
+  else
+  {
+    WiFi.begin( ssid1, password1 );
+    wifiState = WIFI_SCAN;
+  }
+}
+
+/*
+ * Follow the connection. Returns WIFI_EVENT_CONNECTED on the call that finds it connected and WIFI_EVENT_LOST on the
+ * call that finds it gone.
+ */
+enum WifiEvent wifiPoll( void )
+{
+  uint32_t now = millis();
+
+  switch( wifiState )
+  {
+    case WIFI_FAST:
+    case WIFI_SCAN:
+      if( WiFi.status() == WL_CONNECTED )
+      {
+        if( wifiConnects++ > 0 )
+        {
+          wifiLastOutage = now - wifiDownSince;
+          wifiOutageTime += wifiLastOutage;
+        }
+        wifiFast = ( wifiState == WIFI_FAST );
+        wifiBackoff = WIFI_BACKOFF_MIN;
+        wifiState = WIFI_UP;
+        return WIFI_EVENT_CONNECTED;
+      }
+      if( wifiState == WIFI_FAST && ( now - wifiStartTime ) > WIFI_FAST_TIMEOUT )
+      {
+        DEBUGSL1( "wifiPoll: cached access point not found - scanning" );
+        WiFi.disconnect();
+        WiFi.begin( ssid1, password1 );
+        wifiStartTime = now;
+        wifiState = WIFI_SCAN;
+      }
+      else if( wifiState == WIFI_SCAN && ( now - wifiStartTime ) > WIFI_SCAN_TIMEOUT )
+      {
+        DEBUGS1( "wifiPoll: no connection - retrying in " ); DEBUGSL1( wifiBackoff );
+        WiFi.disconnect();
+        wifiRetryDue = now + wifiBackoff;
+        wifiBackoff = ( wifiBackoff * 2 < WIFI_BACKOFF_MAX ) ? wifiBackoff * 2 : WIFI_BACKOFF_MAX;
+        wifiState = WIFI_WAIT;
+      }
+      break;
+    case WIFI_WAIT:
+      if( (int32_t)( now - wifiRetryDue ) >= 0 )
+        wifiConnect();
+      break;
+    case WIFI_UP:
+      if( WiFi.status() != WL_CONNECTED )
+      {
+        wifiOutages++;
+        wifiDownSince = now;
+        wifiConnect();
+        return WIFI_EVENT_LOST;
+      }
+      break;
+    default:
+      break;
+  }
+  return WIFI_EVENT_NONE;
+}
+
+//Note the access point now connected to. Returns true if it differs from the one cached, so it needs saving.
+bool wifiRememberAP( void )
+{
+  uint8_t* bssid = WiFi.BSSID();
+  int channel = WiFi.channel();
+
+  if( bssid == nullptr || ( channel == wifiChannel && memcmp( bssid, wifiBssid, sizeof( wifiBssid ) ) == 0 ) )
+    return false;
+  memcpy( wifiBssid, bssid, sizeof( wifiBssid ) );
+  wifiChannel = channel;
+  return true;
+}
+
+//True once WiFi has been down for longer than the restart window
+bool wifiRestartDue( void )
+{
+  return ( wifiState != WIFI_UP && wifiRestartWindow > 0 &&
+           ( millis() - wifiDownSince ) > (uint32_t) wifiRestartWindow * 60000UL );
+}
+#endif
@@ -0,0 +1,157 @@
+/*
+command_test.cpp
+Host tests for Webrelay_command.h - run with test/run_tests.sh.
+Switch ranges are checked on their own - a single id, a-b, * and the forms that must be refused such as 3-, 5-2 and
+negative ids - then whole statements go through commandParse(): each verb with its arguments, the pulse times and
+count at and past their limits, missing and trailing arguments, and a text of several statements read one at a time.
+*/
+#include <stdio.h>
+#include "arduino_host.h"
+#include "../Webrelay_command.h"
+#include "check.h"
+
+//A token over the whole of text
+static CommandToken token( const char* text )
+{
+  CommandToken t;
+  t.start = text;
+  t.length = (uint8_t) strlen( text );
+  return t;
+}
+
+static bool range( const char* text, int first, int last )
+{
+  uint8_t a = 0, b = 0;
+  return tokenToRange( token( text ), a, b ) && a == first && b == last;
+}
+
+static bool badRange( const char* text )
+{
+  uint8_t a, b;
+  return !tokenToRange( token( text ), a, b );
+}
+
+//Parse a single statement, true if it is accepted
+static bool parse( const char* text, Command& cmd )
+{
+  const char* p = text;
+  const char* error;
+  return commandParse( p, cmd, error );
+}
+
+//Parse a single statement that should be refused, true if it is with the error given
+static bool refused( const char* text, const char* expected )
+{
+  Command cmd;
+  const char* p = text;
+  const char* error;
+  return !commandParse( p, cmd, error ) && strcmp( error, expected ) == 0;
+}
+
+static void testRanges( void )
+{
+  CHECK( range( "3", 3, 3 ) );
+  CHECK( range( "0-7", 0, 7 ) );
+  CHECK( range( "5-5", 5, 5 ) );
+  CHECK( range( "*", 0, COMMAND_ALL ) );
+  CHECK( badRange( "3-" ) );
+  CHECK( badRange( "5-2" ) );
+  CHECK( badRange( "-1" ) );
+  CHECK( badRange( "2-x" ) );
+  CHECK( badRange( "2x" ) );
+  CHECK( badRange( "**" ) );
+  CHECK( badRange( "255" ) );
+  CHECK( badRange( "" ) );
+
+  //The token ends before the text does - nothing after it is read as part of the range
+  CommandToken t = token( "3- 5" );
+  uint8_t a, b;
+  t.length = 2;
+  CHECK( !tokenToRange( t, a, b ) );
+}
+
+static void testVerbs( void )
+{
+  Command cmd;
+
+  CHECK( parse( "SET 0-3 On", cmd ) && cmd.verb == VERB_SET && cmd.first == 0 && cmd.last == 3 && cmd.state );
+  CHECK( parse( "set 2 off", cmd ) && cmd.verb == VERB_SET && !cmd.state );
+  CHECK( parse( "value 5 512.5", cmd ) && cmd.verb == VERB_VALUE && cmd.first == 5 && cmd.value == 512.5F );
+  CHECK( parse( "get *", cmd ) && cmd.verb == VERB_GET && cmd.last == COMMAND_ALL );
+  CHECK( parse( "scene park", cmd ) && cmd.verb == VERB_SCENE && cmd.name.length == 4 && strncmp( cmd.name.start, "park", 4 ) == 0 );
+  CHECK( parse( "   ", cmd ) && cmd.verb == VERB_NONE );
+  CHECK( refused( "toggle 1", "unknown verb" ) );
+  CHECK( refused( "set 1 maybe", "expected on or off" ) );
+  CHECK( refused( "value 1 high", "expected a value" ) );
+  CHECK( refused( "get 3-", "expected a switch id, range a-b or *" ) );
+  CHECK( refused( "set 5-2 on", "expected a switch id, range a-b or *" ) );
+  CHECK( refused( "scene", "expected a scene name" ) );
+}
+
+static void testPulse( void )
+{
+  Command cmd;
+  char text[64];
+
+  CHECK( parse( "pulse 2 500", cmd ) && cmd.verb == VERB_PULSE && cmd.onTime == 500 && cmd.offTime == 500 && cmd.count == 1 );
+  CHECK( parse( "pulse 2 500 250 0", cmd ) && cmd.onTime == 500 && cmd.offTime == 250 && cmd.count == 0 );
+  CHECK( parse( "pulse 0-1 1 1 65535", cmd ) && cmd.count == 65535 );
+
+  snprintf( text, sizeof( text ), "pulse 1 %ld %ld", SWITCH_TIMER_MAX, SWITCH_TIMER_MAX );
+  CHECK( parse( text, cmd ) && cmd.onTime == SWITCH_TIMER_MAX && cmd.offTime == SWITCH_TIMER_MAX );
+  snprintf( text, sizeof( text ), "pulse 1 %ld", SWITCH_TIMER_MAX + 1 );
+  CHECK( refused( text, "expected an on time in msecs, up to a day" ) );
+  snprintf( text, sizeof( text ), "pulse 1 500 %ld", SWITCH_TIMER_MAX + 1 );
+  CHECK( refused( text, "expected an off time in msecs, up to a day" ) );
+
+  CHECK( refused( "pulse 1", "expected an on time in msecs, up to a day" ) );
+  CHECK( refused( "pulse 1 0", "expected an on time in msecs, up to a day" ) );
+  CHECK( refused( "pulse 1 -1", "expected an on time in msecs, up to a day" ) );
+  CHECK( refused( "pulse 1 99999999999", "expected an on time in msecs, up to a day" ) );
+  CHECK( refused( "pulse 1 500ms", "expected an on time in msecs, up to a day" ) );
+  CHECK( refused( "pulse 1 500 -250", "expected an off time in msecs, up to a day" ) );
+  CHECK( refused( "pulse 1 500 250 -1", "expected a pulse count, 0 for no limit" ) );
+  CHECK( refused( "pulse 1 500 250 65536", "expected a pulse count, 0 for no limit" ) );
+}
+
+static void testTrailing( void )
+{
+  CHECK( refused( "set 1 on now", "too many arguments" ) );
+  CHECK( refused( "get 1 2", "too many arguments" ) );
+  CHECK( refused( "scene park now", "too many arguments" ) );
+  CHECK( refused( "pulse 1 500 250 3 4", "too many arguments" ) );
+}
+
+//Statements are read one at a time, each leaving p at the next
+static void testStatements( void )
+{
+  const char* text = "set 0-3 on; value 5 512\n\npulse 2 500 ;get 0-7";
+  const char* p = text;
+  const char* error;
+  Command cmd;
+  int verbs[6];
+  int n = 0;
+
+  while( *p != '\0' && n < 6 )
+  {
+    CHECK( commandParse( p, cmd, error ) );
+    verbs[n++] = cmd.verb;
+  }
+  CHECK( n == 5 );
+  CHECK( verbs[0] == VERB_SET && verbs[1] == VERB_VALUE && verbs[2] == VERB_NONE && verbs[3] == VERB_PULSE && verbs[4] == VERB_GET );
+
+  //The second statement is refused once the first has been read
+  p = "set 1 on; set 2 sideways; set 3 on";
+  CHECK( commandParse( p, cmd, error ) );
+  CHECK( !commandParse( p, cmd, error ) && strcmp( error, "expected on or off" ) == 0 );
+}
+
+int main( void )
+{
+  testRanges();
+  testVerbs();
+  testPulse();
+  testTrailing();
+  testStatements();
+  return checkResult( "command_test" );
+}
@@ -0,0 +1,137 @@
+/*
+eventqueue_test.cpp
+Host tests for Webrelay_eventqueue.h - run with test/run_tests.sh.
+Order, wrap round of the free running indexes, full queue drops and drain() are checked from one thread; then a
+producer and a consumer thread pass STRESS_EVENTS events through a small queue. The producer posts each event again
+until the queue takes it, so the consumer must see every event exactly once, in order and not torn, and the queue's
+dropped count must match the posts that were refused.
+*/
+#include <stdio.h>
+#include <thread>
+#include <atomic>
+#include "../Webrelay_eventqueue.h"
+#include "check.h"
+
+#define STRESS_EVENTS 1000000
+
+static void testOrder( void )
+{
+  EventQueue<4> q;
+  Event e;
+
+  CHECK( !q.get( e ) );
+  CHECK( q.post( EVENT_TICK, 1, 2, 3 ) );
+  CHECK( q.post( EVENT_MQTT, 4, 5, 6 ) );
+  CHECK( q.size() == 2 );
+  CHECK( q.get( e ) && e.type == EVENT_TICK && e.arg8 == 1 && e.arg16 == 2 && e.arg == 3 );
+  CHECK( q.get( e ) && e.type == EVENT_MQTT && e.arg8 == 4 && e.arg16 == 5 && e.arg == 6 );
+  CHECK( !q.get( e ) );
+  CHECK( q.size() == 0 );
+}
+
+static void testFull( void )
+{
+  EventQueue<4> q;
+  Event e;
+
+  for( int i = 0; i < 4; i++ )
+    CHECK( q.post( EVENT_GPIO, i ) );
+  CHECK( !q.post( EVENT_GPIO, 99 ) );
+  CHECK( q.dropped() == 1 );
+  //The event that didn't fit mustn't overwrite one not yet read
+  for( int i = 0; i < 4; i++ )
+    CHECK( q.get( e ) && e.arg8 == i );
+  CHECK( !q.get( e ) );
+}
+
+//The indexes are uint16_t and run freely - go round them several times
+static void testWrap( void )
+{
+  EventQueue<8> q;
+  Event e;
+
+  for( uint32_t i = 0; i < 200000; i++ )
+  {
+    CHECK( q.post( EVENT_TICK, 0, 0, i ) );
+    if( !q.get( e ) || e.arg != i )
+    {
+      CHECK( e.arg == i );
+      break;
+    }
+  }
+  CHECK( q.size() == 0 && q.dropped() == 0 );
+}
+
+static void testDrain( void )
+{
+  EventQueue<8> q;
+  Event events[8];
+
+  for( int i = 0; i < 6; i++ )
+    q.post( EVENT_TICK, i );
+  CHECK( q.drain( events, 4 ) == 4 );
+  CHECK( events[0].arg8 == 0 && events[3].arg8 == 3 );
+  CHECK( q.drain( events, 8 ) == 2 );
+  CHECK( events[0].arg8 == 4 && events[1].arg8 == 5 );
+  CHECK( q.drain( events, 8 ) == 0 );
+}
+
+static void testStress( void )
+{
+  static EventQueue<16> q;
+  std::atomic<bool> done( false );
+  uint32_t refused = 0;
+  uint32_t read = 0;
+  uint32_t last = 0;
+  bool ordered = true;
+
+  std::thread producer( [&]()
+  {
+    for( uint32_t i = 1; i <= STRESS_EVENTS; i++ )
+    {
+      //arg8 and arg16 carry checks on arg, so a torn event shows up
+      while( !q.post( EVENT_GPIO, (uint8_t) i, (uint16_t)( i * 7 ), i ) )
+      {
+        refused++;
+        std::this_thread::yield();
+      }
+    }
+    done.store( true, std::memory_order_release );
+  } );
+
+  Event events[4];
+  for( ;; )
+  {
+    bool finished = done.load( std::memory_order_acquire );
+    int count = q.drain( events, 4 );
+    for( int i = 0; i < count; i++ )
+    {
+      if( events[i].arg != last + 1 || events[i].arg8 != (uint8_t) events[i].arg || events[i].arg16 != (uint16_t)( events[i].arg * 7 ) )
+        ordered = false;
+      last = events[i].arg;
+      read++;
+    }
+    if( count == 0 )
+    {
+      if( finished )
+        break;
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+
+  CHECK( ordered );
+  CHECK( read == STRESS_EVENTS );
+  CHECK( q.dropped() == refused );
+  printf( "stress: %u read, %u posts refused while full\n", read, refused );
+}
+
+int main( void )
+{
+  testOrder();
+  testFull();
+  testWrap();
+  testDrain();
+  testStress();
+  return checkResult( "eventqueue_test" );
+}
@@ -0,0 +1,267 @@
+/*
+fastudp_test.cpp
+Host tests for Webrelay_fastudp.h - run with test/run_tests.sh.
+The frame layout is checked against the protocol, the HMAC against RFC 4231, and then frames are sent over loopback
+UDP to fastUdp: a good frame is taken, and frames of the wrong size, format or key are each counted and dropped.
+fastCheckSequence() is run through new, repeated, old and other-session sequence numbers, and a FAST_STALE reply
+checked for the session and last sequence a client needs to carry on.
+Last, a benchmark times BENCH_FRAMES round trips as the device and a client would make them - the client signs a
+FAST_SET and sends it, the device receives, checks and answers it, and the client checks the reply's mac - and
+prints the latency percentiles. The HMAC runs on the PC's CPU here, so the figures show the cost of the protocol
+and the loopback, not of the ESP8266.
+*/
+#include <stdio.h>
+#include <stddef.h>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include "arduino_host.h"
+#include "../Webrelay_fastudp.h"
+#include "check.h"
+
+#define BENCH_FRAMES 5000
+#define POLL_LIMIT 100000 //parsePacket() calls to wait for a loopback datagram
+
+WiFiUDP client;
+
+static void frameInit( FastFrame& frame, uint8_t type, uint32_t seq )
+{
+  memset( &frame, 0, sizeof( frame ) );
+  frame.magic[0] = 'W';
+  frame.magic[1] = 'R';
+  frame.version = FAST_VERSION;
+  frame.type = type;
+  frame.session = fastSession;
+  frame.seq = seq;
+  frame.mask = 0x0003;
+  frame.state = 0x0001;
+}
+
+static void clientSend( const void* data, size_t length )
+{
+  client.beginPacket( IPAddress( 127, 0, 0, 1 ), fastUdp.localPort() );
+  client.write( (const uint8_t*) data, length );
+  client.endPacket();
+}
+
+//Wait for a datagram on udp - loopback delivery is all but immediate
+static int waitPacket( WiFiUDP& udp )
+{
+  int size = 0;
+  for( int i = 0; i < POLL_LIMIT && size == 0; i++ )
+    size = udp.parsePacket();
+  return size;
+}
+
+//Send data to fastUdp and run it through fastReceive() as the fastudp task would
+static bool deliver( const void* data, size_t length, FastFrame& frame )
+{
+  int size;
+
+  clientSend( data, length );
+  size = waitPacket( fastUdp );
+  CHECK( size == (int) length );
+  return fastReceive( size, frame );
+}
+
+static void testLayout( void )
+{
+  CHECK( sizeof( FastFrame ) == 84 );
+  CHECK( offsetof( FastFrame, version ) == 2 );
+  CHECK( offsetof( FastFrame, type ) == 3 );
+  CHECK( offsetof( FastFrame, session ) == 4 );
+  CHECK( offsetof( FastFrame, seq ) == 8 );
+  CHECK( offsetof( FastFrame, mask ) == 12 );
+  CHECK( offsetof( FastFrame, state ) == 14 );
+  CHECK( offsetof( FastFrame, status ) == 16 );
+  CHECK( offsetof( FastFrame, applied ) == 17 );
+  CHECK( offsetof( FastFrame, switches ) == 18 );
+  CHECK( offsetof( FastFrame, value ) == 20 );
+  CHECK( offsetof( FastFrame, mac ) == 20 + 2 * FAST_SWITCHES );
+
+  //Little endian on the wire, as the ESP8266 is
+  FastFrame frame;
+  frameInit( frame, FAST_SET, 0x01020304 );
+  CHECK( ( (const uint8_t*) &frame )[8] == 0x04 && ( (const uint8_t*) &frame )[11] == 0x01 );
+}
+
+//RFC 4231 test case 2
+static void testHmac( void )
+{
+  const uint8_t expected[] =
+  {
+    0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+    0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43
+  };
+  const char* data = "what do ya want for nothing?";
+  br_hmac_key_context key;
+  br_hmac_context ctx;
+  uint8_t mac[FAST_MAC_LENGTH];
+
+  br_hmac_key_init( &key, &br_sha256_vtable, "Jefe", 4 );
+  br_hmac_init( &ctx, &key, 0 );
+  br_hmac_update( &ctx, data, 10 );
+  br_hmac_update( &ctx, data + 10, strlen( data ) - 10 );
+  CHECK( br_hmac_out( &ctx, mac ) == FAST_MAC_LENGTH );
+  CHECK( memcmp( mac, expected, sizeof( expected ) ) == 0 );
+
+  //fastMac() signs everything before the mac with the shared key
+  FastFrame frame;
+  uint8_t check[FAST_MAC_LENGTH];
+  fastSetKey( "Jefe" );
+  frameInit( frame, FAST_GET, 1 );
+  fastMac( frame, frame.mac );
+  br_hmac_init( &ctx, &key, 0 );
+  br_hmac_update( &ctx, &frame, offsetof( FastFrame, mac ) );
+  br_hmac_out( &ctx, check );
+  CHECK( memcmp( frame.mac, check, FAST_MAC_LENGTH ) == 0 );
+}
+
+static void testReceive( void )
+{
+  FastFrame frame;
+  FastFrame received;
+  uint32_t bad = fastBadFrames;
+  uint32_t auth = fastAuthFailures;
+
+  fastSetKey( "shared secret" );
+  frameInit( frame, FAST_SET, 1 );
+  frame.value[3] = 512;
+  fastMac( frame, frame.mac );
+  CHECK( deliver( &frame, sizeof( frame ), received ) );
+  CHECK( memcmp( &frame, &received, sizeof( frame ) ) == 0 );
+
+  //Short, long, wrong magic, version or type - counted as bad before the mac is worked out
+  CHECK( !deliver( &frame, sizeof( frame ) - 1, received ) );
+  uint8_t longer[sizeof( FastFrame ) + 1];
+  memcpy( longer, &frame, sizeof( frame ) );
+  longer[sizeof( frame )] = 0;
+  CHECK( !deliver( longer, sizeof( longer ), received ) );
+  frame.magic[1] = 'X';
+  CHECK( !deliver( &frame, sizeof( frame ), received ) );
+  frame.magic[1] = 'R';
+  frame.version = FAST_VERSION + 1;
+  CHECK( !deliver( &frame, sizeof( frame ), received ) );
+  frame.version = FAST_VERSION;
+  frame.type = FAST_ACK;
+  CHECK( !deliver( &frame, sizeof( frame ), received ) );
+  CHECK( fastBadFrames == bad + 5 );
+  CHECK( fastAuthFailures == auth );
+
+  //Any change after signing, or the wrong key, fails the mac
+  frame.type = FAST_SET;
+  frame.state ^= 0x0002;
+  CHECK( !deliver( &frame, sizeof( frame ), received ) );
+  frame.state ^= 0x0002;
+  frame.mac[FAST_MAC_LENGTH - 1] ^= 0x01;
+  CHECK( !deliver( &frame, sizeof( frame ), received ) );
+  fastSetKey( "other secret" );
+  fastMac( frame, frame.mac );
+  fastSetKey( "shared secret" );
+  CHECK( !deliver( &frame, sizeof( frame ), received ) );
+  CHECK( fastAuthFailures == auth + 3 );
+  CHECK( fastBadFrames == bad + 5 );
+}
+
+static void testSequence( void )
+{
+  FastFrame frame;
+  uint32_t stale = fastStale;
+
+  fastSession = 0x5eed0001;
+  fastLastSeq = 0;
+  frameInit( frame, FAST_SET, 1 );
+  CHECK( fastCheckSequence( frame ) == FAST_OK && fastLastSeq == 1 );
+  CHECK( fastCheckSequence( frame ) == FAST_STALE );        //replayed
+  frame.seq = 10;
+  CHECK( fastCheckSequence( frame ) == FAST_OK && fastLastSeq == 10 );
+  frame.seq = 9;
+  CHECK( fastCheckSequence( frame ) == FAST_STALE );        //older
+  frame.seq = 11;
+  frame.session = 0x5eed0000;
+  CHECK( fastCheckSequence( frame ) == FAST_STALE );        //from before a restart
+  CHECK( fastLastSeq == 10 );
+  CHECK( fastStale == stale + 3 );
+
+  //A FAST_GET needs neither, and moves nothing on
+  frameInit( frame, FAST_GET, 0 );
+  frame.session = 0;
+  CHECK( fastCheckSequence( frame ) == FAST_OK && fastLastSeq == 10 );
+
+  //A stale reply tells the client the session and where to carry on from
+  FastFrame reply;
+  uint8_t mac[FAST_MAC_LENGTH];
+  fastSetKey( "shared secret" );
+  frameInit( frame, FAST_SET, 3 );
+  frame.session = 0;
+  fastMac( frame, frame.mac );
+  CHECK( deliver( &frame, sizeof( frame ), frame ) );
+  frame.status = fastCheckSequence( frame );
+  CHECK( frame.status == FAST_STALE );
+  fastSend( frame );
+  CHECK( waitPacket( client ) == sizeof( FastFrame ) );
+  CHECK( client.read( (unsigned char*) &reply, sizeof( reply ) ) == sizeof( reply ) );
+  CHECK( reply.type == FAST_ACK && reply.status == FAST_STALE );
+  CHECK( reply.session == fastSession && reply.seq == 10 );
+  fastMac( reply, mac );
+  CHECK( memcmp( mac, reply.mac, FAST_MAC_LENGTH ) == 0 );
+}
+
+static void testLatency( void )
+{
+  std::vector<uint32_t> usecs;
+  FastFrame request;
+  FastFrame frame;
+  FastFrame reply;
+  uint8_t mac[FAST_MAC_LENGTH];
+  int answered = 0;
+
+  fastSetKey( "shared secret" );
+  fastLastSeq = 0;
+  usecs.reserve( BENCH_FRAMES );
+  for( uint32_t seq = 1; seq <= BENCH_FRAMES; seq++ )
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    //Client
+    frameInit( request, FAST_SET, seq );
+    request.state = seq & 0x0003;
+    fastMac( request, request.mac );
+    clientSend( &request, sizeof( request ) );
+
+    //Device, as fastUdpPoll() would - less applying the frame to the switches
+    if( !fastReceive( waitPacket( fastUdp ), frame ) )
+      continue;
+    frame.status = fastCheckSequence( frame );
+    frame.applied = 0xFF;
+    fastSend( frame );
+
+    //Client
+    if( waitPacket( client ) != sizeof( FastFrame ) || client.read( (unsigned char*) &reply, sizeof( reply ) ) != sizeof( reply ) )
+      continue;
+    fastMac( reply, mac );
+    if( memcmp( mac, reply.mac, FAST_MAC_LENGTH ) != 0 || reply.status != FAST_OK || reply.seq != seq )
+      continue;
+    usecs.push_back( (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start ).count() );
+    answered++;
+  }
+  CHECK( answered == BENCH_FRAMES );
+  if( usecs.empty() )
+    return;
+
+  std::sort( usecs.begin(), usecs.end() );
+  printf( "latency: %d round trips, usecs p50 %u, p90 %u, p99 %u, max %u\n", answered,
+          usecs[ usecs.size() / 2 ], usecs[ usecs.size() * 9 / 10 ], usecs[ usecs.size() * 99 / 100 ], usecs.back() );
+}
+
+int main( void )
+{
+  CHECK( fastUdp.begin( 0 ) && client.begin( 0 ) );
+
+  testLayout();
+  testHmac();
+  testReceive();
+  testSequence();
+  testLatency();
+  return checkResult( "fastudp_test" );
+}
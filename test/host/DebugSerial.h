@@ -0,0 +1,7 @@
+//Host stand-in for DebugSerial.h - debug output is dropped
+#ifndef _DEBUG_SERIAL_H_
+#define _DEBUG_SERIAL_H_
+#include "arduino_host.h"
+#define DEBUGS1( x ) do {} while( 0 )
+#define DEBUGSL1( x ) do {} while( 0 )
+#endif
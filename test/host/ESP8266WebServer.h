@@ -0,0 +1,7 @@
+//Host stand-in for ESP8266WebServer.h - only the types Webrelay_httpserver.h uses
+#ifndef _ESP8266_WEBSERVER_HOST_H_
+#define _ESP8266_WEBSERVER_HOST_H_
+#include "ESP8266WiFi.h"
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#endif
@@ -0,0 +1,127 @@
+/*
+ESP8266WiFi.h
+Host stand-in for the ESP8266 WiFi library with a scripted TCP connection in place of lwIP.
+A HostSocket is one connection as the test sees it: deliver() adds bytes for the server to read - call it several
+times with handleClient() in between for a request that arrives in pieces - and sent holds what the server wrote,
+no more than sendSpace bytes at a time. hangUp() closes the client end. WiFiClient is a handle on a HostSocket, copied
+freely like the real one. hostListener is the WiFiServer last begun, and hands out the sockets queued with connect().
+*/
+#ifndef _ESP8266_WIFI_HOST_H_
+#define _ESP8266_WIFI_HOST_H_
+
+#include <memory>
+#include <deque>
+#include "arduino_host.h"
+
+typedef enum { WL_IDLE_STATUS = 0, WL_NO_SSID_AVAIL = 1, WL_CONNECTED = 3, WL_CONNECT_FAILED = 4, WL_CONNECTION_LOST = 5, WL_DISCONNECTED = 6 } wl_status_t;
+
+class IPAddress
+{
+  public:
+  IPAddress( void ) : _address( 0 ) {}
+  IPAddress( uint32_t address ) : _address( address ) {}
+  IPAddress( uint8_t a, uint8_t b, uint8_t c, uint8_t d ) : _address( a | ( b << 8 ) | ( c << 16 ) | ( (uint32_t) d << 24 ) ) {}
+  operator uint32_t( void ) const { return _address; }
+
+  private:
+  uint32_t _address;
+};
+
+class ESP8266WiFiClass
+{
+  public:
+  wl_status_t status( void ) { return hostStatus; }
+  IPAddress localIP( void ) { return IPAddress( 127, 0, 0, 1 ); }
+  wl_status_t hostStatus = WL_CONNECTED;
+};
+
+ESP8266WiFiClass WiFi;
+
+struct HostSocket
+{
+  std::string input;        //bytes delivered and not yet read by the server
+  std::string sent;         //everything the server has written
+  size_t sendSpace = 1460;  //room in the send buffer on each call
+  bool peerOpen = true;
+  bool stopped = false;     //the server closed it
+  bool noDelay = false;
+
+  void deliver( const std::string& data ) { input += data; }
+  void hangUp( void ) { peerOpen = false; }
+};
+
+typedef std::shared_ptr<HostSocket> HostSocketPtr;
+
+class WiFiClient : public Print
+{
+  public:
+  WiFiClient( void ) {}
+  WiFiClient( HostSocketPtr socket ) : _socket( socket ) {}
+
+  explicit operator bool( void ) const { return _socket != nullptr; }
+  uint8_t connected( void ) { return _socket != nullptr && !_socket->stopped && ( _socket->peerOpen || !_socket->input.empty() ); }
+  int available( void ) { return ( _socket != nullptr && !_socket->stopped ) ? _socket->input.size() : 0; }
+
+  int read( uint8_t* buffer, size_t size )
+  {
+    size_t count = available();
+    if( count > size )
+      count = size;
+    memcpy( buffer, _socket->input.data(), count );
+    _socket->input.erase( 0, count );
+    return count;
+  }
+
+  size_t availableForWrite( void ) { return ( connected() ) ? _socket->sendSpace : 0; }
+
+  using Print::write;
+  size_t write( const uint8_t* data, size_t length )
+  {
+    if( _socket == nullptr || _socket->stopped )
+      return 0;
+    _socket->sent.append( (const char*) data, length );
+    return length;
+  }
+
+  size_t write_P( PGM_P data, size_t length ) { return write( (const uint8_t*) data, length ); }
+
+  void setNoDelay( bool noDelay ) { if( _socket != nullptr ) _socket->noDelay = noDelay; }
+  void stop( void ) { if( _socket != nullptr ) _socket->stopped = true; }
+
+  private:
+  HostSocketPtr _socket;
+};
+
+class WiFiServer;
+WiFiServer* hostListener = nullptr;
+
+class WiFiServer
+{
+  public:
+  WiFiServer( int port ) : _port( port ) {}
+  void begin( void ) { _listening = true; hostListener = this; }
+  void setNoDelay( bool ) {}
+
+  WiFiClient available( void )
+  {
+    if( !_listening || _pending.empty() )
+      return WiFiClient();
+    HostSocketPtr socket = _pending.front();
+    _pending.pop_front();
+    return WiFiClient( socket );
+  }
+
+  //A new connection for the next available() to return
+  HostSocketPtr connect( void )
+  {
+    HostSocketPtr socket = std::make_shared<HostSocket>();
+    _pending.push_back( socket );
+    return socket;
+  }
+
+  private:
+  int _port;
+  bool _listening = false;
+  std::deque<HostSocketPtr> _pending;
+};
+#endif
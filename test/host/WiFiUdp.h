@@ -0,0 +1,133 @@
+/*
+WiFiUdp.h
+Host stand-in for WiFiUDP on a real UDP socket bound to 127.0.0.1, so datagrams can be sent between two of them in
+one process and timed. parsePacket() doesn't wait - it returns 0 if nothing has arrived. begin( 0 ) takes any free
+port, which localPort() reports.
+*/
+#ifndef _WIFI_UDP_HOST_H_
+#define _WIFI_UDP_HOST_H_
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string>
+#include "ESP8266WiFi.h"
+
+#define HOST_UDP_MAX 1472
+
+class WiFiUDP : public Print
+{
+  public:
+  ~WiFiUDP() { stop(); }
+
+  uint8_t begin( uint16_t port )
+  {
+    struct sockaddr_in address;
+    socklen_t length = sizeof( address );
+
+    stop();
+    _socket = socket( AF_INET, SOCK_DGRAM, 0 );
+    if( _socket < 0 )
+      return 0;
+    memset( &address, 0, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    address.sin_port = htons( port );
+    if( bind( _socket, (struct sockaddr*) &address, sizeof( address ) ) != 0 ||
+        getsockname( _socket, (struct sockaddr*) &address, &length ) != 0 )
+    {
+      stop();
+      return 0;
+    }
+    _port = ntohs( address.sin_port );
+    return 1;
+  }
+
+  void stop( void )
+  {
+    if( _socket >= 0 )
+      close( _socket );
+    _socket = -1;
+  }
+
+  uint16_t localPort( void ) { return _port; }
+
+  int parsePacket( void )
+  {
+    struct sockaddr_in from;
+    socklen_t length = sizeof( from );
+    ssize_t size;
+
+    _in.clear();
+    _read = 0;
+    if( _socket < 0 )
+      return 0;
+    _in.resize( HOST_UDP_MAX );
+    size = recvfrom( _socket, &_in[0], _in.size(), MSG_DONTWAIT, (struct sockaddr*) &from, &length );
+    if( size <= 0 )
+    {
+      _in.clear();
+      return 0;
+    }
+    _in.resize( size );
+    _remoteIP = IPAddress( from.sin_addr.s_addr );
+    _remotePort = ntohs( from.sin_port );
+    return size;
+  }
+
+  int available( void ) { return _in.size() - _read; }
+
+  int read( unsigned char* buffer, size_t size )
+  {
+    size_t count = available();
+    if( count > size )
+      count = size;
+    memcpy( buffer, &_in[_read], count );
+    _read += count;
+    return count;
+  }
+
+  int read( char* buffer, size_t size ) { return read( (unsigned char*) buffer, size ); }
+
+  IPAddress remoteIP( void ) { return _remoteIP; }
+  uint16_t remotePort( void ) { return _remotePort; }
+
+  int beginPacket( IPAddress ip, uint16_t port )
+  {
+    _out.clear();
+    _toIP = ip;
+    _toPort = port;
+    return 1;
+  }
+
+  using Print::write;
+  size_t write( const uint8_t* data, size_t length )
+  {
+    _out.append( (const char*) data, length );
+    return length;
+  }
+
+  int endPacket( void )
+  {
+    struct sockaddr_in to;
+
+    memset( &to, 0, sizeof( to ) );
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = (uint32_t) _toIP;
+    to.sin_port = htons( _toPort );
+    return sendto( _socket, _out.data(), _out.size(), 0, (struct sockaddr*) &to, sizeof( to ) ) == (ssize_t) _out.size();
+  }
+
+  private:
+  int _socket = -1;
+  uint16_t _port = 0;
+  std::string _in;
+  size_t _read = 0;
+  std::string _out;
+  IPAddress _remoteIP;
+  uint16_t _remotePort = 0;
+  IPAddress _toIP;
+  uint16_t _toPort = 0;
+};
+#endif
@@ -0,0 +1,119 @@
+/*
+arduino_host.h
+The parts of the Arduino core the host tests need, built on the C++ library. Flash is ordinary memory here, so
+PROGMEM, PSTR() and F() do nothing and the _P functions are the plain ones. Time stands still unless a test moves
+it on - millis() returns hostMillis.
+*/
+#ifndef _ARDUINO_HOST_H_
+#define _ARDUINO_HOST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+#define ICACHE_RAM_ATTR
+#define PGM_P const char*
+class __FlashStringHelper;
+#define F( s ) ( reinterpret_cast<const __FlashStringHelper*>( s ) )
+#define FPSTR( s ) ( reinterpret_cast<const __FlashStringHelper*>( s ) )
+#define PSTR( s ) ( s )
+#define pgm_read_byte( p ) ( *(const uint8_t*)( p ) )
+#define pgm_read_ptr( p ) ( *(const void* const*)( p ) )
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define memcpy_P memcpy
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+uint32_t hostMillis = 0;
+
+unsigned long millis( void )
+{
+  return hostMillis;
+}
+
+unsigned long micros( void )
+{
+  return hostMillis * 1000UL;
+}
+
+void yield( void )
+{
+}
+
+void delay( unsigned long msecs )
+{
+  hostMillis += msecs;
+}
+
+class String
+{
+  public:
+  String( void ) {}
+  String( const char* s ) : _s( ( s != nullptr ) ? s : "" ) {}
+  String( const __FlashStringHelper* s ) : _s( (const char*) s ) {}
+  String( char c ) : _s( 1, c ) {}
+  String( int value ) : _s( std::to_string( value ) ) {}
+  String( unsigned int value ) : _s( std::to_string( value ) ) {}
+  String( long value ) : _s( std::to_string( value ) ) {}
+  String( unsigned long value ) : _s( std::to_string( value ) ) {}
+
+  const char* c_str( void ) const { return _s.c_str(); }
+  unsigned int length( void ) const { return _s.length(); }
+  bool reserve( unsigned int size ) { _s.reserve( size ); return true; }
+  void remove( unsigned int index, unsigned int count ) { _s.erase( index, count ); }
+  char operator[]( unsigned int index ) const { return _s[index]; }
+  int indexOf( const char* s ) const { size_t at = _s.find( s ); return ( at == std::string::npos ) ? -1 : (int) at; }
+  int toInt( void ) const { return atoi( _s.c_str() ); }
+  bool equals( const String& s ) const { return _s == s._s; }
+  bool equalsIgnoreCase( const String& s ) const { return strcasecmp( _s.c_str(), s.c_str() ) == 0; }
+  bool operator==( const String& s ) const { return _s == s._s; }
+  bool operator==( const char* s ) const { return _s == s; }
+  bool operator!=( const char* s ) const { return _s != s; }
+
+  String& operator+=( const String& s ) { _s += s._s; return *this; }
+  String& operator+=( const char* s ) { _s += s; return *this; }
+  String& operator+=( const __FlashStringHelper* s ) { _s += (const char*) s; return *this; }
+  String& operator+=( char c ) { _s += c; return *this; }
+  String& operator+=( int value ) { _s += std::to_string( value ); return *this; }
+  String& operator+=( unsigned int value ) { _s += std::to_string( value ); return *this; }
+  String& operator+=( long value ) { _s += std::to_string( value ); return *this; }
+  String& operator+=( unsigned long value ) { _s += std::to_string( value ); return *this; }
+
+  private:
+  std::string _s;
+};
+
+inline String operator+( const String& a, const String& b ) { String s( a ); s += b; return s; }
+inline String operator+( const String& a, const char* b ) { String s( a ); s += b; return s; }
+inline String operator+( const char* a, const String& b ) { String s( a ); s += b; return s; }
+
+class EspClass
+{
+  public:
+  uint32_t getFreeHeap( void ) { return 40000; }
+};
+
+EspClass ESP;
+
+class Print
+{
+  public:
+  virtual ~Print() {}
+  virtual size_t write( uint8_t c ) { return write( &c, 1 ); }
+  virtual size_t write( const uint8_t* data, size_t length ) = 0;
+};
+#endif
@@ -0,0 +1,175 @@
+/*
+bearssl_hmac.h
+Host stand-in for the BearSSL HMAC calls Webrelay_fastudp.h makes, with SHA-256 as the only hash. Same names and
+arguments as BearSSL, so the frame code under test is unchanged - fastudp_test.cpp checks it against RFC 4231.
+*/
+#ifndef _BEARSSL_HMAC_HOST_H_
+#define _BEARSSL_HMAC_HOST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define br_sha256_SIZE 32
+#define SHA256_BLOCK 64
+
+typedef struct
+{
+  size_t digestSize;
+} br_hash_class;
+
+const br_hash_class br_sha256_vtable = { br_sha256_SIZE };
+
+typedef struct
+{
+  uint32_t h[8];
+  uint8_t block[SHA256_BLOCK];
+  uint64_t length; //bytes hashed so far
+} HostSha256;
+
+typedef struct
+{
+  const br_hash_class* dig_vtable;
+  uint8_t ipad[SHA256_BLOCK]; //key xor 0x36
+  uint8_t opad[SHA256_BLOCK]; //key xor 0x5c
+} br_hmac_key_context;
+
+typedef struct
+{
+  const br_hmac_key_context* key;
+  HostSha256 inner;
+} br_hmac_context;
+
+static const uint32_t sha256K[64] =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t sha256Rotr( uint32_t x, int n )
+{
+  return ( x >> n ) | ( x << ( 32 - n ) );
+}
+
+static void sha256Init( HostSha256& s )
+{
+  static const uint32_t h0[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+  memcpy( s.h, h0, sizeof( s.h ) );
+  s.length = 0;
+}
+
+static void sha256Block( HostSha256& s, const uint8_t* p )
+{
+  uint32_t w[64];
+  uint32_t v[8];
+
+  for( int i = 0; i < 16; i++ )
+    w[i] = ( (uint32_t) p[4*i] << 24 ) | ( (uint32_t) p[4*i+1] << 16 ) | ( (uint32_t) p[4*i+2] << 8 ) | p[4*i+3];
+  for( int i = 16; i < 64; i++ )
+  {
+    uint32_t s0 = sha256Rotr( w[i-15], 7 ) ^ sha256Rotr( w[i-15], 18 ) ^ ( w[i-15] >> 3 );
+    uint32_t s1 = sha256Rotr( w[i-2], 17 ) ^ sha256Rotr( w[i-2], 19 ) ^ ( w[i-2] >> 10 );
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+  memcpy( v, s.h, sizeof( v ) );
+  for( int i = 0; i < 64; i++ )
+  {
+    uint32_t t1 = v[7] + ( sha256Rotr( v[4], 6 ) ^ sha256Rotr( v[4], 11 ) ^ sha256Rotr( v[4], 25 ) ) + ( ( v[4] & v[5] ) ^ ( ~v[4] & v[6] ) ) + sha256K[i] + w[i];
+    uint32_t t2 = ( sha256Rotr( v[0], 2 ) ^ sha256Rotr( v[0], 13 ) ^ sha256Rotr( v[0], 22 ) ) + ( ( v[0] & v[1] ) ^ ( v[0] & v[2] ) ^ ( v[1] & v[2] ) );
+    memmove( &v[1], &v[0], 7 * sizeof( uint32_t ) );
+    v[4] += t1;
+    v[0] = t1 + t2;
+  }
+  for( int i = 0; i < 8; i++ )
+    s.h[i] += v[i];
+}
+
+static void sha256Update( HostSha256& s, const void* data, size_t length )
+{
+  const uint8_t* p = (const uint8_t*) data;
+  while( length > 0 )
+  {
+    size_t used = s.length % SHA256_BLOCK;
+    size_t count = SHA256_BLOCK - used;
+    if( count > length )
+      count = length;
+    memcpy( &s.block[used], p, count );
+    s.length += count;
+    p += count;
+    length -= count;
+    if( s.length % SHA256_BLOCK == 0 )
+      sha256Block( s, s.block );
+  }
+}
+
+static void sha256Out( HostSha256 s, uint8_t* digest )
+{
+  uint64_t bits = s.length * 8;
+  uint8_t pad = 0x80;
+  uint8_t lengthBytes[8];
+
+  sha256Update( s, &pad, 1 );
+  pad = 0;
+  while( s.length % SHA256_BLOCK != 56 )
+    sha256Update( s, &pad, 1 );
+  for( int i = 0; i < 8; i++ )
+    lengthBytes[i] = (uint8_t)( bits >> ( 56 - 8 * i ) );
+  sha256Update( s, lengthBytes, 8 );
+  for( int i = 0; i < 32; i++ )
+    digest[i] = (uint8_t)( s.h[i / 4] >> ( 24 - 8 * ( i % 4 ) ) );
+}
+
+static inline void br_hmac_key_init( br_hmac_key_context* kc, const br_hash_class* digest, const void* key, size_t length )
+{
+  uint8_t k[SHA256_BLOCK];
+
+  memset( k, 0, sizeof( k ) );
+  if( length > SHA256_BLOCK )
+  {
+    HostSha256 s;
+    sha256Init( s );
+    sha256Update( s, key, length );
+    sha256Out( s, k );
+  }
+  else
+    memcpy( k, key, length );
+  kc->dig_vtable = digest;
+  for( int i = 0; i < SHA256_BLOCK; i++ )
+  {
+    kc->ipad[i] = k[i] ^ 0x36;
+    kc->opad[i] = k[i] ^ 0x5c;
+  }
+}
+
+//out_len 0 for the full digest, as in BearSSL
+static inline void br_hmac_init( br_hmac_context* ctx, const br_hmac_key_context* kc, size_t )
+{
+  ctx->key = kc;
+  sha256Init( ctx->inner );
+  sha256Update( ctx->inner, kc->ipad, SHA256_BLOCK );
+}
+
+static inline void br_hmac_update( br_hmac_context* ctx, const void* data, size_t length )
+{
+  sha256Update( ctx->inner, data, length );
+}
+
+static inline size_t br_hmac_out( const br_hmac_context* ctx, void* out )
+{
+  HostSha256 outer;
+  uint8_t digest[br_sha256_SIZE];
+
+  sha256Out( ctx->inner, digest );
+  sha256Init( outer );
+  sha256Update( outer, ctx->key->opad, SHA256_BLOCK );
+  sha256Update( outer, digest, sizeof( digest ) );
+  sha256Out( outer, (uint8_t*) out );
+  return br_sha256_SIZE;
+}
+#endif
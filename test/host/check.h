@@ -0,0 +1,21 @@
+/*
+check.h
+Checks for the host tests. CHECK() prints the file, line and condition of each one that fails and carries on, so
+one run shows every failure; main() ends with return checkResult( "name" ), which prints the verdict and gives
+test/run_tests.sh a nonzero exit status if anything failed.
+*/
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdio.h>
+
+static int checkFailures = 0;
+
+#define CHECK( condition ) do { if( !( condition ) ) { printf( "FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition ); checkFailures++; } } while( 0 )
+
+static int checkResult( const char* name )
+{
+  printf( "%s: %s\n", name, ( checkFailures == 0 ) ? "passed" : "FAILED" );
+  return ( checkFailures == 0 ) ? 0 : 1;
+}
+#endif
@@ -0,0 +1,254 @@
+/*
+httpserver_test.cpp
+Host tests for Webrelay_httpserver.h - run with test/run_tests.sh.
+Requests go in through the scripted sockets of test/host/ESP8266WiFi.h, a byte or a few bytes per pass where the
+point is a request arriving in pieces, and the tests check the response written back: request line, arguments from
+the query string and a form body, the limits - 414 and 431 at HTTP_LINE_MAX, 413 for a body of HTTP_LINE_MAX or more -
+the 503 sent when every connection is in use, and the idle timeout.
+*/
+#include <stdio.h>
+#include "arduino_host.h"
+#include "../Webrelay_httpserver.h"
+#include "check.h"
+
+HttpServer server( 80 );
+
+//Echoes what the handler sees, so the tests can check the parse
+static void handleEcho( void )
+{
+  String message = "method=";
+  message += (int) server.method();
+  message += " uri=";
+  message += server.uri();
+  for( int i = 0; i < server.args(); i++ )
+  {
+    message += ' ';
+    message += server.argName( i );
+    message += '=';
+    message += server.arg( i );
+  }
+  message += " id=";
+  message += server.arg( "ID" );
+  //As the handlers ask, with the name in flash
+  if( hasArgIC( F("id"), server, false ) )
+  {
+    message += " flash=";
+    message += server.arg( F("iD") );
+  }
+  server.send( 200, "text/plain", message );
+}
+
+static bool startsWith( const std::string& s, const char* prefix )
+{
+  return s.compare( 0, strlen( prefix ), prefix ) == 0;
+}
+
+static bool contains( const std::string& s, const char* part )
+{
+  return s.find( part ) != std::string::npos;
+}
+
+//Open a connection and let the server accept it
+static HostSocketPtr open( void )
+{
+  HostSocketPtr socket = hostListener->connect();
+  server.handleClient();
+  return socket;
+}
+
+//Deliver data step bytes at a time, with a pass of the server after each piece
+static void trickle( HostSocketPtr socket, const std::string& data, size_t step )
+{
+  for( size_t i = 0; i < data.size(); i += step )
+  {
+    socket->deliver( data.substr( i, step ) );
+    server.handleClient();
+  }
+}
+
+//Let the server finish with every connection
+static void settle( void )
+{
+  for( int i = 0; i < 4; i++ )
+    server.handleClient();
+}
+
+static void testPartialRequest( void )
+{
+  const std::string request = "GET /echo?Id=3&ClientTransactionID=7 HTTP/1.1\r\nHost: webrelay\r\nAccept: */*\r\n\r\n";
+  HostSocketPtr socket = open();
+
+  trickle( socket, request.substr( 0, request.size() - 1 ), 1 );
+  CHECK( socket->sent.empty() );
+  CHECK( server.activeConnections() == 1 );
+  trickle( socket, request.substr( request.size() - 1 ), 1 );
+  CHECK( startsWith( socket->sent, "HTTP/1.1 200 OK\r\n" ) );
+  CHECK( contains( socket->sent, "Connection: close\r\n" ) );
+  CHECK( contains( socket->sent, "\r\n\r\nmethod=1 uri=/echo Id=3 ClientTransactionID=7 id=3 flash=3" ) );
+  settle();
+  CHECK( socket->stopped );
+  CHECK( server.activeConnections() == 0 );
+}
+
+static void testFormBody( void )
+{
+  const std::string body = "Id=2&Value=1.5&Name=Dew+heater%202";
+  std::string request = "PUT /echo HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: ";
+  request += std::to_string( body.size() ) + "\r\n\r\n" + body;
+  HostSocketPtr socket = open();
+
+  //The headers and the start of the body in one read, then the rest a few bytes at a time
+  socket->deliver( request.substr( 0, request.size() - 10 ) );
+  server.handleClient();
+  CHECK( socket->sent.empty() );
+  trickle( socket, request.substr( request.size() - 10 ), 3 );
+  CHECK( startsWith( socket->sent, "HTTP/1.1 200 OK\r\n" ) );
+  CHECK( contains( socket->sent, "method=4 uri=/echo Id=2 Value=1.5 Name=Dew heater 2 id=2" ) );
+  settle();
+}
+
+static void testPlainBody( void )
+{
+  HostSocketPtr socket = open();
+
+  trickle( socket, "POST /echo HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello", 7 );
+  CHECK( contains( socket->sent, "method=3 uri=/echo plain=hello" ) );
+  settle();
+}
+
+static void testLineLimits( void )
+{
+  uint32_t bad = server.badRequests;
+  HostSocketPtr socket;
+
+  //A header line of HTTP_LINE_MAX - 1 characters fits, one more doesn't
+  socket = open();
+  trickle( socket, "GET /echo HTTP/1.1\r\nX-Pad: " + std::string( HTTP_LINE_MAX - 1 - 7, 'a' ) + "\r\n\r\n", 32 );
+  CHECK( startsWith( socket->sent, "HTTP/1.1 200 OK\r\n" ) );
+  settle();
+
+  socket = open();
+  trickle( socket, "GET /echo HTTP/1.1\r\nX-Pad: " + std::string( HTTP_LINE_MAX - 7, 'a' ) + "\r\n\r\n", 32 );
+  CHECK( startsWith( socket->sent, "HTTP/1.1 431 Request Header Fields Too Large\r\n" ) );
+  settle();
+  CHECK( socket->stopped );
+
+  socket = open();
+  trickle( socket, "GET /echo?pad=" + std::string( HTTP_LINE_MAX, 'a' ) + " HTTP/1.1\r\n\r\n", 32 );
+  CHECK( startsWith( socket->sent, "HTTP/1.1 414 URI Too Long\r\n" ) );
+  settle();
+
+  //A path that fits the line but not the URI buffer
+  socket = open();
+  trickle( socket, "GET /" + std::string( HTTP_URI_MAX, 'a' ) + " HTTP/1.1\r\n\r\n", 32 );
+  CHECK( startsWith( socket->sent, "HTTP/1.1 414 URI Too Long\r\n" ) );
+  settle();
+
+  CHECK( server.badRequests == bad + 3 );
+}
+
+static void testBodyLimit( void )
+{
+  HostSocketPtr socket;
+
+  socket = open();
+  trickle( socket, "PUT /echo HTTP/1.1\r\nContent-Length: " + std::to_string( HTTP_LINE_MAX - 1 ) + "\r\n\r\n" + std::string( HTTP_LINE_MAX - 1, 'b' ), 64 );
+  CHECK( startsWith( socket->sent, "HTTP/1.1 200 OK\r\n" ) );
+  settle();
+
+  //Refused as soon as the headers are read - the body is never taken
+  socket = open();
+  trickle( socket, "PUT /echo HTTP/1.1\r\nContent-Length: " + std::to_string( HTTP_LINE_MAX ) + "\r\n\r\n", 64 );
+  CHECK( startsWith( socket->sent, "HTTP/1.1 413 Payload Too Large\r\n" ) );
+  settle();
+  CHECK( socket->stopped );
+}
+
+static void testBadRequests( void )
+{
+  HostSocketPtr socket;
+
+  socket = open();
+  trickle( socket, "BREW /pot HTTP/1.1\r\n\r\n", 8 );
+  CHECK( startsWith( socket->sent, "HTTP/1.1 405 Method Not Allowed\r\n" ) );
+  settle();
+
+  socket = open();
+  trickle( socket, "GET /nothing HTTP/1.1\r\n\r\n", 8 );
+  CHECK( startsWith( socket->sent, "HTTP/1.1 404 Not Found\r\n" ) );
+  settle();
+}
+
+static void testBusy( void )
+{
+  HostSocketPtr held[HTTP_MAX_CONNECTIONS];
+  HostSocketPtr extra;
+  uint32_t refused = server.refused;
+
+  for( int i = 0; i < HTTP_MAX_CONNECTIONS; i++ )
+    held[i] = open();
+  CHECK( server.activeConnections() == HTTP_MAX_CONNECTIONS );
+
+  extra = open();
+  CHECK( extra->sent == httpBusyResponse );
+  CHECK( extra->stopped );
+  CHECK( server.refused == refused + 1 );
+
+  //The connections already open are served as normal
+  trickle( held[2], "GET /echo?id=9 HTTP/1.1\r\n\r\n", 5 );
+  CHECK( contains( held[2]->sent, "id=9" ) );
+  settle();
+  for( int i = 0; i < HTTP_MAX_CONNECTIONS; i++ )
+    held[i]->hangUp();
+  settle();
+  CHECK( server.activeConnections() == 0 );
+}
+
+static void testIdleTimeout( void )
+{
+  uint32_t timeouts = server.timeouts;
+  HostSocketPtr socket = open();
+
+  trickle( socket, "GET /echo HTTP/1.1\r\nHost:", 4 );
+  hostMillis += HTTP_IDLE_TIMEOUT;
+  server.handleClient();
+  CHECK( !socket->stopped );
+  hostMillis += 1;
+  server.handleClient();
+  CHECK( socket->stopped );
+  CHECK( socket->sent.empty() );
+  CHECK( server.timeouts == timeouts + 1 );
+  CHECK( server.activeConnections() == 0 );
+}
+
+//A response bigger than the send buffer goes out over several passes
+static void testSlowSend( void )
+{
+  HostSocketPtr socket = open();
+  size_t passes = 0;
+
+  socket->sendSpace = 16;
+  trickle( socket, "GET /echo?id=1 HTTP/1.1\r\n\r\n", 64 );
+  while( !socket->stopped && passes++ < 100 )
+    server.handleClient();
+  CHECK( startsWith( socket->sent, "HTTP/1.1 200 OK\r\n" ) );
+  CHECK( contains( socket->sent, "id=1" ) );
+  CHECK( passes > 4 );
+}
+
+int main( void )
+{
+  server.on( "/echo", handleEcho );
+  server.begin();
+
+  testPartialRequest();
+  testFormBody();
+  testPlainBody();
+  testLineLimits();
+  testBodyLimit();
+  testBadRequests();
+  testBusy();
+  testIdleTimeout();
+  testSlowSend();
+  return checkResult( "httpserver_test" );
+}
@@ -0,0 +1,141 @@
+/*
+rules_test.cpp
+Host tests for Webrelay_rules.h - run with test/run_tests.sh.
+Rules are added and removed through addRule() and removeRule() and the compiled masks checked for each type, then
+ruleCheck() and ruleCheckMask() are run against relays noted on and off: an exclusive pair, a switch that requires
+another and can't lose it, and delay-after rules timed against millis() - including one switch waiting on two
+others with different delays, and two rules for the same pair keeping the longer delay.
+*/
+#include <stdio.h>
+#include "arduino_host.h"
+#include "../Webrelay_rules.h"
+#include "check.h"
+
+static void reset( void )
+{
+  numRules = 0;
+  compileRules();
+  for( int i = 0; i < MAX_INTERLOCK_SWITCHES; i++ )
+    ruleNoteState( i, false );
+  hostMillis = 100000;
+}
+
+static void testCompile( void )
+{
+  reset();
+  CHECK( addRule( RULE_EXCLUSIVE, 0, 1, 0 ) );
+  CHECK( addRule( RULE_REQUIRES, 2, 3, 0 ) );
+  CHECK( addRule( RULE_DELAY_AFTER, 4, 3, 5000 ) );
+  CHECK( excludeMask[0] == 0x02 && excludeMask[1] == 0x01 );
+  CHECK( requireMask[2] == 0x08 && requireMask[4] == 0x08 );
+  CHECK( dependentMask[3] == 0x14 );
+  CHECK( delayMask[4] == 0x08 && delayMask[2] == 0 );
+  CHECK( numRuleDelays == 1 && ruleDelay[0].target == 4 && ruleDelay[0].other == 3 && ruleDelay[0].delay == 5000 );
+  //Only delay-after rules keep their delay
+  CHECK( rule[1].delay == 0 );
+
+  //Refused - a switch on itself, out of range, no type or a full table
+  CHECK( !addRule( RULE_EXCLUSIVE, 5, 5, 0 ) );
+  CHECK( !addRule( RULE_REQUIRES, 5, MAX_INTERLOCK_SWITCHES, 0 ) );
+  CHECK( !addRule( RULE_REQUIRES, -1, 5, 0 ) );
+  CHECK( !addRule( RULE_NONE, 5, 6, 0 ) );
+  CHECK( !addRule( RULE_DELAY_AFTER + 1, 5, 6, 0 ) );
+  CHECK( numRules == 3 );
+
+  //Removing a rule compiles the table again without it
+  CHECK( removeRule( 1 ) );
+  CHECK( numRules == 2 && requireMask[2] == 0 && dependentMask[3] == 0x10 );
+  CHECK( !removeRule( 2 ) );
+
+  while( numRules < MAX_RULES )
+    CHECK( addRule( RULE_EXCLUSIVE, 6, 7, 0 ) );
+  CHECK( !addRule( RULE_EXCLUSIVE, 8, 9, 0 ) );
+}
+
+static void testExclusive( void )
+{
+  reset();
+  addRule( RULE_EXCLUSIVE, 0, 1, 0 );
+  CHECK( ruleCheck( 0, true ) == RULE_OK );
+  ruleNoteState( 0, true );
+  CHECK( ruleCheck( 1, true ) == RULE_EXCLUDED );
+  CHECK( ruleCheck( 2, true ) == RULE_OK );
+  //Both at once is refused as well, but swapping them over in one change is not
+  CHECK( ruleCheckMask( 0x00, 0x03 ) == RULE_EXCLUDED );
+  CHECK( ruleCheckMask( 0x01, 0x02 ) == RULE_OK );
+  ruleNoteState( 0, false );
+  CHECK( ruleCheck( 1, true ) == RULE_OK );
+}
+
+static void testRequires( void )
+{
+  reset();
+  addRule( RULE_REQUIRES, 2, 3, 0 );
+  CHECK( ruleCheck( 2, true ) == RULE_MISSING_REQUIRED );
+  CHECK( ruleCheckMask( 0x00, 0x0C ) == RULE_OK );
+  ruleNoteState( 3, true );
+  CHECK( ruleCheck( 2, true ) == RULE_OK );
+  ruleNoteState( 2, true );
+  CHECK( ruleCheck( 3, false ) == RULE_HAS_DEPENDENT );
+  CHECK( ruleCheckMask( 0x0C, 0x00 ) == RULE_OK );
+  //A state that already breaks the rule doesn't block unrelated changes
+  CHECK( ruleCheckMask( 0x04, 0x24 ) == RULE_OK );
+}
+
+static void testDelays( void )
+{
+  reset();
+  addRule( RULE_DELAY_AFTER, 4, 3, 5000 );
+  addRule( RULE_DELAY_AFTER, 4, 5, 2000 );
+  CHECK( numRuleDelays == 2 );
+  CHECK( ruleCheck( 4, true ) == RULE_MISSING_REQUIRED );
+  //Coming on in the same change isn't long enough
+  CHECK( ruleCheckMask( 0x00, 0x38 ) == RULE_TOO_SOON );
+
+  ruleNoteState( 3, true );
+  hostMillis += 1000;
+  ruleNoteState( 5, true );
+  hostMillis += 2000;
+  CHECK( ruleCheck( 4, true ) == RULE_TOO_SOON );    //3 on for 3000 of its 5000
+  hostMillis += 1999;
+  CHECK( ruleCheck( 4, true ) == RULE_TOO_SOON );
+  hostMillis += 1;
+  CHECK( ruleCheck( 4, true ) == RULE_OK );
+
+  //Noting a relay on again doesn't restart its time, turning it off does
+  ruleNoteState( 3, true );
+  CHECK( ruleCheck( 4, true ) == RULE_OK );
+  ruleNoteState( 5, false );
+  ruleNoteState( 5, true );
+  CHECK( ruleCheck( 4, true ) == RULE_TOO_SOON );
+  hostMillis += 2000;
+  CHECK( ruleCheck( 4, true ) == RULE_OK );
+}
+
+//Two rules for one pair compile to one delay, the longer
+static void testLongerDelay( void )
+{
+  reset();
+  addRule( RULE_DELAY_AFTER, 1, 0, 1000 );
+  addRule( RULE_DELAY_AFTER, 1, 0, 3000 );
+  addRule( RULE_DELAY_AFTER, 1, 0, 2000 );
+  CHECK( numRuleDelays == 1 && ruleDelay[0].delay == 3000 );
+  ruleNoteState( 0, true );
+  hostMillis += 2500;
+  CHECK( ruleCheck( 1, true ) == RULE_TOO_SOON );
+  hostMillis += 500;
+  CHECK( ruleCheck( 1, true ) == RULE_OK );
+  //The other switch can't go off under it either
+  ruleNoteState( 1, true );
+  CHECK( ruleCheck( 0, false ) == RULE_HAS_DEPENDENT );
+}
+
+int main( void )
+{
+  testCompile();
+  testExclusive();
+  testRequires();
+  testDelays();
+  testLongerDelay();
+  return checkResult( "rules_test" );
+}
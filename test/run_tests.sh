@@ -0,0 +1,24 @@
+#!/bin/sh
+# Host tests for the modules that don't need the ESP8266 - builds each test/*_test.cpp with the host compiler and runs it.
+# Tests use CHECK() from test/host/check.h. Those that need Arduino types include test/host/arduino_host.h, a small
+# stand-in for the parts they use.
+# Usage: test/run_tests.sh [test name ...]    e.g. test/run_tests.sh eventqueue_test
+cd "$(dirname "$0")" || exit 1
+CXX=${CXX:-g++}
+BUILD=${BUILD:-/tmp/webrelay_tests}
+mkdir -p "$BUILD"
+
+if [ $# -eq 0 ]; then
+  set -- $(ls *_test.cpp | sed 's/\.cpp$//')
+fi
+
+failed=0
+for t in "$@"; do
+  if ! $CXX -std=gnu++11 -O1 -Wall -Wno-unused-function -pthread -Ihost -o "$BUILD/$t" "$t.cpp" $(cat "$t.flags" 2>/dev/null); then
+    echo "$t: build FAILED"
+    failed=1
+    continue
+  fi
+  "$BUILD/$t" || failed=1
+done
+exit $failed
@@ -0,0 +1,151 @@
+/*
+schedule_test.cpp
+Host tests for Webrelay_schedule.h - run with test/run_tests.sh.
+Built for a device three hours ahead of UTC - TZ 2 and an hour of DST - so the tests show entries fire at the device's
+clock time and not at the same hour UTC. scheduleRun() is given UTC seconds, as time() gives it on the device, and the
+clock is stepped a minute at a time through the day to see when each entry fires.
+*/
+#define TZ 2
+#define DST_MN 60
+#include <stdio.h>
+#include "arduino_host.h"
+#include "../Webrelay_schedule.h"
+#include "check.h"
+
+#define HOUR 3600
+#define DAY 86400
+#define SAT_1_JUNE_2024 1717200000 //00:00 UTC, a Saturday
+
+int firedIndex = -1;
+time_t firedAt = 0; //UTC
+time_t clockUtc = 0;
+ScheduleEntry entry;
+
+static void onFire( int index )
+{
+  firedIndex = index;
+  firedAt = clockUtc;
+}
+
+//Fill in entry as a clock entry turning switch 0 on
+static ScheduleEntry& clockEntry( uint8_t days, uint8_t hour, uint8_t minute )
+{
+  memset( &entry, 0, sizeof( entry ) );
+  entry.action = SCHED_ON;
+  entry.base = SCHED_CLOCK;
+  entry.days = days;
+  entry.hour = hour;
+  entry.minute = minute;
+  return entry;
+}
+
+//Step the clock a minute at a time from 'from' until an entry fires or 'until' is passed. Returns the UTC it fired at.
+static time_t runUntilFired( time_t from, time_t until )
+{
+  firedIndex = -1;
+  firedAt = 0;
+  for( clockUtc = from; clockUtc <= until && firedIndex < 0; clockUtc += 60 )
+    scheduleRun( clockUtc, onFire );
+  return firedAt;
+}
+
+static void reset( void )
+{
+  numSchedules = 0;
+  scheduleStale = true;
+  scheduleLast = 0;
+}
+
+static void testOffset( void )
+{
+  CHECK( SCHED_UTC_OFFSET == 3 * HOUR );
+}
+
+//07:30 device time is 04:30 UTC
+static void testClockEntry( void )
+{
+  ScheduleEntry e = clockEntry( SCHED_ALL_DAYS, 7, 30 );
+
+  reset();
+  CHECK( scheduleNextTime( e, SAT_1_JUNE_2024 + SCHED_UTC_OFFSET ) == SAT_1_JUNE_2024 + 7 * HOUR + 30 * 60 );
+  CHECK( addSchedule( e ) );
+  CHECK( runUntilFired( SAT_1_JUNE_2024, SAT_1_JUNE_2024 + DAY ) == SAT_1_JUNE_2024 + 4 * HOUR + 30 * 60 );
+  CHECK( firedIndex == 0 );
+  //Next due the same time the next day, in device clock seconds
+  CHECK( scheduleNextFire[0] == SAT_1_JUNE_2024 + DAY + 7 * HOUR + 30 * 60 );
+}
+
+//The day mask is the device's day - 01:00 Saturday device time is still Friday UTC
+static void testDayBoundary( void )
+{
+  reset();
+  CHECK( addSchedule( clockEntry( 1 << 6, 1, 0 ) ) ); //Saturdays
+  CHECK( runUntilFired( SAT_1_JUNE_2024 - 6 * HOUR, SAT_1_JUNE_2024 + DAY ) == SAT_1_JUNE_2024 - 2 * HOUR );
+
+  reset();
+  CHECK( addSchedule( clockEntry( 1 << 5, 23, 30 ) ) ); //Fridays
+  CHECK( runUntilFired( SAT_1_JUNE_2024 - DAY, SAT_1_JUNE_2024 + DAY ) == SAT_1_JUNE_2024 - 3 * HOUR - 30 * 60 );
+}
+
+//An hourly entry fires at each device hour's minute, and every minute entry the next whole minute
+static void testWildcards( void )
+{
+  time_t device = SAT_1_JUNE_2024 + SCHED_UTC_OFFSET;
+  ScheduleEntry hourly = clockEntry( SCHED_ALL_DAYS, SCHED_ANY, 15 );
+  ScheduleEntry everyMinute = clockEntry( SCHED_ALL_DAYS, 9, SCHED_ANY );
+
+  CHECK( scheduleNextTime( hourly, device ) == device + 15 * 60 );
+  CHECK( scheduleNextTime( hourly, device + 15 * 60 ) == device + HOUR + 15 * 60 );
+  CHECK( scheduleNextTime( everyMinute, device ) == SAT_1_JUNE_2024 + 9 * HOUR );
+  CHECK( scheduleNextTime( everyMinute, SAT_1_JUNE_2024 + 9 * HOUR + 10 ) == SAT_1_JUNE_2024 + 9 * HOUR + 60 );
+  CHECK( scheduleNextTime( everyMinute, SAT_1_JUNE_2024 + 9 * HOUR + 59 * 60 ) == SAT_1_JUNE_2024 + DAY + 9 * HOUR );
+}
+
+//Sunrise on the equator at longitude 0 is close to 06:00 UTC all year - 09:00 device time
+static void testSunrise( void )
+{
+  ScheduleEntry e = clockEntry( SCHED_ALL_DAYS, 0, 0 );
+  time_t when;
+
+  siteLatitude = 0.0F;
+  siteLongitude = 0.0F;
+  CHECK( sunEventTime( SAT_1_JUNE_2024, true, when ) );
+  CHECK( when > SAT_1_JUNE_2024 + 8 * HOUR + 50 * 60 && when < SAT_1_JUNE_2024 + 9 * HOUR + 10 * 60 );
+
+  reset();
+  e.base = SCHED_SUNRISE;
+  e.offset = -30;
+  CHECK( addSchedule( e ) );
+  when = runUntilFired( SAT_1_JUNE_2024, SAT_1_JUNE_2024 + DAY );
+  CHECK( when > SAT_1_JUNE_2024 + 5 * HOUR + 20 * 60 && when < SAT_1_JUNE_2024 + 5 * HOUR + 40 * 60 );
+
+  //No sunrise in the arctic summer
+  siteLatitude = 80.0F;
+  CHECK( !sunEventTime( SAT_1_JUNE_2024, true, when ) );
+  siteLatitude = 0.0F;
+}
+
+//Setting the clock works the fire times out again rather than firing what was missed
+static void testClockSet( void )
+{
+  reset();
+  CHECK( addSchedule( clockEntry( SCHED_ALL_DAYS, 7, 30 ) ) );
+  clockUtc = 0;
+  scheduleRun( 1000, onFire );        //clock not set yet
+  CHECK( scheduleStale );
+  firedIndex = -1;
+  scheduleRun( SAT_1_JUNE_2024 + 12 * HOUR, onFire );
+  CHECK( firedIndex < 0 );
+  CHECK( scheduleNext == SAT_1_JUNE_2024 + DAY + 7 * HOUR + 30 * 60 );
+}
+
+int main( void )
+{
+  testOffset();
+  testClockEntry();
+  testDayBoundary();
+  testWildcards();
+  testSunrise();
+  testClockSet();
+  return checkResult( "schedule_test" );
+}
@@ -0,0 +1,171 @@
+/*
+sensors_test.cpp
+Host tests for Webrelay_sensors.h - run with test/run_tests.sh.
+The I2C bus is replaced by a table of register values per address, so each chip's scaling can be checked from known
+register contents: the INA219's shunt and bus registers, the INA3221's 13 bit values in the top of each register,
+power from the two - including a shunt of a milliohm at full scale, which overflowed 32 bits - and the moving window
+of samples behind a sensor switch's level.
+*/
+#include <stdio.h>
+#include "arduino_host.h"
+#include "../Webrelay_common.h"
+#include "../Webrelay_switchtypes.h"
+
+//Stand in for Webrelay_i2c.h
+#define _WEBRELAY_I2C_H_
+uint16_t fakeRegister[0x50][8];
+bool fakeBusUp = true;
+int fakeReads = 0;
+
+bool i2cReadRegister( uint8_t address, uint8_t reg, uint16_t& value )
+{
+  fakeReads++;
+  if( !fakeBusUp || address >= 0x50 || reg >= 8 )
+    return false;
+  value = fakeRegister[address][reg];
+  return true;
+}
+
+int numSwitches = 0;
+SwitchEntry** switchEntry;
+
+#include "../Webrelay_sensors.h"
+#include "check.h"
+
+static SensorBinding binding( uint8_t chip, uint8_t address, uint8_t channel, uint8_t quantity, uint16_t shunt )
+{
+  SensorBinding b;
+  b.target = 0;
+  b.chip = chip;
+  b.address = address;
+  b.channel = channel;
+  b.quantity = quantity;
+  b.shunt = shunt;
+  return b;
+}
+
+static int32_t read( const SensorBinding& b )
+{
+  int32_t value = 0x7FFFFFFF;
+  CHECK( sensorRead( b, value ) );
+  return value;
+}
+
+static void testIna219( void )
+{
+  //Shunt LSB 10uV: 4000 is 40mV, 400mA through 100 milliohms. Bus LSB 4mV above 3 flag bits.
+  fakeRegister[0x40][INA219_SHUNT] = 4000;
+  fakeRegister[0x40][INA219_SHUNT + 1] = ( ( 12000 / 4 ) << 3 ) | 0x02;
+  CHECK( read( binding( SENSOR_INA219, 0x40, 0, SENSOR_CURRENT, 100 ) ) == 400 );
+  CHECK( read( binding( SENSOR_INA219, 0x40, 0, SENSOR_VOLTAGE, 100 ) ) == 12000 );
+  CHECK( read( binding( SENSOR_INA219, 0x40, 0, SENSOR_POWER, 100 ) ) == 4800 );
+
+  fakeRegister[0x40][INA219_SHUNT] = (uint16_t) -4000;
+  CHECK( read( binding( SENSOR_INA219, 0x40, 0, SENSOR_CURRENT, 100 ) ) == -400 );
+  CHECK( read( binding( SENSOR_INA219, 0x40, 0, SENSOR_POWER, 100 ) ) == -4800 );
+}
+
+static void testIna3221( void )
+{
+  //Channel 2's registers are the third pair. Shunt LSB 40uV, bus LSB 8mV, both 13 bits above 3 unused ones.
+  fakeRegister[0x41][INA3221_SHUNT + 4] = ( 1000 << 3 ) | 0x07;
+  fakeRegister[0x41][INA3221_SHUNT + 5] = ( 1500 << 3 ) | 0x07;
+  CHECK( read( binding( SENSOR_INA3221, 0x41, 2, SENSOR_CURRENT, 100 ) ) == 400 );
+  CHECK( read( binding( SENSOR_INA3221, 0x41, 2, SENSOR_VOLTAGE, 100 ) ) == 12000 );
+  CHECK( read( binding( SENSOR_INA3221, 0x41, 2, SENSOR_POWER, 100 ) ) == 4800 );
+
+  //A negative shunt voltage keeps its sign through the shift
+  fakeRegister[0x41][INA3221_SHUNT + 4] = (uint16_t)( -1000 * 8 );
+  CHECK( read( binding( SENSOR_INA3221, 0x41, 2, SENSOR_CURRENT, 100 ) ) == -400 );
+  //The other channels are read from their own registers
+  CHECK( read( binding( SENSOR_INA3221, 0x41, 0, SENSOR_CURRENT, 100 ) ) == 0 );
+}
+
+//320A at 32V through 1 milliohm is 10.24kW - 3.2e5 mA times 3.2e4 mV is past 32 bits
+static void testPowerRange( void )
+{
+  fakeRegister[0x42][INA219_SHUNT] = 32000;
+  fakeRegister[0x42][INA219_SHUNT + 1] = ( 32000 / 4 ) << 3;
+  CHECK( read( binding( SENSOR_INA219, 0x42, 0, SENSOR_CURRENT, 1 ) ) == 320000 );
+  CHECK( read( binding( SENSOR_INA219, 0x42, 0, SENSOR_POWER, 1 ) ) == 10240000 );
+  fakeRegister[0x42][INA219_SHUNT] = (uint16_t) -32000;
+  CHECK( read( binding( SENSOR_INA219, 0x42, 0, SENSOR_POWER, 1 ) ) == -10240000 );
+}
+
+static void testReadFailure( void )
+{
+  int32_t value = 123;
+
+  fakeBusUp = false;
+  CHECK( !sensorRead( binding( SENSOR_INA219, 0x40, 0, SENSOR_POWER, 100 ), value ) );
+  CHECK( value == 123 );
+  fakeBusUp = true;
+}
+
+static void testFilter( void )
+{
+  SensorFilter f;
+
+  memset( &f, 0, sizeof( f ) );
+  CHECK( sensorAverage( f ) == 0 );
+  sensorFilterAdd( f, 10 );
+  CHECK( f.count == 1 && f.min == 10 && f.max == 10 && sensorAverage( f ) == 10 );
+
+  //Once the window is full the oldest sample goes - 1 to 10 leaves 3 to 10
+  memset( &f, 0, sizeof( f ) );
+  for( int32_t i = 1; i <= 10; i++ )
+    sensorFilterAdd( f, i );
+  CHECK( f.count == SENSOR_WINDOW );
+  CHECK( f.sum == 52 && sensorAverage( f ) == 6 );
+  CHECK( f.min == 3 && f.max == 10 );
+  sensorFilterAdd( f, -5 );
+  CHECK( f.min == -5 && f.max == 10 && f.sum == 52 - 3 - 5 );
+  //The max leaves the window with its sample
+  for( int i = 0; i < SENSOR_WINDOW; i++ )
+    sensorFilterAdd( f, 0 );
+  CHECK( f.min == 0 && f.max == 0 && f.sum == 0 );
+}
+
+//The sensors task moves the average into the bound switch's level
+static void testSample( void )
+{
+  SwitchEntry entry;
+  SwitchEntry* table[1] = { &entry };
+  SensorBinding b = binding( SENSOR_INA219, 0x43, 0, SENSOR_CURRENT, 100 );
+  int32_t min;
+  int32_t max;
+
+  numSwitches = 1;
+  switchEntry = table;
+  entry.type = SWITCH_SENSOR;
+  sensorRange( b, min, max );
+  CHECK( min == -3200 && max == 3200 );
+  switchSetRange( &entry, min, max, 1.0F );
+  numSensors = 0;
+  CHECK( addSensor( b ) == 0 );
+
+  fakeRegister[0x43][INA219_SHUNT] = 1000; //100mA
+  sensorSample();
+  fakeRegister[0x43][INA219_SHUNT] = 3000; //300mA
+  sensorSample();
+  CHECK( sensorFilter[0].reads == 2 );
+  CHECK( switchValue( &entry, entry.level ) == 200.0 );
+  CHECK( entry.rampTarget == entry.level );
+
+  fakeBusUp = false;
+  sensorSample();
+  fakeBusUp = true;
+  CHECK( sensorFilter[0].errors == 1 && sensorFilter[0].reads == 2 );
+  CHECK( switchValue( &entry, entry.level ) == 200.0 );
+}
+
+int main( void )
+{
+  testIna219();
+  testIna3221();
+  testPowerRange();
+  testReadFailure();
+  testFilter();
+  testSample();
+  return checkResult( "sensors_test" );
+}
@@ -0,0 +1,153 @@
+/*
+timerwheel_test.cpp
+Host tests for Webrelay_timerwheel.h - run with test/run_tests.sh.
+Entries are scheduled and the wheel advanced through millis() to see each expire on the right tick and not before:
+delays within one revolution, of exactly one and past several, and one of more revolutions than 16 bits can count -
+over 58 hours. Also cancelling, rescheduling from the callback, several entries in one slot, catching up
+after a late advance and running across the wrap of millis().
+*/
+#include <stdio.h>
+#include "arduino_host.h"
+#include "../Webrelay_timerwheel.h"
+#include "check.h"
+
+#define REVOLUTION ( WHEEL_SLOTS * WHEEL_TICK )
+
+uint32_t expiredAt[WHEEL_MAX_ENTRIES];  //millis() when each entry last expired, 0 if it hasn't
+int expiries = 0;
+int rescheduleId = -1;
+
+static void onExpire( int id )
+{
+  expiredAt[id] = hostMillis;
+  expiries++;
+  if( id == rescheduleId )
+    wheelSchedule( id, 500 );
+}
+
+static void reset( uint32_t now )
+{
+  hostMillis = now;
+  wheelInit();
+  memset( expiredAt, 0, sizeof( expiredAt ) );
+  expiries = 0;
+  rescheduleId = -1;
+}
+
+//Move the clock on a tick at a time, as loop() does
+static void run( uint32_t msecs )
+{
+  for( uint32_t t = 0; t < msecs; t += WHEEL_TICK )
+  {
+    hostMillis += WHEEL_TICK;
+    wheelAdvance( hostMillis, onExpire );
+  }
+}
+
+static void testShort( void )
+{
+  reset( 1000 );
+  CHECK( wheelSchedule( 0, 120 ) );    //rounded up to 150
+  CHECK( wheelSchedule( 1, 0 ) );      //next tick
+  CHECK( wheelPending( 0 ) && wheelRemaining( 0 ) == 150 );
+  run( 50 );
+  CHECK( expiredAt[1] == 1050 && expiredAt[0] == 0 );
+  run( 50 );
+  CHECK( expiredAt[0] == 0 );
+  run( 50 );
+  CHECK( expiredAt[0] == 1150 && !wheelPending( 0 ) );
+  CHECK( wheelRemaining( 0 ) == 0 );
+  CHECK( !wheelSchedule( -1, 100 ) && !wheelSchedule( WHEEL_MAX_ENTRIES, 100 ) );
+}
+
+static void testRevolutions( void )
+{
+  reset( 1000 );
+  wheelSchedule( 0, REVOLUTION );
+  wheelSchedule( 1, REVOLUTION + WHEEL_TICK );
+  wheelSchedule( 2, 3 * REVOLUTION + 7 * WHEEL_TICK );
+  //Entries 0 and 2 share a slot, at different rounds
+  run( REVOLUTION - WHEEL_TICK );
+  CHECK( expiries == 0 );
+  run( WHEEL_TICK );
+  CHECK( expiredAt[0] == 1000 + REVOLUTION && expiries == 1 );
+  run( WHEEL_TICK );
+  CHECK( expiredAt[1] == 1000 + REVOLUTION + WHEEL_TICK );
+  run( 2 * REVOLUTION + 5 * WHEEL_TICK );
+  CHECK( expiredAt[2] == 0 && wheelRemaining( 2 ) == WHEEL_TICK );
+  run( WHEEL_TICK );
+  CHECK( expiredAt[2] == 1000 + 3 * REVOLUTION + 7 * WHEEL_TICK && expiries == 3 );
+}
+
+//More revolutions than a 16 bit count holds
+static void testLong( void )
+{
+  uint32_t delay = 70UL * 3600 * 1000;
+
+  CHECK( delay / REVOLUTION > 65535 );
+  reset( 1000 );
+  wheelSchedule( 3, delay );
+  run( delay - WHEEL_TICK );
+  CHECK( expiries == 0 && wheelPending( 3 ) );
+  run( WHEEL_TICK );
+  CHECK( expiredAt[3] == 1000 + delay );
+}
+
+static void testCancel( void )
+{
+  reset( 1000 );
+  wheelSchedule( 0, 200 );
+  wheelSchedule( 1, 200 );
+  wheelSchedule( 2, 200 );
+  wheelCancel( 1 );
+  CHECK( !wheelPending( 1 ) && wheelPending( 0 ) && wheelPending( 2 ) );
+  wheelCancel( 1 );                   //already cancelled
+  //Scheduling again replaces the expiry already pending
+  wheelSchedule( 2, 400 );
+  run( 200 );
+  CHECK( expiredAt[0] == 1200 && expiredAt[1] == 0 && expiredAt[2] == 0 );
+  run( 200 );
+  CHECK( expiredAt[2] == 1400 && expiries == 2 );
+}
+
+static void testReschedule( void )
+{
+  reset( 1000 );
+  rescheduleId = 4;
+  wheelSchedule( 4, 100 );
+  run( 100 );
+  CHECK( expiredAt[4] == 1100 && wheelPending( 4 ) );
+  run( 500 );
+  CHECK( expiredAt[4] == 1600 && expiries == 2 );
+  rescheduleId = -1;
+  run( 500 );
+  CHECK( expiries == 3 && !wheelPending( 4 ) );
+}
+
+//A late advance catches up every tick missed, and millis() wrapping makes no difference
+static void testLateAndWrap( void )
+{
+  reset( 0xFFFFFF00UL );
+  wheelSchedule( 0, 100 );
+  wheelSchedule( 1, 1000 );
+  hostMillis += 2000;
+  wheelAdvance( hostMillis, onExpire );
+  CHECK( expiries == 2 && expiredAt[0] != 0 && expiredAt[1] != 0 );
+  CHECK( wheelTime == (uint32_t)( 0xFFFFFF00UL + 2000 ) );
+
+  wheelSchedule( 2, 300 );
+  CHECK( wheelRemaining( 2 ) == 300 );
+  run( 300 );
+  CHECK( expiredAt[2] == (uint32_t)( 0xFFFFFF00UL + 2300 ) );
+}
+
+int main( void )
+{
+  testShort();
+  testRevolutions();
+  testLong();
+  testCancel();
+  testReschedule();
+  testLateAndWrap();
+  return checkResult( "timerwheel_test" );
+}